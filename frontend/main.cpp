@@ -17,6 +17,8 @@
 #ifndef _WIN32
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <glob.h>
 #include <unistd.h>
 #include <libgen.h>
 #include <dlfcn.h>
@@ -24,6 +26,8 @@
 #include <windows.h>
 #endif
 #include <chrono>
+#include <algorithm>
+#include <vector>
 #include <iostream>
 #include <thread>
 #include <stdexcept>
@@ -56,7 +60,8 @@ static void reduce (const std::string& plugin_file,
 		    const std::string& subdir,
 		    const bool verbose,
 		    const uint16_t parallel,
-		    const int max_files)
+		    const int max_files,
+		    const size_t memory)
 {
     if (verbose)
     {
@@ -66,11 +71,12 @@ static void reduce (const std::string& plugin_file,
 	       << " Using working directory " << work_dir << "\n"
 	       << " Using " << parallel << " threads, with HW concurrency at "
 	       << std::thread::hardware_concurrency() << "\n";
+	if (memory) stream << " Memory budget is " << memory << " bytes.\n";
 	std::cerr << stream.str();
     }
 
     engine mapred_engine (plugin_file, work_dir, subdir, parallel, 0,
-			  max_files);
+			  max_files, memory);
     auto start_time (std::chrono::high_resolution_clock::now());
 
     mapred_engine.reduce_existing_files();
@@ -82,21 +88,197 @@ static void reduce (const std::string& plugin_file,
     }
 }
 
+static void print_settings (const std::string& plugin_file,
+			    const std::string& work_dir,
+			    const size_t buffer_size,
+			    const size_t memory,
+			    const uint16_t parallel)
+{
+    std::ostringstream stream;
+
+    stream << plugin_file << ":\n"
+	   << " Using working directory " << work_dir << "\n";
+    if (memory) stream << " Memory budget is " << memory << " bytes.\n";
+    else stream << " Sort buffer size is " << buffer_size << " bytes.\n";
+    // Sorted input is mapped and reduced by a single thread
+    stream << " Using "
+	   << (settings::instance().input_sorted() ? 1 : parallel)
+	   << " threads,  with HW"
+	   << " concurrency at "
+	   << std::thread::hardware_concurrency() << "\n";
+    std::cerr << stream.str();
+}
+
+static void finish_run (engine& mapred_engine,
+			const bool verbose,
+			const bool map_only,
+			std::chrono::high_resolution_clock::time_point& start_time)
+{
+    if (verbose)
+    {
+	std::cerr << "Sorting finished in " << std::fixed
+		  << duration (start_time) << "s\n";
+    }
+
+    if (!map_only)
+    {
+	mapred_engine.reduce();
+	if (verbose)
+	{
+	    std::cerr << "Merging finished in " << std::fixed
+		      << duration (start_time) << "s\n";
+	}
+    }
+}
+
+#ifndef _WIN32
+/**
+ * Add an input argument to a list of input files.  A directory adds
+ * the files under it, and a glob pattern the files it matches.
+ */
+static void add_input (const std::string& input,
+		       std::vector<std::string>& files)
+{
+    struct stat st;
+
+    if (stat(input.c_str(), &st) != 0)
+    {
+	if (input.find_first_of ("*?[") == std::string::npos)
+	{
+	    char err[80];
+
+	    throw std::runtime_error
+		("Can not open input file " + input + ": "
+		 + strerror_r(errno, err, sizeof(err)));
+	}
+
+	glob_t matches;
+	std::vector<std::string> paths;
+
+	if (glob(input.c_str(), 0, nullptr, &matches) == 0)
+	{
+	    paths.assign (matches.gl_pathv,
+			  matches.gl_pathv + matches.gl_pathc);
+	}
+	globfree (&matches);
+	if (paths.empty())
+	{
+	    throw std::runtime_error ("No input files match " + input);
+	}
+	for (auto& path: paths) add_input (path, files);
+    }
+    else if (S_ISDIR(st.st_mode))
+    {
+	std::vector<std::string> names;
+
+	for (const auto& name: directory(input)) names.push_back (name);
+	std::sort (names.begin(), names.end());
+	for (auto& name: names) add_input (input + "/" + name, files);
+    }
+    else files.push_back (input);
+}
+#endif
+
 static void run (const std::string& plugin_file,
-		 const std::string& input_file,
+		 const std::vector<std::string>& inputs,
 		 const std::string& work_dir,
 		 const std::string& subdir,
 		 const bool verbose,
 		 const size_t buffer_size,
+		 const size_t memory,
 		 const uint16_t parallel,
 		 const int max_files,
-		 const bool map_only)
+		 const bool map_only,
+		 const bool use_mmap)
 {
     engine mapred_engine (plugin_file, work_dir, subdir, parallel, buffer_size,
-			  max_files);
+			  max_files, memory);
+    std::chrono::high_resolution_clock::time_point start_time;
+
+#ifndef _WIN32
+    std::vector<std::string> input_files;
+    struct stat st;
+
+    for (auto& input: inputs) add_input (input, input_files);
+    if (inputs.size() && input_files.empty()) return; // no input
+
+    if (input_files.size() > 1
+	|| (input_files.size() == 1
+	    && stat(input_files[0].c_str(), &st) == 0 && S_ISREG(st.st_mode)))
+    {
+	size_t total_size = 0;
+
+	for (auto& file: input_files)
+	{
+	    if (stat(file.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+	    {
+		throw std::runtime_error
+		    ("Input " + file + " is not a regular file, as required"
+		     " with several inputs");
+	    }
+	    total_size += st.st_size;
+	}
+	if (total_size == 0) return; // no input
+
+	start_time = std::chrono::high_resolution_clock::now();
+	if (verbose)
+	{
+	    print_settings (plugin_file, work_dir, buffer_size, memory,
+			    parallel);
+	}
+	mapred_engine.process_files (input_files, use_mmap);
+	finish_run (mapred_engine, verbose, map_only, start_time);
+	return;
+    }
+
+    const std::string input_file (input_files.size() ? input_files[0] : "");
+    int fd = 0;
+
+    if (input_file.size())
+    {
+	fd = open (input_file.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+	    char err[80];
+
+	    throw std::runtime_error
+		(std::string("Can not open input file: ")
+		 + strerror_r(errno, err, sizeof(err)));
+	}
+    }
+
+    start_time = std::chrono::high_resolution_clock::now();
+    if (verbose)
+    {
+	print_settings (plugin_file, work_dir, buffer_size, memory, parallel);
+    }
+
+    size_t bytes;
+
+    try
+    {
+	bytes = mapred_engine.process_stream (fd);
+    }
+    catch (...)
+    {
+	if (fd) close (fd);
+	throw;
+    }
+    if (fd) close (fd);
+
+    if (!bytes) return; // no input
+
+    finish_run (mapred_engine, verbose, map_only, start_time);
+#else
+    if (inputs.size() > 1)
+    {
+	throw std::runtime_error
+	    ("Only one input file is supported on this platform");
+    }
+
+    const std::string input_file (inputs.size() ? inputs[0] : "");
     size_t bytes;
     bool first = true;
-    std::chrono::high_resolution_clock::time_point start_time;    
     input_buffer* buffer = mapred_engine.prepare_input();
     FILE* fp = stdin;
 
@@ -131,40 +313,21 @@ static void run (const std::string& plugin_file,
 	    start_time = std::chrono::high_resolution_clock::now();
 	    if (verbose)
 	    {
-		std::ostringstream stream;
-
-		stream << plugin_file << ":\n"
-		       << " Using working directory " << work_dir << "\n"
-		       << " Sort buffer size is " << buffer_size << " bytes.\n"
-		       << " Using " << parallel << " threads,  with HW"
-		       << " concurrency at "
-		       << std::thread::hardware_concurrency() << "\n";
-		std::cerr << stream.str();
+		print_settings (plugin_file, work_dir, buffer_size, memory,
+				parallel);
 	    }
 	}
 
 	buffer = mapred_engine.provide_input_data (buffer);
     }
+    if (fp != stdin) fclose (fp);
 
     mapred_engine.complete_input (buffer);
 
     if (first) return; // no input
 
-    if (verbose)
-    {
-	std::cerr << "Sorting finished in " << std::fixed
-		  << duration (start_time) << "s\n";
-    }
-    
-    if (!map_only)
-    {
-	mapred_engine.reduce();
-	if (verbose)
-	{
-	    std::cerr << "Merging finished in " << std::fixed
-		      << duration (start_time) << "s\n";
-	}
-    }
+    finish_run (mapred_engine, verbose, map_only, start_time);
+#endif
 }
 
 static std::string get_default_workdir()
@@ -176,7 +339,9 @@ int
 main (int argc, char* argv[])
 {
     int64_t buffer_size;
+    int64_t memory;
     const char* buffer_size_str = "2M";
+    const char* memory_str = "0";
     uint16_t parallel = std::thread::hardware_concurrency() + 1;
     int max_files = 20 * parallel;
     bool no_compression = false;
@@ -194,6 +359,9 @@ main (int argc, char* argv[])
     env = getenv ("MAPREDO_BUFFER_SIZE");
     if (env) buffer_size_str = env;
 
+    env = getenv ("MAPREDO_MEMORY");
+    if (env) memory_str = env;
+
     env = getenv ("MAPREDO_COMPRESSION");
     if (env) no_compression = (env[0] == '0' || env[0] == 'f' || env[0] == 'F');
 
@@ -213,6 +381,10 @@ main (int argc, char* argv[])
 	TCLAP::ValueArg<std::string> buffer_size_arg
 	    ("b", "buffer-size", "Buffer size to use",
 	     false, buffer_size_str, "size", cmd);
+	TCLAP::ValueArg<std::string> memory_arg
+	    ("", "memory", "Memory budget to divide between all buffers,"
+	     " replacing the buffer size.  0 for no budget",
+	     false, memory_str, "size", cmd);
 	TCLAP::ValueArg<int> max_files_arg
 	    ("f", "max-open-files", "Maximum number of open files",
 	     false, max_files, "number", cmd);
@@ -234,16 +406,42 @@ main (int argc, char* argv[])
 	    ("", "sort", "Sort keys in final output", cmd, false);
 	TCLAP::SwitchArg reverse_sort_arg
 	    ("", "rsort", "Reverse sort keys in final output", cmd, false);
-	TCLAP::ValueArg<std::string> inputfile
+	TCLAP::SwitchArg replacement_selection_arg
+	    ("", "replacement-selection", "Write fewer and longer sorted"
+	     " temporary files by replacement selection, instead of sorting"
+	     " in the background", cmd, false);
+	TCLAP::SwitchArg input_sorted_arg
+	    ("", "input-sorted", "The mapper output is already sorted on"
+	     " key, in descending order with --rsort.  Groups of keys are"
+	     " reduced as they come, without sorting or temporary files."
+	     "  Mapping and reducing then run in a single thread, whatever"
+	     " the number of threads is", cmd, false);
+#ifdef _WIN32
+	TCLAP::SwitchArg lock_free_arg
+	    ("", "lock-free", "Hand input buffers to the threads through"
+	     " lock-free queues instead of queues under a lock, which may"
+	     " scale better with many threads", cmd, false);
+#endif
+	TCLAP::SwitchArg no_mmap_arg
+	    ("", "no-mmap", "Let each thread read its own part of the input"
+	     " file instead of memory mapping it", cmd, false);
+	TCLAP::ValueArg<std::string> input_format_arg
+	    ("", "input-format", "Input record format: lines, or varint or"
+	     " fixed32 for binary records preceded by their length as a"
+	     " varint or a 4 byte big-endian number",
+	     false, "lines", "format", cmd);
+	TCLAP::MultiArg<std::string> inputfile
 	    ("i", "input",
-	     "Input file to use, defaults to reading standard input",
-	     false, "", "string", cmd);
+	     "Input file, directory or glob pattern to use, may be given"
+	     " several times.  Defaults to reading standard input",
+	     false, "string", cmd);
 	TCLAP::UnlabeledValueArg<std::string> plugin_path
 	    ("plugin", "Plugin file to use", true, "", "plugin file", cmd);
 
 	cmd.parse (argc, argv);
 	subdir = subdir_arg.getValue();
 	buffer_size = config.parse_size (buffer_size_arg.getValue());
+	memory = config.parse_size (memory_arg.getValue());
 	max_files = max_files_arg.getValue();
 	parallel = threads_arg.getValue();
 
@@ -272,6 +470,13 @@ main (int argc, char* argv[])
 		("Options --sort and --rsort are mutually exclusive",
 		 "sort");
 	}
+	if (input_sorted_arg.getValue()
+	    && (map_only.getValue() || reduce_only.getValue()))
+	{
+	    throw TCLAP::ArgException
+		("Option --input-sorted cannot be used with --map-only or"
+		 " --reduce-only", "input-sorted");
+	}
 	if (map_only.getValue() && subdir.empty())
 	{
 	    throw TCLAP::ArgException
@@ -290,17 +495,28 @@ main (int argc, char* argv[])
 	if (keep_tmpfiles.getValue()) config.set_keep_tmpfiles();
 	if (sort_arg.getValue()) config.set_sort_output();
 	if (reverse_sort_arg.getValue()) config.set_reverse_sort();
+	if (replacement_selection_arg.getValue())
+	{
+	    config.set_replacement_selection();
+	}
+	if (input_sorted_arg.getValue()) config.set_input_sorted();
+#ifdef _WIN32
+	if (lock_free_arg.getValue()) config.set_lock_free_handoff();
+#endif
+	config.set_input_format
+	    (record_format::parse (input_format_arg.getValue()));
 
 	if (reduce_only.getValue())
 	{
 	    reduce (plugin_path.getValue(), work_dir.getValue(), subdir,
-		    verbose_arg.getValue(), parallel, max_files);
+		    verbose_arg.getValue(), parallel, max_files, memory);
 	}
 	else
 	{
 	    run (plugin_path.getValue(), inputfile.getValue(),
 		 work_dir.getValue(), subdir, verbose_arg.getValue(),
-		 buffer_size, parallel, max_files, map_only.getValue());
+		 buffer_size, memory, parallel, max_files, map_only.getValue(),
+		 !no_mmap_arg.getValue());
 	}
     }
     catch (const TCLAP::ArgException& e)
@@ -0,0 +1,351 @@
+/*
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include "aggregator.h"
+#include "scanner.h"
+
+aggregator::aggregator (mapredo::base& reducer, const size_t max_bytes,
+			output_function output) :
+    _combiner (reducer),
+    _max_table (std::min(max_bytes / 16 * 11, size_t(UINT32_MAX))),
+    _max_batch (std::min(max_bytes / 16, size_t(UINT32_MAX))),
+    _max_record (_max_batch / 4),
+    _output (output)
+{
+    size_t slots = _initial_slots;
+
+    // Start with an index of at most half of the table
+    while (slots > 4 && slots * sizeof(slot) * 2 > _max_table) slots /= 2;
+    _slots.resize (slots);
+}
+
+void
+aggregator::add (const char* line, const size_t keylen, const size_t length)
+{
+    // Records too long to gain from the table are passed on at once
+    if (length > _max_record)
+    {
+	pass_on (line, keylen, length);
+	return;
+    }
+
+    const uint64_t hash = mapredo::base::hash (line, keylen);
+    slot& entry (find (line, keylen, hash));
+
+    if (entry.offset == _unused) insert (hash, line, keylen, length);
+    else defer (entry, line, length);
+}
+
+void
+aggregator::flush()
+{
+    combine();
+    for (auto& entry: _slots)
+    {
+	if (entry.offset != _unused && entry.length)
+	{
+	    pass_on (_records.get() + entry.offset, entry.keylen,
+		     entry.length);
+	}
+	entry.offset = _unused;
+    }
+    _keys = 0;
+    _records_size = 0;
+}
+
+aggregator::slot&
+aggregator::find (const char* key, const size_t keylen, const uint64_t hash)
+{
+    const size_t mask = _slots.size() - 1;
+
+    for (size_t i = hash & mask;; i = (i + 1) & mask)
+    {
+	slot& entry (_slots[i]);
+
+	// A key combined into nothing keeps its old record for this
+	if (entry.offset == _unused
+	    || (entry.hash == uint32_t(hash) && entry.keylen == keylen
+		&& memcmp(_records.get() + entry.offset, key, keylen) == 0))
+	{
+	    return entry;
+	}
+    }
+}
+
+void
+aggregator::insert (const uint64_t hash, const char* line,
+		    const size_t keylen, const size_t length)
+{
+    if ((_keys + 1) * 4 > _slots.size() * 3)
+    {
+	// Growing moves the slots the batch refers to
+	combine();
+	if (!grow()) flush();
+    }
+    if (!reserve (length))
+    {
+	flush();
+	reserve (length);
+    }
+
+    slot& entry (find (line, keylen, hash));
+
+    entry.hash = uint32_t(hash);
+    entry.offset = _records_size;
+    entry.keylen = keylen;
+    entry.length = entry.space = length;
+    memcpy (_records.get() + _records_size, line, length);
+    _records_size += length;
+    _keys++;
+}
+
+void
+aggregator::defer (slot& entry, const char* line, const size_t length)
+{
+    const size_t key_bytes = entry.batch == _unused
+	? entry.length + 1 + 2 * sizeof(size_t) : 0;
+
+    if (_batch_size + key_bytes + length + 1 + sizeof(deferred) > _max_batch)
+    {
+	combine();
+    }
+    if (entry.batch == _unused)
+    {
+	// A key combined into nothing has no record to combine with
+	if (entry.length == 0)
+	{
+	    if (!store (entry, line, length))
+	    {
+		const uint64_t hash = entry.hash;
+		const size_t keylen = entry.keylen;
+
+		flush();
+		insert (hash, line, keylen, length);
+	    }
+	    return;
+	}
+	if (_batch_slots.empty()) _pending.reserve (_max_batch);
+	entry.batch = _batch_slots.size();
+	_batch_slots.push_back (&entry - _slots.data());
+	_batch_size += entry.length + 1 + 2 * sizeof(size_t);
+    }
+
+    const deferred header {entry.batch, uint32_t(length)};
+
+    _pending.append (reinterpret_cast<const char*>(&header), sizeof(header));
+    _pending.append (line, length);
+    _pending += '\n';
+    _batch_size += length + 1 + sizeof(deferred);
+}
+
+void
+aggregator::combine()
+{
+    if (_batch_slots.empty()) return;
+
+    // Lay the batch out key by key, each key starting with its record
+    // in the table followed by the deferred ones
+    const size_t keys = _batch_slots.size();
+    const char* const pending = _pending.data();
+    const char* const pending_end = pending + _pending.size();
+    deferred header;
+    size_t size = 0;
+
+    _positions.assign (keys, 0);
+    for (const char* pos = pending; pos < pending_end;
+	 pos += sizeof(header) + header.length + 1)
+    {
+	memcpy (&header, pos, sizeof(header));
+	_positions[header.batch] += header.length + 1;
+    }
+    for (size_t i = 0; i < keys; i++)
+    {
+	const size_t bytes = _positions[i] + _slots[_batch_slots[i]].length + 1;
+
+	_positions[i] = size;
+	size += bytes;
+    }
+    char* const batch = _combiner.buffer (size);
+
+    for (size_t i = 0; i < keys; i++)
+    {
+	slot& entry (_slots[_batch_slots[i]]);
+
+	memcpy (batch + _positions[i], _records.get() + entry.offset,
+		entry.length);
+	_positions[i] += entry.length;
+	batch[_positions[i]++] = '\n';
+	entry.length = 0;
+    }
+    for (const char* pos = pending; pos < pending_end;
+	 pos += sizeof(header) + header.length + 1)
+    {
+	memcpy (&header, pos, sizeof(header));
+	memcpy (batch + _positions[header.batch], pos + sizeof(header),
+		header.length + 1);
+	_positions[header.batch] += header.length + 1;
+    }
+
+    _folded.clear();
+    _combiner.combine (size, _folded);
+
+    const char* pos = _folded.data();
+    const char* const end = pos + _folded.size();
+    size_t next = 0; // in _batch_slots, of the key output last
+
+    while (pos < end)
+    {
+	const char* nl = scanner::find (pos, end, '\n');
+	const char* tab = scanner::find (pos, nl, '\t');
+	const size_t keylen = (tab ? tab : nl) - pos;
+	slot* entry = nullptr;
+
+	// The keys are reduced in the order of the batch, so the output
+	// is likely to be for the same key as before or the next one
+	for (size_t i = next; !entry && i < std::min(next + 2, keys); i++)
+	{
+	    slot& candidate (_slots[_batch_slots[i]]);
+
+	    if (candidate.keylen == keylen
+		&& memcmp(_records.get() + candidate.offset, pos, keylen) == 0)
+	    {
+		entry = &candidate;
+		next = i;
+	    }
+	}
+	if (!entry) entry = &find (pos, keylen, mapredo::base::hash(pos, keylen));
+	keep (*entry, pos, keylen, nl - pos);
+	pos = nl + 1;
+    }
+
+    for (auto index: _batch_slots) _slots[index].batch = _unused;
+    _batch_slots.clear();
+    _pending.clear();
+    _batch_size = 0;
+}
+
+void
+aggregator::keep (slot& entry, const char* line, const size_t keylen,
+		  const size_t length)
+{
+    // A combining reducer outputs the keys it was given, which are
+    // kept in the table.  Any other output is passed on.
+    if (entry.offset == _unused || entry.batch == _unused)
+    {
+	pass_on (line, keylen, length);
+	return;
+    }
+
+    // A key is output more than once, so only the last one is kept
+    if (entry.length)
+    {
+	pass_on (_records.get() + entry.offset, keylen, entry.length);
+	entry.length = 0;
+    }
+    if (length > _max_record || !store (entry, line, length))
+    {
+	pass_on (line, keylen, length);
+    }
+}
+
+bool
+aggregator::store (slot& entry, const char* line, const size_t length)
+{
+    if (length <= entry.space)
+    {
+	memcpy (_records.get() + entry.offset, line, length);
+	entry.length = length;
+	return true;
+    }
+
+    // A record that has grown is likely to grow again, so it is given
+    // room for that.  Its old space is left unused until the next flush.
+    size_t space = length + length / 2;
+
+    if (!reserve (space))
+    {
+	if (!reserve (length)) return false;
+	space = length;
+    }
+    entry.offset = _records_size;
+    entry.length = length;
+    entry.space = space;
+    memcpy (_records.get() + _records_size, line, length);
+    _records_size += space;
+
+    return true;
+}
+
+bool
+aggregator::reserve (const size_t bytes)
+{
+    const size_t needed = _records_size + bytes;
+
+    if (needed <= _records_capacity) return true;
+
+    const size_t index_bytes = _slots.size() * sizeof(slot);
+
+    if (needed + index_bytes > _max_table) return false;
+
+    // Room is left for the index to double if the records allow it
+    const size_t room = needed + 2 * index_bytes <= _max_table
+	? _max_table - 2 * index_bytes : _max_table - index_bytes;
+    const size_t capacity = std::min (std::max(needed, 2 * _records_capacity),
+				      room);
+    std::unique_ptr<char[]> records (new char[capacity]);
+
+    if (_records_size) memcpy (records.get(), _records.get(), _records_size);
+    _records = std::move (records);
+    _records_capacity = capacity;
+
+    return true;
+}
+
+bool
+aggregator::grow()
+{
+    const size_t slots = _slots.size() * 2;
+
+    if (slots * sizeof(slot) + _records_capacity > _max_table) return false;
+
+    std::vector<slot> old (slots);
+    const size_t mask = slots - 1;
+
+    old.swap (_slots);
+    for (auto& entry: old)
+    {
+	if (entry.offset == _unused) continue;
+
+	size_t i = entry.hash & mask;
+
+	while (_slots[i].offset != _unused) i = (i + 1) & mask;
+	_slots[i] = entry;
+    }
+
+    return true;
+}
+
+void
+aggregator::pass_on (const char* line, const size_t keylen,
+		     const size_t length)
+{
+    _output (line, keylen, length);
+    _records_output++;
+}
@@ -0,0 +1,140 @@
+/* -*- C++ -*-
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef _HEXTREME_MAPREDO_AGGREGATOR_H
+#define _HEXTREME_MAPREDO_AGGREGATOR_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+
+#include "combiner.h"
+
+/**
+ * Hash table used by the consumers to combine records with the same
+ * key before they are sorted, for mapreducers where
+ * reducer_can_combine() is true.  Each key has a single record in the
+ * table, stored back to back with the others in one buffer and
+ * indexed by an open addressing table.  Records added for keys
+ * already there are held back in a batch, and combined with the
+ * records of their keys in one run of the reducer when the batch is
+ * full.  When the table would grow beyond 11/16 of the memory bound,
+ * all records are passed on and the table is emptied.  The batch is
+ * held to 1/16, leaving the rest for the reducer to read it from and
+ * write its output to.
+ */
+class aggregator
+{
+public:
+    /**
+     * Function taking records out of the table.
+     * @param line key and value, tab separated
+     * @param keylen length of the key
+     * @param length length of the line
+     */
+    typedef std::function<void(const char* line, const size_t keylen,
+			       const size_t length)> output_function;
+
+    /**
+     * @param reducer reducer to combine records with.  This must not
+     *                be the object doing the mapping, as reduce() may
+     *                use the same output buffer as map().
+     * @param max_bytes memory bound of the table
+     * @param output where to pass the records on to
+     */
+    aggregator (mapredo::base& reducer, const size_t max_bytes,
+		output_function output);
+
+    /**
+     * Add a record to the table.  The table is flushed if there is no
+     * room for it.
+     * @param line key and value, tab separated
+     * @param keylen length of the key, which must not be empty
+     * @param length length of the line
+     */
+    void add (const char* line, const size_t keylen, const size_t length);
+
+    /** Pass all records on, emptying the table */
+    void flush();
+
+    /** @returns the number of records passed on so far */
+    size_t records_output() const {return _records_output;}
+
+    /** @returns the memory held by the table and the batch */
+    size_t bytes() const {
+	return _records_capacity + _slots.size() * sizeof(slot)
+	    + _pending.capacity() + _combiner.bytes() + _folded.capacity()
+	    + (_batch_slots.capacity() + _positions.capacity())
+	    * sizeof(size_t);
+    }
+
+private:
+    struct slot
+    {
+	uint32_t hash; // lower half of it
+	uint32_t offset = _unused; // of the record in _records
+	uint32_t keylen;
+	uint32_t length; // of the record, 0 if combined into nothing
+	uint32_t space; // room for the record at offset
+	uint32_t batch = _unused; // index in _batch_slots if deferred
+    };
+
+    /** Header of each record held back in _pending */
+    struct deferred
+    {
+	uint32_t batch; // index in _batch_slots of the key
+	uint32_t length; // of the record following the header
+    };
+
+    slot& find (const char* key, const size_t keylen, const uint64_t hash);
+    void insert (const uint64_t hash, const char* line, const size_t keylen,
+		 const size_t length);
+    void defer (slot& entry, const char* line, const size_t length);
+    void combine();
+    void keep (slot& entry, const char* line, const size_t keylen,
+	       const size_t length);
+    bool store (slot& entry, const char* line, const size_t length);
+    bool reserve (const size_t bytes);
+    bool grow();
+    void pass_on (const char* line, const size_t keylen,
+		  const size_t length);
+
+    /** Offset of slots without a key and batch of keys not deferred */
+    static const uint32_t _unused = uint32_t(-1);
+    /** Number of slots in a new table */
+    static const size_t _initial_slots = 1024;
+
+    combiner _combiner;
+    const size_t _max_table; // bytes of the records and the index
+    const size_t _max_batch; // bytes held back for combining
+    const size_t _max_record; // longer records are passed on at once
+    output_function _output;
+    std::vector<slot> _slots; // a power of two, at most 3/4 in use
+    size_t _keys = 0;
+    std::unique_ptr<char[]> _records;
+    size_t _records_size = 0;
+    size_t _records_capacity = 0;
+    size_t _records_output = 0;
+    std::string _pending; // deferred records, newline terminated
+    std::vector<size_t> _batch_slots; // keys with deferred records
+    size_t _batch_size = 0; // bytes of the batch, within _max_batch
+    std::vector<size_t> _positions; // of each key in the batch
+    std::string _folded; // output of the reducer
+};
+
+#endif
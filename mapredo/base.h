@@ -17,6 +17,9 @@
 #ifndef _HEXTREME_MAPREDO_BASE_H
 #define _HEXTREME_MAPREDO_BASE_H
 
+#include <cstdint>
+#include <cstddef>
+
 #include "mcollector.h"
 #include "rcollector.h"
 #include "configuration.h"
@@ -31,6 +34,16 @@ namespace mapredo
     public:
 	virtual ~base() {}
 
+	/**
+	 * Version of the interface between mapredo and its plugins.  It
+	 * is raised whenever this class changes in a way which requires
+	 * plugins to be rebuilt, such as a new virtual function, and
+	 * plugins built for another version are refused when loaded.
+	 * Version 2 added partition(), and version 3 added
+	 * mapper_reads_only().
+	 */
+	static const unsigned interface_version = 3;
+
 	/** The different datatypes supported for of key sorting */
 	enum keytype
 	{
@@ -42,20 +55,62 @@ namespace mapredo
 
 	/**
 	 * Map function.
-	 * @param line input line, nul-terminated.
+	 * @param line input line, nul-terminated unless
+	 *             mapper_reads_only() is true.  With length-prefixed
+	 *             input records, this is the record data as is.
 	 * @param length input line length in bytes
 	 * @param collector used 0 or more times to output map results.
 	 */
 	virtual void map (char* line, const int length,
 			  mcollector& output) = 0;
 
+	/**
+	 * @return true if map() only reads the length bytes of its
+	 *              input, without modifying it or looking for the
+	 *              terminating nul.  Lines of memory-mapped input
+	 *              files are then passed to map() straight from the
+	 *              read-only mapping, and are neither copied nor
+	 *              nul-terminated.
+	 */
+	virtual bool mapper_reads_only() const {return false;}
+
 	/**
 	 * Function used to reduce data from mapper.
 	 * @return true if reduced() can be used as a combiner (can be
-	 *              called again on its own output).
+	 *              called again on its own output).  Records with
+	 *              the same key are then combined already while
+	 *              mapping, by a separate object of the mapreducer.
 	 */
 	virtual bool reducer_can_combine() const {return false;}
 
+	/**
+	 * Choose the partition a key collected by map() goes to.  Each
+	 * partition is sorted and reduced separately, so this decides
+	 * how evenly the work is spread over the reducers.  Override
+	 * this to keep related keys together or to weight keys by
+	 * known frequencies.  The default uses hash().  This is not
+	 * used when sorted output is partitioned by key ranges sampled
+	 * from the input, as the partitions must then follow the sort
+	 * order of the keys.
+	 * @param key the key, not nul-terminated
+	 * @param length key length in bytes
+	 * @param partitions number of partitions
+	 * @returns partition number, less than partitions
+	 */
+	virtual size_t partition (const char* const key, const size_t length,
+				  const size_t partitions) const {
+	    return hash (key, length) % partitions;
+	}
+
+	/**
+	 * Fast hash function, taking eight bytes at a time.  All bits of
+	 * the key affect all bits of the result, so keys sharing long
+	 * prefixes are spread as well as any.
+	 * @param key data to hash
+	 * @param length length of the data in bytes
+	 */
+	static uint64_t hash (const char* const key, const size_t length);
+
 	/** @returns the key datatype for this mapreducer */
 	keytype type() const {return _type;}
 
@@ -76,9 +131,11 @@ namespace mapredo
 
 	/**
 	 * Fast integer to ascii convertor from Andrei Alexandrescu.  This
-	 * may be handy inside your reducer.
+	 * may be handy inside your reducer, it is also what
+	 * collect_keyval() formats integers with.
+	 * @see field::uint_to_ascii()
 	 */
-	size_t uint_to_ascii (uint64_t value, char* dst);
+	static size_t uint_to_ascii (uint64_t value, char* dst);
 
     protected:
 	base() = default;
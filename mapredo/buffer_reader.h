@@ -0,0 +1,95 @@
+/* -*- C++ -*-
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef _HEXTREME_MAPREDO_BUFFER_READER_H
+#define _HEXTREME_MAPREDO_BUFFER_READER_H
+
+#include <cstring>
+
+#include "data_reader.h"
+
+/**
+ * Used to read newline terminated records from memory in the same way
+ * as from temporary files, so they can be given to a reducer.
+ */
+template <class T>
+class buffer_reader : public data_reader<T>
+{
+public:
+    /**
+     * @param data records to read, which are copied
+     * @param size number of bytes in data
+     */
+    buffer_reader (const char* const data, const size_t size) :
+	data_reader<T> (true) {
+	assign (data, size);
+    }
+
+    /** Create a reader without records, see assign() */
+    buffer_reader() : data_reader<T> (true) {
+	assign (nullptr, 0);
+    }
+
+    /**
+     * Replace the records to read, reusing the buffer if they fit.
+     * @param data records to read, which are copied
+     * @param size number of bytes in data
+     */
+    void assign (const char* const data, const size_t size) {
+	if (size) memcpy (room (size), data, size);
+	else room (0);
+	fill (size);
+    }
+
+    /**
+     * Get the buffer to write records to, for fill().  This
+     * replaces the records read so far.
+     * @param size number of bytes to be written
+     */
+    char* room (const size_t size) {
+	if (!this->_buffer || size > _capacity)
+	{
+	    delete[] this->_buffer;
+	    this->_buffer = nullptr;
+	    this->_buffer = new char[size + 1];
+	    _capacity = size;
+	}
+	return this->_buffer;
+    }
+
+    /**
+     * Read the records written to the buffer from room().
+     * @param size number of bytes written
+     */
+    void fill (const size_t size) {
+	this->_buffer[size] = '\0';
+	this->_start_pos = 0;
+	this->_end_pos = size;
+	this->fill_next_line();
+    }
+
+    /** @returns the size of the buffer */
+    size_t capacity() const {return _capacity;}
+
+    buffer_reader (const buffer_reader&) = delete;
+    buffer_reader& operator=(const buffer_reader&) = delete;
+
+private:
+    size_t _capacity = 0;
+};
+
+#endif
@@ -14,28 +14,22 @@
  *
  */
 
-#include <thread>
-#include <iostream>
-#include <sstream>
+#include <stdexcept>
 
 #include "buffer_trader.h"
 
-static const char* snames[] =
-{
-    "INITIAL", "WORKING", "FILLED", "FINISHED"
-};
-
 buffer_trader::buffer_trader (const size_t buffer_size,
-			      const size_t num_consumers) :
+			      const size_t num_consumers,
+			      const bool lock_free) :
     _buffer_size (buffer_size),
-    _num_consumers (num_consumers),
-    _states (new std::atomic<state>[num_consumers]),
-    _sems (new bsem[num_consumers]),
-    _producer_scan (false)
-{
-    for (size_t i = 0; i < num_consumers; i++) _states[i] = INITIAL;
-    _buffers.resize (num_consumers);
-}
+    // Two for the producer, and one for each consumer and queue entry
+    _num_buffers (num_consumers * 2 + 2),
+    _lock_free (lock_free),
+    _filled_queue (lock_free ? _num_buffers : 0),
+    _empty_queue (lock_free ? _num_buffers : 0),
+    _finished (false),
+    _failed (false)
+{}
 
 buffer_trader::~buffer_trader()
 {}
@@ -43,7 +37,7 @@ buffer_trader::~buffer_trader()
 input_buffer*
 buffer_trader::producer_get()
 {
-    if (_all_buffers.size() < _num_consumers * 2)
+    if (_all_buffers.size() < _num_buffers - 2)
     {
 	_all_buffers.emplace_back (_buffer_size);
 	return &_all_buffers.back();
@@ -56,112 +50,77 @@ buffer_trader::producer_get()
 input_buffer*
 buffer_trader::producer_swap (input_buffer* buffer)
 {
-    input_buffer* empty = nullptr;
+    if (_lock_free) return swap_lock_free (buffer);
+
+    std::unique_lock<std::mutex> lock (_mutex);
+
+    if (_failed) return nullptr;
+    _filled.push_back (buffer);
+    _filled_cv.notify_one();
 
-    if (_initiated < _num_consumers * 2)
+    if (_empty.empty() && _all_buffers.size() < _num_buffers)
     {
 	_all_buffers.emplace_back (_buffer_size);
-	empty = &_all_buffers.back();
-
-	for(;;)
-	{
-	    state status = _states[_current_task];
-
-	    if (status == INITIAL)
-	    {
-		_buffers[_current_task] = buffer;
-		_states[_current_task] = FILLED;
-		_sems[_current_task].post();
-		_initiated++;
-		_current_task = (_current_task + 1) % _num_consumers;
-		return empty;
-	    }
-	    else if (status == FINISHED) return nullptr;
-	    else if (status != FILLED && status != WORKING)
-	    {
-		std::ostringstream stream;
-		stream << "Invalid state " << snames[status]
-		       << " in buffer_trader::producer_swap()";
-		throw std::runtime_error (stream.str());
-	    }
-	    _current_task = (_current_task + 1) % _num_consumers;
-	}
+	return &_all_buffers.back();
     }
 
-    size_t current = _current_task;
-    _producer_scan = true;
+    // Any consumer finishing a buffer will do
+    while (_empty.empty() && !_failed) _empty_cv.wait (lock);
+    if (_failed) return nullptr;
 
-    for (;;)
-    {
-	state status = _states[current];
+    input_buffer* empty = _empty.back();
+    _empty.pop_back();
 
-	switch (status)
-	{
-	case INITIAL:
-	{
-	    std::ostringstream stream;
-	    stream << "Invalid state " << snames[status]
-		   << " in buffer_trader::consumer_get()";
-	    throw std::runtime_error (stream.str());
-	}
-	case WORKING:
-	{
-	    bool expected = true;
-	    if (!_producer_scan.compare_exchange_strong(expected, false))
-	    {
-		_producer_sem.wait();
-	    }
-	    input_buffer* nbuffer = _buffers[current];
-	    _buffers[current] = buffer;
-	    _states[current] = FILLED;
-	    _sems[current].post();
-	    _current_task = (current + 1) % _num_consumers;
-	    return nbuffer;
-	}
-	case FINISHED:
-	    return nullptr;
-	default:
-	    current = (current + 1) % _num_consumers;
-	    if (current == _current_task)
-	    {
-		_producer_sem.wait();
-		_producer_scan = true;
-	    }
-	    break;
-	}
-    }
+    return empty;
 }
 
 input_buffer*
-buffer_trader::consumer_get (const size_t id)
+buffer_trader::swap_lock_free (input_buffer* buffer)
 {
-    _sems[id].wait();
+    if (_failed) return nullptr;
 
-    state status = _states[id];
+    // There is room for every buffer
+    _filled_queue.push (buffer);
+    _filled_event.notify_one();
 
-    switch (status)
+    input_buffer* empty = nullptr;
+
+    if (_empty_queue.try_pop (empty)) return empty;
+    if (_all_buffers.size() < _num_buffers)
     {
-    case FINISHED:
-	return nullptr;
-    case FILLED:
+	_all_buffers.emplace_back (_buffer_size);
+	return &_all_buffers.back();
+    }
+
+    // Any consumer finishing a buffer will do
+    while (!event_count::spin ([&]() {return take_empty (empty);}))
     {
-	bool expected = true;
-	if (_producer_scan.compare_exchange_strong(expected, false))
+	const uint32_t key = _empty_event.prepare_wait();
+
+	if (take_empty (empty))
 	{
-	    _producer_sem.post();
+	    _empty_event.cancel_wait();
+	    break;
 	}
-	input_buffer* buffer = _buffers[id];
-	_states[id] = INITIAL;
-	return buffer;
-    }
-    default:
-    {
-	std::ostringstream stream;
-	stream << "Invalid state " << snames[status]
-	       << " in buffer_trader::consumer_get()";
-	throw std::runtime_error (stream.str());
-    }
+	_empty_event.wait (key);
     }
+
+    return _failed ? nullptr : empty;
+}
+
+bool
+buffer_trader::take_empty (input_buffer*& buffer)
+{
+    return _empty_queue.try_pop (buffer) || _failed;
+}
+
+input_buffer*
+buffer_trader::consumer_get (const size_t id)
+{
+    if (_lock_free) return next_filled_lock_free();
+
+    std::unique_lock<std::mutex> lock (_mutex);
+    return next_filled (lock);
 }
 
 input_buffer*
@@ -170,79 +129,98 @@ buffer_trader::consumer_swap (input_buffer* buffer, const size_t id)
     buffer->start() = 0;
     buffer->end() = 0;
 
-    _sems[id].wait();
+    if (_lock_free)
+    {
+	_empty_queue.push (buffer);
+	_empty_event.notify_one();
+	return next_filled_lock_free();
+    }
+
+    std::unique_lock<std::mutex> lock (_mutex);
+    _empty.push_back (buffer);
+    _empty_cv.notify_one();
 
-    state status = _states[id];
+    return next_filled (lock);
+}
 
-    switch (status)
-    {
-    case FINISHED:
-	return nullptr;
-    case FILLED:
+input_buffer*
+buffer_trader::next_filled (std::unique_lock<std::mutex>& lock)
+{
+    while (_filled.empty() && !_finished && !_failed) _filled_cv.wait (lock);
+    if (_failed || _filled.empty()) return nullptr;
+
+    input_buffer* buffer = _filled.front();
+    _filled.pop_front();
+
+    return buffer;
+}
+
+input_buffer*
+buffer_trader::next_filled_lock_free()
+{
+    input_buffer* buffer = nullptr;
+
+    while (!event_count::spin ([&]() {return take_filled (buffer);}))
     {
-	bool expected = true;
-	if (_producer_scan.compare_exchange_strong(expected, false))
+	const uint32_t key = _filled_event.prepare_wait();
+
+	if (take_filled (buffer))
 	{
-	    _producer_sem.post();
+	    _filled_event.cancel_wait();
+	    break;
 	}
-	input_buffer* nbuffer = _buffers[id];
-	_buffers[id] = buffer;
-	_states[id] = WORKING;
-	return nbuffer;
-    }
-    default:
-    {
-	std::ostringstream stream;
-	stream << "Invalid state " << snames[status]
-	       << " in buffer_trader::consumer_get()";
-	throw std::runtime_error (stream.str());
-    }
+	_filled_event.wait (key);
     }
+
+    return _failed ? nullptr : buffer;
+}
+
+bool
+buffer_trader::take_filled (input_buffer*& buffer)
+{
+    if (_failed || _filled_queue.try_pop (buffer)) return true;
+    if (!_finished) return false;
+
+    // The producer may have queued a last buffer just before finishing
+    if (!_filled_queue.try_pop (buffer)) buffer = nullptr;
+    return true;
 }
 
 void
 buffer_trader::producer_finish()
 {
-    bool done;
-
-    do
     {
-	done = true;
+	std::lock_guard<std::mutex> lock (_mutex);
 
-	for (size_t i = 0; i < _num_consumers; i++)
-	{
-	    state status = _states[i];
-
-	    if (status != FILLED)
-	    {
-		if (status != FINISHED)
-		{
-		    _states[i] = FINISHED;
-		    _sems[i].post();
-		}
-	    }
-	    else done = false;
-	}
-	std::this_thread::yield();
+	// Buffers already queued are still processed
+	_finished = true;
+	_filled_cv.notify_all();
     }
-    while (!done);
+    _filled_event.notify_all();
 }
 
 void
 buffer_trader::consumer_fail (const size_t id)
 {
-    state status;
-
-    while ((status = _states[id]) != FILLED && status != FINISHED)
     {
-	std::this_thread::yield();
+	std::lock_guard<std::mutex> lock (_mutex);
+
+	_failed = true;
+	_filled_cv.notify_all();
+	_empty_cv.notify_all();
     }
+    _filled_event.notify_all();
+    _empty_event.notify_all();
+}
 
-    if (status != FINISHED) _states[id] = FINISHED;
+void
+buffer_trader::release_buffers()
+{
+    input_buffer* buffer;
 
-    bool expected = true;
-    if (_producer_scan.compare_exchange_strong(expected, false))
-    {
-	_producer_sem.post();
-    }
+    _filled.clear();
+    _empty.clear();
+    while (_lock_free && _filled_queue.try_pop (buffer)) {}
+    while (_lock_free && _empty_queue.try_pop (buffer)) {}
+    _all_buffers.clear();
 }
@@ -18,28 +18,44 @@
 #define _HEXTREME_MAPREDO_BUFFER_TRADER_H
 
 #include <list>
+#include <deque>
 #include <vector>
-#include <stack>
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
 
-#include "input_buffer.h"
+#include "input_source.h"
+#include "mpmc_queue.h"
+#include "event_count.h"
 
 /**
- * Used to keep track of input buffers in memory.  This class is
- * thread safe, but needs to be be used with caution to avoid hanging
- * consumer threads.
+ * Used to keep track of input buffers in memory.  Filled buffers are
+ * put in a queue shared by the consumers, so whichever consumer is
+ * idle takes the next one, and the producer only waits when there are
+ * no empty buffers left.  The queues are either protected by a
+ * mutex, or lock-free with threads that have nothing to do spinning
+ * briefly before they sleep.  The mutex is the default, and the
+ * lock-free queues are meant for many consumers on many cores, where
+ * the mutex is contended.  tests/trader_benchmark compares the two.
+ * This class is thread safe.
+ *
+ * This is the input source behind engine::prepare_input() and
+ * provide_input_data(), as used on Windows and by library users.
+ * engine::process_files() and process_stream() use multi_input and
+ * ring_input instead, where idle consumers take chunks directly.
  */
-class buffer_trader
+class buffer_trader : public input_source
 {
 public:
     /**
      * @param buffer_size size of each input buffer in bytes
      * @param num_consumers number of consumer threads
+     * @param lock_free if true, hand over buffers through lock-free
+     *                  queues instead of queues under a mutex
      */
     buffer_trader (const size_t buffer_size,
-		   const size_t num_consumers);
+		   const size_t num_consumers,
+		   const bool lock_free = false);
     ~buffer_trader();
 
     /**
@@ -52,12 +68,12 @@ public:
 
     /**
      * Swap a filled buffer with an empty one.  This function is
-     * called from the input thread and may spin until there is an
-     * available buffer.
+     * called from the input thread and may wait until any consumer
+     * returns a buffer.
      * @param buffer filled buffer
      * @returns empty buffer, or nullptr if a consumer has indicated failure
      */
-     input_buffer* producer_swap (input_buffer* buffer);
+    input_buffer* producer_swap (input_buffer* buffer);
 
     /**
      * Get the next buffer ready to be sorted.  This function may hang until
@@ -65,7 +81,7 @@ public:
      * @param id thread identifier
      * @returns filled buffer or nullptr if there will be no more data
      */
-    input_buffer* consumer_get (const size_t id);
+    virtual input_buffer* consumer_get (const size_t id) final;
 
     /**
      * Swap a now empty buffer with the next buffer ready to be
@@ -75,7 +91,8 @@ public:
      * @param id thread identifier
      * @returns filled buffer or nullptr if there will be no more data
      */
-    input_buffer* consumer_swap (input_buffer* buffer, const size_t id);
+    virtual input_buffer* consumer_swap (input_buffer* buffer,
+					 const size_t id) final;
 
     /**
      * Called by producer to indicate that there will be no more
@@ -91,53 +108,50 @@ public:
      * processing to stop.
      * @param id thread identifier
      */
-    void consumer_fail (const size_t id);
+    virtual void consumer_fail (const size_t id) final;
+
+    /**
+     * Free all buffers, so that their memory can be used for merging.
+     * Only call this after the consumer threads have been joined.
+     */
+    void release_buffers();
 
 private:
-    class bsem
-    {
-    public:
-	void post() {
-	    {
-		std::unique_lock<std::mutex> locker(_mutex);
-		if (_value)
-		{
-		    throw std::runtime_error
-			("Unexpected value in bsem::post()");
-		}
-		_value = true;
-	    }
-	    _cv.notify_one();
-	}
-	void wait() {
-	    std::unique_lock<std::mutex> locker(_mutex);
-	    while (!_value) _cv.wait(locker);
-	    _value = false;
-	}
-    private:
-	std::mutex _mutex;
-	std::condition_variable _cv;
-	bool _value = false;
-    };
-
-    enum state
-    {
-	INITIAL, // no buffer, should be filled by producer shortly
-	WORKING, // consumer is working, empty buffer available
-	FILLED,  // filled buffer, ready for processing
-	FINISHED // no more input
-    };
+    /** @returns the next filled buffer, or nullptr */
+    input_buffer* next_filled (std::unique_lock<std::mutex>& lock);
+
+    /** producer_swap() through the lock-free queues */
+    input_buffer* swap_lock_free (input_buffer* buffer);
+
+    /** next_filled() through the lock-free queues */
+    input_buffer* next_filled_lock_free();
+
+    /** @returns true if there is no need to wait for a filled buffer */
+    bool take_filled (input_buffer*& buffer);
+
+    /** @returns true if there is no need to wait for an empty buffer */
+    bool take_empty (input_buffer*& buffer);
 
     const size_t _buffer_size;
-    const size_t _num_consumers;
+    const size_t _num_buffers;
+    const bool _lock_free;
     std::list<input_buffer> _all_buffers;
-    std::unique_ptr<std::atomic<state>[]> _states;
-    std::vector<input_buffer*> _buffers;
-    std::unique_ptr<bsem[]> _sems;
-    size_t _current_task = 0;
-    size_t _initiated = 0;
-    std::atomic<bool> _producer_scan;
-    bsem _producer_sem;
+
+    // Queues under a mutex
+    std::deque<input_buffer*> _filled;
+    std::vector<input_buffer*> _empty;
+    std::mutex _mutex;
+    std::condition_variable _filled_cv;
+    std::condition_variable _empty_cv;
+
+    // Lock-free queues
+    mpmc_queue<input_buffer*> _filled_queue;
+    mpmc_queue<input_buffer*> _empty_queue;
+    event_count _filled_event;
+    event_count _empty_event;
+
+    std::atomic<bool> _finished;
+    std::atomic<bool> _failed;
 };
 
 #endif
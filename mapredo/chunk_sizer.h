@@ -0,0 +1,129 @@
+/* -*- C++ -*-
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef _HEXTREME_MAPREDO_CHUNK_SIZER_H
+#define _HEXTREME_MAPREDO_CHUNK_SIZER_H
+
+#include <chrono>
+#include <algorithm>
+#include <mutex>
+
+/**
+ * Decides how many bytes of input to give a consumer at a time.  The
+ * size is doubled while consumers finish chunks quickly, so handoffs
+ * stay cheap relative to the work, and halved when they hold on to
+ * chunks for long, so there is little left to wait for at the end of
+ * the input.  This class is thread safe, so one sizer can be shared
+ * by the sources of several input files.
+ */
+class chunk_sizer
+{
+public:
+    typedef std::chrono::steady_clock::duration duration;
+
+    /**
+     * Create a sizer which keeps the chunk size fixed.
+     * @param size chunk size in bytes
+     */
+    chunk_sizer (const size_t size) :
+	_size (size), _min (size), _max (size) {}
+
+    /**
+     * Create a sizer which adapts the chunk size to the consumers.
+     * @param size initial chunk size in bytes
+     * @param min smallest chunk size in bytes
+     * @param max largest chunk size in bytes
+     */
+    chunk_sizer (const size_t size, const size_t min, const size_t max) :
+	_size (size), _min (min), _max (max) {}
+
+    chunk_sizer (const chunk_sizer& other) {
+	std::lock_guard<std::mutex> lock (other._mutex);
+
+	_size = other._size;
+	_min = other._min;
+	_max = other._max;
+    }
+
+    chunk_sizer& operator=(const chunk_sizer&) = delete;
+
+    /** @returns the current chunk size in bytes */
+    size_t size() const {
+	std::lock_guard<std::mutex> lock (_mutex);
+	return _size;
+    }
+
+    /** @returns the largest chunk size in bytes */
+    size_t max() const {
+	std::lock_guard<std::mutex> lock (_mutex);
+	return _max;
+    }
+
+    /**
+     * Lower the largest chunk size, for instance to fit a buffer.
+     * @param max largest chunk size in bytes
+     */
+    void limit (const size_t max) {
+	std::lock_guard<std::mutex> lock (_mutex);
+
+	_max = std::max (std::min(_max, max), _min);
+	_size = std::min (_size, _max);
+    }
+
+    /**
+     * Report how long a consumer spent on a chunk.
+     * @param bytes size of the chunk
+     * @param time time from handing out the chunk until it was returned
+     */
+    void processed (const size_t bytes, const duration time) {
+	std::lock_guard<std::mutex> lock (_mutex);
+
+	// Chunks cut short by the end of input say little about the size
+	if (_min == _max || bytes < _size / 2) return;
+
+	if (time < std::chrono::milliseconds(2))
+	{
+	    _slow = 0;
+	    if (_size < _max && ++_fast == _samples)
+	    {
+		_size = std::min (_size * 2, _max);
+		_fast = 0;
+	    }
+	}
+	else if (time > std::chrono::milliseconds(100))
+	{
+	    _fast = 0;
+	    if (_size > _min && ++_slow == _samples)
+	    {
+		_size = std::max (_size / 2, _min);
+		_slow = 0;
+	    }
+	}
+	else _fast = _slow = 0;
+    }
+
+private:
+    static const size_t _samples = 4; // agreeing samples before resizing
+
+    size_t _size;
+    size_t _min;
+    size_t _max;
+    size_t _fast = 0;
+    size_t _slow = 0;
+    mutable std::mutex _mutex;
+};
+
+#endif
@@ -17,7 +17,9 @@
 #ifndef _HEXTREME_MAPREDO_COLLECTOR_H
 #define _HEXTREME_MAPREDO_COLLECTOR_H
 
-#include <sstream>
+#include <string>
+
+#include "field.h"
 
 namespace mapredo
 {
@@ -28,17 +30,42 @@ namespace mapredo
     {
     public:
 	virtual void collect (const char* line, const size_t length) = 0;
+
+	/**
+	 * Collect a key and a value, tab separated.  Strings, integers
+	 * and floating point numbers are formatted without allocating
+	 * memory, see field.
+	 */
 	template<typename T1, typename T2>
 	void collect_keyval (const T1& key, const T2& value) {
-	    std::ostringstream stream;
-	    stream << key << '\t' << value;
-	    const std::string& val (stream.str());
-	    collect (val.c_str(), val.size());
+	    const field k (key), v (value);
+	    const size_t length = k.size() + 1 + v.size();
+
+	    if (length > _max_stack_line)
+	    {
+		std::string line;
+
+		line.reserve (length);
+		line.append(k.data(), k.size()).append(1, '\t')
+		    .append(v.data(), v.size());
+		collect (line.data(), length);
+		return;
+	    }
+
+	    char line[_max_stack_line];
+
+	    memcpy (line, k.data(), k.size());
+	    line[k.size()] = '\t';
+	    memcpy (line + k.size() + 1, v.data(), v.size());
+	    collect (line, length);
 	}
 	virtual ~collector() {}
 
     protected:
 	collector() = default;
+
+	/** Longest line formatted on the stack by collect_keyval() */
+	static const size_t _max_stack_line = 1024;
     };
 }
 
@@ -0,0 +1,125 @@
+/*
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <cstring>
+
+#include "combiner.h"
+#include "mapreducer.h"
+
+/** Collects reducer output into a string of newline terminated lines */
+class string_collector final : public mapredo::rcollector
+{
+public:
+    string_collector (std::string& output) : _output (output) {}
+
+    virtual void collect (const char* line, const size_t length) final {
+	_output.append (line, length);
+	_output += '\n';
+    }
+
+    virtual char* reserve (const size_t bytes) final {
+	_reserved_pos = _output.size();
+	_reserved_bytes = bytes;
+	_output.resize (_reserved_pos + bytes + 1);
+	return &_output[_reserved_pos];
+    }
+
+    virtual void collect_reserved (const size_t length = 0) final {
+	if (_reserved_bytes == 0)
+	{
+	    throw std::runtime_error
+		("No memory reserved via reserve() in"
+		 " string_collector::collect_reserved()");
+	}
+	_output.resize (_reserved_pos + (length ? length : _reserved_bytes));
+	_output += '\n';
+	_reserved_bytes = 0;
+    }
+
+private:
+    std::string& _output;
+    size_t _reserved_pos = 0;
+    size_t _reserved_bytes = 0;
+};
+
+combiner::combiner (mapredo::base& reducer) :
+    _reducer (reducer)
+{}
+
+void
+combiner::combine (const char* lines, const size_t size, std::string& output)
+{
+    char* const records = buffer (size);
+
+    if (size) memcpy (records, lines, size);
+    combine (size, output);
+}
+
+char*
+combiner::buffer (const size_t size)
+{
+    switch (_reducer.type())
+    {
+    case mapredo::base::keytype::STRING:
+	return _string_reader.room (size);
+    case mapredo::base::keytype::DOUBLE:
+	return _double_reader.room (size);
+    case mapredo::base::keytype::INT64:
+	return _integer_reader.room (size);
+    case mapredo::base::keytype::UNKNOWN:
+	break;
+    }
+    throw std::runtime_error ("Program error, keytype not set"
+			      " in mapredo::base");
+}
+
+void
+combiner::combine (const size_t size, std::string& output)
+{
+    switch (_reducer.type())
+    {
+    case mapredo::base::keytype::STRING:
+	reduce (_string_tree, _string_reader, size, output);
+	break;
+    case mapredo::base::keytype::DOUBLE:
+	reduce (_double_tree, _double_reader, size, output);
+	break;
+    case mapredo::base::keytype::INT64:
+	reduce (_integer_tree, _integer_reader, size, output);
+	break;
+    case mapredo::base::keytype::UNKNOWN:
+	throw std::runtime_error ("Program error, keytype not set"
+				  " in mapredo::base");
+    }
+}
+
+template<typename T> void
+combiner::reduce (loser_tree<T>& tree, buffer_reader<T>& reader,
+		  const size_t size, std::string& output)
+{
+    string_collector collector (output);
+
+    reader.fill (size);
+    tree.push (reader);
+
+    mapredo::valuelist<T> list (tree);
+
+    while (!tree.empty())
+    {
+	static_cast<mapredo::mapreducer<T>&>(_reducer).reduce
+	    (list.get_key(), list, collector);
+    }
+}
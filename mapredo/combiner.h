@@ -0,0 +1,95 @@
+/* -*- C++ -*-
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef _HEXTREME_MAPREDO_COMBINER_H
+#define _HEXTREME_MAPREDO_COMBINER_H
+
+#include <string>
+
+#include "base.h"
+#include "loser_tree.h"
+#include "buffer_reader.h"
+
+/**
+ * Runs the reducer of a mapreducer on records in memory.  This is used
+ * to combine records with the same key before they reach a temporary
+ * file where reducer_can_combine() is true, and to reduce input that
+ * is already sorted.
+ */
+class combiner
+{
+public:
+    /**
+     * @param reducer the mapreducer object to reduce with.  This must
+     *                not be the object doing the mapping, as reduce()
+     *                may use the same output buffer as map().
+     */
+    combiner (mapredo::base& reducer);
+
+    /**
+     * Reduce some records.
+     * @param lines newline terminated records, with the records of
+     *              each key next to each other
+     * @param size number of bytes in lines
+     * @param output the reducer output is appended to this as
+     *               newline terminated lines.
+     */
+    void combine (const char* lines, const size_t size, std::string& output);
+
+    /**
+     * Get a buffer to write records to, to reduce them through
+     * combine (size, output) without copying them.  This is valid
+     * until the next call.
+     * @param size number of bytes to be written
+     */
+    char* buffer (const size_t size);
+
+    /**
+     * Reduce the records written to the buffer from buffer().
+     * @param size number of bytes written
+     * @param output the reducer output is appended to this as
+     *               newline terminated lines.
+     */
+    void combine (const size_t size, std::string& output);
+
+    /** @returns the memory held for the records to reduce */
+    size_t bytes() const {
+	return _string_reader.capacity() + _integer_reader.capacity()
+	    + _double_reader.capacity();
+    }
+
+    combiner (const combiner&) = delete;
+    combiner& operator=(const combiner&) = delete;
+
+private:
+    template<typename T> void reduce (loser_tree<T>& tree,
+				      buffer_reader<T>& reader,
+				      const size_t size, std::string& output);
+
+    mapredo::base& _reducer;
+
+    // Kept between calls, so combining a few records allocates nothing.
+    // Only the ones of the key type are used.
+    loser_tree<char*> _string_tree;
+    loser_tree<int64_t> _integer_tree;
+    loser_tree<double> _double_tree;
+    buffer_reader<char*> _string_reader;
+    buffer_reader<int64_t> _integer_reader;
+    buffer_reader<double> _double_reader;
+};
+
+#endif
@@ -127,6 +127,40 @@ public:
 	    ("Can not uncompress corrupted Snappy data");
     }
 
+    /**
+     * @param inbuffer start of a compressed block
+     * @param inbuffer_size the number of bytes available
+     * @returns the size of the whole block, or 0 if not even the
+     *          size in front of it is available
+     */
+    static size_t block_size (const char* const inbuffer,
+			      const size_t inbuffer_size) {
+	if (inbuffer_size < 4) return 0;
+
+	return ((uint8_t)inbuffer[0]
+		| (uint8_t)inbuffer[1] << 8
+		| (uint8_t)inbuffer[2] << 16
+		| size_t((uint8_t)inbuffer[3]) << 24) + 4;
+    }
+
+    /**
+     * @param inbuffer a whole compressed block
+     * @param block_size the size returned by block_size()
+     * @returns the size of the data of the block once uncompressed
+     */
+    static size_t uncompressed_size (const char* const inbuffer,
+				     const size_t block_size) {
+	size_t uncomp_len;
+
+	if (snappy_uncompressed_length (inbuffer + 4, block_size - 4,
+					&uncomp_len) != SNAPPY_OK)
+	{
+	    throw std::runtime_error
+		("Can not parse corrupted Snappy uncompressed size");
+	}
+	return uncomp_len;
+    }
+
     static size_t max_compressed_size (const size_t data_size) {
 	return snappy_max_compressed_length (data_size);
     }
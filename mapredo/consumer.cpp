@@ -14,8 +14,13 @@
  *
  */
 
+#include <cstring>
+
 #include "consumer.h"
 #include "mapreducer.h"
+#include "range_partitioner.h"
+#include "scanner.h"
+#include "settings.h"
 
 consumer::consumer (mapredo::base& mapreducer,
 		    const std::string& tmpdir,
@@ -23,17 +28,39 @@ consumer::consumer (mapredo::base& mapreducer,
 		    const uint16_t buckets,
 		    const uint16_t worker_id,
 		    const size_t bytes_buffer,
-		    const bool reverse) :
+		    const bool reverse,
+		    const range_partitioner* ranges,
+		    const std::function<mapredo::base&()>& new_combiner,
+		    thread_pool* const pool,
+		    mapredo::base* const sorted) :
     _mapreducer (mapreducer),
+    _ranges (ranges),
     _tmpdir (tmpdir),
     _is_subdir (is_subdir),
     _buckets (buckets),
-    _worker_id (worker_id)
+    _worker_id (worker_id),
+    _tmpfiles (buckets)
 {
-    for (size_t i = 0; i < buckets; i++)
+    if (sorted)
+    {
+	_sorted.reset (new sorted_reducer (*sorted, bytes_buffer, reverse));
+	return;
+    }
+
+    _sorter.reset (new sorter (_tmpdir, buckets, worker_id, bytes_buffer,
+			       mapreducer.type(), reverse,
+			       new_combiner ? &new_combiner() : nullptr,
+			       pool));
+    if (new_combiner)
     {
-	_sorters.emplace_back (_tmpdir, i, worker_id, bytes_buffer,
-			       mapreducer.type(), reverse);
+	_aggregator.reset
+	    (new aggregator (new_combiner(), bytes_buffer,
+			     [this](const char* line, const size_t keylen,
+				    const size_t length)
+			     {
+				 _sorter->add (line, keylen, length,
+					       bucket(line, keylen));
+			     }));
     }
 }
 
@@ -43,9 +70,9 @@ consumer::~consumer()
 }
 
 void
-consumer::start_thread (buffer_trader& trader)
+consumer::start_thread (input_source& input)
 {
-    _thread = std::thread (&consumer::work, this, std::ref(trader));
+    _thread = std::thread (&consumer::work, this, std::ref(input));
 }
 
 void
@@ -55,94 +82,164 @@ consumer::join_thread()
 }
 
 void
-consumer::append_tmpfiles (const size_t index, std::list<std::string>& files)
+consumer::append_tmpfiles (const size_t index,
+			   std::list<tmpfile_section>& files)
 {
-    auto iter (_tmpfiles.find (index));
-
-    if (iter != _tmpfiles.end()) files.splice (files.end(), iter->second);
+    files.splice (files.end(), _tmpfiles[index]);
 }
 
 void
-consumer::work (buffer_trader& trader)
+consumer::work (input_source& input)
 {
     try
     {
-	auto* buffer = trader.consumer_get (_worker_id);
+	auto* buffer = input.consumer_get (_worker_id);
 
 	if (!buffer) return;
-	std::stringstream stream;
-
-	size_t pos;
+	const record_format::type format
+	    (settings::instance().input_format());
 
 	do
 	{
-	    char* buf = buffer->get();
-	    size_t start = buffer->start();
-	    const size_t end = buffer->end();
-
-	    while (start < end)
-	    {
-		for (pos = start; pos < end && buf[pos] != '\n'; pos++) ;
-
-		if (pos == start || buf[pos-1] != '\r')
-		{
-		    buf[pos] = '\0';
-		    _mapreducer.map (buf + start, pos - start, *this);
-		}
-		else
-		{
-		    buf[pos-1] = '\0';
-		    _mapreducer.map (buf + start, pos - start - 1, *this);
-		}
-		start = pos + 1;
-	    }
+	    if (format == record_format::LINES) map_lines (*buffer);
+	    else map_records (*buffer, format);
 	}
-	while ((buffer = trader.consumer_swap(buffer, _worker_id)));
+	while ((buffer = input.consumer_swap(buffer, _worker_id)));
 
-	for (auto& sorter: _sorters)
+	if (_sorted)
 	{
-	    sorter.flush();
-	    _tmpfiles[sorter.hash_index()] = sorter.grab_tmpfiles();
+	    _sorted->flush();
+	    return;
 	}
-	_sorters.clear();
+	if (_aggregator) _aggregator->flush();
+	_sorter->flush();
+	for (size_t i = 0; i < _buckets; i++)
+	{
+	    _tmpfiles[i] = _sorter->grab_tmpfiles (i);
+	}
+	_sorter.reset();
     }
     catch (...)
     {
 	_texception = std::current_exception();
-	trader.consumer_fail (_worker_id);
+	input.consumer_fail (_worker_id);
+    }
+}
+
+void
+consumer::map_lines (input_buffer& buffer)
+{
+    char* buf = buffer.get();
+    size_t start = buffer.start();
+    const size_t end = buffer.end();
+    const bool writable = buffer.writable();
+    const bool copy = !writable && !_mapreducer.mapper_reads_only();
+    size_t pos;
+
+    while (start < end)
+    {
+	const char* nl = scanner::find (buf + start, buf + end, '\n');
+	size_t length;
+
+	pos = nl ? nl - buf : end;
+	length = pos - start;
+	if (length && buf[pos-1] == '\r') length--;
+
+	if (copy)
+	{
+	    _record.assign (buf + start, length);
+	    _mapreducer.map (&_record[0], length, *this);
+	}
+	else
+	{
+	    if (writable) buf[start + length] = '\0';
+	    _mapreducer.map (buf + start, length, *this);
+	}
+	start = pos + 1;
     }
 }
 
-static unsigned int hash (const char* str, size_t siz, size_t& keylen,
-			  const char delim = '\t')
+void
+consumer::map_records (input_buffer& buffer,
+		       const record_format::type format)
 {
-    unsigned int result = 0x55555555;
+    char* pos = buffer.get() + buffer.start();
+    char* const end = buffer.get() + buffer.end();
+    uint64_t length;
 
-    for (keylen = 0; keylen < siz && str[keylen] != delim; keylen++)
+    while (pos < end)
     {
-	result ^= str[keylen];
-	result = ((result << 5) | (result >> 27));
+	const size_t header_size = record_format::header (format, pos, end,
+							  length);
+	if (!header_size || length > size_t(end - pos) - header_size)
+	{
+	    throw std::runtime_error ("Truncated record in input");
+	}
+
+	char* const record = pos + header_size;
+	pos = record + length;
+
+	// Records are nul-terminated like lines.  The byte after the
+	// last record of a buffer may belong to the buffer of another
+	// consumer, so that record is copied instead, as are all
+	// records of read-only buffers unless the mapper only reads them.
+	if (!buffer.writable() && _mapreducer.mapper_reads_only())
+	{
+	    _mapreducer.map (record, length, *this);
+	}
+	else if (pos < end && buffer.writable())
+	{
+	    const char next = *pos;
+
+	    *pos = '\0';
+	    _mapreducer.map (record, length, *this);
+	    *pos = next;
+	}
+	else
+	{
+	    _record.assign (record, length);
+	    _mapreducer.map (&_record[0], length, *this);
+	}
     }
-    return result;
+}
+
+size_t
+consumer::bucket (const char* const key, const size_t keylen) const
+{
+    if (_ranges) return _ranges->partition (key, keylen);
+    return _mapreducer.partition (key, keylen, _buckets);
 }
 
 void
 consumer::collect (const char* inbuffer, const size_t insize)
 {
-    size_t keylen = 0;
-    unsigned int bucket = hash(inbuffer, insize, keylen) % _buckets;
+    const char* tab = scanner::find (inbuffer, inbuffer + insize, '\t');
+    const size_t keylen = (tab ? tab - inbuffer : insize);
 
-    _sorters[bucket].add (inbuffer, keylen, insize);
+    if (_sorted) _sorted->add (inbuffer, keylen, insize);
+    else if (_aggregator && keylen)
+    {
+	_aggregator->add (inbuffer, keylen, insize);
+    }
+    else _sorter->add (inbuffer, keylen, insize, bucket(inbuffer, keylen));
 }
 
 char*
 consumer::reserve (const char* const key, const size_t bytes)
 {
-    _reserved_bucket = hash(key, 0, _reserved_keylen, '\0') % _buckets;
+    _reserved_keylen = strlen (key);
     _reserved_valuelen = bytes;
 
-    char* buf = _sorters[_reserved_bucket].reserve
-	(_reserved_keylen + 1 + bytes);
+    if (_sorted || (_aggregator && _reserved_keylen))
+    {
+	_reserved.resize (_reserved_keylen + 1 + bytes);
+	memcpy (&_reserved[0], key, _reserved_keylen);
+	_reserved[_reserved_keylen] = '\t';
+	return &_reserved[_reserved_keylen + 1];
+    }
+    _reserved_bucket = bucket (key, _reserved_keylen);
+
+    char* buf = _sorter->reserve (_reserved_keylen + 1 + bytes);
     memcpy (buf, key, _reserved_keylen);
     buf[_reserved_keylen] = '\t';
 
@@ -152,14 +249,16 @@ consumer::reserve (const char* const key, const size_t bytes)
 void
 consumer::collect_reserved (const size_t length)
 {
-    if (length == 0)
+    const size_t size = _reserved_keylen + 1
+	+ (length ? length : _reserved_valuelen);
+
+    if (_sorted) _sorted->add (_reserved.data(), _reserved_keylen, size);
+    else if (_aggregator && _reserved_keylen)
     {
-	_sorters[_reserved_bucket].add_reserved
-	    (_reserved_keylen, _reserved_keylen + 1 + _reserved_valuelen);
+	_aggregator->add (_reserved.data(), _reserved_keylen, size);
     }
     else
     {
-	_sorters[_reserved_bucket].add_reserved
-	    (_reserved_keylen, _reserved_keylen + 1 + length);
+	_sorter->add_reserved (_reserved_keylen, size, _reserved_bucket);
     }
 }
@@ -17,15 +17,23 @@
 #ifndef _HEXTREME_MAPREDO_CONSUMER_H
 #define _HEXTREME_MAPREDO_CONSUMER_H
 
-#include <unordered_map>
+#include <vector>
+#include <list>
+#include <memory>
 #include <thread>
+#include <functional>
 
 #include "mcollector.h"
 #include "sorter.h"
-#include "buffer_trader.h"
+#include "input_source.h"
+#include "record_format.h"
+#include "aggregator.h"
+#include "sorted_reducer.h"
 
 class plugin_loader;
 class mapreducer;
+class range_partitioner;
+class thread_pool;
 
 /**
  * Class used to run map and sort
@@ -40,6 +48,20 @@ public:
      * @param is_subdir true if the directory is a specified subdirectory.
      * @param type type to use for sorting.
      * @param reverse if true, sort in descending order instead of ascending.
+     * @param ranges if not nullptr, partition keys by range with this
+     *               instead of with mapredo::base::partition().
+     * @param new_combiner if set, creates other objects of the
+     *                     mapreducer, used to combine records with the
+     *                     same key before they are sorted.  The
+     *                     aggregator and the sorter get their own, as
+     *                     the sorter may be flushed by other threads.
+     * @param pool if not nullptr, threads to sort and write full sort
+     *             buffers with in the background.
+     * @param sorted if not nullptr, the mapper output is already in
+     *               key order.  It is reduced by this other object of
+     *               the mapreducer as it comes, with the output going
+     *               to standard output, see sorted_reducer.  Nothing
+     *               is sorted or written to temporary files.
      */
     consumer (mapredo::base& mapred,
 	      const std::string& tmpdir,
@@ -47,14 +69,18 @@ public:
 	      const uint16_t buckets,
 	      const uint16_t worker_id, 
 	      const size_t bytes_buffer,
-	      const bool reverse);
+	      const bool reverse,
+	      const range_partitioner* ranges = nullptr,
+	      const std::function<mapredo::base&()>& new_combiner = nullptr,
+	      thread_pool* const pool = nullptr,
+	      mapredo::base* const sorted = nullptr);
     virtual ~consumer();
 
     /**
      * Process input data in a separate thread.
-     * @param trader object to pull jobs from.
+     * @param input object to pull jobs from.
      */
-    void start_thread (buffer_trader& trader);
+    void start_thread (input_source& input);
 
     /**
      * Wait for input data processing thread to finish.
@@ -62,7 +88,8 @@ public:
     void join_thread();
 
     /** Append all temporary files of a given index to a list of files */
-    void append_tmpfiles (const size_t index, std::list<std::string>& files);
+    void append_tmpfiles (const size_t index,
+			  std::list<tmpfile_section>& files);
 
     /** Used to collect data, called from the mapper */
     virtual void collect (const char* line, const size_t length) final;
@@ -84,22 +111,37 @@ public:
     consumer& operator=(const consumer&) = delete;
     
 private:
-    void work (buffer_trader& trader);
+    void work (input_source& input);
+
+    /** Map each newline terminated line in a buffer */
+    void map_lines (input_buffer& buffer);
+
+    /** Map each length-prefixed record in a buffer */
+    void map_records (input_buffer& buffer,
+		      const record_format::type format);
+
+    /** @returns the bucket of a key */
+    size_t bucket (const char* const key, const size_t keylen) const;
 
     std::thread _thread;
     mapredo::base& _mapreducer;
+    const range_partitioner* const _ranges;
     const std::string _tmpdir;
     const bool _is_subdir = false;
     const size_t _buckets;
     const size_t _worker_id;
     std::exception_ptr _texception = nullptr;
 
-    std::vector<sorter> _sorters;
-    std::unordered_map<int, std::list<std::string>> _tmpfiles;
+    std::unique_ptr<sorter> _sorter; // shared by all buckets
+    std::unique_ptr<aggregator> _aggregator;
+    std::unique_ptr<sorted_reducer> _sorted;
+    std::vector<std::list<tmpfile_section>> _tmpfiles;
 
     size_t _reserved_bucket;
     size_t _reserved_keylen;
     size_t _reserved_valuelen;
+    std::string _reserved; // reserved record unless sorting
+    std::string _record; // copy of a line or record, nul-terminated
 };
 
 #endif
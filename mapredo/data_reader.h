@@ -14,6 +14,7 @@
  *
  */
 
+
 #ifndef _HEXTREME_MAPREDO_DATA_READER_H
 #define _HEXTREME_MAPREDO_DATA_READER_H
 
@@ -21,7 +22,14 @@
 #include <iostream>
 #include <stdexcept>
 
-/** Base class for classes used when reading data in merge sort phase */
+#include "scanner.h"
+#include "run_format.h"
+
+/**
+ * Base class for classes used when reading data in merge sort phase.
+ * The data is records in the binary format of run_format, or newline
+ * terminated lines of tab separated keys and values.
+ */
 template <class T> class data_reader
 {
 public:
@@ -32,15 +40,15 @@ public:
     /**
      * Peek at the next key from the data source.  This function may
      * be called multiple times and it will return the same pointer
-     * until get_next_value or get_next_line() is called.
+     * until get_next_value or get_next_record() is called.
      * @returns pointer to next key if there is more data, nullptr otherwise
      */
     const T* next_key() {
-	if (_keylen > 0) return &_key;
-	if (_keylen == 0)
+	if (_state == READY) return &_key;
+	if (_state == EMPTY)
 	{
 	    fill_next_line();
-	    if (_keylen > 0) return &_key;
+	    if (_state == READY) return &_key;
 	}
 	return nullptr;
     }
@@ -53,13 +61,13 @@ public:
     char* get_next_value();
 
     /**
-     * Get the next line (key-value pair) from the file.  The line is
-     * not nul-terminated.  Remember to call next_key() before calling
+     * Get the next record as it is stored, to copy it to another file
+     * of the same format.  Remember to call next_key() before calling
      * this function.
-     * @param size set to the size of the keyvalue field.
-     * @returns pointer to next keyvalue field or nullptr.
+     * @param size set to the size of the record.
+     * @returns pointer to the record.
      */
-    const char* get_next_line (size_t& length);
+    const char* get_next_record (size_t& length);
 
     /** Comparison with a key, used when traversing files during merge */
     template<class U = T,
@@ -83,7 +91,7 @@ public:
 	     typename std::enable_if<std::is_fundamental<U>::value>::type*
 	     = nullptr>
     int compare (const T& other_key) {
-	return _key - other_key;
+	return (_key > other_key) - (_key < other_key);
     }
     
     /** Comparison with other object, used when traversing files during merge */
@@ -98,16 +106,36 @@ public:
     data_reader& operator=(const data_reader&) = delete;
     
 protected:
-    data_reader() {
+    /**
+     * @param lines true if the data is text lines instead of binary
+     *              records
+     */
+    data_reader (const bool lines = false) : _lines (lines) {
 	static_assert (std::is_same<T,char*>::value
                        || std::is_same<T,int64_t>::value
 		       || std::is_same<T,double>::value,
                        "Only char*, int64_t and double keys are supported");
     }
 
-    /** Prepare next line from buffer */
+    /** Prepare next line or record from buffer */
     void fill_next_line();
 
+    /**
+     * Find the end of the key and of the line starting at a position
+     * in the buffer, and nul-terminate both.
+     * @param start position of the line in the buffer
+     * @returns true if the whole line is in the buffer
+     */
+    bool split_line (const size_t start);
+
+    /**
+     * Find the key and value of the record starting at a position in
+     * the buffer.
+     * @param start position of the record in the buffer
+     * @returns true if the whole record is in the buffer
+     */
+    bool split_record (const size_t start);
+
     /** Override this if the data source can provide more data. */
     virtual bool read_more() {return false;}
 
@@ -116,6 +144,16 @@ protected:
     size_t _end_pos = 0;
 
 private:
+    enum state
+    {
+	EMPTY, /// the next record is not prepared yet
+	READY, /// the next record is prepared
+	DONE   /// there are no more records
+    };
+
+    /** String keys are followed by a nul in the records */
+    static const size_t _key_terminator = std::is_same<T,char*>::value;
+
     template<class U = T,
 	     typename std::enable_if<std::is_floating_point<U>::value>::type*
 	     = nullptr>
@@ -137,116 +175,146 @@ private:
 	_key = buf;
     }
 
+    template<class U = T,
+	     typename std::enable_if<std::is_fundamental<U>::value>::type*
+	     = nullptr>
+    void set_record_key (const char* const key, const uint64_t keysize) {
+	if (keysize != sizeof(_key))
+	{
+	    throw std::runtime_error ("Invalid key size in temporary file");
+	}
+	memcpy (&_key, key, sizeof(_key));
+    }
+
+    template<class U = T,
+	     typename std::enable_if<std::is_same<U,char*>::value,
+				     bool>::type* = nullptr>
+    void set_record_key (char* const key, const uint64_t keysize) {
+	_key = key;
+    }
+
+    const bool _lines;
+    state _state = EMPTY;
     T _key;
-    int _keylen = 0;
-    int _totallen = 0;
+    char* _value = nullptr;
+    size_t _keylen = 0; // of lines
+    size_t _record_size = 0;
 };
 
 template <class T> void
 data_reader<T>::fill_next_line()
 {
-    _keylen = _totallen = -1;
+    _state = DONE;
     if (_start_pos == _end_pos && !read_more()) return;
 
-    size_t i;
-
-    set_key (_buffer + _start_pos);
-
-    for (i = _start_pos; i < _end_pos; i++)
+    while (!(_lines ? split_line (_start_pos) : split_record (_start_pos)))
     {
-	if (_buffer[i] == '\t')
-	{
-	    _keylen = i - _start_pos;
-	    _buffer[i] = '\0';
-	    break;
-	}
-	else if (_buffer[i] == '\n') break;
-    }
-    for (; i < _end_pos; i++)
-    {
-	if (_buffer[i] == '\n')
+	const size_t available = _end_pos - _start_pos;
+
+	// The data left is moved to the start of the buffer
+	if (!read_more() || _end_pos - _start_pos == available)
 	{
-	    _buffer[i] = '\0';
-	    _totallen = i - _start_pos;
-	    if (_keylen < 0)
-	    {
-		_keylen = _totallen;
-	    }
-	    return;
+	    throw std::runtime_error
+		(_lines
+		 ? "Temporary data does not contain trailing newline"
+		 : "Record in temporary file is truncated or larger than"
+		 " the read buffer");
 	}
     }
+    _state = READY;
+}
 
-    if (!read_more())
-    {
-	throw std::runtime_error
-	    ("Temporary data does not contain newlines or tabs");
-    }
+template <class T> bool
+data_reader<T>::split_line (const size_t start)
+{
+    char* const line = _buffer + start;
+    const char* const end = _buffer + _end_pos;
+    const char* pos = scanner::find_either (line, end, '\t', '\n');
+
+    if (!pos) return false;
 
-    set_key (_buffer);
+    const size_t keylen = pos - line;
 
-    for (i = 0; i < _end_pos; i++)
+    if (*pos == '\t')
     {
-	if (_keylen < 0 && _buffer[i] == '\t')
-	{
-	    _keylen = i;
-	    _buffer[i] = '\0';
-	}
-	else if (_buffer[i] == '\n')
-	{
-	    _buffer[i] = '\0';
-	    _totallen = i;
-	    if (_keylen < 0) _keylen = _totallen;
-	    return;
-	}
+	pos = scanner::find (pos + 1, end, '\n');
+	if (!pos) return false;
+	_value = line + keylen + 1;
     }
+    else _value = line + keylen;
+
+    _keylen = keylen;
+    _record_size = pos - line + 1;
+    line[keylen] = '\0';
+    line[_record_size - 1] = '\0';
+    set_key (line);
+
+    return true;
+}
+
+template <class T> bool
+data_reader<T>::split_record (const size_t start)
+{
+    char* const record = _buffer + start;
+    const char* const end = _buffer + _end_pos;
+    uint64_t keysize;
+    uint64_t valuesize;
+    const size_t header = run_format::header (record, end, keysize,
+					      valuesize);
+
+    if (!header) return false;
 
-    if (i == _end_pos)
+    const uint64_t keybytes = keysize + _key_terminator;
+
+    if (keybytes + valuesize + 1 > uint64_t(end - record) - header)
     {
-	throw std::runtime_error
-	    ("Temporary file does not contain trailing newline");
+	return false;
     }
+    set_record_key (record + header, keysize);
+    _value = record + header + keybytes;
+    _record_size = header + keybytes + valuesize + 1;
+
+    return true;
 }
 
 template <class T> char*
 data_reader<T>::get_next_value()
 {
-    if (_keylen <= 0)
+    if (_state != READY)
     {
-	throw std::runtime_error ("Programming error, keylen is zero in "
+	throw std::runtime_error ("Programming error, no key read before "
 				  + std::string(__FUNCTION__) + "()");
     }
 
-    char *value = _buffer + _start_pos + _keylen;
+    char *value = _value;
 
-    if (_keylen == _totallen) _start_pos += _keylen + 1;
-    else
-    {
-	value++;
-	_start_pos += _totallen + 1;
-    }
-    _keylen = 0;
+    _start_pos += _record_size;
+    _state = EMPTY;
 
     return value;
 }
 
 template <class T> const char*
-data_reader<T>::get_next_line (size_t& length)
+data_reader<T>::get_next_record (size_t& length)
 {
-    if (_keylen <= 0)
+    if (_state != READY)
     {
-	throw std::runtime_error ("Programming error, keylen is zero in "
+	throw std::runtime_error ("Programming error, no key read before "
 				  + std::string(__FUNCTION__) + "()");
     }
 
-    char* line = _buffer + _start_pos;
+    char* record = _buffer + _start_pos;
 
-    line[_keylen] = '\t';
-    line[_totallen] = '\n';
-    length = ++_totallen;
-    _start_pos += _totallen;
-    _keylen = 0;
+    if (_lines)
+    {
+	record[_keylen] = '\t';
+	record[_record_size - 1] = '\n';
+    }
+    length = _record_size;
+    _start_pos += _record_size;
+    _state = EMPTY;
 
-    return line;
+    return record;
 }
 
 #endif
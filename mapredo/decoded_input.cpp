@@ -0,0 +1,818 @@
+/*
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <algorithm>
+#include <vector>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include <snappy-c.h>
+
+#include "decoded_input.h"
+
+/** Largest zstd frame to decompress by one consumer, in chunk sizes */
+static const size_t max_frame_chunks = 16;
+
+/** Decompression state, for sequential data or for one consumer */
+struct decoded_input::codec
+{
+    codec (const format fmt);
+    ~codec();
+
+    format fmt;
+    bool active = false; // in the middle of a gzip member or zstd frame
+#ifdef HAVE_ZLIB
+    z_stream zs;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_DCtx* zctx = nullptr;
+#endif
+};
+
+struct decoded_input::worker
+{
+    struct part
+    {
+	size_t packed_size;
+	size_t content_size;
+    };
+
+    worker() : output (0), stitched (0) {}
+
+    size_t seq = 0;
+    bool decoded = false;      // output holds data decoded while claiming
+    std::vector<char> packed;  // compressed parts claimed
+    std::vector<part> parts;
+    input_buffer output;       // decompressed data
+    input_buffer stitched;     // lines pieced together from several blocks
+    bool stitched_given = false;
+    std::unique_ptr<codec> state;
+};
+
+static void
+throw_error (const std::string& what)
+{
+    char err[80];
+
+    throw std::runtime_error
+	(what + ": " + strerror_r(errno, err, sizeof(err)));
+}
+
+static uint32_t
+little_endian (const unsigned char* data, const size_t bytes)
+{
+    uint32_t value = 0;
+
+    for (size_t i = bytes; i > 0; i--) value = value << 8 | data[i-1];
+    return value;
+}
+
+static uint32_t
+crc32c (const unsigned char* data, size_t bytes)
+{
+    struct table
+    {
+	table() {
+	    for (uint32_t i = 0; i < 256; i++)
+	    {
+		uint32_t crc = i;
+		for (int j = 0; j < 8; j++)
+		{
+		    crc = (crc >> 1) ^ (crc & 1 ? 0x82f63b78 : 0);
+		}
+		values[i] = crc;
+	    }
+	}
+	uint32_t values[256];
+    };
+    static const table crcs;
+    uint32_t crc = 0xffffffff;
+
+    while (bytes--) crc = crcs.values[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+decoded_input::codec::codec (const format fmt) :
+    fmt (fmt)
+{
+    switch (fmt)
+    {
+    case GZIP:
+#ifdef HAVE_ZLIB
+	memset (&zs, 0, sizeof(zs));
+	if (inflateInit2(&zs, 15 + 16) != Z_OK)
+	{
+	    throw std::runtime_error ("Can not initialize gzip decompression");
+	}
+	break;
+#else
+	throw std::runtime_error
+	    ("gzip compressed input is not supported by this build");
+#endif
+    case ZSTD:
+#ifdef HAVE_ZSTD
+	zctx = ZSTD_createDCtx();
+	if (!zctx || ZSTD_isError(ZSTD_initDStream(zctx)))
+	{
+	    throw std::runtime_error ("Can not initialize zstd decompression");
+	}
+	break;
+#else
+	throw std::runtime_error
+	    ("zstd compressed input is not supported by this build");
+#endif
+    default:
+	break;
+    }
+}
+
+decoded_input::codec::~codec()
+{
+#ifdef HAVE_ZLIB
+    if (fmt == GZIP) inflateEnd (&zs);
+#endif
+#ifdef HAVE_ZSTD
+    if (zctx) ZSTD_freeDCtx (zctx);
+#endif
+}
+
+decoded_input::format
+decoded_input::detect (const char* data, const size_t bytes)
+{
+    const unsigned char* magic = reinterpret_cast<const unsigned char*>(data);
+
+    if (bytes >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) return GZIP;
+    if (bytes < 4) return PLAIN;
+
+    const uint32_t value = little_endian (magic, 4);
+
+    if (value == 0xfd2fb528 || (value & 0xfffffff0) == 0x184d2a50)
+    {
+	return ZSTD;
+    }
+    if (value == 0x000006ff) return SNAPPY;
+
+    return PLAIN;
+}
+
+decoded_input::format
+decoded_input::detect (const std::string& filename)
+{
+    int fd = open (filename.c_str(), O_RDONLY);
+
+    if (fd < 0) throw_error ("Can not open input file " + filename);
+
+    char magic[magic_size];
+    ssize_t bytes = pread (fd, magic, magic_size, 0);
+    close (fd);
+
+    return detect (magic, bytes > 0 ? bytes : 0);
+}
+
+static int
+open_input (const std::string& filename)
+{
+    int fd = open (filename.c_str(), O_RDONLY);
+
+    if (fd < 0) throw_error ("Can not open input file " + filename);
+    return fd;
+}
+
+decoded_input::decoded_input (const std::string& filename,
+			      const size_t chunk_size,
+			      const size_t num_consumers) :
+    decoded_input (open_input(filename), std::string(), chunk_size,
+		   num_consumers, filename, true)
+{}
+
+decoded_input::decoded_input (const int fd,
+			      const std::string& head,
+			      const size_t chunk_size,
+			      const size_t num_consumers) :
+    decoded_input (fd, head, chunk_size, num_consumers, "input", false)
+{}
+
+decoded_input::decoded_input (const int fd,
+			      const std::string& head,
+			      const size_t chunk_size,
+			      const size_t num_consumers,
+			      const std::string& name,
+			      const bool own_fd) :
+    _fd (fd),
+    _own_fd (own_fd),
+    _name (name),
+    _chunk_size (chunk_size),
+    _in (new char[std::max(chunk_size, head.size())]),
+    _in_capacity (std::max(chunk_size, head.size())),
+    _workers (new worker[num_consumers])
+{
+    memcpy (_in.get(), head.data(), head.size());
+    _in_end = _in_total = head.size();
+
+    try
+    {
+	fill (magic_size);
+	_format = detect (_in.get(), available());
+	if (_format == PLAIN)
+	{
+	    throw std::runtime_error ("Unknown compression format in " + _name);
+	}
+	_stream.reset (new codec(_format));
+    }
+    catch (...)
+    {
+	if (_own_fd) close (_fd);
+	throw;
+    }
+}
+
+decoded_input::~decoded_input()
+{
+    if (_own_fd) close (_fd);
+}
+
+input_buffer*
+decoded_input::consumer_get (const size_t id)
+{
+    return next_lines (id);
+}
+
+input_buffer*
+decoded_input::consumer_swap (input_buffer* buffer, const size_t id)
+{
+    return next_lines (id);
+}
+
+void
+decoded_input::consumer_fail (const size_t id)
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    _stopped = true;
+}
+
+input_buffer*
+decoded_input::next_lines (const size_t id)
+{
+    worker& wrk (_workers[id]);
+
+    if (wrk.stitched_given)
+    {
+	wrk.stitched.start() = wrk.stitched.end() = 0;
+	wrk.stitched_given = false;
+    }
+    else if (wrk.stitched.end() > 0)
+    {
+	// Lines pieced together while claiming the previous block
+	wrk.stitched_given = true;
+	return &wrk.stitched;
+    }
+
+    for (;;)
+    {
+	bool claimed;
+	size_t total;
+
+	{
+	    std::lock_guard<std::mutex> lock (_mutex);
+
+	    if (_stopped) return nullptr;
+	    claimed = claim (wrk);
+	    total = _next_seq;
+	}
+
+	if (!claimed)
+	{
+	    {
+		std::lock_guard<std::mutex> lock (_stitch_mutex);
+		_at_end = true;
+		_total_seq = total;
+		finish_lines (wrk);
+	    }
+	    if (wrk.stitched.end() == 0) return nullptr;
+	    wrk.stitched_given = true;
+	    return &wrk.stitched;
+	}
+
+	if (!wrk.decoded) decode_parts (wrk);
+
+	input_buffer& out (wrk.output);
+	char* const buf = out.get();
+	fragments frags;
+
+	// Skip any Windows style UTF-8 header
+	const unsigned char u8header[] = {0xef, 0xbb, 0xbf};
+	if (wrk.seq == 0 && out.end() >= 3 && memcmp(buf, u8header, 3) == 0)
+	{
+	    out.start() = 3;
+	}
+
+	const char* first = static_cast<const char*>
+	    (memchr(buf + out.start(), '\n', out.end() - out.start()));
+
+	if (first)
+	{
+	    const char* last = static_cast<const char*>
+		(memrchr(first, '\n', buf + out.end() - first));
+
+	    frags.head.assign (buf + out.start(), first + 1 - buf - out.start());
+	    frags.tail.assign (last + 1, buf + out.end() - last - 1);
+	    frags.newline = true;
+	    out.start() = first + 1 - buf;
+	    out.end() = last + 1 - buf;
+	}
+	else
+	{
+	    frags.head.assign (buf + out.start(), out.end() - out.start());
+	    frags.newline = false;
+	    out.start() = out.end();
+	}
+	stitch (wrk, std::move(frags));
+
+	if (out.start() < out.end()) return &out;
+	if (wrk.stitched.end() > 0)
+	{
+	    wrk.stitched_given = true;
+	    return &wrk.stitched;
+	}
+    }
+}
+
+bool
+decoded_input::claim (worker& wrk)
+{
+    wrk.packed.clear();
+    wrk.parts.clear();
+    wrk.output.start() = wrk.output.end() = 0;
+    wrk.decoded = false;
+
+    if (!_stream->active)
+    {
+	size_t content_size = 0;
+	part_result result = PART;
+
+	// Several small blocks are given out together
+	while (content_size < _chunk_size)
+	{
+	    switch (_format)
+	    {
+	    case GZIP: result = next_gzip (wrk); break;
+	    case ZSTD: result = next_zstd (wrk); break;
+	    default: result = next_snappy (wrk); break;
+	    }
+	    if (result != PART) break;
+	    content_size += wrk.parts.back().content_size;
+	}
+	if (wrk.parts.empty() && result == END) return false;
+    }
+
+    if (wrk.parts.empty())
+    {
+	decode_piece (wrk);
+	wrk.decoded = true;
+    }
+    wrk.seq = _next_seq++;
+
+    return true;
+}
+
+void
+decoded_input::add_part (worker& wrk, const size_t packed_size,
+			 const size_t content_size)
+{
+    const char* data = reinterpret_cast<const char*>(peek());
+
+    wrk.packed.insert (wrk.packed.end(), data, data + packed_size);
+    wrk.parts.push_back (worker::part{packed_size, content_size});
+    consume (packed_size);
+}
+
+decoded_input::part_result
+decoded_input::next_gzip (worker& wrk)
+{
+    if (!fill(1)) return END;
+    if (!fill(18)) throw std::runtime_error ("Truncated gzip " + _name);
+
+    const unsigned char* p = peek();
+
+    if (p[0] != 0x1f || p[1] != 0x8b || p[2] != 8)
+    {
+	throw std::runtime_error ("Invalid gzip member in " + _name);
+    }
+
+    // A BGZF block has its size in an extra field
+    if (p[3] & 4)
+    {
+	const size_t xlen = little_endian (p + 10, 2);
+
+	if (!fill(12 + xlen)) throw std::runtime_error ("Truncated gzip " + _name);
+	p = peek();
+
+	for (size_t pos = 12; pos + 4 <= 12 + xlen;
+	     pos += 4 + little_endian(p + pos + 2, 2))
+	{
+	    if (p[pos] == 'B' && p[pos+1] == 'C'
+		&& little_endian(p + pos + 2, 2) == 2 && pos + 6 <= 12 + xlen)
+	    {
+		const size_t block_size = little_endian (p + pos + 4, 2) + 1;
+
+		if (block_size < 12 + xlen + 8 || !fill(block_size))
+		{
+		    throw std::runtime_error ("Truncated gzip " + _name);
+		}
+		p = peek();
+		add_part (wrk, block_size, little_endian(p + block_size - 4, 4));
+		return PART;
+	    }
+	}
+    }
+
+    // An ordinary member can only be decompressed from start to end
+    _stream->active = true;
+    return SEQUENTIAL;
+}
+
+decoded_input::part_result
+decoded_input::next_zstd (worker& wrk)
+{
+    for (;;)
+    {
+	if (!fill(1)) return END;
+	if (!fill(5)) throw std::runtime_error ("Truncated zstd " + _name);
+
+	const unsigned char* p = peek();
+	const uint32_t magic = little_endian (p, 4);
+
+	if ((magic & 0xfffffff0) == 0x184d2a50)
+	{
+	    const size_t frame_size = 8 + little_endian (p + 4, 4);
+	    if (!fill(frame_size))
+	    {
+		throw std::runtime_error ("Truncated zstd " + _name);
+	    }
+	    consume (frame_size);
+	    continue;
+	}
+	if (magic != 0xfd2fb528)
+	{
+	    throw std::runtime_error ("Invalid zstd frame in " + _name);
+	}
+
+	const unsigned fhd = p[4];
+	const bool single_segment = fhd & 0x20;
+	const size_t did_sizes[] = {0, 1, 2, 4};
+	const size_t fcs_sizes[] = {single_segment ? 1u : 0u, 2, 4, 8};
+	const size_t did_size = did_sizes[fhd & 3];
+	const size_t fcs_size = fcs_sizes[fhd >> 6];
+	size_t pos = 5 + (single_segment ? 0 : 1) + did_size + fcs_size;
+
+	if (!fill(pos)) throw std::runtime_error ("Truncated zstd " + _name);
+	p = peek();
+
+	// Only frames of known and moderate size are given out whole
+	const size_t max_size = max_frame_chunks * _chunk_size;
+	uint64_t content_size = 0;
+
+	if (fcs_size == 0) content_size = max_size + 1;
+	else
+	{
+	    for (size_t i = pos; i > pos - fcs_size; i--)
+	    {
+		content_size = content_size << 8 | p[i-1];
+	    }
+	    if (fcs_size == 2) content_size += 256;
+	}
+
+	for (bool last = false; !last && content_size <= max_size; )
+	{
+	    if (!fill(pos + 3))
+	    {
+		throw std::runtime_error ("Truncated zstd " + _name);
+	    }
+	    p = peek();
+
+	    const uint32_t header = little_endian (p + pos, 3);
+	    const unsigned type = (header >> 1) & 3;
+
+	    if (type == 3)
+	    {
+		throw std::runtime_error ("Invalid zstd block in " + _name);
+	    }
+	    last = header & 1;
+	    pos += 3 + (type == 1 ? 1 : header >> 3);
+	    if (pos > 2 * max_size) content_size = max_size + 1;
+	}
+
+	if (content_size > max_size)
+	{
+	    _stream->active = true;
+	    return SEQUENTIAL;
+	}
+	if (fhd & 4) pos += 4; // checksum
+	if (!fill(pos)) throw std::runtime_error ("Truncated zstd " + _name);
+	add_part (wrk, pos, content_size);
+
+	return PART;
+    }
+}
+
+decoded_input::part_result
+decoded_input::next_snappy (worker& wrk)
+{
+    for (;;)
+    {
+	if (!fill(1)) return END;
+	if (!fill(4)) throw std::runtime_error ("Truncated snappy " + _name);
+
+	const size_t length = little_endian (peek() + 1, 3);
+	if (!fill(4 + length))
+	{
+	    throw std::runtime_error ("Truncated snappy " + _name);
+	}
+
+	const unsigned char* p = peek();
+	const unsigned type = p[0];
+
+	if (type == 0xff)
+	{
+	    if (length != 6 || memcmp(p + 4, "sNaPpY", 6) != 0)
+	    {
+		throw std::runtime_error ("Invalid snappy stream identifier in "
+					  + _name);
+	    }
+	}
+	else if (type <= 1)
+	{
+	    size_t content_size = length - 4;
+
+	    if (length < 4
+		|| (type == 0
+		    && snappy_uncompressed_length
+		    (reinterpret_cast<const char*>(p + 8), length - 4,
+		     &content_size) != SNAPPY_OK))
+	    {
+		throw std::runtime_error ("Corrupt snappy chunk in " + _name);
+	    }
+	    add_part (wrk, 4 + length, content_size);
+	    return PART;
+	}
+	else if (type < 0x80)
+	{
+	    throw std::runtime_error ("Unsupported snappy chunk type in "
+				      + _name);
+	}
+	consume (4 + length); // padding or skippable chunk
+    }
+}
+
+void
+decoded_input::decode_piece (worker& wrk)
+{
+    // Decompress the next part of a gzip member or zstd frame while
+    // holding the lock, as this depends on the data before it.
+    input_buffer& out (wrk.output);
+    codec& stream (*_stream);
+
+    out.increase_capacity (_chunk_size);
+
+    while (stream.active && out.end() < out.capacity())
+    {
+	if (!available() && !fill(1))
+	{
+	    throw std::runtime_error ("Truncated compressed " + _name);
+	}
+
+	const size_t in_size = available();
+
+	if (_format == GZIP)
+	{
+#ifdef HAVE_ZLIB
+	    z_stream& zs (stream.zs);
+
+	    zs.next_in = const_cast<Bytef*>(peek());
+	    zs.avail_in = in_size;
+	    zs.next_out = reinterpret_cast<Bytef*>(out.get() + out.end());
+	    zs.avail_out = out.capacity() - out.end();
+
+	    const int ret = inflate (&zs, Z_NO_FLUSH);
+
+	    consume (in_size - zs.avail_in);
+	    out.end() = out.capacity() - zs.avail_out;
+	    if (ret == Z_STREAM_END)
+	    {
+		inflateReset (&zs);
+		stream.active = false;
+	    }
+	    else if (ret != Z_OK)
+	    {
+		throw std::runtime_error ("Corrupt gzip " + _name + ": "
+					  + (zs.msg ? zs.msg : "error"));
+	    }
+#endif
+	}
+	else
+	{
+#ifdef HAVE_ZSTD
+	    ZSTD_inBuffer in = {peek(), in_size, 0};
+	    ZSTD_outBuffer output = {out.get(), out.capacity(), out.end()};
+
+	    const size_t ret = ZSTD_decompressStream (stream.zctx, &output, &in);
+
+	    consume (in.pos);
+	    out.end() = output.pos;
+	    if (ZSTD_isError(ret))
+	    {
+		throw std::runtime_error ("Corrupt zstd " + _name + ": "
+					  + ZSTD_getErrorName(ret));
+	    }
+	    if (ret == 0)
+	    {
+		ZSTD_initDStream (stream.zctx);
+		stream.active = false;
+	    }
+#endif
+	}
+    }
+}
+
+void
+decoded_input::decode_parts (worker& wrk)
+{
+    input_buffer& out (wrk.output);
+    size_t total = 0;
+
+    for (auto& part: wrk.parts) total += part.content_size;
+    out.increase_capacity (total);
+    if (!wrk.state) wrk.state.reset (new codec(_format));
+
+    const char* in = wrk.packed.data();
+    char* const buf = out.get();
+
+    for (auto& part: wrk.parts)
+    {
+	char* const to = buf + out.end();
+
+	if (_format == GZIP)
+	{
+#ifdef HAVE_ZLIB
+	    z_stream& zs (wrk.state->zs);
+
+	    inflateReset (&zs);
+	    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in));
+	    zs.avail_in = part.packed_size;
+	    zs.next_out = reinterpret_cast<Bytef*>(to);
+	    zs.avail_out = part.content_size;
+	    if (inflate(&zs, Z_FINISH) != Z_STREAM_END || zs.avail_out)
+	    {
+		throw std::runtime_error ("Corrupt gzip block in " + _name);
+	    }
+#endif
+	}
+	else if (_format == ZSTD)
+	{
+#ifdef HAVE_ZSTD
+	    const size_t ret = ZSTD_decompressDCtx
+		(wrk.state->zctx, to, part.content_size, in, part.packed_size);
+
+	    if (ret != part.content_size)
+	    {
+		throw std::runtime_error
+		    ("Corrupt zstd frame in " + _name + ": "
+		     + (ZSTD_isError(ret) ? ZSTD_getErrorName(ret)
+			: "unexpected size"));
+	    }
+#endif
+	}
+	else
+	{
+	    const unsigned char* chunk
+		= reinterpret_cast<const unsigned char*>(in);
+	    size_t size = part.content_size;
+
+	    if (chunk[0] == 0)
+	    {
+		if (snappy_uncompress (in + 8, part.packed_size - 8, to, &size)
+		    != SNAPPY_OK || size != part.content_size)
+		{
+		    throw std::runtime_error ("Corrupt snappy chunk in " + _name);
+		}
+	    }
+	    else memcpy (to, in + 8, size);
+
+	    const uint32_t crc = crc32c
+		(reinterpret_cast<const unsigned char*>(to), size);
+	    if (((crc >> 15 | crc << 17) + 0xa282ead8)
+		!= little_endian(chunk + 4, 4))
+	    {
+		throw std::runtime_error ("Snappy checksum mismatch in " + _name);
+	    }
+	}
+	in += part.packed_size;
+	out.end() += part.content_size;
+    }
+}
+
+void
+decoded_input::stitch (worker& wrk, fragments&& frags)
+{
+    std::lock_guard<std::mutex> lock (_stitch_mutex);
+
+    _pending.emplace (wrk.seq, std::move(frags));
+
+    // Complete the lines crossing blocks for as long as blocks are
+    // decoded in order
+    for (auto iter = _pending.begin();
+	 iter != _pending.end() && iter->first == _stitch_seq;
+	 iter = _pending.erase(iter), _stitch_seq++)
+    {
+	fragments& next (iter->second);
+
+	_carry += next.head;
+	if (next.newline)
+	{
+	    input_buffer& out (wrk.stitched);
+
+	    out.increase_capacity (out.end() + _carry.size());
+	    memcpy (out.get() + out.end(), _carry.data(), _carry.size());
+	    out.end() += _carry.size();
+	    _carry.swap (next.tail);
+	}
+    }
+    finish_lines (wrk);
+}
+
+void
+decoded_input::finish_lines (worker& wrk)
+{
+    // Give out a last line not ending with a newline
+    if (_at_end && _stitch_seq == _total_seq && !_carry.empty())
+    {
+	input_buffer& out (wrk.stitched);
+
+	_carry += '\n';
+	out.increase_capacity (out.end() + _carry.size());
+	memcpy (out.get() + out.end(), _carry.data(), _carry.size());
+	out.end() += _carry.size();
+	_carry.clear();
+    }
+}
+
+bool
+decoded_input::fill (const size_t bytes)
+{
+    while (available() < bytes)
+    {
+	if (_in_eof) return false;
+
+	if (_in_capacity - _in_start < std::max(bytes, _chunk_size / 2))
+	{
+	    // Move unused data to the start, and make room for more
+	    memmove (_in.get(), _in.get() + _in_start, available());
+	    _in_end -= _in_start;
+	    _in_start = 0;
+
+	    if (_in_capacity < bytes)
+	    {
+		const size_t capacity = std::max (bytes, _in_capacity * 2);
+		std::unique_ptr<char[]> in (new char[capacity]);
+
+		memcpy (in.get(), _in.get(), _in_end);
+		_in = std::move (in);
+		_in_capacity = capacity;
+	    }
+	}
+
+	ssize_t got = read (_fd, _in.get() + _in_end, _in_capacity - _in_end);
+
+	if (got < 0)
+	{
+	    if (errno == EINTR) continue;
+	    throw_error ("Can not read " + _name);
+	}
+	if (got == 0) _in_eof = true;
+	_in_end += got;
+	_in_total += got;
+    }
+
+    return true;
+}
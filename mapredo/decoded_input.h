@@ -0,0 +1,161 @@
+/* -*- C++ -*-
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef _HEXTREME_MAPREDO_DECODED_INPUT_H
+#define _HEXTREME_MAPREDO_DECODED_INPUT_H
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <memory>
+
+#include "input_source.h"
+
+/**
+ * Provides compressed input to consumer threads.  The stream is cut
+ * into independently compressed blocks, such as BGZF blocks, zstd
+ * frames or framed snappy chunks, which consumers claim in turn and
+ * decompress in parallel.  Formats without such blocks, like ordinary
+ * gzip, are decompressed in pieces by whichever consumer claims them.
+ * Lines crossing block boundaries are pieced together in order.
+ */
+class decoded_input : public input_source
+{
+public:
+    enum format
+    {
+	PLAIN,  // not compressed, or in an unknown format
+	GZIP,   // gzip, including multi-member gzip and BGZF
+	ZSTD,   // zstd frames
+	SNAPPY  // snappy framing format
+    };
+
+    /** Number of bytes needed to detect the format */
+    static const size_t magic_size = 4;
+
+    /**
+     * Detect compression format.
+     * @param data the first bytes of the input
+     * @param bytes number of bytes in data, at most magic_size are used
+     */
+    static format detect (const char* data, const size_t bytes);
+
+    /**
+     * Detect compression format of a file.
+     * @param filename path of file to check
+     */
+    static format detect (const std::string& filename);
+
+    /**
+     * @param filename path of compressed file to read
+     * @param chunk_size approximate number of uncompressed bytes given
+     *                   to a consumer at a time
+     * @param num_consumers number of consumer threads
+     */
+    decoded_input (const std::string& filename,
+		   const size_t chunk_size,
+		   const size_t num_consumers);
+
+    /**
+     * @param fd file descriptor to read compressed data from
+     * @param head bytes already read from the file descriptor
+     * @param chunk_size approximate number of uncompressed bytes given
+     *                   to a consumer at a time
+     * @param num_consumers number of consumer threads
+     */
+    decoded_input (const int fd,
+		   const std::string& head,
+		   const size_t chunk_size,
+		   const size_t num_consumers);
+    ~decoded_input();
+
+    /** @returns the number of compressed bytes read so far */
+    size_t bytes_read() const {return _in_total;}
+
+    virtual input_buffer* consumer_get (const size_t id) final;
+    virtual input_buffer* consumer_swap (input_buffer* buffer,
+					 const size_t id) final;
+    virtual void consumer_fail (const size_t id) final;
+
+    decoded_input (const decoded_input&) = delete;
+    decoded_input& operator=(const decoded_input&) = delete;
+
+private:
+    decoded_input (const int fd,
+		   const std::string& head,
+		   const size_t chunk_size,
+		   const size_t num_consumers,
+		   const std::string& name,
+		   const bool own_fd);
+
+    struct codec;
+    struct worker;
+    enum part_result {PART, SEQUENTIAL, END};
+    struct fragments
+    {
+	std::string head; // up to and including the first newline
+	std::string tail; // after the last newline
+	bool newline;     // false if the block has no newline at all
+    };
+
+    input_buffer* next_lines (const size_t id);
+    bool claim (worker& wrk);
+    part_result next_gzip (worker& wrk);
+    part_result next_zstd (worker& wrk);
+    part_result next_snappy (worker& wrk);
+    void add_part (worker& wrk, const size_t packed_size,
+		   const size_t content_size);
+    void decode_piece (worker& wrk);
+    void decode_parts (worker& wrk);
+    void stitch (worker& wrk, fragments&& frags);
+    void finish_lines (worker& wrk);
+    bool fill (const size_t bytes);
+    void consume (const size_t bytes) {_in_start += bytes;}
+    size_t available() const {return _in_end - _in_start;}
+    const unsigned char* peek() const {
+	return reinterpret_cast<const unsigned char*>(_in.get() + _in_start);
+    }
+
+    int _fd;
+    const bool _own_fd;
+    const std::string _name;
+    format _format;
+    const size_t _chunk_size;
+
+    // Compressed input, guarded by _mutex
+    std::mutex _mutex;
+    std::unique_ptr<char[]> _in;
+    size_t _in_capacity = 0;
+    size_t _in_start = 0;
+    size_t _in_end = 0;
+    size_t _in_total = 0;
+    bool _in_eof = false;
+    std::unique_ptr<codec> _stream; // state of sequentially decoded data
+    size_t _next_seq = 0;
+    bool _stopped = false;
+
+    // Lines crossing blocks, guarded by _stitch_mutex
+    std::mutex _stitch_mutex;
+    std::map<size_t, fragments> _pending;
+    size_t _stitch_seq = 0;
+    size_t _total_seq = 0; // number of blocks, known at end of input
+    bool _at_end = false;
+    std::string _carry; // start of a line continuing in the next block
+
+    std::unique_ptr<worker[]> _workers;
+};
+
+#endif
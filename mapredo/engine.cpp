@@ -16,6 +16,8 @@
 
 #ifndef _WIN32
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #else
 #include <io.h>
 #endif
@@ -36,20 +38,34 @@
 #include "settings.h"
 #include "compression.h"
 #include "prefered_stdout_output.h"
+#include "scanner.h"
+#include "range_partitioner.h"
+#ifndef _WIN32
+#include "multi_input.h"
+#include "ring_input.h"
+#include "decoded_input.h"
+#endif
+
+#ifndef _WIN32
+static const size_t sample_size = 0x100000;
+static const size_t sample_window_size = 0x4000;
+#endif
 
 engine::engine (const std::string& plugin,
 		const std::string& tmpdir,
 		const std::string& subdir,
 		const uint16_t parallel,
 		const size_t bytes_buffer,
-		const int max_open_files) :
+		const int max_open_files,
+		const size_t memory) :
     _plugin_loader (plugin),
     _tmpdir (subdir.empty() ? tmpdir : (tmpdir + "/" + subdir)),
     _is_subdir (subdir.size()),
-    _parallel (parallel),
-    _bytes_buffer (bytes_buffer),
+    _parallel (settings::instance().input_sorted() ? 1 : parallel),
     _max_files (max_open_files),
-    _buffer_trader (0x100000, parallel)
+    _budget (memory, _parallel, bytes_buffer, max_open_files),
+    _buffer_trader (_budget.input_chunk(), _parallel,
+		    settings::instance().lock_free_handoff())
 {
 #ifndef _WIN32
     if (access(tmpdir.c_str(), R_OK|W_OK|X_OK) != 0)
@@ -83,14 +99,7 @@ engine::prepare_input()
 				      + " shall only be called once");
 	}
 	_next_buffer = _buffer_trader.producer_get();
-
-	for (uint16_t i = 0; i < _parallel; i++)
-	{
-	    _consumers.emplace_back (_plugin_loader.get(), _tmpdir, _is_subdir,
-				     _parallel, i, _bytes_buffer,
-				     settings::instance().reverse_sort());
-	    _consumers.back().start_thread (_buffer_trader);
-	}
+	start_consumers (_buffer_trader);
 
 	return _buffer_trader.producer_get();
     }
@@ -101,36 +110,87 @@ engine::prepare_input()
     }
 }
 
-static void
-transfer_end (input_buffer* current, input_buffer* next)
+void
+engine::start_consumers (input_source& input)
 {
-    const size_t start (current->start());
-    char* buf (current->get());
+    if (!_consumers.empty())
+    {
+	throw std::runtime_error ("engine input shall only be given once");
+    }
+
+    std::function<mapredo::base&()> new_combiner;
+    mapredo::base* sorted = nullptr;
+
+    // Sorted input is mapped and reduced by a single consumer, to
+    // keep the order
+    if (settings::instance().input_sorted()) sorted = &_plugin_loader.get();
+    else if (!_spill_pool) _spill_pool.reset (new thread_pool (_parallel));
 
-    for (size_t i = current->end(); i > start; i--)
+    for (uint16_t i = 0; i < _parallel; i++)
     {
-	if (buf[i-1] == '\n')
+	auto& mapreducer (_plugin_loader.get());
+
+	if (mapreducer.reducer_can_combine() && !sorted)
 	{
-	    next->end() = current->end() - i;
-	    if (next->end() > 0)
-	    {
-		memcpy (next->get(), buf + i, next->end());
-		current->end() = i;
-	    }
-	    return;
+	    new_combiner = [this]() -> mapredo::base& {
+		return _plugin_loader.get();
+	    };
 	}
+	_consumers.emplace_back (mapreducer, _tmpdir, _is_subdir,
+				 _parallel, i,
+				 _budget.sort_buffer
+				 (mapreducer.reducer_can_combine()),
+				 settings::instance().reverse_sort(),
+				 _ranges.get(), new_combiner,
+				 _spill_pool.get(), sorted);
+	_consumers.back().start_thread (input);
     }
+}
 
-    throw std::runtime_error ("No newlines found in input buffer: \""
-			      + std::string(buf, current->end() - start)
-			      + "\"");
+/**
+ * Move any unfinished line or record at the end of one buffer to the
+ * next.
+ * @returns false if the buffer holds no whole line or record at all
+ */
+static bool
+transfer_end (input_buffer* current, input_buffer* next)
+{
+    const record_format::type format (settings::instance().input_format());
+    char* buf (current->get());
+    const char* const start = buf + current->start();
+    const char* const end = buf + current->end();
+    const char* last;
+
+    if (format == record_format::LINES)
+    {
+	last = scanner::rfind (start, end, '\n');
+	if (!last) return false;
+	last++;
+    }
+    else
+    {
+	last = record_format::records_end (format, start, end, end - start);
+	if (last == start) return false;
+    }
+
+    const size_t i = last - buf;
+
+    next->end() = current->end() - i;
+    if (next->end() > 0)
+    {
+	next->increase_capacity (next->end());
+	memcpy (next->get(), buf + i, next->end());
+	current->end() = i;
+    }
+
+    return true;
 }
 
 static void wait_consumers (std::list<consumer>& consumers)
 {
+    for (auto& consumer: consumers) consumer.join_thread();
     for (auto& consumer: consumers)
     {
-	consumer.join_thread();
 	if (consumer.exception_ptr())
 	{
 	    std::rethrow_exception (consumer.exception_ptr());
@@ -150,7 +210,13 @@ engine::provide_input_data (input_buffer* data)
 		 " engine::provide_input_data()");
 	}
 
-	transfer_end (data, _next_buffer);
+	if (!transfer_end (data, _next_buffer))
+	{
+	    // Slow path for a line longer than the buffer: let the
+	    // producer keep filling the same buffer after growing it.
+	    data->increase_capacity (data->capacity() * 2);
+	    return data;
+	}
 	auto* current = _next_buffer;
 	_next_buffer = _buffer_trader.producer_swap (data);
 	if (!_next_buffer) wait_consumers (_consumers);
@@ -179,18 +245,335 @@ engine::complete_input (input_buffer* data)
     wait_consumers (_consumers);
 }
 
+#ifndef _WIN32
+static chunk_sizer
+adaptive_chunk_size (const memory_budget& budget)
+{
+    return chunk_sizer (budget.input_chunk(), memory_budget::min_input_chunk,
+			budget.max_input_chunk());
+}
+
+/**
+ * Read from a file descriptor until some data holds a given number of
+ * bytes.
+ * @returns false if the end of the input was reached first
+ */
+static bool
+read_head (const int fd, std::string& data, const size_t size)
+{
+    size_t data_size = data.size();
+
+    data.resize (size);
+    while (data_size < size)
+    {
+	const ssize_t got = read (fd, &data[data_size], size - data_size);
+
+	if (got < 0)
+	{
+	    if (errno == EINTR) continue;
+	    char err[80];
+	    throw std::runtime_error
+		(std::string("Error reading input: ")
+		 + strerror_r (errno, err, sizeof(err)));
+	}
+	if (got == 0) break;
+	data_size += got;
+    }
+    data.resize (data_size);
+
+    return data_size == size;
+}
+
+/**
+ * Sample the keys of the whole lines or records in part of a file.
+ * @param offset where to start, which unless 0 is inside some line
+ */
+static void
+sample_part (range_partitioner& ranges, mapredo::base& mapreducer,
+	     const int fd, const std::string& filename, const off_t file_size,
+	     const off_t offset, const size_t size)
+{
+    const record_format::type format (settings::instance().input_format());
+    std::string buffer (size, '\0');
+    size_t bytes = 0;
+
+    while (bytes < size)
+    {
+	const ssize_t got = pread (fd, &buffer[bytes], size - bytes,
+				   offset + bytes);
+	if (got < 0)
+	{
+	    if (errno == EINTR) continue;
+	    char err[80];
+	    throw std::runtime_error
+		("Error reading " + filename + ": "
+		 + strerror_r (errno, err, sizeof(err)));
+	}
+	if (got == 0) break;
+	bytes += got;
+    }
+    buffer.resize (bytes);
+
+    // The last line of a file may have no newline
+    if (format == record_format::LINES && offset + off_t(bytes) == file_size
+	&& bytes && buffer.back() != '\n')
+    {
+	buffer += '\n';
+    }
+
+    const char* start = buffer.data();
+    const char* const end = start + buffer.size();
+
+    if (format == record_format::LINES)
+    {
+	if (offset > 0)
+	{
+	    start = scanner::find (start, end, '\n');
+	    if (!start) return;
+	    start++;
+	}
+	else if (bytes >= 3 && memcmp(start, "\xef\xbb\xbf", 3) == 0)
+	{
+	    start += 3; // skip Windows style UTF-8 header
+	}
+    }
+    ranges.sample (mapreducer, start, end - start, format);
+}
+
+void
+engine::sample_files (const std::vector<std::string>& filenames)
+{
+    const record_format::type format (settings::instance().input_format());
+    std::vector<std::pair<std::string, off_t>> files;
+    off_t total = 0;
+
+    // Compressed files can not be sampled from the middle, and are
+    // left out of the sample
+    for (auto& filename: filenames)
+    {
+	struct stat st;
+
+	if (stat(filename.c_str(), &st) != 0 || st.st_size == 0) continue;
+	if (format == record_format::LINES
+	    && decoded_input::detect(filename) != decoded_input::PLAIN)
+	{
+	    continue;
+	}
+	files.emplace_back (filename, st.st_size);
+	total += st.st_size;
+    }
+    if (files.empty()) return;
+
+    auto& mapreducer (_plugin_loader.get());
+    const off_t windows = sample_size / sample_window_size;
+    off_t window = 0;
+    off_t file_start = 0;
+
+    _ranges.reset (new range_partitioner (mapreducer.type(), _parallel,
+					  settings::instance().reverse_sort()));
+
+    for (auto& file: files)
+    {
+	const int fd = open (file.first.c_str(), O_RDONLY);
+
+	if (fd < 0)
+	{
+	    char err[80];
+	    throw std::runtime_error
+		("Can not open " + file.first + ": "
+		 + strerror_r (errno, err, sizeof(err)));
+	}
+
+	try
+	{
+	    if (total <= off_t(sample_size))
+	    {
+		sample_part (*_ranges, mapreducer, fd, file.first,
+			     file.second, 0, file.second);
+	    }
+	    else if (format != record_format::LINES)
+	    {
+		// Records can only be found by stepping from the start
+		// of a file, so only the start of each file is sampled
+		sample_part (*_ranges, mapreducer, fd, file.first,
+			     file.second, 0,
+			     std::max(sample_size / files.size(),
+				      sample_window_size));
+	    }
+	    else
+	    {
+		// Windows evenly spread over all the files
+		for (; window < windows
+			 && window * total / windows < file_start + file.second;
+		     window++)
+		{
+		    sample_part (*_ranges, mapreducer, fd, file.first,
+				 file.second,
+				 window * total / windows - file_start,
+				 sample_window_size);
+		}
+	    }
+	}
+	catch (...)
+	{
+	    close (fd);
+	    throw;
+	}
+	close (fd);
+	file_start += file.second;
+    }
+
+    if (!_ranges->finish()) _ranges.reset();
+}
+
+void
+engine::sample_data (const std::string& data, const bool at_end)
+{
+    const record_format::type format (settings::instance().input_format());
+    auto& mapreducer (_plugin_loader.get());
+    std::string lines;
+    size_t start = 0;
+
+    _ranges.reset (new range_partitioner (mapreducer.type(), _parallel,
+					  settings::instance().reverse_sort()));
+    if (format == record_format::LINES)
+    {
+	if (data.compare(0, 3, "\xef\xbb\xbf") == 0)
+	{
+	    start = 3; // skip Windows style UTF-8 header
+	}
+	if (at_end && data.size() > start && data.back() != '\n')
+	{
+	    // The last line may have no newline
+	    lines = data.substr(start) + '\n';
+	    _ranges->sample (mapreducer, lines.data(), lines.size(), format);
+	}
+    }
+    if (lines.empty())
+    {
+	_ranges->sample (mapreducer, data.data() + start, data.size() - start,
+			 format);
+    }
+
+    // Only the start of a longer stream is sampled.  If its keys do
+    // not predict the rest, as with input sorted on key, ranges would
+    // put most keys in one partition, so keys are hashed instead and
+    // the reduced partitions merged.
+    if ((!at_end && !_ranges->balanced()) || !_ranges->finish())
+    {
+	_ranges.reset();
+    }
+}
+
+void
+engine::process_files (const std::vector<std::string>& filenames,
+		       const bool use_mmap)
+{
+    if (_next_buffer)
+    {
+	throw std::runtime_error (std::string("engine::") + __FUNCTION__
+				  + " can not be used with prepare_input()");
+    }
+
+    if (settings::instance().sort_output()
+	&& !settings::instance().input_sorted())
+    {
+	sample_files (filenames);
+    }
+
+    multi_input input (filenames, adaptive_chunk_size(_budget),
+		       _parallel, use_mmap);
+
+    try
+    {
+	start_consumers (input);
+    }
+    catch (...)
+    {
+	input.consumer_fail (0);
+	for (auto& consumer: _consumers) consumer.join_thread();
+	throw;
+    }
+    wait_consumers (_consumers);
+}
+
+size_t
+engine::process_stream (const int fd)
+{
+    if (_next_buffer)
+    {
+	throw std::runtime_error (std::string("engine::") + __FUNCTION__
+				  + " can not be used with prepare_input()");
+    }
+
+    // Peek at the start of the stream to tell compressed input apart
+    std::string head;
+    bool at_end = !read_head (fd, head, decoded_input::magic_size);
+
+    if (settings::instance().input_format() == record_format::LINES
+	&& decoded_input::detect(head.data(), head.size())
+	!= decoded_input::PLAIN)
+    {
+	decoded_input input (fd, head, _budget.input_chunk(), _parallel);
+
+	try
+	{
+	    start_consumers (input);
+	}
+	catch (...)
+	{
+	    input.consumer_fail (0);
+	    for (auto& consumer: _consumers) consumer.join_thread();
+	    throw;
+	}
+	wait_consumers (_consumers);
+
+	return input.bytes_read();
+    }
+
+    if (settings::instance().sort_output()
+	&& !settings::instance().input_sorted())
+    {
+	if (!at_end) at_end = !read_head (fd, head, _budget.input_chunk());
+	sample_data (head, at_end);
+    }
+
+    ring_input input (fd, adaptive_chunk_size(_budget),
+		      _parallel, head);
+    size_t bytes;
+
+    try
+    {
+	start_consumers (input);
+	bytes = input.read_input();
+    }
+    catch (...)
+    {
+	input.consumer_fail (0);
+	for (auto& consumer: _consumers) consumer.join_thread();
+	throw;
+    }
+    wait_consumers (_consumers);
+
+    return bytes;
+}
+#endif
+
 void
 engine::reduce()
 {
     for (size_t i = 0; i < _parallel; i++)
     {
-	std::list<std::string> tmpfiles;
+	std::list<tmpfile_section> tmpfiles;
 
 	for (auto& consumer: _consumers)
 	{
 	    consumer.append_tmpfiles (i, tmpfiles);
 	}
-	if (tmpfiles.size() == 1 && settings::instance().sort_output())
+	// With hash partitioning, the sorted buckets are reduced in a
+	// final merge.  Ranges are reduced separately, in order.
+	if (tmpfiles.size() == 1 && settings::instance().sort_output()
+	    && !_ranges)
 	{
 	    _files_final_merge.push_back (tmpfiles.front());
 	}
@@ -200,14 +583,19 @@ engine::reduce()
 		(file_merger(_plugin_loader.get(),
 			     std::move(tmpfiles),
 			     _tmpdir, _unique_id++,
-			     _max_files/_parallel));
+			     _max_files/_parallel,
+			     _budget.reader_buffer()));
 	}
     }
     _consumers.clear();
+    _buffer_trader.release_buffers();
 
-    auto& mapreducer (_plugin_loader.get());
-    if (settings::instance().sort_output()) merge_sorted (mapreducer);
-    else merge_grouped (mapreducer);
+    if (_ranges) merge_grouped (true);
+    else if (settings::instance().sort_output())
+    {
+	merge_sorted (_plugin_loader.get());
+    }
+    else merge_grouped();
 }
 
 void
@@ -221,7 +609,7 @@ engine::reduce_existing_files()
 
     try
     {
-	std::vector<std::list<std::string>> lists;
+	std::vector<std::list<tmpfile_section>> lists;
 	directory dir (_tmpdir);
 
 	lists.resize (_parallel);
@@ -229,13 +617,30 @@ engine::reduce_existing_files()
 	for (const auto& file: dir)
 	{
 	    const char *period = strchr (file, '.');
+	    const std::string path (_tmpdir + "/" + file);
 
-	    if (!period || period[1] != 'h' || !isdigit(period[2]))
+	    if (!period || (period[1] != 'h' && period[1] != 'p')
+		|| !isdigit(period[2]))
 	    {
 		throw std::runtime_error (std::string("Invalid tmpfile name ")
 					  + file);
 	    }
-	    lists[atoi(period+2)%_parallel].push_back (_tmpdir + "/" + file);
+	    if (period[1] == 'h')
+	    {
+		lists[atoi(period+2)%_parallel].push_back (path);
+		continue;
+	    }
+
+	    // A run file with the sections of several partitions
+	    auto sections (tmpfile_section::read_sections (path));
+
+	    for (size_t i = 0; i < sections.size(); i++)
+	    {
+		if (sections[i].size())
+		{
+		    lists[i%_parallel].push_back (sections[i]);
+		}
+	    }
 	}
 
 	for (auto& tmpfiles: lists)
@@ -249,15 +654,17 @@ engine::reduce_existing_files()
 		_mergers.push_back
 		    (file_merger
 		     (_plugin_loader.get(),
-		      static_cast<std::list<std::string>&&>(tmpfiles),
-		      _tmpdir, _unique_id++, _max_files/_parallel));
+		      static_cast<std::list<tmpfile_section>&&>(tmpfiles),
+		      _tmpdir, _unique_id++, _max_files/_parallel,
+		      _budget.reader_buffer()));
 	    }
 	}
 
-	auto& mapreducer (_plugin_loader.get());
-
-	if (settings::instance().sort_output()) merge_sorted (mapreducer);
-	else merge_grouped (mapreducer);
+	if (settings::instance().sort_output())
+	{
+	    merge_sorted (_plugin_loader.get());
+	}
+	else merge_grouped();
     }
     catch (...)
     {
@@ -274,8 +681,14 @@ engine::reduce_existing_files()
     }
 }
 
+/**
+ * Reduce each bucket in parallel, and output the results one after
+ * the other.
+ * @param in_order output in the order of the buckets, otherwise the
+ *                 first bucket done may be written directly.
+ */
 void
-engine::merge_grouped (mapredo::base& mapreducer)
+engine::merge_grouped (const bool in_order)
 {
     auto iter = _mergers.begin();
 
@@ -296,9 +709,13 @@ engine::merge_grouped (mapredo::base& mapreducer)
 
     for (auto& merger: _mergers)
     {
+	// Only the first in order may be written before the others
+	prefered_output* sink (!in_order || riter == results.begin()
+			       ? &prefered_sink : nullptr);
+
 	*riter++ = std::async (std::launch::async,
 			       &file_merger::merge_to_file,
-			       &merger, &prefered_sink);
+			       &merger, sink);
     }
 
     for (iter = _mergers.begin(), riter = results.begin();
@@ -320,7 +737,7 @@ engine::merge_grouped (mapredo::base& mapreducer)
 void
 engine::merge_sorted (mapredo::base& mapreducer)
 {
-    std::vector<std::future<std::list<std::string>>> results;
+    std::vector<std::future<std::list<tmpfile_section>>> results;
     results.resize (_mergers.size());
     auto iter = _mergers.begin();
     auto riter = results.begin();
@@ -360,8 +777,8 @@ engine::merge_sorted (mapredo::base& mapreducer)
 
     file_merger merger
 	(mapreducer,
-	 static_cast<std::list<std::string>&&>(_files_final_merge),
-	 _tmpdir, _unique_id, _max_files);
+	 static_cast<std::list<tmpfile_section>&&>(_files_final_merge),
+	 _tmpdir, _unique_id, _max_files, _budget.reader_buffer());
     merger.merge();
 
     _files_final_merge.clear();
@@ -381,8 +798,9 @@ engine::output_final_files()
 	compressor.reset (new compression());
     }
 
-    for (auto& file: _files_final_merge)
+    for (auto& section: _files_final_merge)
     {
+	const std::string& file (section.filename());
 	size_t bytes;
 	FILE *fp = fopen (file.c_str(), "rb");
 
@@ -20,6 +20,7 @@
 #include <memory>
 #include <deque>
 #include <list>
+#include <vector>
 
 #include "collector.h"
 #include "file_merger.h"
@@ -31,8 +32,11 @@
 #endif
 #include "buffer_trader.h"
 #include "consumer.h"
+#include "thread_pool.h"
+#include "memory_budget.h"
 
 class buffer_trader;
+class range_partitioner;
 
 /**
  * Runs overall map-reduce algorithm
@@ -44,17 +48,22 @@ public:
      * @param loader plugin loader factory for creation of extra mapreducers
      * @param tmpdir temporary directory
      * @param subdirectory under temporary directory, may be empty
-     * @param parallel the number of worker threads
+     * @param parallel the number of worker threads.  Input already in
+     *        key order, see settings::input_sorted(), is processed by
+     *        a single thread.
      * @param bytes_buffer number of bytes in each sort buffer, must be at
      *        least as high as parallel.
      * @param max_open_files the maximum number of files open while merging
+     * @param memory if not 0, the number of bytes to divide between all
+     *        buffers, see memory_budget.  bytes_buffer is then ignored.
      */
     engine (const std::string& plugin,
 	    const std::string& tmpdir,
 	    const std::string& subdir,
 	    const uint16_t parallel,
 	    const size_t bytes_buffer,
-	    const int max_open_files);
+	    const int max_open_files,
+	    const size_t memory = 0);
     virtual ~engine();
 
     /**
@@ -67,7 +76,9 @@ public:
     /**
      * Provide data to sorters.
      * @param data input data to be provided.
-     * @returns buffer with room for more data.
+     * @returns buffer with room for more data.  If the data held no
+     *          complete line, this is the same buffer with its capacity
+     *          increased, to be filled further.
      */
     input_buffer* provide_input_data (input_buffer* data);
 
@@ -79,6 +90,42 @@ public:
      */
     void complete_input (input_buffer* data);
 
+#ifndef _WIN32
+    /**
+     * Map and sort the contents of regular files.  The consumer
+     * threads process newline aligned parts of the files directly,
+     * either from memory mappings of them or by reading separate
+     * ranges of them.  Small files are read whole by one consumer,
+     * while big ones are shared.  Compressed files are decoded by the
+     * consumers, see decoded_input.  This is used instead of
+     * prepare_input(), provide_input_data() and complete_input().
+     * If the output is to be sorted, keys are partitioned by ranges
+     * chosen from samples spread over the uncompressed files.
+     * @param filenames paths of the files to read input from.
+     * @param use_mmap memory map the files if true, otherwise let
+     *                 each consumer read its own parts of the files.
+     */
+    void process_files (const std::vector<std::string>& filenames,
+			const bool use_mmap = true);
+
+    /**
+     * Map and sort data from a stream such as a pipe.  The calling
+     * thread reads ahead into a ring buffer, while the consumer threads
+     * process newline aligned segments of the ring directly.  Streams
+     * compressed with gzip, zstd or framed snappy are recognized and
+     * decoded by the consumers instead.  This is used instead of
+     * prepare_input(), provide_input_data() and complete_input().
+     * If the output is to be sorted, keys in uncompressed streams are
+     * partitioned by ranges chosen from a sample of the first input
+     * chunk.  If the sample does not predict the rest of the stream,
+     * see range_partitioner::balanced(), keys are partitioned by hash
+     * and merged after reducing instead.
+     * @param fd file descriptor to read input from.
+     * @returns the number of bytes read.
+     */
+    size_t process_stream (const int fd);
+#endif
+
     /**
      * Go through all sorted temporary files and generate a reduced file.
      */
@@ -92,7 +139,12 @@ public:
     void reduce_existing_files();
 
 private:
-    void merge_grouped (mapredo::base& mapreducer);
+    void start_consumers (input_source& input);
+#ifndef _WIN32
+    void sample_files (const std::vector<std::string>& filenames);
+    void sample_data (const std::string& data, const bool at_end);
+#endif
+    void merge_grouped (const bool in_order = false);
     void merge_sorted (mapredo::base& mapreducer);
     void output_final_files();
 
@@ -101,15 +153,17 @@ private:
     const std::string _tmpdir;
     bool _is_subdir = false;
     size_t _parallel;
-    size_t _bytes_buffer;
     int _max_files;
+    const memory_budget _budget;
     size_t _unique_id = 0;
 
+    std::unique_ptr<thread_pool> _spill_pool; // must outlive the consumers
     std::list<consumer> _consumers;
+    std::unique_ptr<range_partitioner> _ranges;
     buffer_trader _buffer_trader;
 
     std::deque<file_merger> _mergers;
-    std::list<std::string> _files_final_merge;
+    std::list<tmpfile_section> _files_final_merge;
 };
 
 #endif
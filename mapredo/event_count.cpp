@@ -0,0 +1,68 @@
+/*
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+#include <thread>
+
+#include "event_count.h"
+
+// Spinning only pays off if the thread to wait for can run meanwhile
+const int event_count::_spin_count
+= std::thread::hardware_concurrency() > 1 ? 200 : 0;
+
+void
+event_count::wait (const uint32_t key)
+{
+#ifdef __linux__
+    // The kernel only sleeps if the epoch still equals the key
+    while (_epoch.load() == key)
+    {
+	syscall (SYS_futex, reinterpret_cast<uint32_t*>(&_epoch),
+		 FUTEX_WAIT_PRIVATE, key, nullptr, nullptr, 0);
+    }
+#else
+    std::unique_lock<std::mutex> lock (_mutex);
+    while (_epoch.load() == key) _cv.wait (lock);
+#endif
+    _waiters.fetch_sub (1);
+}
+
+void
+event_count::wake (const int32_t threads)
+{
+#ifdef __linux__
+    syscall (SYS_futex, reinterpret_cast<uint32_t*>(&_epoch),
+	     FUTEX_WAKE_PRIVATE, threads, nullptr, nullptr, 0);
+#else
+    std::lock_guard<std::mutex> lock (_mutex);
+    if (threads == 1) _cv.notify_one();
+    else _cv.notify_all();
+#endif
+}
+
+void
+event_count::pause()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_ia32_pause();
+#else
+    std::this_thread::yield();
+#endif
+}
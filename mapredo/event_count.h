@@ -0,0 +1,103 @@
+/* -*- C++ -*-
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef _HEXTREME_MAPREDO_EVENT_COUNT_H
+#define _HEXTREME_MAPREDO_EVENT_COUNT_H
+
+#include <atomic>
+#include <cstdint>
+#ifndef __linux__
+#include <mutex>
+#include <condition_variable>
+#endif
+
+/**
+ * Lets threads sleep until a condition checked without locks, such as
+ * a lock-free queue being non-empty, may have changed.  A waiter
+ * spins briefly, then calls prepare_wait(), checks the condition again
+ * and calls wait() with the key if it still does not hold.  Notifiers
+ * change the condition first and then call notify_all(), which is
+ * cheap when nobody sleeps.  On Linux the threads sleep on a futex.
+ */
+class event_count
+{
+public:
+    /**
+     * Announce that the calling thread is about to sleep.
+     * @returns key to pass to wait() or cancel_wait()
+     */
+    uint32_t prepare_wait() {
+	_waiters.fetch_add (1);
+	return _epoch.load();
+    }
+
+    /** Do not sleep after all, the condition held when checked again */
+    void cancel_wait() {
+	_waiters.fetch_sub (1);
+    }
+
+    /**
+     * Sleep until notify_all() is called, unless it has been called
+     * since prepare_wait().
+     * @param key value returned by prepare_wait()
+     */
+    void wait (const uint32_t key);
+
+    /**
+     * Wake one thread sleeping in wait(), for instance when one item
+     * has been added to a queue.
+     */
+    void notify_one() {
+	_epoch.fetch_add (1);
+	if (_waiters.load() > 0) wake (1);
+    }
+
+    /** Wake all threads sleeping in wait() */
+    void notify_all() {
+	_epoch.fetch_add (1);
+	if (_waiters.load() > 0) wake (INT32_MAX);
+    }
+
+    /**
+     * Spin a while, which is useful before sleeping when the
+     * condition is likely to change soon.
+     * @param condition returns true when the wait is over
+     * @returns true if the condition holds
+     */
+    template <class F> static bool spin (F condition) {
+	for (int i = 0; i < _spin_count; i++)
+	{
+	    if (condition()) return true;
+	    pause();
+	}
+	return false;
+    }
+
+private:
+    void wake (const int32_t threads);
+    static void pause();
+
+    static const int _spin_count;
+    std::atomic<uint32_t> _epoch {0};
+    std::atomic<int> _waiters {0};
+#ifndef __linux__
+    std::mutex _mutex;
+    std::condition_variable _cv;
+#endif
+};
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <algorithm>
+#include <cstdio>
+
+#include "field.h"
+
+#define P07 10000000LLU
+#define P08 100000000LLU
+#define P09 1000000000LLU
+#define P10 10000000000LLU
+#define P11 100000000000LLU
+#define P12 1000000000000LLU
+
+static inline size_t digits10 (uint64_t v)
+{
+    if (v < 10) return 1;
+    if (v < 100) return 2;
+    if (v < 1000) return 3;
+    if (v < P12)
+    {
+	if (v < P08)
+	{
+	    if (v < 1000000)
+	    {
+		if (v < 10000) return 4;
+		return 5 + (v >= 100000);
+	    }
+	    return 7 + (v >= P07);
+	}
+
+	if (v < P10) return 9 + (v >= P09);
+	return 11 + (v >= P11);
+    }
+    return 12 + digits10 (v/P12);
+}
+
+size_t
+mapredo::field::uint_to_ascii (uint64_t value, char* dst)
+{
+    static const char digits[] = \
+	"0001020304050607080910111213141516171819"
+	"2021222324252627282930313233343536373839"
+	"4041424344454647484950515253545556575859"
+	"6061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+    size_t const length = digits10(value);
+    size_t next = length - 1;
+
+    while (value >= 100)
+    {
+	uint64_t const i = (value % 100) * 2;
+	value /= 100;
+	dst[next] = digits[i + 1];
+	dst[next - 1] = digits[i];
+
+	next -= 2;
+    }
+
+    // Handle last 1-2 digits
+    if (value < 10) dst[next] = '0' + uint32_t(value);
+    else
+    {
+	uint32_t i = uint32_t(value) * 2;
+	dst[next] = digits[i + 1];
+	dst[next - 1] = digits[i];
+    }
+
+    return length;
+}
+
+size_t
+mapredo::field::int_to_ascii (const int64_t value, char* dst)
+{
+    if (value >= 0) return uint_to_ascii (value, dst);
+
+    // Negate in unsigned arithmetic, which also works for INT64_MIN
+    *dst = '-';
+    return 1 + uint_to_ascii (-uint64_t(value), dst + 1);
+}
+
+size_t
+mapredo::field::double_to_ascii (const double value, char* dst)
+{
+    const int length = snprintf (dst, 32, "%g", value);
+
+    return length < 0 ? 0 : std::min (size_t(length), size_t(31));
+}
@@ -0,0 +1,122 @@
+/* -*- C++ -*-
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef _HEXTREME_MAPREDO_FIELD_H
+#define _HEXTREME_MAPREDO_FIELD_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <sstream>
+#include <type_traits>
+
+namespace mapredo
+{
+    /**
+     * Text form of a key or value passed to collect_keyval().
+     * Strings are referred to as they are, while numbers are
+     * formatted into a buffer inside the object, so that no memory is
+     * allocated for the common types.  Other types are formatted by
+     * their output stream operator.  The text is always
+     * nul-terminated.
+     */
+    class field
+    {
+    public:
+	/** Integer, formatted as by an output stream */
+	template<typename T, typename std::enable_if
+		 <std::is_integral<T>::value
+		  && !std::is_same<T,char>::value, int>::type = 0>
+	field (const T value) : _data (_buffer) {
+	    if (std::is_signed<T>::value) _size = int_to_ascii (value, _buffer);
+	    else _size = uint_to_ascii (value, _buffer);
+	    _buffer[_size] = '\0';
+	}
+
+	/** Floating point number, formatted as by an output stream */
+	template<typename T, typename std::enable_if
+		 <std::is_floating_point<T>::value, int>::type = 0>
+	field (const T value) : _data (_buffer),
+	    _size (double_to_ascii (value, _buffer)) {}
+
+	field (const char value) : _data (_buffer), _size (1) {
+	    _buffer[0] = value;
+	    _buffer[1] = '\0';
+	}
+
+	field (const char* const text) : _data (text), _size (strlen(text)) {}
+
+	field (const std::string& text) :
+	    _data (text.c_str()), _size (text.size()) {}
+
+	/** Any other type with an output stream operator */
+	template<typename T, typename std::enable_if
+		 <!std::is_arithmetic<T>::value
+		  && !std::is_convertible<T,const char*>::value
+		  && !std::is_convertible<T,std::string>::value,
+		  int>::type = 0>
+	field (const T& value) {
+	    std::ostringstream stream;
+	    stream << value;
+	    _text = stream.str();
+	    _data = _text.c_str();
+	    _size = _text.size();
+	}
+
+	field (const field&) = delete;
+	field& operator= (const field&) = delete;
+
+	/** @returns the nul-terminated text */
+	const char* data() const {return _data;}
+	/** @returns the length of the text */
+	size_t size() const {return _size;}
+
+	/**
+	 * Fast integer to ascii convertor from Andrei Alexandrescu.
+	 * @param value number to format
+	 * @param dst where to write the digits, at least 20 bytes
+	 * @returns number of digits written, there is no nul-termination
+	 */
+	static size_t uint_to_ascii (uint64_t value, char* dst);
+
+	/**
+	 * Signed version of uint_to_ascii().
+	 * @param value number to format
+	 * @param dst where to write the number, at least 20 bytes
+	 * @returns number of characters written
+	 */
+	static size_t int_to_ascii (const int64_t value, char* dst);
+
+	/**
+	 * Format a floating point number with six significant digits,
+	 * the way an output stream does by default.
+	 * @param value number to format
+	 * @param dst where to write the number, at least 32 bytes
+	 * @returns number of characters written, not counting the
+	 *          nul-termination
+	 */
+	static size_t double_to_ascii (const double value, char* dst);
+
+    private:
+	const char* _data;
+	size_t _size;
+	char _buffer[32];
+	std::string _text;
+    };
+}
+
+#endif
@@ -29,13 +29,16 @@
 #include "valuelist.h"
 
 file_merger::file_merger (mapredo::base& reducer,
-			  std::list<std::string>&& tmpfiles,
+			  std::list<tmpfile_section>&& tmpfiles,
 			  const std::string& tmpdir,
 			  const size_t index,
-			  const size_t max_open_files) :
+			  const size_t max_open_files,
+			  const size_t reader_buffer) :
     _reducer (reducer),
     _max_open_files (max_open_files),
-    _tmpfiles (tmpfiles)
+    _reader_buffer (reader_buffer),
+    _tmpfiles (tmpfiles),
+    _buffer (new char[_initial_buffer_size])
 {
     std::ostringstream filename;
 
@@ -58,8 +61,11 @@ file_merger::file_merger (mapredo::base& reducer,
 file_merger::file_merger (file_merger&& other) :
     _reducer (other._reducer),
     _max_open_files (other._max_open_files),
+    _reader_buffer (other._reader_buffer),
     _file_prefix (std::move(other._file_prefix)),
-    _tmpfiles (std::move(other._tmpfiles))
+    _tmpfiles (std::move(other._tmpfiles)),
+    _compressor (std::move(other._compressor)),
+    _buffer (new char[_initial_buffer_size])
 {}
 
 file_merger::~file_merger()
@@ -86,7 +92,7 @@ file_merger::merge_to_file (prefered_output* alt_output)
 	}
 	while (_tmpfiles.size() > 1);
 
-	return _tmpfiles.front();
+	return _tmpfiles.front().filename();
     }
     catch (...)
     {
@@ -95,7 +101,7 @@ file_merger::merge_to_file (prefered_output* alt_output)
     }
 }
 
-std::list<std::string>
+std::list<tmpfile_section>
 file_merger::merge_to_files()
 {
     try
@@ -116,7 +122,7 @@ file_merger::merge_to_files()
     catch (...)
     {
 	_texception = std::current_exception();
-	return (std::list<std::string>());
+	return (std::list<tmpfile_section>());
     }
 }
 
@@ -155,8 +161,8 @@ file_merger::merge_max_files (const file_merger::merge_mode mode,
 void
 file_merger::collect (const char* line, const size_t length)
 {
-    if (_buffer_pos + length >= _buffer_size) flush();
-    memcpy (_buffer + _buffer_pos, line, length);
+    if (_buffer_pos + length >= _buffer_size) make_room (length);
+    memcpy (_buffer.get() + _buffer_pos, line, length);
     _buffer_pos += length;
     _buffer[_buffer_pos++] = '\n';
 }
@@ -165,8 +171,8 @@ char*
 file_merger::reserve (const size_t bytes)
 {
     _reserved_bytes = bytes;
-    if (_buffer_pos + bytes >= _buffer_size) flush();
-    return (_buffer + _buffer_pos);
+    if (_buffer_pos + bytes >= _buffer_size) make_room (bytes);
+    return (_buffer.get() + _buffer_pos);
 }
 
 void
@@ -185,3 +191,14 @@ file_merger::collect_reserved (const size_t length)
 
     _reserved_bytes = 0;
 }
+
+void
+file_merger::make_room (const size_t bytes)
+{
+    flush();
+    if (bytes < _buffer_size) return;
+
+    // A line longer than the buffer is written in one piece all the same
+    _buffer_size = bytes + 1;
+    _buffer.reset (new char[_buffer_size]);
+}
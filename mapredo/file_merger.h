@@ -26,7 +26,8 @@
 #include "valuelist.h"
 #include "mapreducer.h"
 #include "tmpfile_collector.h"
-#include "data_reader_queue.h"
+#include "loser_tree.h"
+#include "run_writer.h"
 
 namespace mapredo
 {
@@ -39,11 +40,20 @@ namespace mapredo
 class file_merger : public mapredo::rcollector
 {
 public:
+    /**
+     * @param reducer mapreducer to reduce with
+     * @param tmpfiles sorted files or file sections to merge
+     * @param tmpdir where to write merged files
+     * @param index number used in filenames
+     * @param max_open_files the most files to merge at once
+     * @param reader_buffer size of the buffer of each file read
+     */
     file_merger (mapredo::base& reducer,
-		 std::list<std::string>&& tmpfiles,
+		 std::list<tmpfile_section>&& tmpfiles,
 		 const std::string& tmpdir,
 		 const size_t index,
-		 const size_t max_open_files);
+		 const size_t max_open_files,
+		 const size_t reader_buffer);
     virtual ~file_merger();
 
     /**
@@ -62,7 +72,7 @@ public:
     /**
      * Merge to at most max_open_files file and return the file names.
      */
-    std::list<std::string> merge_to_files();
+    std::list<tmpfile_section> merge_to_files();
 
     /** Function called by reducer to report output. */
     void collect (const char* line, const size_t length);
@@ -89,35 +99,6 @@ private:
 	TO_OUTPUT
     };
 
-    template <class T> class key_holder {
-    public:
-	template<class U = T,
-		 typename std::enable_if<std::is_fundamental<U>::value>
-                 ::type* = nullptr>
-	U get_key (data_reader<T>& reader) {
-	    auto key = reader.next_key();
-	    if (key) return *key;
-	    throw std::runtime_error
-		("Attempted to key_handler::get_key() on an empty file");
-	}
-
-	template<class U = T,
-                 typename std::enable_if<std::is_same<U,char*>::value,
-                                         bool>::type* = nullptr>
-	char* get_key (data_reader<T>& reader) {
-	    auto key = reader.next_key();
-	    if (key)
-	    {
-		_key_copy = *key;
-		return const_cast<char*>(_key_copy.c_str());
-	    }
-	    throw std::runtime_error
-		("Attempted to key_handler::get_key() on an empty file");
-	}
-    private:
-	std::string _key_copy;
-    };
-    
     void merge_max_files (const merge_mode mode,
 			  prefered_output* alt_output = nullptr);
     void compressed_sort();
@@ -125,26 +106,30 @@ private:
     void flush() {
 	if (_buffer_pos > 0)
 	{
-	    fwrite (_buffer, _buffer_pos, 1, stdout);
+	    fwrite (_buffer.get(), _buffer_pos, 1, stdout);
 	    _buffer_pos = 0;
 	}
     }
+
+    /** Flush the buffer, and grow it unless it has room for bytes */
+    void make_room (const size_t bytes);
+
     template<typename T> void do_merge (const merge_mode mode,
 					prefered_output* alt_output,
 					const bool reverse);
 
     mapredo::base& _reducer;
-    static const size_t _buffer_size = 0x10000;
+    static const size_t _initial_buffer_size = 0x10000;
     size_t _max_open_files;
+    size_t _reader_buffer;
     size_t _num_merged_files = 0;
     std::string _file_prefix;
     int _tmpfile_id = 0;
-    std::list<std::string> _tmpfiles;
+    std::list<tmpfile_section> _tmpfiles;
     std::unique_ptr<compression> _compressor;
-    char _buffer[_buffer_size];
-    std::unique_ptr<char[]> _coutbuffer;
+    std::unique_ptr<char[]> _buffer;
+    size_t _buffer_size = _initial_buffer_size;
     size_t _buffer_pos = 0;
-    size_t _coutbufpos;
     size_t _reserved_bytes = 0;
     std::exception_ptr _texception = nullptr;
 };
@@ -153,7 +138,7 @@ template <typename T> void
 file_merger::do_merge (const merge_mode mode, prefered_output* alt_output,
 		       const bool reverse)
 {
-    data_reader_queue<T> queue (reverse);
+    loser_tree<T> tree (reverse);
     size_t files;
 
     if (mode == TO_MAX_FILES)
@@ -165,39 +150,36 @@ file_merger::do_merge (const merge_mode mode, prefered_output* alt_output,
     
     for (size_t i = 0; i < files; i++)
     {
-	const std::string& filename = _tmpfiles.front();
 	auto* proc = new tmpfile_reader<T>
-	    (filename, 0x100000, !settings::instance().keep_tmpfiles());
+	    (_tmpfiles.front(), _reader_buffer,
+	     !settings::instance().keep_tmpfiles());
 	const T* key = proc->next_key();
 
-	if (key) queue.push(proc);
-	else if (!settings::instance().keep_tmpfiles())
-	{
-	    remove (filename.c_str());
-	}
+	if (key) tree.push(proc);
+	else delete proc;
 
 	_tmpfiles.pop_front();
     }
     if (settings::instance().verbose())
     {
 	std::ostringstream stream;
-	stream << "Processing " << queue.size() << " tmpfiles, "
+	stream << "Processing " << tree.size() << " tmpfiles, "
 	       << _tmpfiles.size() << " left\n";
 	std::cerr << stream.str();
     }
 
-    if (queue.empty())
+    if (tree.empty())
     {
-	throw std::runtime_error ("Queue should not be empty here");
+	throw std::runtime_error ("Merge tree should not be empty here");
     }
 
     _num_merged_files++;
 
     if (_tmpfiles.empty() && mode == TO_OUTPUT) // last_merge, run reducer
     {
-	mapredo::valuelist<T> list (queue);
+	mapredo::valuelist<T> list (tree);
 
-	while (!queue.empty())
+	while (!tree.empty())
 	{
 	    static_cast<mapredo::mapreducer<T>&>(_reducer).reduce
 		(list.get_key(), list, *this);
@@ -207,14 +189,13 @@ file_merger::do_merge (const merge_mode mode, prefered_output* alt_output,
     else if (_reducer.reducer_can_combine()
 	     || (_tmpfiles.empty() && mode == TO_SINGLE_FILE))
     {
+	const bool last_merge (_tmpfiles.empty() && mode == TO_SINGLE_FILE);
 	tmpfile_collector collector
-	    (_file_prefix, _tmpfile_id,
-	     (_tmpfiles.empty() && mode == TO_SINGLE_FILE)
-	     ? alt_output
-	     : nullptr);
-	mapredo::valuelist<T> list (queue);
+	    (_file_prefix, _tmpfile_id, last_merge ? alt_output : nullptr,
+	     last_merge ? mapredo::base::UNKNOWN : _reducer.type());
+	mapredo::valuelist<T> list (tree);
 
-	while (!queue.empty())
+	while (!tree.empty())
 	{
 	    static_cast<mapredo::mapreducer<T>&>(_reducer).reduce
 		(list.get_key(), list, collector);
@@ -224,108 +205,23 @@ file_merger::do_merge (const merge_mode mode, prefered_output* alt_output,
     }
     else // no reduction
     {
-	std::ofstream outfile;
 	std::ostringstream filename;
-	const bool compressed (settings::instance().compressed());
 
 	filename << _file_prefix << _tmpfile_id++;
-	if (compressed)
-	{
-	    filename << ".snappy";
-	    _coutbuffer.reset (new char[0x15000]);
-	    _buffer_pos = 0;
-	}
-	outfile.open (filename.str(), std::ofstream::binary);
-	if (!outfile)
-	{
-	    char err[80];
-#ifdef _WIN32
-	    strerror_s (err, sizeof(err), errno);
-#endif	
-	    throw std::invalid_argument
-		("Unable to open " + filename.str() + " for writing: "
-#ifndef _WIN32
-		 + strerror_r (errno, err, sizeof(err))
-#else
-		 + err
-#endif
-		);
-	}
-	_tmpfiles.push_back (filename.str());
+	if (_compressor) filename << ".snappy";
 
-	const T* next_key;
+	// Records longer than a compressed block are split between blocks
+	run_writer writer (filename.str(), 1, _compressor.get());
+	std::vector<std::list<tmpfile_section>> written (1);
 	size_t length;
-	key_holder<T> keyh;
-	auto* proc = queue.top();
-	T key (keyh.get_key(*proc));
-	queue.pop();
-
-	for(;;)
-	{
-	    while ((next_key = proc->next_key())
-		   && (*proc == key || queue.empty()))
-	    {
-		auto line = proc->get_next_line (length);
-		if (compressed)
-		{
-		    if (_buffer_pos + length > _buffer_size)
-		    {
-			_coutbufpos = 0x15000;
-			_compressor->compress (_buffer,
-					       _buffer_pos,
-					       _coutbuffer.get(),
-					       _coutbufpos);
-			outfile.write (_coutbuffer.get(), _coutbufpos);
-			_buffer_pos = 0;
-		    }
-		    memcpy (_buffer + _buffer_pos, line, length);
-		    _buffer_pos += length;
-		}
-		else outfile.write (line, length);
-	    }
-
-	    if (!next_key) // file emptied
-	    {
-		delete proc;
-		if (queue.empty()) break;
-		proc = queue.top();
-		key = keyh.get_key (*proc);
-		queue.pop();
-		continue;
-	    }
-
-	    auto* nproc = queue.top();
 
-	    if (*nproc == key)
-	    {
-		queue.pop();
-		queue.push (proc);
-		proc = nproc;
-	    }
-	    else
-	    {
-		int cmp = nproc->compare (*next_key);
-		if (cmp < 0)
-		{
-		    queue.pop();
-		    queue.push (proc);
-		    proc = nproc;
-		}
-		key = keyh.get_key (*proc);
-	    }
-	}
-
-	if (compressed && _buffer_pos > 0)
+	while (!tree.empty())
 	{
-	    _coutbufpos = 0x15000;
-	    _compressor->compress (_buffer,
-				   _buffer_pos,
-				   _coutbuffer.get(),
-				   _coutbufpos);
-	    outfile.write (_coutbuffer.get(), _coutbufpos);
+	    const char* record = tree.next_record (length);
+	    writer.write (record, length);
 	}
-
-	outfile.close();
+	writer.close (written);
+	_tmpfiles.splice (_tmpfiles.end(), written[0]);
     }
 }
 
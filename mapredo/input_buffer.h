@@ -18,28 +18,74 @@
 #define _HEXTREME_MAPREDO_INPUT_BUFFER_H
 
 #include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
 
+/**
+ * Buffer of input lines to be mapped.  The buffer either owns its
+ * memory, or it is a view of memory owned by someone else, such as a
+ * memory mapped input file.
+ */
 class input_buffer
 {
 public:
     input_buffer (const size_t bytes) :
-	_buf(new char[bytes+1]), _capacity (bytes) {}
+	_buf(new char[bytes+1]), _data (_buf.get()), _capacity (bytes) {}
+
+    /** Create a buffer without memory of its own, see set_view() */
+    input_buffer() {}
 
     /** Get pointer to correctly sized buffer */
-    char* get() {return _buf.get();}
+    char* get() {return _data;}
+    const char* get() const {return _data;}
 
     /** Get buffer capacity in bytes */
     size_t capacity() const {return _capacity;}
 
     /**
-     * Increase buffer capacity.  The actual capacity reserved may be
-     * bigger than the requested number of bytes.
+     * Increase buffer capacity, keeping the data up to end().  The
+     * actual capacity reserved may be bigger than the requested number
+     * of bytes.  This is only possible for buffers owning their memory.
      * @param bytes number of bytes to fit in buffer
      */
     void increase_capacity (size_t bytes) {
-	abort(); // not yet implemented
+	if (bytes <= _capacity) return;
+	if (_data != _buf.get())
+	{
+	    throw std::logic_error
+		("input_buffer::increase_capacity() called for a view");
+	}
+	bytes = std::max (bytes, _capacity * 2);
+
+	std::unique_ptr<char[]> buf (new char[bytes+1]);
+	memcpy (buf.get(), _data, _end);
+	_buf = std::move (buf);
+	_data = _buf.get();
+	_capacity = bytes;
+    }
+
+    /**
+     * Make the buffer refer to memory it does not own.  If writable,
+     * the byte following the viewed memory must be writable too, as
+     * the consumer may nul-terminate the last line there.  Lines in a
+     * read-only view are copied by the consumer before mapping.
+     * @param data start of memory to view
+     * @param bytes number of bytes to view
+     * @param writable true if the consumer may modify the memory
+     */
+    void set_view (char* data, const size_t bytes,
+		   const bool writable = true) {
+	_data = data;
+	_capacity = bytes;
+	_start = 0;
+	_end = bytes;
+	_writable = writable;
     }
 
+    /** @returns false if this is a read-only view */
+    bool writable() const {return _writable;}
+
     /** Start of buffer */
     size_t& start() {return _start;}
 
@@ -48,9 +94,11 @@ public:
 
 private:
     std::unique_ptr<char[]> _buf;
-    size_t _capacity;
+    char* _data = nullptr;
+    size_t _capacity = 0;
     size_t _start = 0;
     size_t _end = 0;
+    bool _writable = true;
 };
 
 #endif
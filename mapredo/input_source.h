@@ -0,0 +1,58 @@
+/* -*- C++ -*-
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef _HEXTREME_MAPREDO_INPUT_SOURCE_H
+#define _HEXTREME_MAPREDO_INPUT_SOURCE_H
+
+#include "input_buffer.h"
+
+/**
+ * Interface used by consumer threads to get input data to map.
+ * Implementations need to be thread safe.
+ */
+class input_source
+{
+public:
+    virtual ~input_source() {}
+
+    /**
+     * Get the first buffer ready to be mapped.  This function may
+     * hang until there is an available buffer.
+     * @param id consumer thread identifier
+     * @returns filled buffer or nullptr if there will be no more data
+     */
+    virtual input_buffer* consumer_get (const size_t id) = 0;
+
+    /**
+     * Swap a now processed buffer with the next buffer ready to be
+     * mapped.  This function may hang until there is an available
+     * buffer.
+     * @param buffer processed buffer
+     * @param id consumer thread identifier
+     * @returns filled buffer or nullptr if there will be no more data
+     */
+    virtual input_buffer* consumer_swap (input_buffer* buffer,
+					 const size_t id) = 0;
+
+    /**
+     * Called by consumer to indicate failure.  This will cause
+     * processing to stop.
+     * @param id consumer thread identifier
+     */
+    virtual void consumer_fail (const size_t id) = 0;
+};
+
+#endif
@@ -17,45 +17,116 @@
 #ifndef _HEXTREME_MAPREDO_LOOKUP_H
 #define _HEXTREME_MAPREDO_LOOKUP_H
 
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
 /**
- * Class used in an array to enable sorting of data.
+ * Class used in an array to enable sorting of data.  Each entry
+ * refers to a line in the sort buffer by its offset, and holds the
+ * first bytes of the key in a form where comparing the numbers gives
+ * the sort order.  Most comparisons are decided by this prefix alone,
+ * without reading the buffer.
  */
 struct lookup
 {
-    /** @return a pointer to the key and value of the entry */
-    const char* keyvalue() const {return _keyvalue;}
+    /** @return offset of the key and value of the entry in the buffer */
+    uint32_t offset() const {return _offset;}
     /** @return the length of the key */
-    uint16_t keylen() const {return _keylen;}
-    /** @return the length of the entire line */
-    uint32_t size() const {return _totallen;}
-
-    /** Set the key and value of the entry */
-    void set_ptr (const char* keyvalue,
-		  const uint16_t keylen,
-		  const uint16_t totallen) {
-	_keyvalue = keyvalue;
+    uint32_t keylen() const {return _keylen;}
+    /**
+     * @return the key prefix.  For numeric keys, this is the whole
+     *         key in a sortable form.
+     */
+    uint64_t prefix() const {return _prefix;}
+    /**
+     * Set the entry
+     * @param offset offset of the key and value in the buffer
+     * @param keylen length of the key
+     * @param prefix key prefix made by one of the *_prefix() functions
+     */
+    void set (const uint32_t offset, const uint32_t keylen,
+	      const uint64_t prefix) {
+	_offset = offset;
 	_keylen = keylen;
-	_totallen = totallen;
+	_prefix = prefix;
     }
+
     /**
-     * Operator used when sorting the array
-     * @param the array element to compare this with
+     * @returns the first 8 bytes of a string key as a big endian
+     *          number, padded with zeros
      */
-    bool operator< (const lookup& right) const {
-	register uint16_t len = std::min(_keylen, right._keylen);
-	register uint16_t i;
-	register const char* const rkeyvalue = right._keyvalue;
+    static uint64_t string_prefix (const char* const key,
+				   const size_t keylen) {
+	const unsigned char* const ukey
+	    = reinterpret_cast<const unsigned char*>(key);
+	const size_t length = std::min (keylen, size_t(8));
+	uint64_t prefix = 0;
 
-	for (i = 0; i < len && _keyvalue[i] == rkeyvalue[i]; i++) ;
+	for (size_t i = 0; i < length; i++)
+	{
+	    prefix |= uint64_t(ukey[i]) << (56 - 8 * i);
+	}
 
-	if (i < len) return _keyvalue[i] < rkeyvalue[i];
-	return _keylen < right._keylen;
+	return prefix;
     }
-    
+    /** @returns an integer key with the sign bit flipped */
+    static uint64_t integer_prefix (const int64_t key) {
+	return uint64_t(key) ^ _sign_bit;
+    }
+    /**
+     * @returns the bits of a floating point key, with the sign bit
+     *          flipped for positive numbers and all bits flipped for
+     *          negative ones
+     */
+    static uint64_t real_prefix (const double key) {
+	const double value = (key == 0 ? 0.0 : key); // no negative zero
+	uint64_t bits;
+
+	memcpy (&bits, &value, sizeof(bits));
+	return (bits & _sign_bit ? ~bits : bits ^ _sign_bit);
+    }
+
+    /** @returns the integer key of a prefix made by integer_prefix() */
+    static int64_t integer_key (const uint64_t prefix) {
+	return int64_t(prefix ^ _sign_bit);
+    }
+    /** @returns the floating point key of a prefix made by real_prefix() */
+    static double real_key (const uint64_t prefix) {
+	const uint64_t bits = (prefix & _sign_bit ? prefix ^ _sign_bit : ~prefix);
+	double key;
+
+	memcpy (&key, &bits, sizeof(key));
+	return key;
+    }
+
+    /**
+     * Compare the string keys of two entries, like memcmp() does.
+     * @param buffer the buffer the entries refer to
+     */
+    static int compare (const char* const buffer,
+			const lookup& left, const lookup& right) {
+	if (left._prefix != right._prefix)
+	{
+	    return left._prefix < right._prefix ? -1 : 1;
+	}
+
+	// Equal prefixes of long keys mean equal first 8 bytes
+	const uint32_t len = std::min (left._keylen, right._keylen);
+	const uint32_t skip = (len >= 8 ? 8 : 0);
+	const int cmp = memcmp (buffer + left._offset + skip,
+				buffer + right._offset + skip, len - skip);
+
+	if (cmp) return cmp;
+	return (left._keylen > right._keylen) - (left._keylen < right._keylen);
+    }
+
 private:
-    const char* _keyvalue;
-    uint16_t _keylen;
-    uint32_t _totallen;
+    static const uint64_t _sign_bit = 0x8000000000000000LLU;
+
+    uint64_t _prefix;
+    uint32_t _offset;
+    uint32_t _keylen;
 };
 
 #endif
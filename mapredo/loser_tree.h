@@ -0,0 +1,242 @@
+/* -*- C++ -*-
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef _HEXTREME_MAPREDO_LOSER_TREE_H
+#define _HEXTREME_MAPREDO_LOSER_TREE_H
+
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <cstring>
+
+#include "data_reader.h"
+#include "lookup.h"
+
+/**
+ * Merges the records of several sorted readers, used when traversing
+ * files during merge.  This is a tournament tree where each inner
+ * node holds the reader that lost the match played there, so only
+ * the matches on the path of the reader read from are replayed,
+ * taking log2 of the number of readers comparisons for each record.
+ * Each reader has its key prefix cached as in lookup, which decides
+ * most comparisons without reading the keys.  The comparisons are
+ * specialized for the sort direction at compile time.
+ */
+template <class T> class loser_tree
+{
+public:
+    /** @param reverse merge keys in descending order if true */
+    loser_tree (const bool reverse = false) :
+	_replay (reverse ? &loser_tree::replay<true>
+		 : &loser_tree::replay<false>),
+	_build (reverse ? &loser_tree::build<true>
+		: &loser_tree::build<false>) {}
+
+    /**
+     * Add a reader to merge from.  The tree takes ownership of it,
+     * and deletes it when it has no more records.
+     */
+    void push (data_reader<T>* const reader) {
+	push (*reader);
+	_leaves.back().owned.reset (reader);
+    }
+
+    /**
+     * Add a reader to merge from, which stays owned by the caller.
+     * It may be pushed again once it has no more records, after
+     * being refilled.
+     */
+    void push (data_reader<T>& reader) {
+	_leaves.emplace_back();
+	_leaves.back().reader = &reader;
+	_built = false;
+    }
+
+    /** @returns the number of readers with records left */
+    size_t size() {
+	size_t readers = 0;
+
+	top();
+	for (auto& leaf: _leaves) readers += bool(leaf.reader);
+	return readers;
+    }
+
+    /** @returns true if no reader has records left */
+    bool empty() {return !top();}
+
+    /**
+     * @returns the reader with the first key, or nullptr if no reader
+     *          has records left.  Read from it through next_value()
+     *          or next_record() only.
+     */
+    data_reader<T>* top() {
+	if (!_built) (this->*_build)();
+	else if (_read) (this->*_replay)();
+	return _leaves[_winner].reader;
+    }
+
+    /** @returns the next value of the reader returned by top() */
+    char* next_value() {
+	char* const value = top()->get_next_value();
+	_read = true;
+	return value;
+    }
+
+    /**
+     * @returns the next record of the reader returned by top()
+     * @param length set to the size of the record
+     */
+    const char* next_record (size_t& length) {
+	const char* const record = top()->get_next_record (length);
+	_read = true;
+	return record;
+    }
+
+    loser_tree (const loser_tree&) = delete;
+    loser_tree& operator=(const loser_tree&) = delete;
+
+private:
+    struct leaf
+    {
+	data_reader<T>* reader = nullptr; // nullptr when done
+	std::unique_ptr<data_reader<T>> owned;
+	uint64_t prefix = 0;
+	const char* key = nullptr; // only for string keys
+    };
+
+    static uint64_t prefix (const int64_t key) {
+	return lookup::integer_prefix (key);
+    }
+    static uint64_t prefix (const double key) {
+	return lookup::real_prefix (key);
+    }
+    static uint64_t prefix (const char* const key) {
+	return lookup::string_prefix (key, strnlen (key, 8));
+    }
+
+    template<class U = T,
+	     typename std::enable_if<std::is_fundamental<U>::value>::type*
+	     = nullptr>
+    static void set_key (leaf& entry, const U key) {}
+
+    template<class U = T,
+	     typename std::enable_if<std::is_same<U,char*>::value,
+				     bool>::type* = nullptr>
+    static void set_key (leaf& entry, const char* const key) {
+	entry.key = key;
+    }
+
+    /** Cache the next key of a reader, dropping it if it is done */
+    void refresh (leaf& entry) {
+	const T* const key = entry.reader->next_key();
+
+	if (!key)
+	{
+	    entry.reader = nullptr;
+	    entry.owned.reset();
+	    return;
+	}
+	entry.prefix = prefix (*key);
+	set_key (entry, *key);
+    }
+
+    /** @returns true if the key of one leaf sorts before another */
+    template <bool Reverse> bool before (const leaf& left,
+					 const leaf& right) const {
+	// Readers without records left sort last
+	if (!right.reader) return bool(left.reader);
+	if (!left.reader) return false;
+	if (left.prefix != right.prefix)
+	{
+	    return Reverse ? left.prefix > right.prefix
+		: left.prefix < right.prefix;
+	}
+
+	// Numeric keys are whole in the prefix, and string keys when
+	// shorter than it
+	if (!std::is_same<T,char*>::value || (left.prefix & 0xff) == 0)
+	{
+	    return false;
+	}
+
+	const int cmp = strcmp (left.key + 8, right.key + 8);
+
+	return Reverse ? cmp > 0 : cmp < 0;
+    }
+
+    /** Play all matches, with room for a power of two readers */
+    template <bool Reverse> void build() {
+	size_t size = 1;
+
+	for (auto& entry: _leaves)
+	{
+	    if (entry.reader) refresh (entry);
+	}
+	_leaves.erase (std::remove_if (_leaves.begin(), _leaves.end(),
+				       [](const leaf& entry) {
+					   return !entry.reader;
+				       }), _leaves.end());
+	while (size < _leaves.size()) size *= 2;
+	_leaves.resize (size);
+
+	_winners.resize (2 * size);
+	for (size_t i = 0; i < size; i++) _winners[size + i] = i;
+	_losers.resize (size);
+	for (size_t i = size - 1; i > 0; i--)
+	{
+	    size_t winner = _winners[2 * i];
+	    size_t loser = _winners[2 * i + 1];
+
+	    if (before<Reverse> (_leaves[loser], _leaves[winner]))
+	    {
+		std::swap (winner, loser);
+	    }
+	    _winners[i] = winner;
+	    _losers[i] = loser;
+	}
+	_winner = _winners[1];
+	_built = true;
+	_read = false;
+    }
+
+    /** Replay the matches of the winner after it has been read from */
+    template <bool Reverse> void replay() {
+	size_t winner = _winner;
+
+	refresh (_leaves[winner]);
+	for (size_t i = (winner + _leaves.size()) / 2; i > 0; i /= 2)
+	{
+	    if (before<Reverse> (_leaves[_losers[i]], _leaves[winner]))
+	    {
+		std::swap (winner, _losers[i]);
+	    }
+	}
+	_winner = winner;
+	_read = false;
+    }
+
+    void (loser_tree::*_replay)();
+    void (loser_tree::*_build)();
+    std::vector<leaf> _leaves;
+    std::vector<size_t> _losers; // from index 1
+    std::vector<size_t> _winners; // kept to avoid allocating in build()
+    size_t _winner = 0;
+    bool _built = false;
+    bool _read = false; // the winner has been read from
+};
+
+#endif
@@ -0,0 +1,172 @@
+/*
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <stdexcept>
+
+#include "mapped_input.h"
+#include "settings.h"
+
+mapped_input::mapped_input (const std::string& filename,
+			    const chunk_sizer& chunk_size,
+			    const size_t num_consumers) :
+    mapped_input (filename, std::make_shared<chunk_sizer>(chunk_size),
+		  num_consumers)
+{}
+
+mapped_input::mapped_input (const std::string& filename,
+			    const std::shared_ptr<chunk_sizer>& chunk_size,
+			    const size_t num_consumers) :
+    _chunk_size (chunk_size),
+    _format (settings::instance().input_format()),
+    _stopped (false),
+    _views (num_consumers),
+    _handed_out (num_consumers)
+{
+    int fd = open (filename.c_str(), O_RDONLY);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+	char err[80];
+
+	if (fd >= 0) close (fd);
+	throw std::runtime_error
+	    ("Can not open input file " + filename + ": "
+	     + strerror_r(errno, err, sizeof(err)));
+    }
+    _size = st.st_size;
+
+    if (_size == 0)
+    {
+	close (fd);
+	return;
+    }
+
+    void* area = mmap (nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+    if (area == MAP_FAILED)
+    {
+	char err[80];
+
+	close (fd);
+	throw std::runtime_error
+	    ("Can not map input file " + filename + ": "
+	     + strerror_r(errno, err, sizeof(err)));
+    }
+    close (fd);
+
+    _data = static_cast<char*>(area);
+    madvise (_data, _size, MADV_SEQUENTIAL);
+
+    // Skip any Windows style UTF-8 header
+    const unsigned char u8header[] = {0xef, 0xbb, 0xbf};
+    if (_format == record_format::LINES && _size >= 3
+	&& memcmp(_data, u8header, 3) == 0)
+    {
+	_next_pos = 3;
+    }
+}
+
+mapped_input::~mapped_input()
+{
+    if (_data) munmap (_data, _size);
+}
+
+input_buffer*
+mapped_input::consumer_get (const size_t id)
+{
+    return next_chunk (id, nullptr);
+}
+
+input_buffer*
+mapped_input::consumer_swap (input_buffer* buffer, const size_t id)
+{
+    return next_chunk (id, buffer);
+}
+
+void
+mapped_input::consumer_fail (const size_t id)
+{
+    _stopped = true;
+}
+
+input_buffer*
+mapped_input::next_chunk (const size_t id, const input_buffer* processed)
+{
+    // Chunks are claimed in order under a lock.  The end of a chunk is
+    // found by looking for a newline, or by stepping over
+    // length-prefixed records.
+    if (processed) release (*processed);
+
+    std::lock_guard<std::mutex> lock (_mutex);
+
+    if (processed)
+    {
+	_chunk_size->processed (processed->capacity(),
+			       std::chrono::steady_clock::now()
+			       - _handed_out[id]);
+    }
+
+    if (_stopped || _next_pos >= _size) return nullptr;
+
+    const size_t start = _next_pos;
+    size_t end = start + _chunk_size->size();
+
+    if (_format != record_format::LINES)
+    {
+	end = record_format::records_end (_format, _data + start,
+					  _data + _size, _chunk_size->size())
+	    - _data;
+	if (end == start)
+	{
+	    throw std::runtime_error ("Truncated record at end of input file");
+	}
+    }
+    else if (end >= _size) end = _size;
+    else
+    {
+	const char* nl = static_cast<const char*>
+	    (memchr(_data + end - 1, '\n', _size - end + 1));
+	end = (nl ? nl - _data + 1 : _size);
+    }
+    _next_pos = end;
+    _views[id].set_view (_data + start, end - start, false);
+    _handed_out[id] = std::chrono::steady_clock::now();
+
+    return &_views[id];
+}
+
+void
+mapped_input::release (const input_buffer& processed)
+{
+    // Unmap the pages of a processed chunk, so they stop counting
+    // towards the resident memory of the process.  The mapping is
+    // shared and read-only, so a page also used by a neighbouring
+    // chunk is just faulted in again from the page cache.
+    const uintptr_t mask = ~uintptr_t(sysconf(_SC_PAGESIZE) - 1);
+    const uintptr_t start
+	= reinterpret_cast<uintptr_t>(processed.get()) & mask;
+
+    madvise (reinterpret_cast<void*>(start),
+	     reinterpret_cast<uintptr_t>(processed.get())
+	     + processed.capacity() - start, MADV_DONTNEED);
+}
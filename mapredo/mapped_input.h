@@ -0,0 +1,89 @@
+/* -*- C++ -*-
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef _HEXTREME_MAPREDO_MAPPED_INPUT_H
+#define _HEXTREME_MAPREDO_MAPPED_INPUT_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <memory>
+
+#include "input_source.h"
+#include "chunk_sizer.h"
+#include "record_format.h"
+
+/**
+ * Provides a memory mapped regular file to consumer threads.  The
+ * file is mapped once, and each consumer claims newline aligned parts
+ * of it directly.  The mapping is read-only, so the pages stay in the
+ * page cache rather than being copied into the process when written
+ * to, and consumers copy each line before giving it to the mapper.
+ */
+class mapped_input : public input_source
+{
+public:
+    /**
+     * @param filename path of regular file to map
+     * @param chunk_size approximate number of bytes given to a consumer
+     *                   at a time, fixed or adapting to the consumers
+     * @param num_consumers number of consumer threads
+     */
+    mapped_input (const std::string& filename,
+		  const chunk_sizer& chunk_size,
+		  const size_t num_consumers);
+
+    /**
+     * @param filename path of regular file to map
+     * @param chunk_size chunk sizer shared with other inputs, which
+     *                   learns from the consumers of all of them
+     * @param num_consumers number of consumer threads
+     */
+    mapped_input (const std::string& filename,
+		  const std::shared_ptr<chunk_sizer>& chunk_size,
+		  const size_t num_consumers);
+    ~mapped_input();
+
+    /** @returns the size of the mapped file in bytes */
+    size_t size() const {return _size;}
+
+    virtual input_buffer* consumer_get (const size_t id) final;
+    virtual input_buffer* consumer_swap (input_buffer* buffer,
+					 const size_t id) final;
+    virtual void consumer_fail (const size_t id) final;
+
+    mapped_input (const mapped_input&) = delete;
+    mapped_input& operator=(const mapped_input&) = delete;
+
+private:
+    input_buffer* next_chunk (const size_t id,
+			      const input_buffer* processed);
+    void release (const input_buffer& processed);
+
+    char* _data = nullptr;
+    size_t _size = 0;
+    std::shared_ptr<chunk_sizer> _chunk_size;
+    const record_format::type _format;
+    std::mutex _mutex;
+    size_t _next_pos = 0;
+    std::atomic<bool> _stopped;
+    std::vector<input_buffer> _views;
+    std::vector<std::chrono::steady_clock::time_point> _handed_out;
+};
+
+#endif
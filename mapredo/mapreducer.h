@@ -112,6 +112,8 @@ namespace mapredo
 /// This macro needs to be used exactly once in the map-reducer.
 #define MAPREDO_FACTORIES(t) \
     extern "C" mapredo::base* create() {return new t;} \
-    extern "C" void destroy(mapredo::base* p) {delete p;}
+    extern "C" void destroy(mapredo::base* p) {delete p;} \
+    extern "C" unsigned interface_version() \
+    {return mapredo::base::interface_version;}
 
 #endif
@@ -49,6 +49,20 @@ namespace mapredo
 	 *              the reserved bytes.
 	 */
 	 virtual void collect_reserved (const size_t length = 0) = 0;
+
+	/**
+	 * Collect a key and a value, tab separated.  The value is
+	 * formatted straight into the buffer given by reserve(), see
+	 * field for the types formatted without allocating memory.
+	 */
+	template<typename T1, typename T2>
+	void collect_keyval (const T1& key, const T2& value) {
+	    const field k (key), v (value);
+	    char* buffer = reserve (k.data(), v.size());
+
+	    if (v.size()) memcpy (buffer, v.data(), v.size());
+	    collect_reserved (v.size());
+	}
     };
 }
 
@@ -0,0 +1,66 @@
+/*
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <stdexcept>
+#include <algorithm>
+#include <string>
+
+#include "memory_budget.h"
+
+memory_budget::memory_budget (const size_t bytes, const size_t parallel,
+			      const size_t sort_bytes,
+			      const size_t max_open_files) :
+    _bytes (bytes),
+    _sort_buffer (sort_bytes)
+{
+    if (!bytes) return;
+
+    // Two input chunks for each consumer and two for the producer
+    const size_t input_chunks = 2 * parallel + 2;
+    const size_t reserved = parallel * _output_bytes;
+
+    _sort_buffer = _reader_buffer = 0;
+    if (bytes > reserved)
+    {
+	const size_t available = bytes - reserved;
+
+	// An eighth of the budget for the input while mapping, and all
+	// of it for the readers while merging
+	_input_chunk = std::max
+	    (std::min (available / 8 / input_chunks,
+		       size_t(default_input_chunk)),
+	     size_t(min_input_chunk));
+	// Sorting a buffer to spill it takes scratch space for its
+	// lookup table, which is no larger than half the sort buffers
+	if (available > _input_chunk * input_chunks)
+	{
+	    _sort_buffer = (available - _input_chunk * input_chunks)
+		/ parallel / 3 * 2;
+	}
+	_reader_buffer = std::min (available / max_open_files,
+				   size_t(_max_reader_buffer));
+    }
+
+    if (_sort_buffer < _min_sort_buffer
+	|| _reader_buffer < _min_reader_buffer)
+    {
+	throw std::invalid_argument
+	    ("Memory budget of " + std::to_string(bytes)
+	     + " bytes is too small for " + std::to_string(parallel)
+	     + " threads and " + std::to_string(max_open_files)
+	     + " open files");
+    }
+}
@@ -0,0 +1,99 @@
+/* -*- C++ -*-
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef _HEXTREME_MAPREDO_MEMORY_BUDGET_H
+#define _HEXTREME_MAPREDO_MEMORY_BUDGET_H
+
+#include <cstddef>
+
+/**
+ * Divides a memory budget between the buffers of the engine.  While
+ * mapping, the budget is shared by the input chunks and the consumers,
+ * which split their share between the sort buffers, the aggregator
+ * and the scratch space for sorting a buffer when it is spilled.
+ * Once mapping is done these are freed, and the merge readers get the
+ * budget instead.  A small part is set aside for the output buffers
+ * of each thread during both phases.  Without a budget, the sizes are
+ * the defaults, which have no bound.
+ */
+class memory_budget
+{
+public:
+    /**
+     * @param bytes the budget, or 0 for the default buffer sizes
+     * @param parallel the number of consumers and mergers
+     * @param sort_bytes bytes to sort in each consumer without a budget
+     * @param max_open_files the most merge readers open at once
+     */
+    memory_budget (const size_t bytes, const size_t parallel,
+		   const size_t sort_bytes, const size_t max_open_files);
+
+    /** @returns the budget, or 0 if there is none */
+    size_t bytes() const {return _bytes;}
+
+    /** @returns the size of the input chunks handed to the consumers */
+    size_t input_chunk() const {return _input_chunk;}
+
+    /**
+     * @returns the largest the input chunks may grow to when adapting
+     *          to the consumers.  With a budget, this is input_chunk().
+     */
+    size_t max_input_chunk() const {
+	return _bytes ? _input_chunk : _max_input_chunk;
+    }
+
+    /**
+     * @param aggregating true if the consumers combine records in an
+     *                    aggregator before sorting them
+     * @returns bytes for the sort buffers of each consumer, which is
+     *          also the bound of its aggregator.  With a budget, this
+     *          is halved for the aggregator, and half as much again
+     *          is left for the scratch space of spilling.
+     */
+    size_t sort_buffer (const bool aggregating) const {
+	return _bytes && aggregating ? _sort_buffer / 2 : _sort_buffer;
+    }
+
+    /** @returns the size of the buffer of each merge reader */
+    size_t reader_buffer() const {return _reader_buffer;}
+
+    /** Default size of the input chunks */
+    static const size_t default_input_chunk = 0x100000;
+    /** Smallest size of the input chunks */
+    static const size_t min_input_chunk = 0x10000;
+    /** Default size of the merge reader buffers */
+    static const size_t default_reader_buffer = 0x100000;
+
+private:
+    /** Largest input chunk without a budget */
+    static const size_t _max_input_chunk = 0x4000000;
+    /** Output and compression buffers of each thread */
+    static const size_t _output_bytes = 0x40000;
+    /** Smallest merge reader buffer, enough for compressed blocks */
+    static const size_t _min_reader_buffer = 0x20000;
+    /** Largest useful merge reader buffer */
+    static const size_t _max_reader_buffer = 0x1000000;
+    /** Smallest sort buffer of a consumer */
+    static const size_t _min_sort_buffer = 0x10000;
+
+    const size_t _bytes;
+    size_t _input_chunk = default_input_chunk;
+    size_t _sort_buffer;
+    size_t _reader_buffer = default_reader_buffer;
+};
+
+#endif
@@ -0,0 +1,138 @@
+/* -*- C++ -*-
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef _HEXTREME_MAPREDO_MPMC_QUEUE_H
+#define _HEXTREME_MAPREDO_MPMC_QUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+/**
+ * Bounded lock-free queue for any number of producers and consumers,
+ * after Dmitry Vyukov's design.  Each cell has a sequence number
+ * telling whether it is ready to be written or read in the current
+ * round, so producers and consumers only contend on their own
+ * position counter.  T should be cheap to copy, like a pointer.
+ */
+template <class T> class mpmc_queue
+{
+public:
+    /**
+     * @param capacity least number of elements the queue must hold
+     */
+    mpmc_queue (const size_t capacity) :
+	_mask (round_up(capacity) - 1),
+	_cells (new cell[_mask + 1])
+    {
+	for (size_t i = 0; i <= _mask; i++)
+	{
+	    _cells[i].sequence.store (i, std::memory_order_relaxed);
+	}
+    }
+
+    mpmc_queue (const mpmc_queue&) = delete;
+    mpmc_queue& operator=(const mpmc_queue&) = delete;
+
+    /**
+     * Add an element to the end of the queue.
+     * @returns false if the queue is full
+     */
+    bool try_push (const T& value) {
+	size_t pos = _push_pos.load (std::memory_order_relaxed);
+
+	for (;;)
+	{
+	    cell& c (_cells[pos & _mask]);
+	    const size_t seq = c.sequence.load (std::memory_order_acquire);
+	    const ptrdiff_t diff = seq - pos;
+
+	    if (diff == 0)
+	    {
+		if (_push_pos.compare_exchange_weak
+		    (pos, pos + 1, std::memory_order_relaxed))
+		{
+		    c.value = value;
+		    c.sequence.store (pos + 1, std::memory_order_release);
+		    return true;
+		}
+	    }
+	    else if (diff < 0) return false;
+	    else pos = _push_pos.load (std::memory_order_relaxed);
+	}
+    }
+
+    /**
+     * Add an element to the end of a queue which can never hold more
+     * elements than its capacity.  try_push() may still fail while a
+     * consumer is between claiming and releasing the cell, so this
+     * retries until that consumer is done.
+     */
+    void push (const T& value) {
+	while (!try_push (value)) std::this_thread::yield();
+    }
+
+    /**
+     * Take the element at the front of the queue.
+     * @returns false if the queue is empty
+     */
+    bool try_pop (T& value) {
+	size_t pos = _pop_pos.load (std::memory_order_relaxed);
+
+	for (;;)
+	{
+	    cell& c (_cells[pos & _mask]);
+	    const size_t seq = c.sequence.load (std::memory_order_acquire);
+	    const ptrdiff_t diff = seq - (pos + 1);
+
+	    if (diff == 0)
+	    {
+		if (_pop_pos.compare_exchange_weak
+		    (pos, pos + 1, std::memory_order_relaxed))
+		{
+		    value = c.value;
+		    c.sequence.store (pos + _mask + 1,
+				      std::memory_order_release);
+		    return true;
+		}
+	    }
+	    else if (diff < 0) return false;
+	    else pos = _pop_pos.load (std::memory_order_relaxed);
+	}
+    }
+
+private:
+    struct cell
+    {
+	std::atomic<size_t> sequence;
+	T value;
+    };
+
+    static size_t round_up (const size_t capacity) {
+	size_t size = 2;
+	while (size < capacity) size *= 2;
+	return size;
+    }
+
+    const size_t _mask;
+    std::unique_ptr<cell[]> _cells;
+    // Keep the two positions on separate cache lines
+    alignas(64) std::atomic<size_t> _push_pos {0};
+    alignas(64) std::atomic<size_t> _pop_pos {0};
+};
+
+#endif
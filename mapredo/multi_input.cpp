@@ -0,0 +1,138 @@
+/*
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+#include <iterator>
+
+#include "multi_input.h"
+#include "mapped_input.h"
+#include "split_input.h"
+#include "decoded_input.h"
+#include "settings.h"
+
+multi_input::multi_input (const std::vector<std::string>& filenames,
+			  const chunk_sizer& chunk_size,
+			  const size_t num_consumers,
+			  const bool use_mmap) :
+    _filenames (filenames),
+    _chunk_size (std::make_shared<chunk_sizer>(chunk_size)),
+    _num_consumers (num_consumers),
+    _use_mmap (use_mmap),
+    _current (num_consumers, _files.end())
+{}
+
+input_buffer*
+multi_input::consumer_get (const size_t id)
+{
+    return next_file (id);
+}
+
+input_buffer*
+multi_input::consumer_swap (input_buffer* buffer, const size_t id)
+{
+    // The file is kept open while this consumer uses it, so its
+    // source can be called without holding the lock.
+    input_buffer* next = _current[id]->source->consumer_swap (buffer, id);
+
+    if (next) return next;
+    leave_file (id);
+
+    return next_file (id);
+}
+
+void
+multi_input::consumer_fail (const size_t id)
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+
+    _stopped = true;
+    for (auto& file: _files) file.source->consumer_fail (id);
+}
+
+input_buffer*
+multi_input::next_file (const size_t id)
+{
+    for (;;)
+    {
+	{
+	    std::lock_guard<std::mutex> lock (_mutex);
+
+	    if (_stopped) return nullptr;
+
+	    auto iter = _files.end();
+	    while (iter != _files.begin() && (--iter)->exhausted) ;
+
+	    if (iter == _files.end() || iter->exhausted)
+	    {
+		if (_next_file == _filenames.size()) return nullptr;
+
+		const std::string& filename (_filenames[_next_file++]);
+		_files.emplace_back();
+		iter = std::prev (_files.end());
+		try
+		{
+		    // Length-prefixed records can only be split where
+		    // found by stepping from the start of the file
+		    const bool lines (settings::instance().input_format()
+				      == record_format::LINES);
+
+		    if (lines && decoded_input::detect(filename)
+			!= decoded_input::PLAIN)
+		    {
+			iter->source.reset
+			    (new decoded_input (filename, _chunk_size->size(),
+						_num_consumers));
+		    }
+		    else if (_use_mmap || !lines)
+		    {
+			iter->source.reset
+			    (new mapped_input (filename, _chunk_size,
+					       _num_consumers));
+		    }
+		    else
+		    {
+			iter->source.reset
+			    (new split_input (filename, _chunk_size->size(),
+					      _num_consumers));
+		    }
+		}
+		catch (...)
+		{
+		    _files.pop_back();
+		    throw;
+		}
+	    }
+	    iter->users++;
+	    _current[id] = iter;
+	}
+
+	input_buffer* buffer = _current[id]->source->consumer_get (id);
+
+	if (buffer) return buffer;
+	leave_file (id);
+    }
+}
+
+void
+multi_input::leave_file (const size_t id)
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    auto iter = _current[id];
+
+    // A source returning no data to one consumer has none left for
+    // the others either
+    iter->exhausted = true;
+    if (--iter->users == 0) _files.erase (iter);
+    _current[id] = _files.end();
+}
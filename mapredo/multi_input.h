@@ -0,0 +1,85 @@
+/* -*- C++ -*-
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef _HEXTREME_MAPREDO_MULTI_INPUT_H
+#define _HEXTREME_MAPREDO_MULTI_INPUT_H
+
+#include <string>
+#include <vector>
+#include <list>
+#include <mutex>
+#include <memory>
+
+#include "input_source.h"
+#include "chunk_sizer.h"
+
+/**
+ * Provides a list of regular files to consumer threads.  Files are
+ * opened when consumers get to them, each as a mapped_input or a
+ * split_input of its own, or a decoded_input if compressed.  A
+ * consumer joins the most recently opened file with data left, or
+ * else opens the next file, so small files are read whole by single
+ * consumers while big files are shared.  One chunk sizer is shared by
+ * all files, so what is learned about the consumers carries over from
+ * one file to the next.
+ */
+class multi_input : public input_source
+{
+public:
+    /**
+     * @param filenames paths of regular files to read
+     * @param chunk_size approximate number of bytes given to a consumer
+     *                   at a time, fixed or adapting to the consumers
+     * @param num_consumers number of consumer threads
+     * @param use_mmap memory map the files if true, otherwise let each
+     *                 consumer read its own parts of them
+     */
+    multi_input (const std::vector<std::string>& filenames,
+		 const chunk_sizer& chunk_size,
+		 const size_t num_consumers,
+		 const bool use_mmap = true);
+
+    virtual input_buffer* consumer_get (const size_t id) final;
+    virtual input_buffer* consumer_swap (input_buffer* buffer,
+					 const size_t id) final;
+    virtual void consumer_fail (const size_t id) final;
+
+    multi_input (const multi_input&) = delete;
+    multi_input& operator=(const multi_input&) = delete;
+
+private:
+    struct file
+    {
+	std::unique_ptr<input_source> source;
+	size_t users = 0;       // consumers getting data from the file
+	bool exhausted = false; // no more data to give out
+    };
+
+    input_buffer* next_file (const size_t id);
+    void leave_file (const size_t id);
+
+    const std::vector<std::string> _filenames;
+    const std::shared_ptr<chunk_sizer> _chunk_size;
+    const size_t _num_consumers;
+    const bool _use_mmap;
+    std::mutex _mutex;
+    size_t _next_file = 0;
+    std::list<file> _files; // open files, most recently opened last
+    std::vector<std::list<file>::iterator> _current;
+    bool _stopped = false;
+};
+
+#endif
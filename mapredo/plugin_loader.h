@@ -88,6 +88,7 @@ public:
 
 private:
     typedef mapredo::base* (*create_t)();
+    typedef unsigned (*version_t)();
 
     bool load (const std::string& path) {
 	struct stat st;
@@ -113,6 +114,18 @@ private:
 		throw std::runtime_error (std::string("Can not load plugin: ")
 					  + err);
 	    }
+
+#ifdef __GNUC__
+	    __extension__
+#endif
+	    auto version = (version_t)dlsym(_lib, "interface_version");
+	    if (!version || version() != mapredo::base::interface_version)
+	    {
+		dlclose (_lib);
+		throw std::runtime_error ("The plugin " + path + " is built"
+					  " for another version of mapredo,"
+					  " and must be rebuilt");
+	    }
 	    _path = path;
 	    return true;
 	}
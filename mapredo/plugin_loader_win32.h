@@ -92,6 +92,7 @@ public:
 
 private:
     typedef mapredo::base* (*create_t)();
+    typedef unsigned (*version_t)();
 
     bool load (const std::string& path) {
 	const size_t error_msg_size = 1024;
@@ -136,6 +137,16 @@ private:
 		    std::string("Can not create plugin '" + path + ": ")
 					  + error_msg);
 	    }
+
+	    auto version
+		= (version_t)GetProcAddress(_lib, "interface_version");
+	    if (!version || version() != mapredo::base::interface_version)
+	    {
+		FreeLibrary (_lib);
+		throw std::runtime_error ("The plugin " + path + " is built"
+					  " for another version of mapredo,"
+					  " and must be rebuilt");
+	    }
 	    _path = path;
 	    return true;
 	}
@@ -0,0 +1,253 @@
+/*
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+
+#include "radix_sort.h"
+
+/** Number of buckets in string sorts, the first is for ended keys */
+static const size_t buckets = 257;
+
+/**
+ * @returns the bucket of a string key at a given depth, where 0 is for
+ *          keys shorter than the depth
+ */
+static inline size_t
+bucket (const lookup& entry, const char* const buffer, const size_t depth,
+	const bool reverse)
+{
+    size_t byte;
+
+    if (depth >= entry.keylen()) return reverse ? buckets - 1 : 0;
+    if (depth < 8) byte = (entry.prefix() >> (56 - 8 * depth)) & 0xff;
+    else
+    {
+	byte = static_cast<unsigned char>(buffer[entry.offset() + depth]);
+    }
+
+    return reverse ? buckets - 2 - byte : byte + 1;
+}
+
+void
+radix_sort::sort (lookup* begin, lookup* end, const char* buffer,
+		  const mapredo::base::keytype type, const bool reverse)
+{
+    if (size_t(end - begin) <= _small_array)
+    {
+	comparison_sort (begin, end, buffer, type, reverse);
+	return;
+    }
+
+    switch (type)
+    {
+    case mapredo::base::STRING:
+	sort_strings (begin, end, buffer, reverse);
+	break;
+    case mapredo::base::INT64:
+    case mapredo::base::DOUBLE:
+	sort_numbers (begin, end, reverse);
+	break;
+    case mapredo::base::UNKNOWN:
+	throw std::runtime_error ("Program error, keytype not set"
+				  " in mapredo::base");
+    }
+}
+
+void
+radix_sort::sort_strings (lookup* begin, lookup* end, const char* buffer,
+			  const bool reverse)
+{
+    sort_strings (begin, end, buffer, reverse, 0);
+}
+
+void
+radix_sort::sort_strings (lookup* begin, lookup* end, const char* buffer,
+			  const bool reverse, size_t depth)
+{
+    const size_t ended = reverse ? buckets - 1 : 0;
+    size_t counts[buckets];
+
+    for (;;)
+    {
+	const size_t size = end - begin;
+
+	if (size <= _small_partition || depth >= _max_depth)
+	{
+	    comparison_sort (begin, end, buffer, mapredo::base::STRING,
+			     reverse);
+	    return;
+	}
+
+	std::fill (counts, counts + buckets, 0);
+	for (lookup* entry = begin; entry != end; ++entry)
+	{
+	    counts[bucket(*entry, buffer, depth, reverse)]++;
+	}
+
+	// Entries all in the same bucket are sorted by the next byte
+	const size_t first = bucket (*begin, buffer, depth, reverse);
+
+	if (counts[first] != size) break;
+	if (first == ended) return;
+	depth++;
+    }
+
+    size_t next[buckets];
+    size_t ends[buckets];
+    size_t pos = 0;
+
+    for (size_t i = 0; i < buckets; i++)
+    {
+	next[i] = pos;
+	pos += counts[i];
+	ends[i] = pos;
+    }
+
+    // Move each entry into its bucket, swapping out what is there
+    for (size_t i = 0; i < buckets; i++)
+    {
+	while (next[i] < ends[i])
+	{
+	    lookup entry (begin[next[i]]);
+	    size_t b = bucket (entry, buffer, depth, reverse);
+
+	    while (b != i)
+	    {
+		std::swap (entry, begin[next[b]++]);
+		b = bucket (entry, buffer, depth, reverse);
+	    }
+	    begin[next[i]++] = entry;
+	}
+    }
+
+    // Keys in the bucket of ended keys are equal
+    for (size_t i = 0, start = 0; i < buckets; start = ends[i++])
+    {
+	if (i != ended && ends[i] - start > 1)
+	{
+	    sort_strings (begin + start, begin + ends[i], buffer, reverse,
+			  depth + 1);
+	}
+    }
+}
+
+void
+radix_sort::sort_numbers (lookup* begin, lookup* end, const bool reverse)
+{
+    const size_t size = end - begin;
+    const uint64_t flip = reverse ? 0xff : 0;
+    size_t counts[8][256] = {};
+
+    if (size < 2) return;
+
+    // Count the bytes of all passes at once
+    for (lookup* entry = begin; entry != end; ++entry)
+    {
+	const uint64_t prefix = entry->prefix();
+
+	for (size_t pass = 0; pass < 8; pass++)
+	{
+	    counts[pass][((prefix >> (8 * pass)) & 0xff) ^ flip]++;
+	}
+    }
+
+    std::unique_ptr<lookup[]> scratch;
+    lookup* from = begin;
+    lookup* to = nullptr;
+
+    for (size_t pass = 0; pass < 8; pass++)
+    {
+	const size_t shift = 8 * pass;
+
+	// Skip the pass if all entries have the same byte
+	if (counts[pass][((begin->prefix() >> shift) & 0xff) ^ flip] == size)
+	{
+	    continue;
+	}
+	if (!scratch)
+	{
+	    scratch.reset (new lookup[size]);
+	    to = scratch.get();
+	}
+
+	size_t offsets[256];
+	size_t pos = 0;
+
+	for (size_t i = 0; i < 256; i++)
+	{
+	    offsets[i] = pos;
+	    pos += counts[pass][i];
+	}
+	for (lookup* entry = from; entry != from + size; ++entry)
+	{
+	    to[offsets[((entry->prefix() >> shift) & 0xff) ^ flip]++] = *entry;
+	}
+	std::swap (from, to);
+    }
+
+    if (from != begin) std::copy (from, from + size, begin);
+}
+
+void
+radix_sort::comparison_sort (lookup* begin, lookup* end, const char* buffer,
+			     const mapredo::base::keytype type,
+			     const bool reverse)
+{
+    switch (type)
+    {
+    case mapredo::base::STRING:
+	if (!reverse)
+	{
+	    std::sort (begin, end,
+		       [buffer](const lookup& left, const lookup& right)
+		       {
+			 return lookup::compare (buffer, left, right) < 0;
+		       });
+	}
+	else
+	{
+	    std::sort (begin, end,
+		       [buffer](const lookup& left, const lookup& right)
+		       {
+			 return lookup::compare (buffer, left, right) > 0;
+		       });
+	}
+	break;
+    case mapredo::base::INT64:
+    case mapredo::base::DOUBLE:
+	// The prefix is the whole key for numbers
+	if (!reverse)
+	{
+	    std::sort (begin, end, [](const lookup& left, const lookup& right)
+		       {
+			 return left.prefix() < right.prefix();
+		       });
+	}
+	else
+	{
+	    std::sort (begin, end, [](const lookup& left, const lookup& right)
+		       {
+			 return left.prefix() > right.prefix();
+		       });
+	}
+	break;
+    case mapredo::base::UNKNOWN:
+	throw std::runtime_error ("Program error, keytype not set"
+				  " in mapredo::base");
+    }
+}
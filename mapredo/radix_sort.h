@@ -0,0 +1,94 @@
+/* -*- C++ -*-
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef _HEXTREME_MAPREDO_RADIX_SORT_H
+#define _HEXTREME_MAPREDO_RADIX_SORT_H
+
+#include "lookup.h"
+#include "base.h"
+
+/**
+ * Sorts the lookup entries of a sort buffer.  String keys are sorted
+ * by an in-place most significant byte first radix sort, also known as
+ * American flag sort.  Numeric keys are sorted by a least significant
+ * byte first radix sort of their prefixes.  Small arrays and
+ * partitions are sorted by comparison instead.
+ */
+class radix_sort
+{
+public:
+    /**
+     * Sort entries, choosing the algorithm from the key type and the
+     * number of entries.
+     * @param begin first entry
+     * @param end end of entries
+     * @param buffer the buffer the entries refer to
+     * @param type key type
+     * @param reverse sort in descending order if true
+     */
+    static void sort (lookup* begin, lookup* end, const char* buffer,
+		      const mapredo::base::keytype type, const bool reverse);
+
+    /**
+     * Sort entries with string keys by radix sort
+     * @param begin first entry
+     * @param end end of entries
+     * @param buffer the buffer the entries refer to
+     * @param reverse sort in descending order if true
+     */
+    static void sort_strings (lookup* begin, lookup* end,
+			      const char* buffer, const bool reverse);
+
+    /**
+     * Sort entries with numeric keys by radix sort.  This needs
+     * temporary memory of the same size as the entries.
+     * @param begin first entry
+     * @param end end of entries
+     * @param reverse sort in descending order if true
+     */
+    static void sort_numbers (lookup* begin, lookup* end,
+			      const bool reverse);
+
+    /**
+     * Sort entries by comparison
+     * @param begin first entry
+     * @param end end of entries
+     * @param buffer the buffer the entries refer to
+     * @param type key type
+     * @param reverse sort in descending order if true
+     */
+    static void comparison_sort (lookup* begin, lookup* end,
+				 const char* buffer,
+				 const mapredo::base::keytype type,
+				 const bool reverse);
+
+private:
+    static void sort_strings (lookup* begin, lookup* end, const char* buffer,
+			      const bool reverse, size_t depth);
+
+    /** Arrays up to this size are sorted by comparison */
+    static const size_t _small_array = 256;
+    /** String partitions up to this size are sorted by comparison */
+    static const size_t _small_partition = 32;
+    /**
+     * Key depth from where string partitions are sorted by
+     * comparison, which bounds the recursion
+     */
+    static const size_t _max_depth = 64;
+};
+
+#endif
@@ -0,0 +1,309 @@
+/*
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <functional>
+
+#include "range_partitioner.h"
+#include "mapreducer.h"
+#include "scanner.h"
+
+/** Collector adding the keys output by a mapper to a sample */
+class sample_collector final : public mapredo::mcollector
+{
+public:
+    sample_collector (range_partitioner& ranges) : _ranges (ranges) {}
+
+    virtual void collect (const char* line, const size_t length) final {
+	const char* tab = scanner::find (line, line + length, '\t');
+	_ranges.add_key (line, tab ? tab - line : length);
+    }
+
+    virtual char* reserve (const char* const key, const size_t bytes) final {
+	_ranges.add_key (key, strlen(key));
+	_value.resize (bytes + 1);
+	return &_value[0];
+    }
+
+    virtual void collect_reserved (const size_t length = 0) final {}
+
+private:
+    range_partitioner& _ranges;
+    std::string _value;
+};
+
+/** Copy a key which may not be nul-terminated, for parsing */
+static const char*
+terminated_key (const char* const key, const size_t length, char (&buf)[64])
+{
+    const size_t size = std::min (length, sizeof(buf) - 1);
+
+    memcpy (buf, key, size);
+    buf[size] = '\0';
+
+    return buf;
+}
+
+/** Parse a numeric key the way the sorter does */
+template<typename T> static T
+parse_key (const char* const key, const size_t length);
+
+template<> int64_t
+parse_key (const char* const key, const size_t length)
+{
+    char buf[64];
+    return atoll (terminated_key (key, length, buf));
+}
+
+template<> double
+parse_key (const char* const key, const size_t length)
+{
+    char buf[64];
+    return atof (terminated_key (key, length, buf));
+}
+
+/** Orders strings like strcmp(), as the merge does */
+static bool
+string_less (const std::string& left, const std::string& right)
+{
+    const int cmp = memcmp (left.data(), right.data(),
+			    std::min(left.size(), right.size()));
+    return cmp < 0 || (cmp == 0 && left.size() < right.size());
+}
+
+range_partitioner::range_partitioner (const mapredo::base::keytype type,
+				      const size_t partitions,
+				      const bool reverse) :
+    _type (type),
+    _partitions (partitions),
+    _reverse (reverse)
+{
+    if (type == mapredo::base::UNKNOWN)
+    {
+	throw std::runtime_error ("Program error, keytype not set"
+				  " in mapredo::base");
+    }
+}
+
+void
+range_partitioner::sample (mapredo::base& mapreducer, const char* data,
+			   const size_t size, const record_format::type format)
+{
+    sample_collector collector (*this);
+    const char* pos = data;
+    const char* const end = data + size;
+    std::string record;
+
+    while (pos < end)
+    {
+	const char* start;
+	size_t length;
+
+	if (format == record_format::LINES)
+	{
+	    const char* nl = scanner::find (pos, end, '\n');
+
+	    if (!nl) break;
+	    start = pos;
+	    length = nl - pos;
+	    if (length && nl[-1] == '\r') length--;
+	    pos = nl + 1;
+	}
+	else
+	{
+	    uint64_t record_length;
+	    const size_t header_size = record_format::header
+		(format, pos, end, record_length);
+
+	    if (!header_size
+		|| record_length > size_t(end - pos) - header_size) break;
+	    start = pos + header_size;
+	    length = record_length;
+	    pos = start + length;
+	}
+
+	// The mapper gets a nul-terminated copy, which it may modify
+	record.assign (start, length);
+	mapreducer.map (&record[0], length, collector);
+    }
+}
+
+void
+range_partitioner::add_key (const char* key, const size_t length)
+{
+    switch (_type)
+    {
+    case mapredo::base::STRING:
+	_strings.emplace_back (key, length);
+	break;
+    case mapredo::base::INT64:
+	_integers.push_back (parse_key<int64_t> (key, length));
+	break;
+    case mapredo::base::DOUBLE:
+	_doubles.push_back (parse_key<double> (key, length));
+	break;
+    case mapredo::base::UNKNOWN:
+	break;
+    }
+}
+
+template<typename T> void
+range_partitioner::split (std::vector<T>& sample, std::vector<T>& splits,
+			  const size_t partitions)
+{
+    std::sort (sample.begin(), sample.end());
+
+    // A key equal to a split point goes to the partition after it, so
+    // repeated keys can only be in one partition and are skipped
+    for (size_t i = 1; i < partitions; i++)
+    {
+	const T& key (sample[i * sample.size() / partitions]);
+
+	if (splits.empty() || splits.back() < key) splits.push_back (key);
+    }
+    std::vector<T>().swap (sample);
+}
+
+template<> void
+range_partitioner::split (std::vector<std::string>& sample,
+			  std::vector<std::string>& splits,
+			  const size_t partitions)
+{
+    std::sort (sample.begin(), sample.end(), &string_less);
+
+    for (size_t i = 1; i < partitions; i++)
+    {
+	const std::string& key (sample[i * sample.size() / partitions]);
+
+	if (splits.empty() || string_less(splits.back(), key))
+	{
+	    splits.push_back (key);
+	}
+    }
+    std::vector<std::string>().swap (sample);
+}
+
+template<typename T, typename Less> bool
+range_partitioner::balanced (const std::vector<T>& sample, Less less) const
+{
+    const size_t half = sample.size() / 2;
+
+    if (_partitions < 2 || half < 16 * _partitions) return true;
+
+    std::vector<T> first (sample.begin(), sample.begin() + half);
+    std::vector<size_t> counts (_partitions);
+
+    std::sort (first.begin(), first.end(), less);
+    for (auto iter = sample.begin() + half; iter != sample.end(); ++iter)
+    {
+	// Repeated keys are ranked in the middle of their equals
+	const size_t rank
+	    = (std::lower_bound (first.begin(), first.end(), *iter, less)
+	       - first.begin()
+	       + std::upper_bound (first.begin(), first.end(), *iter, less)
+	       - first.begin()) / 2;
+
+	counts[rank * _partitions / (half + 1)]++;
+    }
+
+    return *std::max_element (counts.begin(), counts.end()) * _partitions
+	<= 2 * (sample.size() - half);
+}
+
+bool
+range_partitioner::balanced() const
+{
+    switch (_type)
+    {
+    case mapredo::base::STRING:
+	return balanced (_strings, &string_less);
+    case mapredo::base::INT64:
+	return balanced (_integers, std::less<int64_t>());
+    case mapredo::base::DOUBLE:
+	return balanced (_doubles, std::less<double>());
+    case mapredo::base::UNKNOWN:
+	break;
+    }
+
+    return true;
+}
+
+bool
+range_partitioner::finish()
+{
+    if (!samples()) return false;
+
+    switch (_type)
+    {
+    case mapredo::base::STRING:
+	split (_strings, _string_splits, _partitions);
+	break;
+    case mapredo::base::INT64:
+	split (_integers, _integer_splits, _partitions);
+	break;
+    case mapredo::base::DOUBLE:
+	split (_doubles, _double_splits, _partitions);
+	break;
+    case mapredo::base::UNKNOWN:
+	break;
+    }
+
+    return true;
+}
+
+template<typename T> size_t
+range_partitioner::partition_of (const std::vector<T>& splits,
+				 const T& key) const
+{
+    const size_t index = std::upper_bound (splits.begin(), splits.end(), key)
+	- splits.begin();
+
+    return _reverse ? _partitions - 1 - index : index;
+}
+
+size_t
+range_partitioner::partition (const char* const key,
+			      const size_t length) const
+{
+    switch (_type)
+    {
+    case mapredo::base::STRING:
+    {
+	auto iter = std::upper_bound
+	    (_string_splits.begin(), _string_splits.end(), key,
+	     [length](const char* const key, const std::string& split)
+	     {
+		 const int cmp = memcmp (key, split.data(),
+					 std::min(length, split.size()));
+		 return cmp < 0 || (cmp == 0 && length < split.size());
+	     });
+	const size_t index = iter - _string_splits.begin();
+
+	return _reverse ? _partitions - 1 - index : index;
+    }
+    case mapredo::base::INT64:
+	return partition_of (_integer_splits,
+			     parse_key<int64_t> (key, length));
+    case mapredo::base::DOUBLE:
+	return partition_of (_double_splits, parse_key<double> (key, length));
+    case mapredo::base::UNKNOWN:
+	break;
+    }
+
+    return 0;
+}
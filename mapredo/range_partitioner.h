@@ -0,0 +1,116 @@
+/* -*- C++ -*-
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef _HEXTREME_MAPREDO_RANGE_PARTITIONER_H
+#define _HEXTREME_MAPREDO_RANGE_PARTITIONER_H
+
+#include <string>
+#include <vector>
+
+#include "base.h"
+#include "record_format.h"
+
+/**
+ * Partitions keys by range instead of by hash, so that the sorted
+ * output of each partition can simply be concatenated in partition
+ * order.  The split points are chosen from a sample of the keys
+ * output by the mapper, taken before the map phase starts.  Any split
+ * points give correct output, the sample only decides how evenly the
+ * partitions are filled.
+ */
+class range_partitioner
+{
+public:
+    /**
+     * @param type the key type of the mapreducer
+     * @param partitions number of partitions
+     * @param reverse if true, the first partition gets the highest keys
+     */
+    range_partitioner (const mapredo::base::keytype type,
+		       const size_t partitions,
+		       const bool reverse);
+
+    /**
+     * Run the mapper on each whole line or record in some input data
+     * and add the keys it collects to the sample.  A last line
+     * without a newline is skipped.
+     * @param mapreducer mapper to get the keys from
+     * @param data input data, starting at a line or record
+     * @param size number of bytes in data
+     * @param format how the data is divided into records
+     */
+    void sample (mapredo::base& mapreducer, const char* data,
+		 const size_t size, const record_format::type format);
+
+    /** Add a single key to the sample */
+    void add_key (const char* key, const size_t length);
+
+    /**
+     * Check if the sample predicts the order of the keys in the rest
+     * of the input.  Split points are chosen from the first half of
+     * the sample, and no partition may then get more than twice its
+     * share of the keys in the second half.  This fails for input
+     * sorted on key, where a sample of the start says little about
+     * the keys that follow.  Call this before finish().
+     * @returns true if the keys in the sample are evenly spread, or
+     *          if there are too few keys to tell.
+     */
+    bool balanced() const;
+
+    /**
+     * Choose the split points from the sample, which is then
+     * discarded.
+     * @returns false if the sample was empty, so that there is
+     *          nothing to choose from.
+     */
+    bool finish();
+
+    /**
+     * @param key the key, not nul-terminated
+     * @param length key length in bytes
+     * @returns partition number of the key
+     */
+    size_t partition (const char* const key, const size_t length) const;
+
+    /** @returns the number of keys sampled */
+    size_t samples() const {
+	return _strings.size() + _integers.size() + _doubles.size();
+    }
+
+private:
+    template<typename T> static void split (std::vector<T>& sample,
+					    std::vector<T>& splits,
+					    const size_t partitions);
+    template<typename T, typename Less>
+    bool balanced (const std::vector<T>& sample, Less less) const;
+    template<typename T> size_t
+    partition_of (const std::vector<T>& splits, const T& key) const;
+
+    const mapredo::base::keytype _type;
+    const size_t _partitions;
+    const bool _reverse;
+
+    // Only the vectors of the key type are used
+    std::vector<std::string> _strings;
+    std::vector<int64_t> _integers;
+    std::vector<double> _doubles;
+    std::vector<std::string> _string_splits;
+    std::vector<int64_t> _integer_splits;
+    std::vector<double> _double_splits;
+};
+
+#endif
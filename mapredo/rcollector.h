@@ -44,6 +44,31 @@ namespace mapredo
 	 *              the reserved bytes.
 	 */
 	 virtual void collect_reserved (const size_t length = 0) = 0;
+
+	/**
+	 * Collect a key and a value, tab separated.  The line is
+	 * formatted straight into the buffer given by reserve(), see
+	 * field for the types formatted without allocating memory.
+	 */
+	template<typename T1, typename T2>
+	void collect_keyval (const T1& key, const T2& value) {
+	    const field k (key), v (value);
+	    const size_t length = k.size() + 1 + v.size();
+
+	    // Output buffers may be small, long lines are copied instead
+	    if (length > _max_stack_line)
+	    {
+		collector::collect_keyval (k.data(), v.data());
+		return;
+	    }
+
+	    char* buffer = reserve (length);
+
+	    memcpy (buffer, k.data(), k.size());
+	    buffer[k.size()] = '\t';
+	    memcpy (buffer + k.size() + 1, v.data(), v.size());
+	    collect_reserved (length);
+	}
     };
 }
 
@@ -0,0 +1,114 @@
+/* -*- C++ -*-
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef _HEXTREME_MAPREDO_RECORD_FORMAT_H
+#define _HEXTREME_MAPREDO_RECORD_FORMAT_H
+
+#include <cstdint>
+#include <string>
+#include <stdexcept>
+
+/**
+ * How input is divided into records.  Besides newline terminated
+ * lines, records may be binary data, each preceded by its length as a
+ * varint (as in protobuf's delimited format) or as a 4 byte big-endian
+ * number.  Chunk boundaries in such input are found by stepping from
+ * header to header, without looking at the data in between.
+ */
+class record_format
+{
+public:
+    enum type
+    {
+	LINES,  /// newline terminated lines
+	VARINT, /// length as an unsigned LEB128 varint, then the data
+	FIXED32 /// length as a 4 byte big-endian number, then the data
+    };
+
+    /**
+     * @param name "lines", "varint" or "fixed32"
+     * @returns the format with the given name
+     */
+    static type parse (const std::string& name) {
+	if (name == "lines") return LINES;
+	if (name == "varint") return VARINT;
+	if (name == "fixed32") return FIXED32;
+	throw std::runtime_error ("Unknown input format '" + name + "'");
+    }
+
+    /**
+     * Read the header of a length-prefixed record.
+     * @param fmt VARINT or FIXED32
+     * @param pos start of the record
+     * @param end end of the available data
+     * @param length set to the length of the record data
+     * @returns the size of the header, or 0 if it is incomplete
+     */
+    static size_t header (const type fmt, const char* pos, const char* end,
+			  uint64_t& length) {
+	const unsigned char* p = reinterpret_cast<const unsigned char*>(pos);
+	const size_t available = end - pos;
+
+	if (fmt == FIXED32)
+	{
+	    if (available < 4) return 0;
+	    length = uint64_t(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3];
+	    return 4;
+	}
+
+	length = 0;
+	for (size_t i = 0; i < available; i++)
+	{
+	    if (i == 10)
+	    {
+		throw std::runtime_error ("Invalid varint record header");
+	    }
+	    length |= uint64_t(p[i] & 0x7f) << (7 * i);
+	    if (!(p[i] & 0x80)) return i + 1;
+	}
+	return 0;
+    }
+
+    /**
+     * Step over whole length-prefixed records.
+     * @param fmt VARINT or FIXED32
+     * @param begin start of a record
+     * @param end end of the available data
+     * @param min_bytes stop after at least this many bytes of records
+     * @returns the end of the last whole record stepped over, which is
+     *          begin if there is none
+     */
+    static const char* records_end (const type fmt, const char* begin,
+				    const char* end, const size_t min_bytes) {
+	const char* pos = begin;
+	uint64_t length;
+
+	while (size_t(pos - begin) < min_bytes)
+	{
+	    const size_t header_size = header (fmt, pos, end, length);
+
+	    if (!header_size || length > size_t(end - pos) - header_size)
+	    {
+		break;
+	    }
+	    pos += header_size + length;
+	}
+	return pos;
+    }
+};
+
+#endif
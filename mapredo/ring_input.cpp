@@ -0,0 +1,314 @@
+/*
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <stdexcept>
+
+#include "ring_input.h"
+#include "settings.h"
+
+static void
+throw_error (const std::string& what)
+{
+    char err[80];
+
+    throw std::runtime_error
+	(what + ": " + strerror_r(errno, err, sizeof(err)));
+}
+
+/**
+ * Map memory of the given size twice in a row, so reads and segments
+ * can run past the end of the ring and continue at its beginning.
+ */
+static char*
+map_ring (const size_t capacity)
+{
+#ifdef __linux__
+    int mfd = memfd_create ("mapredo-ring", MFD_CLOEXEC);
+#else
+    const std::string name ("/mapredo-ring." + std::to_string(getpid()));
+    int mfd = shm_open (name.c_str(), O_RDWR|O_CREAT|O_EXCL, 0600);
+    if (mfd >= 0) shm_unlink (name.c_str());
+#endif
+    if (mfd < 0) throw_error ("Can not create input ring");
+    if (ftruncate(mfd, capacity) != 0)
+    {
+	close (mfd);
+	throw_error ("Can not size input ring");
+    }
+
+    void* area = mmap (nullptr, 2 * capacity, PROT_NONE,
+		       MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    char* ring = static_cast<char*>(area);
+    if (area == MAP_FAILED
+	|| mmap(ring, capacity, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_FIXED, mfd, 0) == MAP_FAILED
+	|| mmap(ring + capacity, capacity, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_FIXED, mfd, 0) == MAP_FAILED)
+    {
+	if (area != MAP_FAILED) munmap (area, 2 * capacity);
+	close (mfd);
+	throw_error ("Can not map input ring");
+    }
+    close (mfd);
+
+    return ring;
+}
+
+ring_input::ring_input (const int fd,
+			const chunk_sizer& chunk_size,
+			const size_t num_consumers,
+			const std::string& head) :
+    _fd (fd),
+    _chunk_size (chunk_size),
+    _format (settings::instance().input_format()),
+    _consumer_segment (num_consumers),
+    _handed_out (num_consumers),
+    _views (num_consumers)
+{
+    // Two chunks per consumer, like the buffers of buffer_trader
+    const size_t page_size = sysconf (_SC_PAGESIZE);
+    _capacity = (2 * num_consumers * _chunk_size.size() + page_size - 1)
+	/ page_size * page_size;
+    _ring = map_ring (_capacity);
+    memcpy (_ring, head.data(), head.size());
+    _write_pos = head.size();
+
+    // Leave room for reading ahead while every consumer has a segment
+    _chunk_size.limit (_capacity / (num_consumers + 1));
+}
+
+ring_input::~ring_input()
+{
+    if (_ring) munmap (_ring, 2 * _capacity);
+}
+
+size_t
+ring_input::read_input()
+{
+    std::unique_lock<std::mutex> lock (_mutex);
+    bool header_checked = (_format != record_format::LINES);
+
+    while (!_failed)
+    {
+	// One byte is always kept free, so the last line can be
+	// nul-terminated if the stream does not end with a newline.
+	size_t space = _capacity - 1 - (_write_pos - _release_pos);
+
+	// Avoid small reads while there are segments left to release
+	while (space < _chunk_size.size() && !_segments.empty() && !_failed)
+	{
+	    _space_cv.wait (lock);
+	    space = _capacity - 1 - (_write_pos - _release_pos);
+	}
+	if (_failed) break;
+	if (space == 0)
+	{
+	    publish (true);
+	    if (_segments.empty()) grow();
+	    else _data_cv.notify_all();
+	    continue;
+	}
+
+	char* const to = at (_write_pos);
+	lock.unlock();
+	ssize_t bytes = read (_fd, to, space);
+	lock.lock();
+
+	if (bytes < 0)
+	{
+	    if (errno == EINTR) continue;
+	    _failed = true;
+	    _data_cv.notify_all();
+	    throw_error ("Can not read input");
+	}
+	if (bytes == 0) break;
+	_write_pos += bytes;
+
+	if (!header_checked && _write_pos >= 3 && _publish_pos == 0)
+	{
+	    // Skip any Windows style UTF-8 header
+	    const unsigned char u8header[] = {0xef, 0xbb, 0xbf};
+	    if (memcmp(_ring, u8header, 3) == 0) _publish_pos = _release_pos = 3;
+	    header_checked = true;
+	}
+
+	// Give out only whole chunks unless consumers are idle
+	const size_t segments = _segments.size();
+	publish (_waiting > 0);
+	if (_segments.size() != segments) _data_cv.notify_all();
+    }
+
+    if (!_failed)
+    {
+	publish (true);
+	if (_write_pos > _publish_pos)
+	{
+	    if (_format != record_format::LINES)
+	    {
+		_failed = true;
+		_data_cv.notify_all();
+		throw std::runtime_error ("Truncated record at end of input");
+	    }
+	    add_segment (_write_pos);
+	}
+    }
+    _eof = true;
+    _data_cv.notify_all();
+
+    return _write_pos;
+}
+
+input_buffer*
+ring_input::consumer_get (const size_t id)
+{
+    std::unique_lock<std::mutex> lock (_mutex);
+    return next_segment (id, lock);
+}
+
+input_buffer*
+ring_input::consumer_swap (input_buffer* buffer, const size_t id)
+{
+    std::unique_lock<std::mutex> lock (_mutex);
+
+    segment& seg (_segments[_consumer_segment[id] - _first_segment]);
+    _chunk_size.processed (seg.end - seg.start,
+			   std::chrono::steady_clock::now() - _handed_out[id]);
+
+    // Segments are released in the order they were given out
+    seg.done = true;
+    if (_segments.front().done)
+    {
+	while (!_segments.empty() && _segments.front().done)
+	{
+	    _release_pos = _segments.front().end;
+	    _segments.pop_front();
+	    _first_segment++;
+	}
+	_space_cv.notify_one();
+    }
+
+    return next_segment (id, lock);
+}
+
+void
+ring_input::consumer_fail (const size_t id)
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    _failed = true;
+    _data_cv.notify_all();
+    _space_cv.notify_one();
+}
+
+input_buffer*
+ring_input::next_segment (const size_t id, std::unique_lock<std::mutex>& lock)
+{
+    while (_next_segment == _first_segment + _segments.size())
+    {
+	if (_failed || _eof) return nullptr;
+
+	// Take whatever whole lines have been read rather than idling
+	publish (true);
+	if (_next_segment < _first_segment + _segments.size()) break;
+
+	_waiting++;
+	_data_cv.wait (lock);
+	_waiting--;
+    }
+    if (_failed) return nullptr;
+
+    const segment& seg (_segments[_next_segment - _first_segment]);
+    _consumer_segment[id] = _next_segment++;
+    _views[id].set_view (at(seg.start), seg.end - seg.start);
+    _handed_out[id] = std::chrono::steady_clock::now();
+
+    return &_views[id];
+}
+
+void
+ring_input::publish (const bool all)
+{
+    if (_format != record_format::LINES)
+    {
+	publish_records (all);
+	return;
+    }
+
+    // Split into segments of about chunk size, ending in newlines found
+    // in data no consumer has touched yet.
+    while (_write_pos - _publish_pos >= _chunk_size.size())
+    {
+	const size_t from = _publish_pos + _chunk_size.size() - 1;
+	const char* nl = static_cast<const char*>
+	    (memchr(at(from), '\n', _write_pos - from));
+	if (!nl) break;
+	add_segment (from + (nl - at(from)) + 1);
+    }
+
+    if (all && _write_pos > _publish_pos)
+    {
+	const char* nl = static_cast<const char*>
+	    (memrchr(at(_publish_pos), '\n', _write_pos - _publish_pos));
+	if (nl) add_segment (_publish_pos + (nl - at(_publish_pos)) + 1);
+    }
+}
+
+void
+ring_input::publish_records (const bool all)
+{
+    // Step over the headers of records read since last time, and split
+    // into segments of about chunk size at record boundaries.
+    for (;;)
+    {
+	const size_t wanted = _publish_pos + _chunk_size.size();
+	const char* from = at (_record_pos);
+
+	_record_pos += record_format::records_end
+	    (_format, from, from + (_write_pos - _record_pos),
+	     wanted > _record_pos ? wanted - _record_pos : 0) - from;
+	if (_record_pos < wanted) break;
+	add_segment (_record_pos);
+    }
+
+    if (all && _record_pos > _publish_pos) add_segment (_record_pos);
+}
+
+void
+ring_input::add_segment (const size_t end)
+{
+    _segments.push_back (segment{_publish_pos, end, false});
+    _publish_pos = end;
+}
+
+void
+ring_input::grow()
+{
+    // Slow path for a line longer than the ring.  No consumer refers
+    // to the ring when there are no segments, so the unfinished line
+    // can be moved to a ring of twice the size.
+    const size_t capacity = 2 * _capacity;
+    char* ring = map_ring (capacity);
+
+    memcpy (ring + _publish_pos % capacity, at(_publish_pos),
+	    _write_pos - _publish_pos);
+    munmap (_ring, 2 * _capacity);
+    _ring = ring;
+    _capacity = capacity;
+}
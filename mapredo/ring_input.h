@@ -0,0 +1,123 @@
+/* -*- C++ -*-
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef _HEXTREME_MAPREDO_RING_INPUT_H
+#define _HEXTREME_MAPREDO_RING_INPUT_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include "input_source.h"
+#include "chunk_sizer.h"
+#include "record_format.h"
+
+/**
+ * Provides data from a stream, such as a pipe, to consumer threads.
+ * One thread reads ahead into a ring buffer while the consumers take
+ * segments of whole lines or records from the ring directly.  The
+ * ring is mapped twice in a row in virtual memory, so a segment
+ * wrapping around the end of the ring is still contiguous and never
+ * needs to be copied.
+ *
+ * There is only one read outstanding at a time.  Each read asks for
+ * all free space in the ring, so the reader is only blocked on the
+ * stream while it has nothing to give, or on the consumers when the
+ * ring is full.  Reads from one pipe are serialized by the kernel
+ * anyway, so more readers would not get data any sooner.
+ */
+class ring_input : public input_source
+{
+public:
+    /**
+     * @param fd file descriptor to read from
+     * @param chunk_size approximate number of bytes given to a consumer
+     *                   at a time, fixed or adapting to the consumers
+     * @param num_consumers number of consumer threads
+     * @param head bytes already read from the file descriptor
+     */
+    ring_input (const int fd,
+		const chunk_sizer& chunk_size,
+		const size_t num_consumers,
+		const std::string& head = std::string());
+    ~ring_input();
+
+    /**
+     * Read all data from the file descriptor into the ring, with one
+     * blocking read at a time.  This is run by the reading thread, and
+     * returns when the stream is exhausted or a consumer has failed.
+     * @returns the number of bytes read
+     */
+    size_t read_input();
+
+    /**
+     * @returns the size of the ring in bytes.  The ring grows if a line
+     *          or record does not fit in it.
+     */
+    size_t capacity() const {return _capacity;}
+
+    virtual input_buffer* consumer_get (const size_t id) final;
+    virtual input_buffer* consumer_swap (input_buffer* buffer,
+					 const size_t id) final;
+    virtual void consumer_fail (const size_t id) final;
+
+    ring_input (const ring_input&) = delete;
+    ring_input& operator=(const ring_input&) = delete;
+
+private:
+    struct segment
+    {
+	size_t start;
+	size_t end;
+	bool done;
+    };
+
+    input_buffer* next_segment (const size_t id,
+				std::unique_lock<std::mutex>& lock);
+    void publish (const bool all);
+    void publish_records (const bool all);
+    void add_segment (const size_t end);
+    void grow();
+    char* at (const size_t pos) {return _ring + pos % _capacity;}
+
+    const int _fd;
+    chunk_sizer _chunk_size;
+    const record_format::type _format;
+    char* _ring = nullptr;
+    size_t _capacity;
+
+    std::mutex _mutex;
+    std::condition_variable _data_cv;
+    std::condition_variable _space_cv;
+    size_t _write_pos = 0;   // stream position of next byte to read
+    size_t _publish_pos = 0; // end of the last segment given out
+    size_t _record_pos = 0;  // end of the whole records read so far
+    size_t _release_pos = 0; // end of the last segment processed
+    std::deque<segment> _segments;
+    size_t _first_segment = 0;  // sequence number of _segments.front()
+    size_t _next_segment = 0;   // sequence number of next to consume
+    std::vector<size_t> _consumer_segment;
+    std::vector<std::chrono::steady_clock::time_point> _handed_out;
+    std::vector<input_buffer> _views;
+    size_t _waiting = 0;
+    bool _eof = false;
+    bool _failed = false;
+};
+
+#endif
@@ -0,0 +1,233 @@
+/* -*- C++ -*-
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef _HEXTREME_MAPREDO_RUN_FORMAT_H
+#define _HEXTREME_MAPREDO_RUN_FORMAT_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+
+#include "base.h"
+
+/**
+ * The binary format of the records in the sorted temporary files.
+ * Each record is the size of its key and the size of its value as
+ * varints, followed by the key and the value.  String keys are
+ * nul-terminated, and so are all values, so that they can be given to
+ * reducers straight from the read buffer.  Numeric keys are stored as
+ * 8 bytes in native byte order, so the merge compares them without
+ * parsing them.  Text is only produced by the reducers, for the final
+ * output.
+ */
+class run_format
+{
+public:
+    /**
+     * @param keylen length of the key as text
+     * @param valuelen length of the value
+     * @returns the most bytes encode() may write for a record
+     */
+    static size_t max_size (const size_t keylen, const size_t valuelen) {
+	return 2 * _max_varint + std::max(keylen, sizeof(int64_t)) + 1
+	    + valuelen + 1;
+    }
+
+    /**
+     * @param length length of a tab separated key and value
+     * @returns the most bytes encode_line() may write for them
+     */
+    static size_t max_line_size (const size_t length) {
+	return 2 * _max_varint + length + sizeof(int64_t) + 2;
+    }
+
+    /**
+     * Encode a record with a text key
+     * @param out where to write, with room for max_size() bytes
+     * @param type key type.  Numeric keys are parsed.
+     * @param key the key, not nul-terminated
+     * @param keylen length of the key
+     * @param value the value, not nul-terminated
+     * @param valuelen length of the value
+     * @returns the number of bytes written
+     */
+    static size_t encode (char* const out, const mapredo::base::keytype type,
+			  const char* const key, const size_t keylen,
+			  const char* const value, const size_t valuelen);
+
+    /**
+     * Encode a record with a numeric key
+     * @param out where to write, with room for max_size() bytes
+     * @param key the key
+     * @param value the value, not nul-terminated
+     * @param valuelen length of the value
+     * @returns the number of bytes written
+     */
+    template<typename T> static size_t
+    encode (char* const out, const T key, const char* const value,
+	    const size_t valuelen) {
+	char* pos = put_varint (out, sizeof(key));
+
+	pos = put_varint (pos, valuelen);
+	memcpy (pos, &key, sizeof(key));
+
+	return put_value (pos + sizeof(key), value, valuelen) - out;
+    }
+
+    /**
+     * Encode a tab separated key and value, or a key without a tab
+     * @param out where to write, with room for max_size() bytes
+     * @param type key type
+     * @param line the line, not newline terminated
+     * @param length length of the line
+     * @returns the number of bytes written
+     */
+    static size_t encode_line (char* const out,
+			       const mapredo::base::keytype type,
+			       const char* const line, const size_t length) {
+	const char* tab = static_cast<const char*>(memchr (line, '\t',
+							   length));
+	if (!tab) return encode (out, type, line, length, "", 0);
+
+	const size_t keylen = tab - line;
+
+	return encode (out, type, line, keylen, tab + 1, length - keylen - 1);
+    }
+
+    /**
+     * Read the header of a record
+     * @param pos start of the record
+     * @param end end of the available data
+     * @param keysize set to the size of the key, without any nul
+     * @param valuesize set to the size of the value, without its nul
+     * @returns the size of the header, or 0 if it is incomplete
+     */
+    static size_t header (const char* const pos, const char* const end,
+			  uint64_t& keysize, uint64_t& valuesize) {
+	const size_t keyheader = get_varint (pos, end, keysize);
+
+	if (!keyheader) return 0;
+
+	const size_t valueheader = get_varint (pos + keyheader, end,
+					       valuesize);
+
+	return valueheader ? keyheader + valueheader : 0;
+    }
+
+    /**
+     * Parse a numeric key given as text
+     * @param key the key, not nul-terminated
+     * @param keylen length of the key
+     */
+    template<typename T> static T parse (const char* const key,
+					 const size_t keylen);
+
+private:
+    /** Bytes of the varint of a size below 4 GB */
+    static const size_t _max_varint = 5;
+
+    static char* put_varint (char* pos, uint64_t value) {
+	while (value >= 0x80)
+	{
+	    *pos++ = char(value | 0x80);
+	    value >>= 7;
+	}
+	*pos++ = char(value);
+
+	return pos;
+    }
+
+    static size_t get_varint (const char* const pos, const char* const end,
+			      uint64_t& value) {
+	const unsigned char* p = reinterpret_cast<const unsigned char*>(pos);
+	const size_t available = end - pos;
+
+	value = 0;
+	for (size_t i = 0; i < available; i++)
+	{
+	    if (i == 10)
+	    {
+		throw std::runtime_error ("Invalid record in temporary file");
+	    }
+	    value |= uint64_t(p[i] & 0x7f) << (7 * i);
+	    if (!(p[i] & 0x80)) return i + 1;
+	}
+	return 0;
+    }
+
+    static char* put_value (char* const pos, const char* const value,
+			    const size_t valuelen) {
+	memcpy (pos, value, valuelen);
+	pos[valuelen] = '\0';
+
+	return pos + valuelen + 1;
+    }
+
+    /** Copy a key which is not nul-terminated, for parsing */
+    static const char* terminated (const char* const key, const size_t keylen,
+				   char (&buf)[64]) {
+	const size_t size = std::min (keylen, sizeof(buf) - 1);
+
+	memcpy (buf, key, size);
+	buf[size] = '\0';
+
+	return buf;
+    }
+};
+
+template<> inline int64_t
+run_format::parse (const char* const key, const size_t keylen)
+{
+    char buf[64];
+    return atoll (terminated (key, keylen, buf));
+}
+
+template<> inline double
+run_format::parse (const char* const key, const size_t keylen)
+{
+    char buf[64];
+    return atof (terminated (key, keylen, buf));
+}
+
+inline size_t
+run_format::encode (char* const out, const mapredo::base::keytype type,
+		    const char* const key, const size_t keylen,
+		    const char* const value, const size_t valuelen)
+{
+    switch (type)
+    {
+    case mapredo::base::INT64:
+	return encode (out, parse<int64_t> (key, keylen), value, valuelen);
+    case mapredo::base::DOUBLE:
+	return encode (out, parse<double> (key, keylen), value, valuelen);
+    case mapredo::base::STRING:
+    case mapredo::base::UNKNOWN:
+	break;
+    }
+
+    char* pos = put_varint (out, keylen);
+
+    pos = put_varint (pos, valuelen);
+    memcpy (pos, key, keylen);
+    pos[keylen] = '\0';
+
+    return put_value (pos + keylen + 1, value, valuelen) - out;
+}
+
+#endif
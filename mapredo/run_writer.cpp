@@ -0,0 +1,142 @@
+/*
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+
+#include "run_writer.h"
+#include "compression.h"
+
+run_writer::run_writer (const std::string& filename, const size_t partitions,
+			compression* const compressor) :
+    _filename (filename),
+    _partitions (partitions),
+    _compressor (compressor)
+{
+    _file.open (filename, std::ofstream::binary);
+    if (!_file)
+    {
+	char err[80];
+#ifdef _WIN32
+	strerror_s (err, sizeof(err), errno);
+#endif
+	throw std::invalid_argument
+	    ("Unable to open " + filename + " for writing: "
+#ifndef _WIN32
+	     + strerror_r (errno, err, sizeof(err))
+#else
+	     + err
+#endif
+	    );
+    }
+
+    if (compressor)
+    {
+	_inbuffer.reset (new char[_inbuffer_size]);
+	_outbuffer.reset (new char[_outbuffer_size]);
+    }
+}
+
+run_writer::~run_writer()
+{
+    if (_file.is_open())
+    {
+	_file.close();
+	std::remove (_filename.c_str());
+    }
+}
+
+void
+run_writer::start (const size_t partition)
+{
+    if (_inbufpos) write_block();
+
+    const uint64_t offset = _file.tellp();
+
+    do _offsets.push_back (offset);
+    while ((_offsets.size() - 1) % _partitions != partition);
+}
+
+void
+run_writer::write (const char* data, const size_t size)
+{
+    if (!_compressor)
+    {
+	_file.write (data, size);
+	return;
+    }
+    const char* pos = data;
+    size_t left = size;
+
+    while (_inbufpos + left > _inbuffer_size)
+    {
+	// Only data bigger than a block is split between blocks
+	const size_t part = (left > _inbuffer_size
+			     ? _inbuffer_size - _inbufpos : 0);
+
+	memcpy (_inbuffer.get() + _inbufpos, pos, part);
+	_inbufpos += part;
+	pos += part;
+	left -= part;
+	write_block();
+    }
+    memcpy (_inbuffer.get() + _inbufpos, pos, left);
+    _inbufpos += left;
+}
+
+void
+run_writer::close (std::vector<std::list<tmpfile_section>>& tmpfiles)
+{
+    if (_inbufpos) write_block();
+    _offsets.push_back (_file.tellp());
+
+    if (_partitions > 1)
+    {
+	tmpfile_section::write_index (_file, _offsets, _partitions);
+    }
+    _file.close();
+    if (!_file)
+    {
+	throw std::runtime_error ("Error writing " + _filename);
+    }
+
+    if (_partitions == 1)
+    {
+	tmpfiles[0].emplace_back (_filename);
+	return;
+    }
+
+    auto sections (tmpfile_section::sections (_filename, _offsets,
+					      _partitions));
+
+    for (size_t i = 0; i < _partitions; i++)
+    {
+	if (sections[i].size()) tmpfiles[i].push_back (sections[i]);
+    }
+}
+
+void
+run_writer::write_block()
+{
+    size_t outbufpos = _outbuffer_size;
+
+    _compressor->compress (_inbuffer.get(), _inbufpos,
+			   _outbuffer.get(), outbufpos);
+    _file.write (_outbuffer.get(), outbufpos);
+    _inbufpos = 0;
+}
@@ -0,0 +1,87 @@
+/* -*- C++ -*-
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef _HEXTREME_MAPREDO_RUN_WRITER_H
+#define _HEXTREME_MAPREDO_RUN_WRITER_H
+
+#include <string>
+#include <vector>
+#include <list>
+#include <fstream>
+#include <memory>
+
+#include "tmpfile_section.h"
+
+class compression;
+
+/**
+ * Writes a sorted run of records to a temporary file.  The records of
+ * each partition are written as extents of the file, going round the
+ * partitions in order, and each extent starts a new compressed block
+ * so that it can be read on its own.
+ */
+class run_writer
+{
+public:
+    /**
+     * @param filename name of the file, which is created
+     * @param partitions number of partitions.  Files with more than
+     *                   one end with an index of the extents.
+     * @param compressor if not nullptr, used to compress the data
+     */
+    run_writer (const std::string& filename, const size_t partitions,
+		compression* const compressor);
+    /** Removes the file if it was not closed */
+    ~run_writer();
+
+    /**
+     * Start an extent for the records of a partition.  Partitions
+     * skipped since the last extent get empty extents.
+     */
+    void start (const size_t partition);
+
+    /** Write records to the current extent */
+    void write (const char* data, const size_t size);
+
+    /**
+     * Write the index and close the file
+     * @param tmpfiles the file, or its sections for the partitions
+     *                 with records, is added to the list of each
+     *                 partition
+     */
+    void close (std::vector<std::list<tmpfile_section>>& tmpfiles);
+
+    run_writer (const run_writer&) = delete;
+    run_writer& operator=(const run_writer&) = delete;
+
+private:
+    void write_block();
+
+    static const size_t _inbuffer_size = 0x10000;
+    static const size_t _outbuffer_size = 0x15000;
+
+    const std::string _filename;
+    const size_t _partitions;
+    compression* const _compressor;
+    std::ofstream _file;
+    std::unique_ptr<char[]> _inbuffer;
+    std::unique_ptr<char[]> _outbuffer;
+    size_t _inbufpos = 0;
+    std::vector<uint64_t> _offsets;
+};
+
+#endif
@@ -0,0 +1,280 @@
+/*
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <stdexcept>
+
+#include "scanner.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCANNER_X86
+#include <immintrin.h>
+#endif
+
+static const char*
+scalar_find (const char* begin, const char* end, const char c)
+{
+    for (; begin < end; begin++)
+    {
+	if (*begin == c) return begin;
+    }
+    return nullptr;
+}
+
+static const char*
+scalar_find_either (const char* begin, const char* end,
+		    const char c1, const char c2)
+{
+    for (; begin < end; begin++)
+    {
+	if (*begin == c1 || *begin == c2) return begin;
+    }
+    return nullptr;
+}
+
+static const char*
+scalar_rfind (const char* begin, const char* end, const char c)
+{
+    while (end > begin)
+    {
+	if (*--end == c) return end;
+    }
+    return nullptr;
+}
+
+#ifdef SCANNER_X86
+/*
+ * The vector versions compare whole blocks, and handle what is left at
+ * the end with one more block overlapping the data already searched,
+ * ignoring the bytes from the overlap.  Only data shorter than a block
+ * is searched byte by byte.
+ */
+
+__attribute__((target("sse2"))) static inline unsigned
+sse2_matches (const char* pos, const __m128i c)
+{
+    const __m128i data
+	= _mm_loadu_si128 (reinterpret_cast<const __m128i*>(pos));
+    return _mm_movemask_epi8 (_mm_cmpeq_epi8 (data, c));
+}
+
+__attribute__((target("sse2"))) static inline unsigned
+sse2_matches (const char* pos, const __m128i c1, const __m128i c2)
+{
+    const __m128i data
+	= _mm_loadu_si128 (reinterpret_cast<const __m128i*>(pos));
+    return _mm_movemask_epi8 (_mm_or_si128 (_mm_cmpeq_epi8 (data, c1),
+					    _mm_cmpeq_epi8 (data, c2)));
+}
+
+__attribute__((target("sse2"))) static const char*
+sse2_find (const char* begin, const char* end, const char c)
+{
+    if (end - begin < 16) return scalar_find (begin, end, c);
+
+    const __m128i vc = _mm_set1_epi8 (c);
+    unsigned mask;
+
+    for (; end - begin >= 16; begin += 16)
+    {
+	if ((mask = sse2_matches (begin, vc)))
+	{
+	    return begin + __builtin_ctz (mask);
+	}
+    }
+    if (begin < end)
+    {
+	mask = sse2_matches (end - 16, vc) >> (16 - (end - begin));
+	if (mask) return begin + __builtin_ctz (mask);
+    }
+    return nullptr;
+}
+
+__attribute__((target("sse2"))) static const char*
+sse2_find_either (const char* begin, const char* end,
+		  const char c1, const char c2)
+{
+    if (end - begin < 16) return scalar_find_either (begin, end, c1, c2);
+
+    const __m128i vc1 = _mm_set1_epi8 (c1);
+    const __m128i vc2 = _mm_set1_epi8 (c2);
+    unsigned mask;
+
+    for (; end - begin >= 16; begin += 16)
+    {
+	if ((mask = sse2_matches (begin, vc1, vc2)))
+	{
+	    return begin + __builtin_ctz (mask);
+	}
+    }
+    if (begin < end)
+    {
+	mask = sse2_matches (end - 16, vc1, vc2) >> (16 - (end - begin));
+	if (mask) return begin + __builtin_ctz (mask);
+    }
+    return nullptr;
+}
+
+__attribute__((target("sse2"))) static const char*
+sse2_rfind (const char* begin, const char* end, const char c)
+{
+    if (end - begin < 16) return scalar_rfind (begin, end, c);
+
+    const __m128i vc = _mm_set1_epi8 (c);
+    unsigned mask;
+
+    for (; end - begin >= 16; end -= 16)
+    {
+	if ((mask = sse2_matches (end - 16, vc)))
+	{
+	    return end - 16 + 31 - __builtin_clz (mask);
+	}
+    }
+    if (begin < end)
+    {
+	mask = sse2_matches (begin, vc) & ((1u << (end - begin)) - 1);
+	if (mask) return begin + 31 - __builtin_clz (mask);
+    }
+    return nullptr;
+}
+
+__attribute__((target("avx2"))) static inline unsigned
+avx2_matches (const char* pos, const __m256i c)
+{
+    const __m256i data
+	= _mm256_loadu_si256 (reinterpret_cast<const __m256i*>(pos));
+    return _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (data, c));
+}
+
+__attribute__((target("avx2"))) static inline unsigned
+avx2_matches (const char* pos, const __m256i c1, const __m256i c2)
+{
+    const __m256i data
+	= _mm256_loadu_si256 (reinterpret_cast<const __m256i*>(pos));
+    return _mm256_movemask_epi8 (_mm256_or_si256
+				 (_mm256_cmpeq_epi8 (data, c1),
+				  _mm256_cmpeq_epi8 (data, c2)));
+}
+
+__attribute__((target("avx2"))) static const char*
+avx2_find (const char* begin, const char* end, const char c)
+{
+    if (end - begin < 32) return sse2_find (begin, end, c);
+
+    const __m256i vc = _mm256_set1_epi8 (c);
+    unsigned mask;
+
+    for (; end - begin >= 32; begin += 32)
+    {
+	if ((mask = avx2_matches (begin, vc)))
+	{
+	    return begin + __builtin_ctz (mask);
+	}
+    }
+    if (begin < end)
+    {
+	mask = avx2_matches (end - 32, vc) >> (32 - (end - begin));
+	if (mask) return begin + __builtin_ctz (mask);
+    }
+    return nullptr;
+}
+
+__attribute__((target("avx2"))) static const char*
+avx2_find_either (const char* begin, const char* end,
+		  const char c1, const char c2)
+{
+    if (end - begin < 32) return sse2_find_either (begin, end, c1, c2);
+
+    const __m256i vc1 = _mm256_set1_epi8 (c1);
+    const __m256i vc2 = _mm256_set1_epi8 (c2);
+    unsigned mask;
+
+    for (; end - begin >= 32; begin += 32)
+    {
+	if ((mask = avx2_matches (begin, vc1, vc2)))
+	{
+	    return begin + __builtin_ctz (mask);
+	}
+    }
+    if (begin < end)
+    {
+	mask = avx2_matches (end - 32, vc1, vc2) >> (32 - (end - begin));
+	if (mask) return begin + __builtin_ctz (mask);
+    }
+    return nullptr;
+}
+
+__attribute__((target("avx2"))) static const char*
+avx2_rfind (const char* begin, const char* end, const char c)
+{
+    if (end - begin < 32) return sse2_rfind (begin, end, c);
+
+    const __m256i vc = _mm256_set1_epi8 (c);
+    unsigned mask;
+
+    for (; end - begin >= 32; end -= 32)
+    {
+	if ((mask = avx2_matches (end - 32, vc)))
+	{
+	    return end - 32 + 31 - __builtin_clz (mask);
+	}
+    }
+    if (begin < end)
+    {
+	mask = avx2_matches (begin, vc) & ((1u << (end - begin)) - 1);
+	if (mask) return begin + 31 - __builtin_clz (mask);
+    }
+    return nullptr;
+}
+#endif
+
+const scanner::implementation scanner::_implementations[] =
+{
+    {scanner::SCALAR, scalar_find, scalar_find_either, scalar_rfind},
+#ifdef SCANNER_X86
+    {scanner::SSE2, sse2_find, sse2_find_either, sse2_rfind},
+    {scanner::AVX2, avx2_find, avx2_find_either, avx2_rfind},
+#endif
+};
+
+// Usable before the choice below is made, by other static initializers
+const scanner::implementation* scanner::_impl = &_implementations[0];
+
+scanner::level
+scanner::supported()
+{
+#ifdef SCANNER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports ("avx2")) return AVX2;
+    if (__builtin_cpu_supports ("sse2")) return SSE2;
+#endif
+    return SCALAR;
+}
+
+void
+scanner::use (const level lvl)
+{
+    if (lvl > supported())
+    {
+	throw std::invalid_argument
+	    ("Delimiter scanning implementation not supported by processor");
+    }
+    _impl = &_implementations[lvl];
+}
+
+static const struct scanner_setup
+{
+    scanner_setup() {scanner::use (scanner::supported());}
+} setup;
@@ -0,0 +1,96 @@
+/* -*- C++ -*-
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef _HEXTREME_MAPREDO_SCANNER_H
+#define _HEXTREME_MAPREDO_SCANNER_H
+
+#include <cstddef>
+
+/**
+ * Searches for delimiters such as newlines and tabs, many bytes at a
+ * time.  SSE2 or AVX2 is used when the processor supports it, with a
+ * plain byte by byte search as the fallback.  The choice is made once,
+ * when the library is loaded.
+ */
+class scanner
+{
+public:
+    enum level {SCALAR, SSE2, AVX2};
+
+    /**
+     * Find the first occurrence of a byte.
+     * @param begin start of the data to search
+     * @param end end of the data to search
+     * @param c byte to look for
+     * @returns pointer to the byte found, or nullptr
+     */
+    static const char* find (const char* begin, const char* end,
+			     const char c) {
+	return _impl->find (begin, end, c);
+    }
+
+    /**
+     * Find the first occurrence of either of two bytes.
+     * @param begin start of the data to search
+     * @param end end of the data to search
+     * @param c1 byte to look for
+     * @param c2 other byte to look for
+     * @returns pointer to the byte found, or nullptr
+     */
+    static const char* find_either (const char* begin, const char* end,
+				    const char c1, const char c2) {
+	return _impl->find_either (begin, end, c1, c2);
+    }
+
+    /**
+     * Find the last occurrence of a byte.
+     * @param begin start of the data to search
+     * @param end end of the data to search
+     * @param c byte to look for
+     * @returns pointer to the byte found, or nullptr
+     */
+    static const char* rfind (const char* begin, const char* end,
+			      const char c) {
+	return _impl->rfind (begin, end, c);
+    }
+
+    /** @returns the fastest implementation supported by the processor */
+    static level supported();
+
+    /** @returns the implementation in use */
+    static level used() {return _impl->lvl;}
+
+    /**
+     * Select an implementation, for testing and benchmarking.
+     * @param lvl implementation to use, must be supported
+     */
+    static void use (const level lvl);
+
+private:
+    struct implementation
+    {
+	level lvl;
+	const char* (*find)(const char*, const char*, char);
+	const char* (*find_either)(const char*, const char*, char, char);
+	const char* (*rfind)(const char*, const char*, char);
+    };
+
+    static const implementation _implementations[];
+    static const implementation* _impl;
+};
+
+#endif
@@ -20,6 +20,8 @@
 #include <cstdint>
 #include <string>
 
+#include "record_format.h"
+
 /** Global settings for the engine */
 class settings
 {
@@ -41,6 +43,20 @@ public:
 	if (on) _sort_output = true;
 	_reverse_sort = on;
     }
+    bool replacement_selection() const {return _replacement_selection;}
+    void set_replacement_selection (const bool on = true) {
+	_replacement_selection = on;
+    }
+    bool input_sorted() const {return _input_sorted;}
+    void set_input_sorted (const bool on = true) {_input_sorted = on;}
+    bool lock_free_handoff() const {return _lock_free_handoff;}
+    void set_lock_free_handoff (const bool on = true) {
+	_lock_free_handoff = on;
+    }
+    record_format::type input_format() const {return _input_format;}
+    void set_input_format (const record_format::type fmt) {
+	_input_format = fmt;
+    }
 
 private:
     settings() = default;
@@ -50,6 +66,10 @@ private:
     bool _keep_tmpfiles = false;
     bool _sort_output = false;
     bool _reverse_sort = false;
+    bool _replacement_selection = false;
+    bool _input_sorted = false;
+    bool _lock_free_handoff = false;
+    record_format::type _input_format = record_format::LINES;
 };
 
 #endif
@@ -0,0 +1,99 @@
+/*
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "sorted_reducer.h"
+#include "lookup.h"
+
+sorted_reducer::sorted_reducer (mapredo::base& reducer,
+				const size_t bytes_batch, const bool reverse) :
+    _combiner (reducer),
+    _type (reducer.type()),
+    _bytes_batch (bytes_batch),
+    _reverse (reverse)
+{}
+
+void
+sorted_reducer::add (const char* line, const size_t keylen,
+		     const size_t length)
+{
+    uint64_t prefix;
+
+    switch (_type)
+    {
+    case mapredo::base::INT64:
+	prefix = lookup::integer_prefix (atoll(line));
+	break;
+    case mapredo::base::DOUBLE:
+	prefix = lookup::real_prefix (atof(line));
+	break;
+    default:
+	prefix = lookup::string_prefix (line, keylen);
+	break;
+    }
+
+    const int cmp = (_lines.empty() ? 1 : compare (line, keylen, prefix));
+
+    if (cmp < 0)
+    {
+	throw std::runtime_error
+	    ("Input is not sorted at key " + std::string(line, keylen));
+    }
+    if (cmp > 0)
+    {
+	// The batch only holds whole groups when a new key starts
+	if (_lines.size() >= _bytes_batch) flush();
+	_last_prefix = prefix;
+	if (_type == mapredo::base::STRING) _last_key.assign (line, keylen);
+    }
+    _lines.append (line, length);
+    _lines += '\n';
+}
+
+void
+sorted_reducer::flush()
+{
+    if (_lines.empty()) return;
+
+    _output.clear();
+    _combiner.combine (_lines.data(), _lines.size(), _output);
+    fwrite (_output.data(), 1, _output.size(), stdout);
+    _lines.clear();
+}
+
+int
+sorted_reducer::compare (const char* const key, const size_t keylen,
+			 const uint64_t prefix) const
+{
+    int cmp = (prefix > _last_prefix) - (prefix < _last_prefix);
+
+    if (cmp == 0 && _type == mapredo::base::STRING)
+    {
+	cmp = memcmp (key, _last_key.data(),
+		      std::min (keylen, _last_key.size()));
+	if (cmp == 0)
+	{
+	    cmp = (keylen > _last_key.size()) - (keylen < _last_key.size());
+	}
+    }
+
+    return _reverse ? -cmp : cmp;
+}
@@ -0,0 +1,79 @@
+/* -*- C++ -*-
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef _HEXTREME_MAPREDO_SORTED_REDUCER_H
+#define _HEXTREME_MAPREDO_SORTED_REDUCER_H
+
+#include <string>
+#include <cstdint>
+
+#include "combiner.h"
+
+/**
+ * Reduces mapper output that is already in key order, such as when
+ * the input is the sorted output of another job, without sorting or
+ * temporary files.  Records are gathered into a batch, and when the
+ * batch is full the groups of records with the same key in it are
+ * reduced, and the output written to standard output.  A group is
+ * never split between batches, so the batch grows to hold a whole
+ * group if needed.
+ */
+class sorted_reducer
+{
+public:
+    /**
+     * @param reducer mapreducer object to reduce with.  This must not
+     *                be the object doing the mapping, as reduce() may
+     *                use the same output buffer as map().
+     * @param bytes_batch number of bytes of records in each batch
+     * @param reverse if true, keys come in descending order instead
+     *                of ascending
+     */
+    sorted_reducer (mapredo::base& reducer, const size_t bytes_batch,
+		    const bool reverse);
+
+    /**
+     * Add a record, which may not sort before the one added before it.
+     * @param line key and value, tab separated
+     * @param keylen length of the key
+     * @param length length of the line
+     * @throws std::runtime_error if the record is out of order
+     */
+    void add (const char* line, const size_t keylen, const size_t length);
+
+    /** Reduce and output all records added so far */
+    void flush();
+
+private:
+    /**
+     * @returns the order of a key compared to the last one added, like
+     *          memcmp() does
+     */
+    int compare (const char* const key, const size_t keylen,
+		 const uint64_t prefix) const;
+
+    combiner _combiner;
+    const mapredo::base::keytype _type;
+    const size_t _bytes_batch;
+    const bool _reverse;
+    std::string _lines; // newline terminated records of the batch
+    std::string _output;
+    uint64_t _last_prefix = 0;
+    std::string _last_key; // only for string keys
+};
+
+#endif
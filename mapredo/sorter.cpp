@@ -21,249 +21,565 @@
 #include <iostream>
 #include <memory>
 #include <cerrno>
+#include <thread>
+#include <cstring>
 
 #include "sorter.h"
 #include "tmpfile_reader.h"
 #include "file_merger.h"
 #include "settings.h"
 #include "compression.h"
+#include "radix_sort.h"
+#include "run_format.h"
+#include "run_writer.h"
+#include "thread_pool.h"
 
 sorter::sorter (const std::string& tmpdir,
-		const uint16_t hash_index,
+		const uint16_t partitions,
 		const uint16_t worker_index,
 		const size_t bytes_buffer,
 		const mapredo::base::keytype type,
-		const bool reverse) :
-    _buffer (bytes_buffer, 3.0),
+		const bool reverse,
+		mapredo::base* const reducer,
+		thread_pool* const pool) :
+    _buffer (new sorter_buffer
+	     (pool && !settings::instance().replacement_selection()
+	      ? bytes_buffer / 2 : bytes_buffer, 3.0, type)),
+    _pool (pool),
     _tmpdir (tmpdir),
     _bytes_per_buffer (bytes_buffer),
-    _index (hash_index),
+    _partitions (partitions),
+    _tmpfiles (partitions),
+    _replacement_selection (settings::instance().replacement_selection()),
+    _run_ends (partitions),
     _type (type),
     _reverse (reverse)
 {
     std::ostringstream filename;
 
-    filename << tmpdir << "/sort_" << std::this_thread::get_id()
-	     << ".h" << hash_index << ".w" << worker_index << ".n";
+    // Files with more than one partition end with an index of them
+    filename << tmpdir << "/sort_" << std::this_thread::get_id();
+    if (partitions > 1) filename << ".p" << partitions;
+    else filename << ".h0";
+    filename << ".w" << worker_index << ".n";
     _file_prefix = filename.str();
 
     if (settings::instance().compressed()) 
     {
 	_compressor.reset (new compression());
     }
+    if (reducer) _combiner.reset (new combiner (*reducer));
 }
 
 sorter::sorter (sorter&& other) noexcept :
     _buffer (std::move(other._buffer)),
+    _spare (std::move(other._spare)),
+    _pool (other._pool),
+    _ratio (other._ratio),
     _tmpdir (std::move(other._tmpdir)),
     _bytes_per_buffer (other._bytes_per_buffer),
-    _index (other._index),
+    _partitions (other._partitions),
     _file_prefix (std::move(other._file_prefix)),
+    _tmpfiles (std::move(other._tmpfiles)),
     _compressor (std::move(other._compressor)),
+    _combiner (std::move(other._combiner)),
+    _replacement_selection (other._replacement_selection),
+    _open_run (std::move(other._open_run)),
+    _run_ends (std::move(other._run_ends)),
     _type (other._type),
     _reverse (other._reverse)
 {}
 
 sorter::~sorter()
 {
-    for (auto& filename: _tmpfiles) std::remove (filename.c_str());
+    // The buffer may still be written if mapping failed
+    if (_flushing_in_progress) _flush_result.wait();
+    for (auto& tmpfiles: _tmpfiles)
+    {
+	for (auto& tmpfile: tmpfiles) tmpfile.remove();
+    }
 }
 
 void
-sorter::add (const char* keyvalue, const size_t keylen, const size_t size)
+sorter::add (const char* keyvalue, const size_t keylen, const size_t size,
+	     const uint32_t partition)
 {
     make_room (size);
-    _buffer.add (keyvalue, keylen, size);
+    _buffer->add (keyvalue, keylen, size, partition);
 }
 
 char*
 sorter::reserve (const size_t bytes)
 {
     make_room (bytes);
-    return (_buffer.buffer() + _buffer.buffer_used());
+    return _buffer->next_line();
 }
 
 void
-sorter::add_reserved (const size_t keylen, const size_t size)
+sorter::add_reserved (const size_t keylen, const size_t size,
+		      const uint32_t partition)
 {
-  _buffer.add_reserved (keylen, size);
+    _buffer->add_reserved (keylen, size, partition);
 }
 
-std::list<std::string>
-sorter::grab_tmpfiles()
+std::list<tmpfile_section>
+sorter::grab_tmpfiles (const size_t partition)
 {
-    return std::move(_tmpfiles);
+    return std::move(_tmpfiles[partition]);
 }
 
-static bool sorter_r (const lookup& left, const lookup& right)
+void
+sorter::flush()
 {
-    register uint16_t len = std::min(left.keylen(), right.keylen());
-    register uint16_t i;
-    register const char* const lkeyvalue = left.keyvalue();
-    register const char* const rkeyvalue = right.keyvalue();
+    if (_replacement_selection)
+    {
+	extend_runs (true);
+	return;
+    }
+    start_flush();
+    finish_flush();
+}
 
-    for (i = 0; i < len && lkeyvalue[i] == rkeyvalue[i]; i++) ;
+void
+sorter::start_flush()
+{
+    if (_buffer->lookup_used() == 0) return;
 
-    if (i < len) return lkeyvalue[i] > rkeyvalue[i];
-    return left.keylen() > right.keylen();
+    if (!_pool)
+    {
+	write_buffer (*_buffer);
+	return;
+    }
+
+    // Wait for the other buffer, then let it be filled while this one
+    // is written
+    finish_flush();
+    if (!_spare)
+    {
+	_spare.reset (new sorter_buffer (_bytes_per_buffer / 2, 3.0, _type));
+    }
+    std::swap (_buffer, _spare);
+
+    sorter_buffer& full (*_spare);
+
+    _flush_result = _pool->submit ([this, &full]() {
+	    write_buffer (full);
+	});
+    _flushing_in_progress = true;
 }
 
 void
-sorter::flush()
+sorter::finish_flush()
 {
-    if (_buffer.lookup_used() == 0) return;
+    if (!_flushing_in_progress) return;
+
+    _flushing_in_progress = false;
+    _flush_result.get();
+}
 
-    switch (_type)
+void
+sorter::write_buffer (sorter_buffer& buffer)
+{
+    const lookup* const begin = buffer.lookup().data();
+    std::vector<size_t> starts;
+
+    sort_buffer (buffer, starts);
+
+    run_writer run (next_filename(), _partitions, _compressor.get());
+
+    for (size_t i = 0; i < _partitions; i++)
+    {
+	run.start (i);
+	write_records (buffer, begin + starts[i], begin + starts[i + 1], run);
+    }
+    run.close (_tmpfiles);
+    buffer.clear();
+}
+
+void
+sorter::extend_runs (const bool all)
+{
+    sorter_buffer& buffer (*_buffer);
+
+    if (buffer.empty() && !_open_run) return;
+
+    lookup* const entries = buffer.lookup().data();
+    std::vector<size_t> starts;
+
+    sort_buffer (buffer, starts);
+
+    // In each partition, the records sorting before the last one
+    // written to the open run are first, and wait for the next run
+    std::vector<size_t> split (starts.begin(), starts.end() - 1);
+    std::vector<size_t> targets (_partitions);
+    bool end_run = all;
+
+    auto bytes = [&](const lookup& entry) {
+	return buffer.size (entry) + sizeof(lookup);
+    };
+
+    for (size_t i = 0; i < _partitions; i++)
     {
-    case mapredo::base::STRING:
-	if (!_reverse)
+	const run_end& last (_run_ends[i]);
+
+	if (_open_run && last.set)
 	{
-	    std::sort (_buffer.lookup().begin(),
-		       _buffer.lookup().begin() + _buffer.lookup_used());	
+	    split[i] = std::partition_point
+		(entries + starts[i], entries + starts[i + 1],
+		 [&](const lookup& entry) {
+		     return before_run_end (buffer.buffer(), entry, last);
+		 }) - entries;
 	}
-	else
+
+	size_t total = 0;
+	size_t eligible = 0;
+
+	for (size_t j = starts[i]; j < starts[i + 1]; j++)
 	{
-	    std::sort (_buffer.lookup().begin(),
-		       _buffer.lookup().begin() + _buffer.lookup_used(),
-		       &sorter_r);
+	    total += bytes (entries[j]);
+	    if (j >= split[i]) eligible += bytes (entries[j]);
 	}
-	break;
-    case mapredo::base::INT64:
-	if (!_reverse)
+
+	// Half of each partition is written, and the open run ends if
+	// less than that sorts after its end
+	targets[i] = all ? total : total / 2;
+	if (eligible < targets[i]) end_run = true;
+    }
+
+    // Write to the open run from the split, then to a new run from
+    // the start of the partitions if the open run ends
+    std::vector<size_t> old_end (split);
+    std::vector<size_t> new_end (starts.begin(), starts.end() - 1);
+
+    auto extend = [&](const std::vector<size_t>& from,
+		      std::vector<size_t>& to, const size_t* const limits,
+		      const bool whole) {
+	if (!_open_run)
 	{
-	    std::sort (_buffer.lookup().begin(),
-		       _buffer.lookup().begin() + _buffer.lookup_used(),
-		       [](const lookup& left, const lookup& right)
-		       {
-			 return (atoll(left.keyvalue())
-				 < atol(right.keyvalue()));
-		       });
+	    _open_run.reset (new run_writer (next_filename(), _partitions,
+					     _compressor.get()));
+	    for (auto& last: _run_ends) last.set = false;
 	}
-	else
+	for (size_t i = 0; i < _partitions; i++)
 	{
-	    std::sort (_buffer.lookup().begin(),
-		       _buffer.lookup().begin() + _buffer.lookup_used(),
-		       [](const lookup& left, const lookup& right)
-		       {
-			 return (atoll(left.keyvalue())
-				 > atol(right.keyvalue()));
-		       });
+	    size_t written = 0;
+
+	    to[i] = from[i];
+	    while (to[i] < limits[i] && (whole || written < targets[i]))
+	    {
+		written += bytes (entries[to[i]++]);
+	    }
+	    targets[i] -= std::min (targets[i], written);
+	    if (to[i] == from[i]) continue;
+
+	    const lookup& last (entries[to[i] - 1]);
+
+	    _open_run->start (i);
+	    write_records (buffer, entries + from[i], entries + to[i],
+			   *_open_run);
+	    _run_ends[i].set = true;
+	    _run_ends[i].prefix = last.prefix();
+	    if (_type == mapredo::base::STRING)
+	    {
+		_run_ends[i].key.assign (buffer.keyvalue(last), last.keylen());
+	    }
 	}
-	break;
-    case mapredo::base::DOUBLE:
-	if (!_reverse)
+    };
+    auto close = [&]() {
+	_open_run->close (_tmpfiles);
+	_open_run.reset();
+    };
+
+    if (!_open_run || !end_run)
+    {
+	extend (split, old_end, starts.data() + 1, all);
+	if (all) close();
+    }
+    else
+    {
+	// The open run gets all it can before it ends, and the records
+	// waiting for the next run start it
+	extend (split, old_end, starts.data() + 1, true);
+	close();
+	if (split != new_end)
 	{
-	    std::sort (_buffer.lookup().begin(),
-		       _buffer.lookup().begin() + _buffer.lookup_used(),
-		       [](const lookup& left, const lookup& right)
-		       {
-			 return (atof(left.keyvalue())
-				 < atof(right.keyvalue()));
-		       });
+	    extend (std::vector<size_t>(new_end), new_end, split.data(), all);
+	    if (all) close();
 	}
-	else
+    }
+
+    // The records not written are kept for later runs
+    size_t kept = 0;
+
+    for (size_t i = 0; i < _partitions; i++)
+    {
+	for (size_t j = new_end[i]; j < split[i]; j++)
 	{
-	    std::sort (_buffer.lookup().begin(),
-		       _buffer.lookup().begin() + _buffer.lookup_used(),
-		       [](const lookup& left, const lookup& right)
-		       {
-			 return (atof(left.keyvalue())
-				 > atof(right.keyvalue()));
-		       });
+	    entries[kept++] = entries[j];
 	}
-	break;
-    case mapredo::base::UNKNOWN:
-	throw std::runtime_error ("Program error, keytype not set"
-                                  " in mapredo::base");
+	for (size_t j = old_end[i]; j < starts[i + 1]; j++)
+	{
+	    entries[kept++] = entries[j];
+	}
+    }
+    buffer.retain (kept);
+}
+
+void
+sorter::write_records (sorter_buffer& buffer, const lookup* begin,
+		       const lookup* const end, run_writer& run)
+{
+    // The text lines of the buffer are written as binary records
+    auto write_record = [&](const lookup& entry)
+	{
+	    const char* const keyvalue = buffer.keyvalue (entry);
+	    const size_t keylen = entry.keylen();
+	    const size_t size = buffer.size (entry); // with newline
+	    const char* const value = keyvalue + keylen + 1;
+	    const size_t valuelen = (keylen + 1 < size ? size - keylen - 2 : 0);
+	    size_t length;
+
+	    _record.resize (run_format::max_size (keylen, valuelen));
+	    switch (_type)
+	    {
+	    case mapredo::base::INT64:
+		length = run_format::encode
+		    (&_record[0], lookup::integer_key (entry.prefix()),
+		     value, valuelen);
+		break;
+	    case mapredo::base::DOUBLE:
+		length = run_format::encode
+		    (&_record[0], lookup::real_key (entry.prefix()),
+		     value, valuelen);
+		break;
+	    default:
+		length = run_format::encode (&_record[0], _type, keyvalue,
+					     keylen, value, valuelen);
+		break;
+	    }
+	    run.write (_record.data(), length);
+	};
+
+    for (const lookup* iter = begin; iter != end; )
+    {
+	const lookup* next = iter + 1;
+
+	if (_combiner)
+	{
+	    // Combine each run of records with the same key
+	    while (next != end && same_key(buffer.buffer(), *iter, *next))
+	    {
+		++next;
+	    }
+	    if (next - iter > 1)
+	    {
+		_run.clear();
+		for (; iter != next; ++iter)
+		{
+		    _run.append (buffer.keyvalue(*iter), buffer.size(*iter));
+		}
+		_combined.clear();
+		_combiner->combine (_run.data(), _run.size(), _combined);
+
+		// The combiner outputs newline terminated text lines
+		for (size_t pos = 0; pos < _combined.size(); )
+		{
+		    const char* const line = _combined.data() + pos;
+		    const size_t length = static_cast<const char*>
+			(memchr (line, '\n', _combined.size() - pos)) - line;
+
+		    _record.resize (run_format::max_line_size (length));
+		    run.write (_record.data(), run_format::encode_line
+			       (&_record[0], _type, line, length));
+		    pos += length + 1;
+		}
+		continue;
+	    }
+	}
+	write_record (*iter);
+	iter = next;
+    }
+}
+
+void
+sorter::sort_buffer (sorter_buffer& buffer, std::vector<size_t>& starts) const
+{
+    lookup* const begin = buffer.lookup().data();
+
+    switch (presorted (buffer))
+    {
+    case REVERSED:
+	std::reverse (begin, begin + buffer.lookup_used());
+	// fall through
+    case SORTED:
+	group_partitions_stable (buffer, starts);
+	return;
+    case UNSORTED:
 	break;
     }
 
-    std::ofstream tmpfile;
+    group_partitions (buffer, starts);
+    for (size_t i = 0; i < _partitions; i++)
+    {
+	radix_sort::sort (begin + starts[i], begin + starts[i + 1],
+			  buffer.buffer(), _type, _reverse);
+    }
+}
+
+sorter::order
+sorter::presorted (const sorter_buffer& buffer) const
+{
+    const lookup* const entries = buffer.lookup().data();
+    const size_t used = buffer.lookup_used();
+    bool ascending = true;
+    bool descending = true;
+
+    // Random keys are told apart after a few entries
+    for (size_t i = 1; i < used && (ascending || descending); i++)
+    {
+	const int cmp = compare_keys (buffer.buffer(), entries[i - 1],
+				      entries[i]);
+	if (cmp > 0) ascending = false;
+	else if (cmp < 0) descending = false;
+    }
+
+    if (ascending) return SORTED;
+    if (descending) return REVERSED;
+    return UNSORTED;
+}
+
+std::string
+sorter::next_filename()
+{
     std::ostringstream filename;
 
     filename << _file_prefix << _tmpfile_id++;
     if (_compressor.get()) filename << ".snappy";
 
-    tmpfile.open (filename.str(), std::ofstream::binary);
-    if (!tmpfile)
+    return filename.str();
+}
+
+void
+sorter::group_partitions (sorter_buffer& buffer,
+			  std::vector<size_t>& starts) const
+{
+    lookup* const entries = buffer.lookup().data();
+    const size_t used = buffer.lookup_used();
+
+    starts.assign (_partitions + 1, 0);
+    if (_partitions == 1)
     {
-	char err[80];
-#ifdef _WIN32
-	strerror_s (err, sizeof(err), errno);
-#endif
-	throw std::invalid_argument
-	    ("Unable to open " + filename.str() + " for writing: "
-#ifndef _WIN32
-	     + strerror_r (errno, err, sizeof(err))
-#else
-	     + err
-#endif
-	    );
+	starts[1] = used;
+	return;
     }
 
-    auto end = _buffer.lookup().cbegin() + _buffer.lookup_used();
+    for (size_t i = 0; i < used; i++)
+    {
+	starts[buffer.partition(entries[i]) + 1]++;
+    }
+    for (size_t i = 1; i <= _partitions; i++) starts[i] += starts[i - 1];
 
-    if (_compressor.get())
+    // Swap each entry into the next free place of its partition, as
+    // in the first pass of an American flag sort
+    std::vector<size_t> next (starts.begin(), starts.end() - 1);
+
+    for (size_t i = 0; i < _partitions; i++)
     {
-	const size_t inbuffer_size = 0x10000;
-	const size_t outbuffer_size = 0x15000;
-	std::unique_ptr<char[]> inbuffer (new char[inbuffer_size]);
-	std::unique_ptr<char[]> outbuffer (new char[outbuffer_size]);
-	size_t inbufpos = 0;
-	size_t outbufpos = outbuffer_size;
-
-	for (auto iter = _buffer.lookup().begin(); iter != end; iter++)
+	while (next[i] < starts[i + 1])
 	{
-	    if (inbufpos + iter->size() > inbuffer_size)
-	    {
-		_compressor->compress (inbuffer.get(), inbufpos,
-				       outbuffer.get(), outbufpos);
-		tmpfile.write (outbuffer.get(), outbufpos);
-		inbufpos = 0;
-		outbufpos = outbuffer_size;
-	    }
-	    memcpy (inbuffer.get() + inbufpos, iter->keyvalue(), iter->size());
-	    inbufpos += iter->size();
+	    const uint32_t partition = buffer.partition (entries[next[i]]);
+
+	    if (partition == i) next[i]++;
+	    else std::swap (entries[next[i]], entries[next[partition]++]);
 	}
-	_compressor->compress (inbuffer.get(), inbufpos,
-				outbuffer.get(), outbufpos);
-	tmpfile.write (outbuffer.get(), outbufpos);
     }
-    else
+}
+
+void
+sorter::group_partitions_stable (sorter_buffer& buffer,
+				 std::vector<size_t>& starts) const
+{
+    lookup* const entries = buffer.lookup().data();
+    const size_t used = buffer.lookup_used();
+
+    starts.assign (_partitions + 1, 0);
+    if (_partitions == 1)
     {
-	for (auto iter = _buffer.lookup().begin(); iter != end; iter++)
-	{
-	    tmpfile.write (iter->keyvalue(), iter->size());
-	}
+	starts[1] = used;
+	return;
+    }
+
+    for (size_t i = 0; i < used; i++)
+    {
+	starts[buffer.partition(entries[i]) + 1]++;
+    }
+    for (size_t i = 1; i <= _partitions; i++) starts[i] += starts[i - 1];
+
+    // A counting sort through a copy of the entries
+    std::vector<lookup> grouped (used);
+    std::vector<size_t> next (starts.begin(), starts.end() - 1);
+
+    for (size_t i = 0; i < used; i++)
+    {
+	grouped[next[buffer.partition(entries[i])]++] = entries[i];
+    }
+    std::copy (grouped.begin(), grouped.end(), entries);
+}
+
+int
+sorter::compare_keys (const char* const buffer,
+		      const lookup& left, const lookup& right) const
+{
+    int cmp = (left.prefix() > right.prefix())
+	- (left.prefix() < right.prefix());
+
+    if (cmp == 0 && _type == mapredo::base::STRING)
+    {
+	cmp = lookup::compare (buffer, left, right);
+    }
+
+    return _reverse ? -cmp : cmp;
+}
+
+bool
+sorter::before_run_end (const char* const buffer, const lookup& entry,
+			const run_end& end) const
+{
+    int cmp = (entry.prefix() > end.prefix) - (entry.prefix() < end.prefix);
+
+    // Equal prefixes of string keys are compared on the whole keys
+    if (cmp == 0 && _type == mapredo::base::STRING)
+    {
+	const size_t keylen = entry.keylen();
+
+	cmp = memcmp (buffer + entry.offset(), end.key.data(),
+		      std::min (keylen, end.key.size()));
+	if (cmp == 0) cmp = (keylen > end.key.size()) - (keylen < end.key.size());
     }
 
-    tmpfile.close();
-    _buffer.clear();
-    _tmpfiles.push_back (std::move(filename.str()));
+    return _reverse ? cmp > 0 : cmp < 0;
 }
 
 void
 sorter::make_room (const size_t size)
 {
-    if (_buffer.would_overflow(size))
+    if (_buffer->would_overflow(size))
     {
-#if 0
-	std::cerr << _current->lookup_used() * sizeof(lookup)
-		  << " >= " << _current->lookup_size() * sizeof(lookup)
-		  << " || "
-		  << _current->buffer_used() + size << " > "
-		  << _current->buffer_size()
-		  << " ideal ratio " << _current->ideal_ratio()
-		  << "\n";
-#endif
-
-	if (!_buffer.tuned())
+	// The ratio can only be tuned from what has been added so far
+	if (!_ratio && _buffer->lookup_used())
 	{
-	    double ratio = _buffer.ideal_ratio();
+	    _ratio = _buffer->ideal_ratio();
+	}
 
-	    flush();
-	    _buffer.tune (ratio);
+	if (_replacement_selection) extend_runs (false);
+	else start_flush();
+	if (_ratio && !_buffer->tuned()) _buffer->tune (_ratio);
+
+	// A line larger than the whole buffer gets a buffer of its own
+	if (_buffer->would_overflow(size))
+	{
+	    if (_replacement_selection) extend_runs (true);
+	    _buffer->fit (size);
 	}
-	else flush();
     }
 }
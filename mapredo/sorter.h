@@ -24,28 +24,52 @@
 
 #include "sorter_buffer.h"
 #include "base.h"
+#include "combiner.h"
+#include "tmpfile_section.h"
 
 class compression;
+class thread_pool;
+class run_writer;
 
 /**
- * Used to sort lines on key
+ * Used to sort lines on key.  Lines of all partitions share the same
+ * buffers, and each buffer is written to a single file holding the
+ * sorted lines of one partition after the other.
+ *
+ * With replacement selection turned on in the settings, a single
+ * buffer is used instead.  When it is full, the lowest half of the
+ * lines that can extend the open run of sorted lines are added to it,
+ * and the rest are kept.  A run ends when too few of the lines kept
+ * sort after its end, which makes runs of random keys longer than the
+ * buffer, and sorted input a single run.
  */
 class sorter
 {
 public:
     /**
      * @param tmpdir where to save temporary files
-     * @param index number used in filenames
+     * @param partitions number of partitions the lines belong to
+     * @param worker_index number used in filenames
      * @param max_bytes_buffer number of bytes in each buffer to sort
      * @param type type of key to sort on
      * @param reverse sort in descending order if true
+     * @param reducer if not nullptr, records with the same key are
+     *                combined by this before they are written.  This
+     *                is done by the threads of the pool, so the object
+     *                must not be used by anyone else.
+     * @param pool if not nullptr, full buffers are sorted and written
+     *             by these threads while the next buffer is filled.
+     *             The bytes of the buffer are then split between two
+     *             buffers.  Not used with replacement selection.
      */
     sorter (const std::string& tmpdir,
-	    const uint16_t hash_index,
+	    const uint16_t partitions,
 	    const uint16_t worker_index,
 	    const size_t max_bytes_buffer,
 	    const mapredo::base::keytype type,
-	    const bool reverse);
+	    const bool reverse,
+	    mapredo::base* const reducer = nullptr,
+	    thread_pool* const pool = nullptr);
     sorter (sorter&& other) noexcept;
     ~sorter();
 
@@ -54,44 +78,140 @@ public:
      * @param keyvalue tab separated key and value
      * @param keylen length of key
      * @param size total length of keyvalue
+     * @param partition partition the line belongs to
      */
-    void add (const char* keyvalue, const size_t keylen, const size_t size);
+    void add (const char* keyvalue, const size_t keylen, const size_t size,
+	      const uint32_t partition = 0);
 
     /** Reserve space in buffer */
     char* reserve (const size_t bytes);
 
     /** Include reserved data in buffer */
-    void add_reserved (const size_t keylen, const size_t size);
+    void add_reserved (const size_t keylen, const size_t size,
+		       const uint32_t partition = 0);
 
     /**
-     * Take the list of temporary files. This empties the list in this object
+     * Take the list of temporary files or file sections of a
+     * partition.  This empties the list in this object.
      */
-    std::list<std::string> grab_tmpfiles();
+    std::list<tmpfile_section> grab_tmpfiles (const size_t partition = 0);
 
     /**
-     * Sort and flush current buffer to disk
+     * Sort and flush current buffer to disk, and wait until any
+     * buffer flushed in the background has been written.
      */
     void flush();
 
-    /** @returns hash index number as given to the constructor */
-    uint16_t hash_index() const {return _index;}
+    /**
+     * Start to sort and flush the current buffer to disk.  If there is
+     * a thread pool, this is done in the background after waiting for
+     * any earlier buffer to be written.
+     */
+    void start_flush();
+
+    /** Wait until any buffer flushed in the background has been written */
+    void finish_flush();
 
     sorter (const sorter&) = delete;
 
 private:
+    /** The last key written to the open run of a partition */
+    struct run_end
+    {
+	bool set = false;
+	uint64_t prefix;
+	std::string key; // only for string keys
+    };
+
     void make_room (const size_t size);
 
-    sorter_buffer _buffer;
+    /**
+     * Sort a buffer, write it to a new temporary file and empty it.
+     * The file or its sections are added to the temporary files.
+     */
+    void write_buffer (sorter_buffer& buffer);
+
+    /**
+     * Write part of the buffer to the open run by replacement
+     * selection, ending it and starting the next if needed.
+     * @param all if true, write all of the buffer and end the runs
+     */
+    void extend_runs (const bool all);
+
+    /** Encode and write sorted entries of a buffer, combining them */
+    void write_records (sorter_buffer& buffer, const lookup* begin,
+			const lookup* const end, run_writer& run);
+
+    /**
+     * Sort a buffer by partition, then by key.  A buffer already in
+     * order or in reverse order, such as the output of a sorted job,
+     * is only grouped by partition.
+     */
+    void sort_buffer (sorter_buffer& buffer,
+		      std::vector<size_t>& starts) const;
+
+    /** Order of the entries of a buffer */
+    enum order {UNSORTED, SORTED, REVERSED};
+
+    /**
+     * Check the order of the entries of a buffer, stopping at the
+     * first sign of neither.
+     */
+    order presorted (const sorter_buffer& buffer) const;
+
+    /** @returns the name of a new temporary file */
+    std::string next_filename();
+
+    /**
+     * Order the entries of a buffer by partition
+     * @param starts set to where each partition starts, followed by
+     *               the end of the last
+     */
+    void group_partitions (sorter_buffer& buffer,
+			   std::vector<size_t>& starts) const;
+
+    /** Like group_partitions(), but keeping the order of the entries */
+    void group_partitions_stable (sorter_buffer& buffer,
+				  std::vector<size_t>& starts) const;
+
+    /**
+     * Compare the keys of two entries in the sort order, like memcmp()
+     * does
+     */
+    int compare_keys (const char* const buffer,
+		      const lookup& left, const lookup& right) const;
+
+    /** @returns true if two records have keys sorted as equal */
+    bool same_key (const char* const buffer,
+		   const lookup& left, const lookup& right) const {
+	return compare_keys (buffer, left, right) == 0;
+    }
+
+    /** @returns true if an entry sorts before the end of a run */
+    bool before_run_end (const char* const buffer, const lookup& entry,
+			 const run_end& end) const;
+
+    std::unique_ptr<sorter_buffer> _buffer; // being filled
+    std::unique_ptr<sorter_buffer> _spare; // being flushed or idle
+    thread_pool* const _pool;
+    double _ratio = 0; // tuned ratio for the buffers
     const std::string _tmpdir;
     const size_t _bytes_per_buffer;
-    uint16_t _index;
+    const uint16_t _partitions;
     std::string _file_prefix;
     int _tmpfile_id = 0;
-    std::list<std::string> _tmpfiles;
+    std::vector<std::list<tmpfile_section>> _tmpfiles;
     std::unique_ptr<compression> _compressor;
+    std::unique_ptr<combiner> _combiner;
+    std::string _run; // records with the same key, to combine
+    std::string _combined;
+    std::string _record; // a record encoded for the file
+    const bool _replacement_selection;
+    std::unique_ptr<run_writer> _open_run; // for replacement selection
+    std::vector<run_end> _run_ends;
     bool _merging_off = false;
     bool _flushing_in_progress = false;
-    std::future<std::string> _flush_result;
+    std::future<void> _flush_result;
     const mapredo::base::keytype _type;
     const bool _reverse;
 };
@@ -15,16 +15,20 @@
  */
 
 #include <stdexcept>
+#include <algorithm>
 
 #include "sorter_buffer.h"
 #include "settings.h"
 
-sorter_buffer::sorter_buffer(const size_t bytes_available, const double ratio)
-    : _bytes_available(bytes_available), _ratio(ratio)
+sorter_buffer::sorter_buffer(const size_t bytes_available, const double ratio,
+			     const mapredo::base::keytype type)
+    : _bytes_available(bytes_available), _ratio(ratio), _type(type)
 {
     double total_ratio = ratio + 1.0;
 
-    _buffer_size = static_cast<size_t> (bytes_available / total_ratio * ratio);
+    _buffer_size = std::min (static_cast<size_t> (bytes_available
+						  / total_ratio * ratio),
+			     size_t(_max_buffer_size));
     _lookup_size = static_cast<size_t> (bytes_available
 					/ total_ratio / sizeof(struct lookup));
     //std::cerr << "b " << _size_buffer << " l " << _size_lookup << "\n";
@@ -50,7 +54,9 @@ sorter_buffer::sorter_buffer (sorter_buffer&& other) noexcept :
     _lookup (std::move(other._lookup)),
     _lookup_size (other._lookup_size),
     _lookup_used (other._lookup_used),
-    _ratio (other._ratio)
+    _ratio (other._ratio),
+    _tuned (other._tuned),
+    _type (other._type)
 {
     other._buffer = 0;
 }
@@ -66,28 +72,80 @@ sorter_buffer::tune (const double ratio)
     if (_lookup_used < _lookup_size / 10 * 7
 	|| _buffer_used < _buffer_size / 10 * 7)
     {
-	_ratio = ratio;
-
-	double total_ratio = _ratio + 1.0;
+	double total_ratio = ratio + 1.0;
 	size_t old_lookup_size = _lookup_size;
+	const size_t buffer_size
+	    = std::min (static_cast<size_t> (_bytes_available
+					     / total_ratio * ratio),
+			size_t(_max_buffer_size));
+	const size_t lookup_size = static_cast<size_t>
+	    (_bytes_available / total_ratio / sizeof(struct lookup));
+
+	if (_buffer_used >= buffer_size || _lookup_used >= lookup_size)
+	{
+	    _tuned = true;
+	    return;
+	}
+	_ratio = ratio;
+	_buffer_size = buffer_size;
+	_lookup_size = lookup_size;
 
-	_buffer_size = static_cast<size_t> (_bytes_available
-					/ total_ratio * _ratio);
-	_lookup_size = static_cast<size_t> (_bytes_available
-					/ total_ratio / sizeof(struct lookup));
+	char* const buffer = new char[_buffer_size];
 
+	memcpy (buffer, _buffer, _buffer_used);
 	delete[] _buffer;
-        
+	_buffer = buffer;
+
 	_lookup.resize (_lookup_size);
 	if (_lookup_size < old_lookup_size) _lookup.shrink_to_fit();
-
-	_buffer = new char[_buffer_size];
         
 	// std::cerr << "Resized buffer/lookup ratio to " << _ratio << ".\n";
     }
     _tuned = true;
 }
 
+void
+sorter_buffer::fit (const size_t bytes)
+{
+    const size_t size = _header_size + bytes + 1;
+
+    if (size <= _buffer_size) return;
+    if (size > _max_buffer_size)
+    {
+	throw std::length_error ("Line of " + std::to_string(bytes)
+				 + " bytes is too long to sort");
+    }
+
+    delete[] _buffer;
+    _buffer = nullptr;
+    _buffer = new char[size];
+    _buffer_size = size;
+}
+
+void
+sorter_buffer::retain (const size_t entries)
+{
+    std::sort (_lookup.begin(), _lookup.begin() + entries,
+	       [](const struct lookup& left, const struct lookup& right) {
+		   return left.offset() < right.offset();
+	       });
+
+    // Lines only move towards the start, so each can be moved in place
+    _buffer_used = 0;
+    for (size_t i = 0; i < entries; i++)
+    {
+	struct lookup& entry (_lookup[i]);
+	const uint32_t bytes = _header_size + size (entry);
+	const uint32_t offset = _buffer_used + _header_size;
+
+	memmove (_buffer + _buffer_used, _buffer + entry.offset()
+		 - _header_size, bytes);
+	entry.set (offset, entry.keylen(), entry.prefix());
+	_buffer_used += bytes;
+    }
+    _lookup_used = entries;
+}
+
 double
 sorter_buffer::ideal_ratio() const
 {
@@ -22,6 +22,7 @@
 #include <iostream>
 
 #include "lookup.h"
+#include "base.h"
 
 /**
  * Represents a buffer that will be sorted, with a lookup table
@@ -33,20 +34,45 @@ public:
      * @param bytes_available the number of bytes to use for the
      *                        buffer and the lookup table in total
      * @param ratio the ratio between the buffer and the lookup table
+     * @param type type of key, numeric keys are parsed when added
      */
-    sorter_buffer (const size_t bytes_available, const double ratio);
+    sorter_buffer (const size_t bytes_available, const double ratio,
+		   const mapredo::base::keytype type);
     sorter_buffer (sorter_buffer&& other) noexcept;
     ~sorter_buffer();
 
     /** @return pointer to buffer */
-    char*& buffer() {return _buffer;}
+    const char* buffer() const {return _buffer;}
     /** @return buffer size in bytes */
     size_t buffer_size() const {return _buffer_size;}
     /** @return number of bytes used in buffer */
-    size_t& buffer_used()  {return _buffer_used;}
+    size_t buffer_used() const {return _buffer_used;}
+    /** @return where to write the next line to be added by add_reserved() */
+    char* next_line() {return _buffer + _buffer_used + _header_size;}
+
+    /** @return the key and value of an entry, newline terminated */
+    const char* keyvalue (const struct lookup& entry) const {
+	return _buffer + entry.offset();
+    }
+    /** @return the length of the line of an entry, including newline */
+    uint32_t size (const struct lookup& entry) const {
+	uint32_t size;
+
+	memcpy (&size, _buffer + entry.offset() - _header_size, sizeof(size));
+	return size;
+    }
+    /** @return the partition of an entry, as given when it was added */
+    uint32_t partition (const struct lookup& entry) const {
+	uint32_t partition;
+
+	memcpy (&partition, _buffer + entry.offset() - sizeof(partition),
+		sizeof(partition));
+	return partition;
+    }
 
     /** @return a reference to a vector of pointers to keyvalues */
     std::vector<struct lookup>& lookup() {return _lookup;}
+    const std::vector<struct lookup>& lookup() const {return _lookup;}
     /** @return size of lookup vector in elements */
     size_t lookup_size() const {return _lookup_size;}
     /** @return number of elements used in lookup vector */
@@ -58,40 +84,83 @@ public:
      */
     bool would_overflow (const size_t bytes) const {
 	return (_lookup_used == _lookup_size
-		|| _buffer_used + bytes >= _buffer_size);
+		|| _buffer_used + _header_size + bytes >= _buffer_size);
     }
+    /**
+     * Make room for a line larger than the buffer, which must be empty
+     * @param bytes length of the line
+     */
+    void fit (const size_t bytes);
     /** @returns true if the buffer does not contain any data */
     bool empty() const {return _buffer_used == 0;}
     /** Remove all data from the buffer and lookup table */
     void clear() {_buffer_used = _lookup_used = 0;}
+    /**
+     * Remove all entries but the first ones of the lookup table, and
+     * move their lines together at the start of the buffer.  The
+     * entries are left in the order of their lines.
+     * @param entries number of entries to keep
+     */
+    void retain (const size_t entries);
 
     /**
      * Add a key and value to the buffer
      * @param keyvalue tab separated key and value
      * @param keylen length of key
      * @param size total length of keyvalue
+     * @param partition partition the record belongs to
      */
-    void add (const char* keyvalue, const size_t keylen, size_t totalsize) {
-	memcpy (&_buffer[_buffer_used], keyvalue, totalsize);
-	_lookup[_lookup_used].set_ptr (&_buffer[_buffer_used], keylen,
-				       ++totalsize);
-	_buffer_used += totalsize;
-	_buffer[_buffer_used - 1] = '\n';
-	++_lookup_used;
+    void add (const char* keyvalue, const size_t keylen, size_t totalsize,
+	      const uint32_t partition = 0) {
+	memcpy (next_line(), keyvalue, totalsize);
+	add_reserved (keylen, totalsize, partition);
     }
 
-    void add_reserved (const size_t keylen, size_t totalsize) {
-	_lookup[_lookup_used].set_ptr (&_buffer[_buffer_used], keylen,
-				       ++totalsize);
-	_buffer_used += totalsize;
+    /**
+     * Add a key and value already written to next_line()
+     * @param keylen length of key
+     * @param size total length of keyvalue
+     * @param partition partition the record belongs to
+     */
+    void add_reserved (const size_t keylen, size_t totalsize,
+		       const uint32_t partition = 0) {
+	const uint32_t offset = _buffer_used + _header_size;
+	const uint32_t size = ++totalsize;
+	const char* const keyvalue = _buffer + offset;
+	uint64_t prefix = 0;
+
+	// Each line is preceded by its length and partition, which are
+	// only needed when the line is written out
+	memcpy (_buffer + _buffer_used, &size, sizeof(size));
+	memcpy (_buffer + _buffer_used + sizeof(size), &partition,
+		sizeof(partition));
+	_buffer_used = offset + size;
 	_buffer[_buffer_used - 1] = '\n';
-	++_lookup_used;
+
+	// Numeric keys are parsed once here instead of in every
+	// comparison.  The key ends with a tab or the newline.
+	switch (_type)
+	{
+	case mapredo::base::STRING:
+	    prefix = lookup::string_prefix (keyvalue, keylen);
+	    break;
+	case mapredo::base::INT64:
+	    prefix = lookup::integer_prefix (atoll(keyvalue));
+	    break;
+	case mapredo::base::DOUBLE:
+	    prefix = lookup::real_prefix (atof(keyvalue));
+	    break;
+	case mapredo::base::UNKNOWN:
+	    break;
+	}
+	_lookup[_lookup_used++].set (offset, keylen, prefix);
     }
 
     /** @return true if buffer size vs lookup vector size is tuned */
     bool tuned() const {return _tuned;}
     /**
-     * Tune size of buffer vs lookup vector
+     * Tune size of buffer vs lookup vector.  Lines already added are
+     * kept, and the sizes are left as they are if they would not fit.
      * @param ratio ratio of buffer size vs lookup size in memory use
      */
     void tune (const double ratio);
@@ -103,6 +172,11 @@ public:
     sorter_buffer (const sorter_buffer&) = delete;
 
 private:
+    /** Bytes in front of each line, holding its length and partition */
+    static const size_t _header_size = 2 * sizeof(uint32_t);
+    /** Lines are referred to by 32 bit offsets */
+    static const size_t _max_buffer_size = 0xffffffff;
+
     size_t _bytes_available;
 
     char* _buffer = nullptr;
@@ -114,6 +188,7 @@ private:
 
     double _ratio;
     bool _tuned = false;
+    const mapredo::base::keytype _type;
 };
 
 #endif
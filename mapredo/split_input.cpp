@@ -0,0 +1,225 @@
+/*
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <algorithm>
+
+#include "split_input.h"
+
+split_input::split_input (const std::string& filename,
+			  const size_t buffer_size,
+			  const size_t num_consumers) :
+    _filename (filename),
+    _next_split (0),
+    _stopped (false)
+{
+    struct stat st;
+
+    _fd = open (filename.c_str(), O_RDONLY);
+    if (_fd < 0 || fstat(_fd, &st) != 0)
+    {
+	char err[80];
+
+	if (_fd >= 0) close (_fd);
+	throw std::runtime_error
+	    ("Can not open input file " + filename + ": "
+	     + strerror_r(errno, err, sizeof(err)));
+    }
+    _size = st.st_size;
+
+    // A few ranges per consumer evens out differences in mapping cost
+    _split_size = (_size + num_consumers * 4 - 1) / (num_consumers * 4);
+    if (_split_size < buffer_size) _split_size = buffer_size;
+
+    _readers.reserve (num_consumers);
+    for (size_t i = 0; i < num_consumers; i++)
+    {
+	_readers.emplace_back (buffer_size);
+    }
+
+    // Skip any Windows style UTF-8 header
+    const unsigned char u8header[] = {0xef, 0xbb, 0xbf};
+    char header[3];
+    if (_size >= 3 && pread(_fd, header, 3, 0) == 3
+	&& memcmp(header, u8header, 3) == 0)
+    {
+	_begin = 3;
+    }
+}
+
+split_input::~split_input()
+{
+    close (_fd);
+}
+
+input_buffer*
+split_input::consumer_get (const size_t id)
+{
+    return next_lines (id);
+}
+
+input_buffer*
+split_input::consumer_swap (input_buffer* buffer, const size_t id)
+{
+    return next_lines (id);
+}
+
+void
+split_input::consumer_fail (const size_t id)
+{
+    _stopped = true;
+}
+
+bool
+split_input::start_split (reader& rdr)
+{
+    const size_t start = _split_size * _next_split++;
+
+    if (start >= _size) return false;
+
+    // Read from the byte before the range, to see if it starts with
+    // a new line or with the end of a line from the previous range.
+    rdr.offset = (start == 0 ? _begin : start - 1);
+    rdr.used = rdr.next = 0;
+    rdr.split_end = std::min (start + _split_size, _size);
+    rdr.skip = (start > 0);
+    rdr.active = true;
+
+    return true;
+}
+
+void
+split_input::read_more (reader& rdr)
+{
+    char* buf = rdr.buffer.get();
+
+    if (rdr.next > 0)
+    {
+	rdr.used -= rdr.next;
+	rdr.offset += rdr.next;
+	if (rdr.used) memmove (buf, buf + rdr.next, rdr.used);
+	rdr.next = 0;
+    }
+
+    if (rdr.used == rdr.buffer.capacity())
+    {
+	// Slow path for a line longer than the buffer
+	rdr.buffer.end() = rdr.used;
+	rdr.buffer.increase_capacity (rdr.used * 2);
+	buf = rdr.buffer.get();
+    }
+
+    ssize_t bytes;
+
+    do
+    {
+	bytes = pread (_fd, buf + rdr.used, rdr.buffer.capacity() - rdr.used,
+		       rdr.offset + rdr.used);
+    }
+    while (bytes < 0 && errno == EINTR);
+
+    if (bytes < 0)
+    {
+	char err[80];
+
+	throw std::runtime_error
+	    ("Can not read input file " + _filename + ": "
+	     + strerror_r(errno, err, sizeof(err)));
+    }
+    if (bytes == 0 && rdr.offset + rdr.used < _size)
+    {
+	// The file has been truncated since it was opened
+	throw std::runtime_error
+	    ("Input file " + _filename + " ended at offset "
+	     + std::to_string(rdr.offset + rdr.used) + ", before its size of "
+	     + std::to_string(_size) + " bytes");
+    }
+    rdr.used += bytes;
+}
+
+input_buffer*
+split_input::next_lines (const size_t id)
+{
+    reader& rdr (_readers[id]);
+
+    while (!_stopped)
+    {
+	if (!rdr.active && !start_split(rdr)) break;
+
+	read_more (rdr);
+
+	char* buf = rdr.buffer.get();
+	const size_t end = rdr.offset + rdr.used; // file offset
+	const char* nl;
+
+	if (rdr.skip)
+	{
+	    nl = static_cast<const char*>(memchr (buf, '\n', rdr.used));
+	    if (!nl)
+	    {
+		// The whole buffer belongs to the previous range
+		rdr.next = rdr.used;
+		if (end >= rdr.split_end) rdr.active = false;
+		continue;
+	    }
+	    rdr.next = nl - buf + 1;
+	    rdr.skip = false;
+	    if (rdr.offset + rdr.next >= rdr.split_end)
+	    {
+		rdr.active = false; // no line starts in this range
+		continue;
+	    }
+	}
+
+	const size_t start = rdr.next;
+
+	if (end >= rdr.split_end)
+	{
+	    // Provide lines up to the one crossing the end of the range
+	    const size_t from = std::max (start,
+					  rdr.split_end - 1 - rdr.offset);
+
+	    nl = static_cast<const char*>
+		(memchr (buf + from, '\n', rdr.used - from));
+	    if (nl || end == _size)
+	    {
+		rdr.next = (nl ? nl - buf + 1 : rdr.used);
+		rdr.active = false;
+		rdr.buffer.start() = start;
+		rdr.buffer.end() = rdr.next;
+		if (start < rdr.next) return &rdr.buffer;
+		continue;
+	    }
+	}
+
+	nl = static_cast<const char*>
+	    (memrchr (buf + start, '\n', rdr.used - start));
+	if (nl)
+	{
+	    rdr.next = nl - buf + 1;
+	    rdr.buffer.start() = start;
+	    rdr.buffer.end() = rdr.next;
+	    return &rdr.buffer;
+	}
+    }
+
+    return nullptr;
+}
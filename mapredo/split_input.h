@@ -0,0 +1,88 @@
+/* -*- C++ -*-
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef _HEXTREME_MAPREDO_SPLIT_INPUT_H
+#define _HEXTREME_MAPREDO_SPLIT_INPUT_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+
+#include "input_source.h"
+
+/**
+ * Provides a seekable file to consumer threads by splitting it into
+ * byte ranges.  Each consumer claims a range and reads it into its
+ * own buffer with pread(), so reading scales with the number of
+ * consumers.  A range holds the lines starting inside it.
+ */
+class split_input : public input_source
+{
+public:
+    /**
+     * @param filename path of regular file to read
+     * @param buffer_size initial size of the input buffer of each
+     *                    consumer, which grows to fit longer lines
+     * @param num_consumers number of consumer threads
+     */
+    split_input (const std::string& filename,
+		 const size_t buffer_size,
+		 const size_t num_consumers);
+    ~split_input();
+
+    /** @returns the size of the file in bytes */
+    size_t size() const {return _size;}
+
+    /** @returns the size of each range of the file in bytes */
+    size_t split_size() const {return _split_size;}
+
+    virtual input_buffer* consumer_get (const size_t id) final;
+    virtual input_buffer* consumer_swap (input_buffer* buffer,
+					 const size_t id) final;
+    virtual void consumer_fail (const size_t id) final;
+
+    split_input (const split_input&) = delete;
+    split_input& operator=(const split_input&) = delete;
+
+private:
+    struct reader
+    {
+	reader (const size_t buffer_size) : buffer (buffer_size) {}
+
+	input_buffer buffer;
+	size_t offset = 0;    // file offset of first byte in buffer
+	size_t used = 0;      // number of bytes in buffer
+	size_t next = 0;      // first byte in buffer not yet provided
+	size_t split_end = 0; // end of current range
+	bool active = false;  // true while working on a range
+	bool skip = false;    // skip line belonging to the previous range
+    };
+
+    input_buffer* next_lines (const size_t id);
+    void read_more (reader& rdr);
+    bool start_split (reader& rdr);
+
+    int _fd = -1;
+    const std::string _filename;
+    size_t _size = 0;
+    size_t _begin = 0;
+    size_t _split_size = 0;
+    std::atomic<size_t> _next_split;
+    std::atomic<bool> _stopped;
+    std::vector<reader> _readers;
+};
+
+#endif
@@ -0,0 +1,63 @@
+/*
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "thread_pool.h"
+
+thread_pool::thread_pool (const size_t threads)
+{
+    for (size_t i = 0; i < threads; i++)
+    {
+	_threads.emplace_back (&thread_pool::work, this);
+    }
+}
+
+thread_pool::~thread_pool()
+{
+    {
+	std::lock_guard<std::mutex> lock (_lock);
+	_stopping = true;
+    }
+    _cond.notify_all();
+    for (auto& thread: _threads) thread.join();
+}
+
+void
+thread_pool::enqueue (std::function<void()>&& task)
+{
+    {
+	std::lock_guard<std::mutex> lock (_lock);
+	_tasks.push_back (std::move(task));
+    }
+    _cond.notify_one();
+}
+
+void
+thread_pool::work()
+{
+    for (;;)
+    {
+	std::function<void()> task;
+	{
+	    std::unique_lock<std::mutex> lock (_lock);
+
+	    _cond.wait (lock, [this]() {return _stopping || !_tasks.empty();});
+	    if (_tasks.empty()) return;
+	    task = std::move (_tasks.front());
+	    _tasks.pop_front();
+	}
+	task(); // exceptions are kept by the packaged task
+    }
+}
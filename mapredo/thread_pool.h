@@ -0,0 +1,74 @@
+/* -*- C++ -*-
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef _HEXTREME_MAPREDO_THREAD_POOL_H
+#define _HEXTREME_MAPREDO_THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Fixed number of threads running tasks in the order they are
+ * submitted.  Used by the sorters to sort and write their buffers in
+ * the background.
+ */
+class thread_pool
+{
+public:
+    /** @param threads number of threads to run tasks with */
+    thread_pool (const size_t threads);
+    /** Runs the tasks already submitted and stops the threads */
+    ~thread_pool();
+
+    /**
+     * Submit a task to be run by one of the threads.
+     * @param task function to run
+     * @returns future result of the task.  Exceptions thrown by the
+     *          task are rethrown when the result is retrieved.
+     */
+    template<typename F> auto submit (F task) -> std::future<decltype(task())>
+    {
+	typedef decltype(task()) result;
+	auto packaged (std::make_shared<std::packaged_task<result()>>
+		       (std::move(task)));
+	auto future (packaged->get_future());
+
+	enqueue ([packaged]() {(*packaged)();});
+	return future;
+    }
+
+    thread_pool (const thread_pool&) = delete;
+    thread_pool& operator= (const thread_pool&) = delete;
+
+private:
+    void enqueue (std::function<void()>&& task);
+    void work();
+
+    std::mutex _lock;
+    std::condition_variable _cond;
+    std::deque<std::function<void()>> _tasks;
+    bool _stopping = false;
+    std::vector<std::thread> _threads;
+};
+
+#endif
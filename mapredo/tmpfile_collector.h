@@ -20,18 +20,31 @@
 #include "settings.h"
 #include "prefered_output.h"
 #include "rcollector.h"
+#include "run_format.h"
 
 /**
- * A collector class that writes to a temporary file
+ * A collector class that writes to a temporary file, either as text
+ * for the final output or as binary records to be merged further.
  */
 class tmpfile_collector : public mapredo::rcollector
 {
 public:
+    /**
+     * @param file_prefix start of the name of the file
+     * @param tmpfile_id number used in the file name, which is increased
+     * @param alt_output if not nullptr, output text to this if possible
+     * @param type if not UNKNOWN, the type of the keys, which are then
+     *             written as binary records in the format of run_format
+     */
     tmpfile_collector (const std::string& file_prefix,
 		       int& tmpfile_id,
-		       prefered_output* alt_output) :
+		       prefered_output* alt_output,
+		       const mapredo::base::keytype type
+		       = mapredo::base::UNKNOWN) :
 	_compressed (settings::instance().compressed()),
-	_prefered_output (alt_output)
+	_buffer (new char[_buffer_size]),
+	_prefered_output (alt_output),
+	_type (type)
     {
 	std::ofstream outfile;
 
@@ -39,6 +52,7 @@ public:
 	if (_compressed)
 	{
 	    _filename_stream << ".snappy";
+	    _compressor.reset (new compression());
             _coutbuffer.reset (new char[0x15000]);
 	}
 	_outfile.open (_filename_stream.str(), std::ofstream::binary);
@@ -64,8 +78,13 @@ public:
     /** Collect data from reducer */
     virtual void collect (const char* line, const size_t length) final
     {
-	if (_buffer_pos + length >= _buffer_size) flush_internal();
-	memcpy (_buffer + _buffer_pos, line, length);
+	if (_type != mapredo::base::UNKNOWN)
+	{
+	    collect_record (line, length);
+	    return;
+	}
+	if (_buffer_pos + length >= _buffer_size) make_room (length);
+	memcpy (_buffer.get() + _buffer_pos, line, length);
 	_buffer_pos += length;
 	_buffer[_buffer_pos++] = '\n';
     }
@@ -73,20 +92,14 @@ public:
     /** Reserve memory buffer for reducer */
     virtual char* reserve (const size_t bytes) final {
 	_reserved_bytes = bytes;
-	if (_buffer_pos + bytes >= _buffer_size)
+	if (_type != mapredo::base::UNKNOWN)
 	{
-	    flush_internal();
-	    if (bytes >= _buffer_size)
-	    {
-		std::ostringstream stream;
-		stream << "Cannot reserve " << bytes
-		       << " bytes in tmpfile_collector::reserve(), "
-		       << (_buffer_size - 1) << " was attempted";
-		throw std::runtime_error (stream.str());
-	    }
-	    return _buffer;
+	    // Encoded when collected
+	    _reserved.resize (bytes + 1);
+	    return &_reserved[0];
 	}
-	else return (_buffer + _buffer_pos);
+	if (_buffer_pos + bytes >= _buffer_size) make_room (bytes);
+	return (_buffer.get() + _buffer_pos);
     }
 
     virtual void collect_reserved (const size_t length = 0) {
@@ -97,9 +110,17 @@ public:
 		 " tmpfile_collector::collect_reserved()");
 	}
 
-	if (length == 0) _buffer_pos += _reserved_bytes;
-	else _buffer_pos += length;
-	_buffer[_buffer_pos++] = '\n';
+	if (_type != mapredo::base::UNKNOWN)
+	{
+	    collect_record (_reserved.data(),
+			    length ? length : _reserved_bytes);
+	}
+	else
+	{
+	    if (length == 0) _buffer_pos += _reserved_bytes;
+	    else _buffer_pos += length;
+	    _buffer[_buffer_pos++] = '\n';
+	}
 
 	_reserved_bytes = 0;
     }
@@ -110,36 +131,64 @@ public:
     std::string filename() {return _filename_stream.str();}
 
 private:
+    /** Encode a line as a binary record */
+    void collect_record (const char* line, const size_t length) {
+	const size_t max_size = run_format::max_line_size (length);
+
+	if (_buffer_pos + max_size >= _buffer_size) make_room (max_size);
+	_buffer_pos += run_format::encode_line (_buffer.get() + _buffer_pos,
+						_type, line, length);
+    }
+
+    /** Flush the buffer, and grow it unless it has room for bytes */
+    void make_room (const size_t bytes) {
+	flush_internal();
+	if (bytes < _buffer_size) return;
+
+	// A line longer than the buffer is written in one piece all the
+	// same, so that it is not split between outputs
+	_buffer_size = bytes + 1;
+	_buffer.reset (new char[_buffer_size]);
+    }
+
     void flush_internal() {
 	if (!_prefered_output
-	    || !_prefered_output->try_write(_buffer, _buffer_pos))
+	    || !_prefered_output->try_write(_buffer.get(), _buffer_pos))
 	{
 	    if (_compressed)
 	    {
-		_coutbufpos = 0x15000;
-		_compressor->compress (_buffer,
-				       _buffer_pos,
-				       _coutbuffer.get(),
-				       _coutbufpos);
-		_outfile.write (_coutbuffer.get(), _coutbufpos);
+		// Each block takes at most 64k of a grown buffer
+		for (size_t pos = 0; pos < _buffer_pos;)
+		{
+		    size_t bytes = _buffer_pos - pos;
+
+		    _coutbufpos = 0x15000;
+		    _compressor->compress (_buffer.get() + pos,
+					   bytes,
+					   _coutbuffer.get(),
+					   _coutbufpos);
+		    _outfile.write (_coutbuffer.get(), _coutbufpos);
+		    pos += bytes;
+		}
 	    }
-	    else _outfile.write (_buffer, _buffer_pos);
+	    else _outfile.write (_buffer.get(), _buffer_pos);
 	}
 	_buffer_pos = 0;
     }
 
-    static const size_t _buffer_size = 0x10000;
-
     std::ostringstream _filename_stream;
     const bool _compressed;
     std::ofstream _outfile;
     std::unique_ptr<compression> _compressor;
-    char _buffer[_buffer_size];
+    size_t _buffer_size = 0x10000;
+    std::unique_ptr<char[]> _buffer;
     std::unique_ptr<char[]> _coutbuffer;
     size_t _buffer_pos = 0;
     size_t _coutbufpos;
     size_t _reserved_bytes = 0;
     prefered_output* _prefered_output;
+    const mapredo::base::keytype _type;
+    std::string _reserved; // reserved line when writing records
 };
 
 #endif
@@ -24,20 +24,21 @@
 
 #include "data_reader.h"
 #include "compression.h"
+#include "tmpfile_section.h"
 
 /**
- * Used to read a temporary file while merge sorting
+ * Used to read a temporary file or file section while merge sorting
  */
 template <class T>
 class tmpfile_reader : public data_reader<T>
 {
 public:
     /**
-     * @param filename the name of the temporary file
+     * @param file the temporary file or section to read
      * @param buffer_size size of the buffer to read data into
      * @param delete_file_after set true if the file can be deleted
      */
-    tmpfile_reader (const std::string& filename,
+    tmpfile_reader (const tmpfile_section& file,
 		    const int buffer_size,
 		    const bool delete_file_after);
     //tmpfile_reader (tmpfile_reader&& other)
@@ -45,11 +46,11 @@ public:
     ~tmpfile_reader() {
 	if (_cbuffer) delete[] _cbuffer;
 	if (_fp) fclose(_fp);
-	if (_delete_file_after) remove (_filename.c_str());
+	if (_delete_file_after) _file.remove();
     }
 
     /** @returns the name of the temporary file */
-    const std::string& filename() const {return _filename;}
+    const std::string& filename() const {return _file.filename();}
 
     tmpfile_reader (const tmpfile_reader&) = delete;
     tmpfile_reader& operator=(const tmpfile_reader&) = delete;
@@ -57,27 +58,49 @@ public:
 private:
     bool read_more();
 
+    /**
+     * Make sure a whole compressed block is in the compressed buffer,
+     * growing the buffer for larger blocks.
+     * @returns the size of the block
+     */
+    size_t read_block();
+
+    /**
+     * Replace the read buffer with a larger one, keeping its data
+     * @param size the new size, not counting the nul after it
+     */
+    void grow_buffer (const size_t size);
+
+    /**
+     * Move to the next extent of the section
+     * @returns false if there are no more
+     */
+    bool next_extent();
+
     FILE* _fp = 0;
-    std::string _filename;
+    tmpfile_section _file;
     size_t _buffer_size;
     size_t _cstart_pos = 0;
     size_t _cend_pos = 0;
     size_t _cbuffer_size;
     char* _cbuffer = nullptr;
-    size_t _bytes_left_file;
+    size_t _bytes_left_file; // in the current extent
+    size_t _next_extent = 0;
     bool _delete_file_after;
     std::unique_ptr<compression> _compressor;
 };
 
 template <class T>
-tmpfile_reader<T>::tmpfile_reader (const std::string& filename,
+tmpfile_reader<T>::tmpfile_reader (const tmpfile_section& file,
 				   const int buffer_size,
 				   const bool delete_file_after) :
-    _filename (filename),
+    _file (file),
     _buffer_size (buffer_size - 1),
     _cbuffer_size (buffer_size),
     _delete_file_after (delete_file_after)
 {
+    const std::string& filename (file.filename());
+
     if (filename.size() > 7
 	&& filename.substr(filename.size() - 7) == ".snappy")
     {
@@ -107,9 +130,13 @@ tmpfile_reader<T>::tmpfile_reader (const std::string& filename,
 				    );
     }
     
-    fseek (_fp, 0, SEEK_END);
-    _bytes_left_file = ftell(_fp);
-    fseek (_fp, 0, SEEK_SET);
+    if (file.extents().size()) next_extent();
+    else
+    {
+	fseek (_fp, 0, SEEK_END);
+	_bytes_left_file = ftell(_fp);
+	fseek (_fp, 0, SEEK_SET);
+    }
 
     if (_compressor)
     {
@@ -127,10 +154,28 @@ tmpfile_reader<T>::tmpfile_reader (const std::string& filename,
     this->fill_next_line();
 }
 
+template <class T> bool
+tmpfile_reader<T>::next_extent()
+{
+    if (_next_extent == _file.extents().size()) return false;
+
+    const tmpfile_section::extent& extent (_file.extents()[_next_extent++]);
+
+    _bytes_left_file = extent.size;
+#ifndef _WIN32
+    fseeko (_fp, extent.offset, SEEK_SET);
+#else
+    _fseeki64 (_fp, extent.offset, SEEK_SET);
+#endif
+
+    return true;
+}
+
 template <class T> bool
 tmpfile_reader<T>::read_more()
 {
-    if (_bytes_left_file == 0 && _cstart_pos == _cend_pos) return false;
+    if (_bytes_left_file == 0 && _cstart_pos == _cend_pos
+	&& !next_extent()) return false;
 
 #if 0
     std::cerr << "Reading more: " << _bytes_left_file << " bytes left"
@@ -154,57 +199,31 @@ tmpfile_reader<T>::read_more()
 
     if (_compressor)
     {
-	// Look for data in cbuffer first
-	size_t insize = _cend_pos - _cstart_pos;
-	size_t outsize = _buffer_size - this->_end_pos;
+	const size_t block = read_block();
+	const size_t uncompressed
+	    = compression::uncompressed_size (_cbuffer + _cstart_pos, block);
 
-	if (insize > 0 &&_compressor->inflate (_cbuffer + _cstart_pos, insize,
-					       this->_buffer + this->_end_pos,
-					       outsize))
+	// A record longer than the buffer spans several blocks
+	if (uncompressed > _buffer_size - this->_end_pos)
 	{
-	    _cstart_pos += insize;
-	    this->_end_pos += outsize;
+	    grow_buffer (std::max (_buffer_size * 2,
+				   this->_end_pos + uncompressed));
 	}
-	else
-	{
-	    if (_cstart_pos != _cend_pos)
-	    {
-		if (_cstart_pos != 0)
-		{
-		    _cend_pos -= _cstart_pos;
-		    memmove (_cbuffer, _cbuffer + _cstart_pos, _cend_pos);
-		    _cstart_pos = 0;
-		}
-	    }
-	    else _cstart_pos = _cend_pos = 0;
-
-	    size_t bytes_to_read = std::min<size_t> (_bytes_left_file,
-						     _cbuffer_size - _cend_pos);
-	    if (!fread(_cbuffer + _cend_pos, bytes_to_read, 1, _fp))
-	    {
-		throw std::runtime_error
-		    ("Can not read compressed data from temporary file");
-	    }
-	    _bytes_left_file -= bytes_to_read;
-	    _cend_pos += bytes_to_read;
-	    insize = _cend_pos - _cstart_pos;
-	    if (_compressor->inflate (_cbuffer, insize,
-				      this->_buffer + this->_end_pos, outsize))
-	    {
-		_cstart_pos += insize;
-		this->_end_pos += outsize;
-	    }
-	    else
-	    {
-		throw std::runtime_error
-		    ("Can not uncompress data from temporary file");
-	    }
-	}
-	//std::cerr << '|' << std::string(this->_buffer, this->_end_pos) << '|'
-	//	  << "\n";
+
+	size_t insize = block;
+	size_t outsize = _buffer_size - this->_end_pos;
+
+	_compressor->inflate (_cbuffer + _cstart_pos, insize,
+			      this->_buffer + this->_end_pos, outsize);
+	_cstart_pos += insize;
+	this->_end_pos += outsize;
+
 	return true;
     }
 
+    // The buffer is only full here if a record is longer than it
+    if (this->_end_pos == _buffer_size) grow_buffer (_buffer_size * 2);
+
     size_t bytes_to_read = std::min<size_t> (_bytes_left_file,
 					     _buffer_size - this->_end_pos);
 
@@ -220,4 +239,62 @@ tmpfile_reader<T>::read_more()
     return true;
 }
 
+template <class T> size_t
+tmpfile_reader<T>::read_block()
+{
+    size_t block = compression::block_size (_cbuffer + _cstart_pos,
+					     _cend_pos - _cstart_pos);
+
+    while (!block || block > _cend_pos - _cstart_pos)
+    {
+	if (_cstart_pos != 0)
+	{
+	    _cend_pos -= _cstart_pos;
+	    memmove (_cbuffer, _cbuffer + _cstart_pos, _cend_pos);
+	    _cstart_pos = 0;
+	}
+	if (block > _cbuffer_size)
+	{
+	    char* const cbuffer = new char[block];
+
+	    memcpy (cbuffer, _cbuffer, _cend_pos);
+	    delete[] _cbuffer;
+	    _cbuffer = cbuffer;
+	    _cbuffer_size = block;
+	}
+
+	if (_bytes_left_file == 0 && !next_extent())
+	{
+	    throw std::runtime_error
+		("Compressed block in temporary file is truncated");
+	}
+
+	const size_t bytes_to_read = std::min<size_t>
+	    (_bytes_left_file, _cbuffer_size - _cend_pos);
+
+	if (!fread(_cbuffer + _cend_pos, bytes_to_read, 1, _fp))
+	{
+	    throw std::runtime_error
+		("Can not read compressed data from temporary file");
+	}
+	_bytes_left_file -= bytes_to_read;
+	_cend_pos += bytes_to_read;
+	block = compression::block_size (_cbuffer, _cend_pos);
+    }
+
+    return block;
+}
+
+template <class T> void
+tmpfile_reader<T>::grow_buffer (const size_t size)
+{
+    char* const buffer = new char[size + 1];
+
+    memcpy (buffer, this->_buffer, this->_end_pos);
+    buffer[size] = '\0';
+    delete[] this->_buffer;
+    this->_buffer = buffer;
+    _buffer_size = size;
+}
+
 #endif
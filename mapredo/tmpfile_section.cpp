@@ -0,0 +1,128 @@
+/*
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <fstream>
+#include <stdexcept>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include "tmpfile_section.h"
+
+std::vector<tmpfile_section>
+tmpfile_section::sections (const std::string& filename,
+			   const std::vector<uint64_t>& offsets,
+			   const size_t partitions)
+{
+    std::vector<tmpfile_section> sections (partitions, tmpfile_section (""));
+    std::shared_ptr<shared_file> shared (new shared_file);
+    size_t used = 0;
+
+    for (size_t i = 0; i + 1 < offsets.size(); i++)
+    {
+	if (offsets[i + 1] == offsets[i]) continue;
+
+	auto& section (sections[i % partitions]);
+	const uint64_t size = offsets[i + 1] - offsets[i];
+
+	if (section._filename.empty())
+	{
+	    section._filename = filename;
+	    section._shared = shared;
+	    used++;
+	}
+	// Extents following each other are read as one
+	if (section._extents.size()
+	    && section._extents.back().offset + section._extents.back().size
+	    == offsets[i])
+	{
+	    section._extents.back().size += size;
+	}
+	else section._extents.push_back (extent{offsets[i], size});
+	section._size += size;
+    }
+    shared->sections_left = used;
+
+    return sections;
+}
+
+void
+tmpfile_section::write_index (std::ostream& file,
+			      const std::vector<uint64_t>& offsets,
+			      const size_t partitions)
+{
+    const uint64_t trailer[] = {offsets.size() - 1, partitions};
+
+    // Native byte order, the files are only read on the same machine
+    file.write (reinterpret_cast<const char*>(offsets.data()),
+		offsets.size() * sizeof(uint64_t));
+    file.write (reinterpret_cast<const char*>(trailer), sizeof(trailer));
+}
+
+std::vector<tmpfile_section>
+tmpfile_section::read_sections (const std::string& filename)
+{
+    std::ifstream file (filename, std::ifstream::binary);
+    uint64_t trailer[2] = {0, 0}; // extents and partitions
+
+    if (!file)
+    {
+	char err[80];
+#ifdef _WIN32
+	strerror_s (err, sizeof(err), errno);
+#endif
+	throw std::invalid_argument
+	    ("Unable to open " + filename + " for reading: "
+#ifndef _WIN32
+	     + strerror_r (errno, err, sizeof(err))
+#else
+	     + err
+#endif
+	    );
+    }
+
+    file.seekg (0, std::ifstream::end);
+    const uint64_t size = file.tellg();
+
+    if (size >= sizeof(trailer))
+    {
+	file.seekg (size - sizeof(trailer));
+	file.read (reinterpret_cast<char*>(trailer), sizeof(trailer));
+    }
+    if (!file || trailer[0] == 0 || trailer[1] == 0
+	|| size / sizeof(uint64_t) < trailer[0] + 3)
+    {
+	throw std::runtime_error ("Invalid index in " + filename);
+    }
+
+    std::vector<uint64_t> offsets (trailer[0] + 1);
+
+    file.seekg (size - (trailer[0] + 3) * sizeof(uint64_t));
+    file.read (reinterpret_cast<char*>(offsets.data()),
+	       offsets.size() * sizeof(uint64_t));
+    if (!file) throw std::runtime_error ("Can not read index of " + filename);
+
+    return sections (filename, offsets, trailer[1]);
+}
+
+void
+tmpfile_section::remove() const
+{
+    if (!_shared || --_shared->sections_left == 0)
+    {
+	std::remove (_filename.c_str());
+    }
+}
@@ -0,0 +1,111 @@
+/* -*- C++ -*-
+ * mapredo
+ * Copyright (C) 2015 Kjell Irgens <hextremist@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef _HEXTREME_MAPREDO_TMPFILE_SECTION_H
+#define _HEXTREME_MAPREDO_TMPFILE_SECTION_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <iosfwd>
+#include <cstdint>
+
+/**
+ * A sorted temporary file, or the section of a partitioned run file
+ * holding the records of one partition.  The sorter of each consumer
+ * writes all partitions to the same run file, one after the other,
+ * followed by an index of where each of them starts.  A run built
+ * over several rounds holds the partitions once for each round, so
+ * that a section may be made of several extents of the file.
+ */
+class tmpfile_section
+{
+public:
+    /** A whole file */
+    tmpfile_section (const std::string& filename) :
+	_filename (filename) {}
+    tmpfile_section (const char* filename) : _filename (filename) {}
+
+    /** A part of the file */
+    struct extent
+    {
+	uint64_t offset;
+	uint64_t size;
+    };
+
+    /**
+     * Make the sections of a partitioned run file
+     * @param filename name of the file
+     * @param offsets start of each extent in the file, followed by the
+     *                end of the last extent.  Extent i holds records
+     *                of partition i % partitions.
+     * @param partitions number of partitions
+     * @returns a section for each partition, with an empty file name
+     *          for the partitions without records.  The file is
+     *          removed by remove() of the last section.
+     */
+    static std::vector<tmpfile_section>
+    sections (const std::string& filename,
+	      const std::vector<uint64_t>& offsets, const size_t partitions);
+
+    /**
+     * Write the index of a partitioned run file to its end
+     * @param file the file, positioned after the last extent
+     * @param offsets as given to sections()
+     * @param partitions as given to sections()
+     */
+    static void write_index (std::ostream& file,
+			     const std::vector<uint64_t>& offsets,
+			     const size_t partitions);
+
+    /**
+     * Read the index written by write_index()
+     * @param filename name of the file
+     * @returns the sections of the file, as made by sections()
+     */
+    static std::vector<tmpfile_section>
+    read_sections (const std::string& filename);
+
+    /** @returns the name of the file */
+    const std::string& filename() const {return _filename;}
+    /** @returns the parts of the file to read, empty for the whole file */
+    const std::vector<extent>& extents() const {return _extents;}
+    /** @returns the size of the section, or 0 for the whole file */
+    uint64_t size() const {return _size;}
+
+    /**
+     * Remove a whole file.  A section is done with instead, and the
+     * file is removed after all its sections are.  This is called once
+     * for each section, after it has been read.
+     */
+    void remove() const;
+
+private:
+    /** Counts the sections of a file not yet done with */
+    struct shared_file
+    {
+	std::atomic<size_t> sections_left;
+    };
+
+    std::string _filename;
+    std::vector<extent> _extents;
+    uint64_t _size = 0;
+    std::shared_ptr<shared_file> _shared;
+};
+
+#endif
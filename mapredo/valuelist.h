@@ -17,10 +17,8 @@
 #ifndef _HEXTREME_MAPREDO_VALUELIST_H
 #define _HEXTREME_MAPREDO_VALUELIST_H
 
-#include <queue>
-
 #include "tmpfile_reader.h"
-#include "data_reader_queue.h"
+#include "loser_tree.h"
 
 namespace mapredo
 {
@@ -34,66 +32,20 @@ namespace mapredo
 	class iterator
 	{
 	public:
-	    iterator (data_reader_queue<T>& queue, const T key) :
-		_queue(&queue), _index(0), _key(key) {
-		auto* proc = queue.top();
-		_value = proc->get_next_value();
-		//std::cerr << "F " << _key << '\n';
+	    iterator (loser_tree<T>& tree, const T key) :
+		_tree(&tree), _index(0), _key(key) {
+		_value = tree.next_value();
 	    }
 	    iterator () {} // for end
 
 	    const iterator& operator++() {
-		auto* proc = _queue->top();
+		auto* proc = _tree->top();
 
-		if (proc->next_key())
-		{
-		    //std::cerr << "N " << *proc->next_key() << "\n";
-		    if (*proc == _key)
-		    {
-			_value = proc->get_next_value();
-			//std::cerr << "V0:" << _value << "\n";
-			++_index;
-			return *this;
-		    }
-		    if (!_queue->empty())
-		    {
-			_queue->pop();
-			auto* nproc = _queue->top();
-			//std::cerr << "NF " << *nproc->next_key() << '\n';
-			if (*nproc == _key)
-			{
-			    _queue->push (proc);
-			    _value = nproc->get_next_value();
-			    //std::cerr << "V1:" << _value << "\n";
-			    return *this;
-			}
-			//std::cerr << "All done for " << _key <<  "\n";
-			_queue->push (proc);
-		    }
-		}
-		else // file emptied, check next
+		if (proc && *proc == _key)
 		{
-		    _queue->pop();
-		    //std::cerr << "Check next, delete\n";
-		    delete proc;
-		    if (!_queue->empty()) //  check next
-		    {
-			proc = _queue->top();
-			if (proc->next_key())
-			{
-			    //std::cerr << "NF2 " << *proc->next_key() << '\n';
-			    if (*proc == _key)
-			    {
-				//std::cerr << "V2\n";
-				_value = proc->get_next_value();
-				//std::cerr << "V2:" << _value << "\n";
-				++_index;
-				return *this;
-			    }
-			}
-			//else std::cerr << "NF is empty\n";
-		    }
-		    //else std::cerr << "No more files\n";
+		    _value = _tree->next_value();
+		    ++_index;
+		    return *this;
 		}
 		_index = -1;
 		return *this;
@@ -107,24 +59,24 @@ namespace mapredo
 
 	    char* operator*() {return _value;}
 	private:
-	    data_reader_queue<T>* _queue = nullptr;
+	    loser_tree<T>* _tree = nullptr;
 	    int _index = -1;
 	    T _key;
 	    char* _value;
 	};
 
-	valuelist (data_reader_queue<T>& queue) :
-	    _queue (queue) {}
+	valuelist (loser_tree<T>& tree) :
+	    _tree (tree) {}
 
 	template<class U = T,
 		 typename std::enable_if<std::is_fundamental<U>::value>
                  ::type* = nullptr>
 	U get_key() {
-	    auto key = _queue.top()->next_key();
-	    if (key)
+	    auto* proc = _tree.top();
+	    if (proc)
 	    {
-		_key = *key;
-		return *key;
+		_key = *proc->next_key();
+		return _key;
 	    }
 	    throw std::runtime_error
 		("Attempted to valuelist::get_key() on an empty file");
@@ -134,17 +86,17 @@ namespace mapredo
                  typename std::enable_if<std::is_same<U,char*>::value,
                                          bool>::type* = nullptr>
 	char* get_key() {
-	    _key_copy = *_queue.top()->next_key();
+	    _key_copy = *_tree.top()->next_key();
 	    _key = const_cast<char*>(_key_copy.c_str());
 	    return _key;
 	}
 
-	iterator begin() const {return iterator (_queue, _key);}
+	iterator begin() const {return iterator (_tree, _key);}
 	const iterator& end() const {return _end;}
 
     private:
 
-	data_reader_queue<T>& _queue;
+	loser_tree<T>& _tree;
 	iterator _end;
 	T _key = 0;
 	std::string _key_copy;
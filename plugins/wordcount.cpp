@@ -9,13 +9,14 @@ void
 wordcount::map (char* line, const int length, mapredo::mcollector& output)
 {
     bool seen_word = false;
+    bool upper = false;
     int start = 0;
 
     for (int i = 0; i < length; i++)
     {
 	if (isspace(line[i]) || ispunct(line[i]))
 	{
-	    if (seen_word) output.collect (line+start, i - start);
+	    if (seen_word) collect (line + start, i - start, upper, output);
 	    seen_word = false;
 	}
 	else
@@ -23,13 +24,30 @@ wordcount::map (char* line, const int length, mapredo::mcollector& output)
 	    if (!seen_word)
 	    {
 		seen_word = true;
+		upper = false;
 		start = i;
 	    }
-	    line[i] = tolower (line[i]);
+	    if (isupper(line[i])) upper = true;
 	}
     }
 
-    if (seen_word) output.collect (line+start, length - start);
+    if (seen_word) collect (line + start, length - start, upper, output);
+}
+
+void
+wordcount::collect (const char* word, const int length, const bool upper,
+		    mapredo::mcollector& output)
+{
+    if (!upper)
+    {
+	output.collect (word, length);
+	return;
+    }
+
+    char* lower = output_buffer (length);
+
+    for (int i = 0; i < length; i++) lower[i] = tolower (word[i]);
+    output.collect (lower, length);
 }
 
 void
@@ -13,7 +13,13 @@ class wordcount final : public mapredo::mapreducer<char*>
 public:
     void map (char* line, const int length, mapredo::mcollector& output);
     void reduce (char* key, vlist& values, mapredo::rcollector& output);
+    bool mapper_reads_only() const {return true;}
     bool reducer_can_combine() const {return true;}
+
+private:
+    /** Collect a word in lower case, copied only if it needs changing */
+    void collect (const char* word, const int length, const bool upper,
+		  mapredo::mcollector& output);
 };
 
 #endif
@@ -11,8 +11,8 @@ wordsort::map (char* line, const int length, mapredo::mcollector& output)
     {
 	if (line[i] == '\t')
 	{
-	    output.collect_keyval (atoll(line + i + 1),
-				   std::string(line, i));
+	    line[i] = '\0';
+	    output.collect_keyval (atoll(line + i + 1), line);
 	    return;
 	}
     }
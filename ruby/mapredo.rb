@@ -32,12 +32,12 @@ module Mapredo
 
     @@id = 0
     
-    # If this mapredo command should take its input from an existing
-    # file, use this method.
+    # If this mapredo command should take its input from existing
+    # files, use this method.
     # Params:
-    # +filename+:: path to input file
-    def input_file(filename)
-      @input_file = filename
+    # +filenames+:: paths to input files, directories or glob patterns
+    def input_file(*filenames)
+      @input_files = filenames
     end
 
     # If this mapredo command should take its input from the output of another
@@ -87,9 +87,9 @@ module Mapredo
 
     def add_cmd(reduce_only = false)
       cmd = ""
-      cmd += "set -o pipefail;" if(@input_file)
+      cmd += "set -o pipefail;" if(@input_files)
       cmd += "mapredo "
-      cmd += "-i '#{@input_file}' " if @input_file
+      @input_files.each { |file| cmd += "-i '#{file}' " } if @input_files
       cmd += "-j #{@parallel} " if @parallel
       cmd += "--no-compression " if @compression == false
       cmd += "-b #{@buffer} " if @buffer
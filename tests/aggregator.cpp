@@ -0,0 +1,99 @@
+#include <gtest/gtest.h>
+
+#include <map>
+#include <string>
+
+#include "aggregator.h"
+#include "mapreducer.h"
+
+/** Counts keys, like the wordcount plugin */
+class counter : public mapredo::mapreducer<char*>
+{
+public:
+    void map (char *line, const int length, mapredo::mcollector&) {}
+    void reduce (char* key, vlist& values, mapredo::rcollector& output) {
+	int count = 0;
+
+	for (char* value : values)
+	{
+	    if (*value) count += atoi(value);
+	    else count++;
+	}
+	output.collect_keyval (key, count);
+    }
+    bool reducer_can_combine() const {return true;}
+};
+
+/** Adds up the counts of each key passed on by an aggregator */
+static aggregator::output_function
+count_into (std::map<std::string, int>& counts)
+{
+    return [&counts](const char* line, const size_t keylen,
+		     const size_t length)
+	{
+	    const std::string value (line + keylen, line + length);
+	    counts[std::string(line, keylen)]
+		+= (value.empty() ? 1 : atoi(value.c_str() + 1));
+	};
+}
+
+TEST(aggregator, fold)
+{
+    counter reducer;
+    std::map<std::string, int> counts;
+    aggregator table (reducer, 0x100000, count_into(counts));
+
+    for (int i = 0; i < 1000; i++)
+    {
+	table.add ("often", 5, 5);
+	if (i % 100 == 0) table.add ("seldom\t2", 6, 8);
+    }
+    EXPECT_TRUE (counts.empty());
+    table.flush();
+
+    EXPECT_EQ (2, counts.size());
+    EXPECT_EQ (1000, counts["often"]);
+    EXPECT_EQ (20, counts["seldom"]);
+    EXPECT_EQ (2, table.records_output());
+}
+
+TEST(aggregator, memory_bound)
+{
+    counter reducer;
+    std::map<std::string, int> counts;
+    aggregator table (reducer, 0x1000, count_into(counts));
+
+    for (int round = 0; round < 3; round++)
+    {
+	for (int i = 0; i < 1000; i++)
+	{
+	    const std::string key ("key" + std::to_string(i));
+	    table.add (key.data(), key.size(), key.size());
+	}
+    }
+    EXPECT_FALSE (counts.empty());
+    table.flush();
+
+    EXPECT_EQ (1000, counts.size());
+    for (auto& count: counts) EXPECT_EQ (3, count.second);
+}
+
+TEST(aggregator, bytes_within_bound)
+{
+    counter reducer;
+    std::map<std::string, int> counts;
+    const size_t max_bytes = 0x10000;
+    aggregator table (reducer, max_bytes, count_into(counts));
+
+    for (int i = 0; i < 100000; i++)
+    {
+	const std::string key ("key" + std::to_string(i * 7919 % 5000));
+
+	table.add (key.data(), key.size(), key.size());
+	ASSERT_LE (table.bytes(), max_bytes);
+    }
+    table.flush();
+
+    EXPECT_EQ (5000, counts.size());
+    for (auto& count: counts) EXPECT_EQ (20, count.second);
+}
@@ -3,6 +3,7 @@
 #include <future>
 
 #include "buffer_trader.h"
+#include "mpmc_queue.h"
 
 TEST(buffer_trader, producer_swap)
 {
@@ -40,11 +41,11 @@ TEST(buffer_trader, producer_swap)
     EXPECT_EQ (111, result.get());
 }
 
-TEST(buffer_trader, consumer_swap)
+static void consumer_swap (const bool lock_free)
 {
     const size_t num_threads = 10;
     const size_t num_pushes = 10000;
-    buffer_trader bt (0x10000, num_threads);
+    buffer_trader bt (0x10000, num_threads, lock_free);
 
     input_buffer* current = bt.producer_get();
     input_buffer* next = bt.producer_get();
@@ -85,7 +86,7 @@ TEST(buffer_trader, consumer_swap)
 	auto* tmp = current;
 	current = next;
 	next = bt.producer_swap (tmp);
-	ASSERT_EQ (0, next->end());
+	EXPECT_EQ (0, next->end());
     }
 
     bt.producer_finish();
@@ -100,6 +101,12 @@ TEST(buffer_trader, consumer_swap)
     EXPECT_EQ (num_pushes * 111, total);
 }
 
+TEST(buffer_trader, consumer_swap)
+{
+    consumer_swap (false);
+    consumer_swap (true);
+}
+
 TEST(buffer_trader, small_data)
 {
     buffer_trader bt (0x10000, 2);
@@ -118,20 +125,121 @@ TEST(buffer_trader, small_data)
     res2.get();
 }
 
+static void busy_consumer (const bool lock_free)
+{
+    const size_t num_pushes = 1000;
+    buffer_trader bt (0x10000, 3, lock_free);
+    std::promise<void> release;
+    std::shared_future<void> released (release.get_future());
+
+    input_buffer* current = bt.producer_get();
+    input_buffer* next = bt.producer_get();
+
+    // The first consumer holds on to its buffer until the end
+    auto busy = std::async(std::launch::async, [&]()
+			   {
+			       auto* buffer = bt.consumer_get(0);
+			       released.wait();
+			       size_t total = buffer ? buffer->end() : 0;
+			       while ((buffer = bt.consumer_swap(buffer, 0)))
+			       {
+				   total += buffer->end();
+			       }
+			       return total;
+			   });
+    std::vector<std::future<size_t>> results;
+
+    for (size_t i = 1; i < 3; i++)
+    {
+	results.push_back
+	    (std::async(std::launch::async, [&bt, i]()
+			{
+			    size_t total = 0;
+			    auto* buffer = bt.consumer_get(i);
+			    while (buffer)
+			    {
+				total += buffer->end();
+				buffer = bt.consumer_swap(buffer, i);
+			    }
+			    return total;
+			}));
+    }
+
+    for (size_t i = 0; i < num_pushes; i++)
+    {
+	current->end() = 1;
+	auto* tmp = current;
+	current = next;
+	next = bt.producer_swap (tmp);
+
+	// Returning here would leave the consumers waiting forever
+	EXPECT_NE (nullptr, next);
+	if (!next) break;
+    }
+    release.set_value();
+    bt.producer_finish();
+
+    size_t total = busy.get();
+    for (auto& result: results) total += result.get();
+    EXPECT_EQ (num_pushes, total);
+}
+
+TEST(buffer_trader, busy_consumer)
+{
+    busy_consumer (false);
+    busy_consumer (true);
+}
 
 TEST(buffer_trader, consumer_failure)
 {
-    buffer_trader bt (0x10000, 1);
+    for (bool lock_free: {false, true})
+    {
+	buffer_trader bt (0x10000, 1, lock_free);
 
-    input_buffer* current = bt.producer_get();
-    bt.producer_get();
+	input_buffer* current = bt.producer_get();
+	bt.producer_get();
+
+	auto res = std::async
+	    (std::launch::async,
+	     [](buffer_trader* bt) {bt->consumer_fail(0);},
+	     &bt);
+
+	// The producer no longer waits for a particular consumer, so it
+	// only sees the failure once it has happened
+	current = bt.producer_swap(current);
+	res.get();
+	EXPECT_EQ (nullptr, bt.producer_swap(current));
+    }
+}
+
+TEST(mpmc_queue, threads)
+{
+    const size_t per_thread = 20000;
+    mpmc_queue<size_t> queue (5);
+    std::vector<std::future<size_t>> sums;
+
+    size_t value;
+    EXPECT_FALSE (queue.try_pop (value));
 
-    auto res = std::async
-	(std::launch::async,
-	 [](buffer_trader* bt) {bt->consumer_fail(0);},
-	 &bt);
+    for (size_t i = 0; i < 4; i++)
+    {
+	sums.push_back (std::async(std::launch::async, [&queue, i]() {
+		    size_t sum = 0, value;
+		    for (size_t j = 0; j < per_thread; j++)
+		    {
+			while (!queue.try_push (i * per_thread + j))
+			{
+			    std::this_thread::yield();
+			}
+			while (!queue.try_pop (value)) std::this_thread::yield();
+			sum += value;
+		    }
+		    return sum;
+		}));
+    }
 
-    current = bt.producer_swap(current);
-    EXPECT_EQ (nullptr, bt.producer_swap(current));
-    res.get();
+    size_t total = 0;
+    for (auto& sum: sums) total += sum.get();
+    EXPECT_EQ (4 * per_thread * (4 * per_thread - 1) / 2, total);
+    EXPECT_FALSE (queue.try_pop (value));
 }
@@ -0,0 +1,108 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "mcollector.h"
+
+/** Keeps the lines collected by a mapper */
+class mapper_lines : public mapredo::mcollector
+{
+public:
+    void collect (const char* line, const size_t length) {
+	lines.emplace_back (line, length);
+    }
+    char* reserve (const char* const key, const size_t bytes) {
+	_key = key;
+	_value.resize (bytes);
+	return &_value[0];
+    }
+    void collect_reserved (const size_t length) {
+	lines.push_back (_key + '\t'
+			 + _value.substr(0, length ? length : _value.size()));
+    }
+
+    std::vector<std::string> lines;
+
+private:
+    std::string _key;
+    std::string _value;
+};
+
+/** Keeps the lines collected by a reducer */
+class reducer_lines : public mapredo::rcollector
+{
+public:
+    void collect (const char* line, const size_t length) {
+	lines.emplace_back (line, length);
+    }
+    char* reserve (const size_t bytes) {
+	_line.resize (bytes);
+	return &_line[0];
+    }
+    void collect_reserved (const size_t length) {
+	lines.push_back (_line.substr(0, length ? length : _line.size()));
+    }
+
+    std::vector<std::string> lines;
+
+private:
+    std::string _line;
+};
+
+template<typename T> static std::string
+streamed (const T& value)
+{
+    std::ostringstream stream;
+    stream << value;
+    return stream.str();
+}
+
+TEST(collector, field)
+{
+    const int64_t integers[] = {0, 7, -7, 10, 99, 100, 123456789,
+				std::numeric_limits<int64_t>::max(),
+				std::numeric_limits<int64_t>::min()};
+    const double doubles[] = {0, -0.5, 1.0/3, 123456789.0, 1e-300, 2.5e100};
+
+    for (auto value: integers)
+    {
+	EXPECT_EQ (streamed(value), mapredo::field(value).data());
+    }
+    for (auto value: doubles)
+    {
+	EXPECT_EQ (streamed(value), mapredo::field(value).data());
+    }
+    EXPECT_EQ (streamed(18446744073709551615LLU),
+	       mapredo::field(18446744073709551615LLU).data());
+    EXPECT_STREQ ("x", mapredo::field('x').data());
+    EXPECT_EQ (3, mapredo::field(std::string("abc")).size());
+}
+
+TEST(collector, keyval)
+{
+    mapper_lines mapped;
+    reducer_lines reduced;
+
+    mapped.collect_keyval ("word", 42);
+    mapped.collect_keyval (int64_t(-3), std::string("text"));
+    mapped.collect_keyval (1.5, "");
+    reduced.collect_keyval (std::string("word"), 0.25);
+    reduced.collect_keyval (int64_t(5), 'c');
+
+    // Lines too long for the reserved buffers go through collect()
+    const std::string word (5000, 'w');
+    reduced.collect_keyval (word, 1u);
+
+    ASSERT_EQ (3, mapped.lines.size());
+    EXPECT_EQ ("word\t42", mapped.lines[0]);
+    EXPECT_EQ ("-3\ttext", mapped.lines[1]);
+    EXPECT_EQ ("1.5\t", mapped.lines[2]);
+    ASSERT_EQ (3, reduced.lines.size());
+    EXPECT_EQ ("word\t0.25", reduced.lines[0]);
+    EXPECT_EQ ("5\tc", reduced.lines[1]);
+    EXPECT_EQ (word + "\t1", reduced.lines[2]);
+}
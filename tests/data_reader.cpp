@@ -1,138 +1,224 @@
 #include <gtest/gtest.h>
 
-#include "data_reader_queue.h"
-#include "tmpfile_reader.h"
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
 
-TEST(data_reader_queue, forward_int64)
+#include "loser_tree.h"
+#include "tmpfile_reader.h"
+#include "run_format.h"
+#include "tmpfile_collector.h"
+#include "settings.h"
+
+/** Write tab separated keys and values to a file as binary records */
+static void
+write_run (const char* filename, const mapredo::base::keytype type,
+	   const std::vector<std::string>& lines)
 {
-    EXPECT_EQ (0, system (R"(printf "1\n5\n6\n" >testfile1)"));
-    EXPECT_EQ (0, system (R"(printf "3\n4\n6\n" >testfile2)"));
-
-    data_reader_queue<int64_t> q;
-    tmpfile_reader<int64_t> r1 ("testfile1", 0x10000, false);
-    tmpfile_reader<int64_t> r2 ("testfile2", 0x10000, false);
-
-    EXPECT_EQ (true, q.empty());
-    
-    q.push (&r1);
-    q.push (&r2);
-
-    EXPECT_EQ (false, q.empty());
-    EXPECT_EQ (2, q.size());
-
-    auto proc = q.top();
-    EXPECT_EQ (1, *proc->next_key());
-    proc->get_next_value();
-
-    q.pop();
-    q.push (proc);
-    proc = q.top();
-    EXPECT_EQ (3, *proc->next_key());    
-    proc->get_next_value();
-
-    q.pop();
-    q.push (proc);
-    proc = q.top();
-    EXPECT_EQ (4, *proc->next_key());
+    std::ofstream file (filename, std::ofstream::binary);
+    std::string record;
+
+    for (auto& line: lines)
+    {
+	record.resize (run_format::max_line_size (line.size()));
+	file.write (record.data(),
+		    run_format::encode_line (&record[0], type, line.data(),
+					     line.size()));
+    }
 }
 
-TEST(data_reader_queue, reverse_int64)
+TEST(loser_tree, forward_int64)
 {
-    EXPECT_EQ (0, system (R"(printf "6\n5\n1\n" >testfile1)"));
-    EXPECT_EQ (0, system (R"(printf "7\n4\n3\n" >testfile2)"));
+    write_run ("testfile1", mapredo::base::INT64, {"1", "5", "6"});
+    write_run ("testfile2", mapredo::base::INT64, {"3", "4", "6"});
+
+    loser_tree<int64_t> tree;
+
+    EXPECT_EQ (true, tree.empty());
 
-    data_reader_queue<int64_t> q (true);
-    tmpfile_reader<int64_t> r1 ("testfile1", 0x10000, false);
-    tmpfile_reader<int64_t> r2 ("testfile2", 0x10000, false);
+    tree.push (new tmpfile_reader<int64_t> ("testfile1", 0x10000, false));
+    tree.push (new tmpfile_reader<int64_t> ("testfile2", 0x10000, false));
 
-    EXPECT_EQ (true, q.empty());
-    
-    q.push (&r1);
-    q.push (&r2);
+    EXPECT_EQ (false, tree.empty());
+    EXPECT_EQ (2, tree.size());
 
-    EXPECT_EQ (false, q.empty());
-    EXPECT_EQ (2, q.size());
+    EXPECT_EQ (1, *tree.top()->next_key());
+    tree.next_value();
+    EXPECT_EQ (3, *tree.top()->next_key());
+    tree.next_value();
+    EXPECT_EQ (4, *tree.top()->next_key());
+}
+
+TEST(loser_tree, reverse_int64)
+{
+    write_run ("testfile1", mapredo::base::INT64, {"6", "5", "1"});
+    write_run ("testfile2", mapredo::base::INT64, {"7", "4", "3"});
 
-    auto proc = q.top();
-    EXPECT_EQ (7, *proc->next_key());
-    proc->get_next_value();
+    loser_tree<int64_t> tree (true);
 
-    q.pop();
-    q.push (proc);
-    proc = q.top();
-    EXPECT_EQ (6, *proc->next_key());    
-    proc->get_next_value();
+    tree.push (new tmpfile_reader<int64_t> ("testfile1", 0x10000, false));
+    tree.push (new tmpfile_reader<int64_t> ("testfile2", 0x10000, false));
 
-    q.pop();
-    q.push (proc);
-    proc = q.top();
-    EXPECT_EQ (5, *proc->next_key());
+    EXPECT_EQ (7, *tree.top()->next_key());
+    tree.next_value();
+    EXPECT_EQ (6, *tree.top()->next_key());
+    tree.next_value();
+    EXPECT_EQ (5, *tree.top()->next_key());
+
+    // Readers are deleted as they run out of records
+    for (int i = 0; i < 4; i++) tree.next_value();
+    EXPECT_EQ (0, tree.size());
+    EXPECT_EQ (nullptr, tree.top());
 
     EXPECT_EQ (0, system ("rm -f testfile1 testfile2"));
 }
 
-TEST(data_reader_queue, forward_string)
+TEST(loser_tree, forward_string)
 {
-    EXPECT_EQ (0, system (R"(printf "abc\ndef\nghi\n" >testfile1)"));
-    EXPECT_EQ (0, system (R"(printf "bcd\nefg\nhij\n" >testfile2)"));
-
-    data_reader_queue<char*> q;
-    tmpfile_reader<char*> r1 ("testfile1", 0x10000, false);
-    tmpfile_reader<char*> r2 ("testfile2", 0x10000, false);
-
-    EXPECT_EQ (true, q.empty());
-    
-    q.push (&r1);
-    q.push (&r2);
-
-    EXPECT_EQ (false, q.empty());
-    EXPECT_EQ (2, q.size());
-
-    auto proc = q.top();
-    EXPECT_EQ (0, strcmp("abc", *proc->next_key()));
-    proc->get_next_value();
-
-    q.pop();
-    q.push (proc);
-    proc = q.top();
-    EXPECT_EQ (0, strcmp("bcd", *proc->next_key()));    
-    proc->get_next_value();
-
-    q.pop();
-    q.push (proc);
-    proc = q.top();
-    EXPECT_EQ (0, strcmp("def", *proc->next_key()));
+    write_run ("testfile1", mapredo::base::STRING, {"abc", "def", "ghi"});
+    write_run ("testfile2", mapredo::base::STRING, {"bcd", "efg", "hij"});
+
+    loser_tree<char*> tree;
+
+    tree.push (new tmpfile_reader<char*> ("testfile1", 0x10000, false));
+    tree.push (new tmpfile_reader<char*> ("testfile2", 0x10000, false));
+
+    EXPECT_STREQ ("abc", *tree.top()->next_key());
+    tree.next_value();
+    EXPECT_STREQ ("bcd", *tree.top()->next_key());
+    tree.next_value();
+    EXPECT_STREQ ("def", *tree.top()->next_key());
+}
+
+TEST(loser_tree, reverse_string)
+{
+    write_run ("testfile1", mapredo::base::STRING, {"ghi", "def", "abc"});
+    write_run ("testfile2", mapredo::base::STRING, {"hij", "efg", "bcd"});
+
+    loser_tree<char*> tree (true);
+
+    tree.push (new tmpfile_reader<char*> ("testfile1", 0x10000, false));
+    tree.push (new tmpfile_reader<char*> ("testfile2", 0x10000, false));
+
+    EXPECT_STREQ ("hij", *tree.top()->next_key());
+    tree.next_value();
+    EXPECT_STREQ ("ghi", *tree.top()->next_key());
+    tree.next_value();
+    EXPECT_STREQ ("efg", *tree.top()->next_key());
+}
+
+TEST(loser_tree, many_readers)
+{
+    for (const bool reverse: {false, true})
+    {
+	// Keys sharing long prefixes are ordered on the rest
+	std::vector<std::string> keys;
+	uint32_t random = 1;
+	loser_tree<char*> tree (reverse);
+
+	for (int i = 0; i < 37; i++)
+	{
+	    std::vector<std::string> run;
+
+	    for (int j = 0; j < 20; j++)
+	    {
+		random = random * 1103515245 + 12345;
+		run.push_back ("key_" + std::string(random % 8, 'x')
+			       + std::to_string(random % 1000));
+	    }
+	    std::sort (run.begin(), run.end());
+	    if (reverse) std::reverse (run.begin(), run.end());
+
+	    const std::string filename ("testfile" + std::to_string(i));
+
+	    write_run (filename.c_str(), mapredo::base::STRING, run);
+	    tree.push (new tmpfile_reader<char*> (filename, 0x1000, true));
+	    keys.insert (keys.end(), run.begin(), run.end());
+	}
+	std::sort (keys.begin(), keys.end());
+	if (reverse) std::reverse (keys.begin(), keys.end());
+
+	std::vector<std::string> merged;
+
+	while (!tree.empty())
+	{
+	    merged.push_back (*tree.top()->next_key());
+	    tree.next_value();
+	}
+	EXPECT_EQ (keys, merged);
+    }
+}
+
+TEST(data_reader, records)
+{
+    write_run ("testfile1", mapredo::base::STRING,
+	       {"key\tvalue", "no value", "\tempty key", "x\ty\tz"});
+    write_run ("testfile2", mapredo::base::DOUBLE, {"2.5\ta", "-1e3"});
+
+    tmpfile_reader<char*> strings ("testfile1", 0x10000, false);
+    tmpfile_reader<double> doubles ("testfile2", 0x10000, false);
+
+    ASSERT_TRUE (strings.next_key());
+    EXPECT_STREQ ("key", *strings.next_key());
+    EXPECT_STREQ ("value", strings.get_next_value());
+    EXPECT_STREQ ("no value", *strings.next_key());
+    EXPECT_STREQ ("", strings.get_next_value());
+    EXPECT_STREQ ("", *strings.next_key());
+    EXPECT_STREQ ("empty key", strings.get_next_value());
+    EXPECT_STREQ ("x", *strings.next_key());
+    EXPECT_STREQ ("y\tz", strings.get_next_value());
+    EXPECT_EQ (nullptr, strings.next_key());
+
+    // Records are copied as they are stored
+    size_t length;
+    std::string record (run_format::max_line_size (5), '\0');
+    record.resize (run_format::encode_line (&record[0], mapredo::base::DOUBLE,
+					    "2.5\ta", 5));
+
+    ASSERT_TRUE (doubles.next_key());
+    EXPECT_EQ (2.5, *doubles.next_key());
+    const char* stored = doubles.get_next_record (length);
+    EXPECT_EQ (record, std::string (stored, length));
+    EXPECT_EQ (-1000, *doubles.next_key());
+    EXPECT_STREQ ("", doubles.get_next_value());
+    EXPECT_EQ (nullptr, doubles.next_key());
+
+    EXPECT_EQ (0, system ("rm -f testfile1 testfile2"));
 }
 
-TEST(data_reader_queue, reverse_string)
+TEST(data_reader, long_records)
 {
-    EXPECT_EQ (0, system (R"(printf "ghi\ndef\nabc\n" >testfile1)"));
-    EXPECT_EQ (0, system (R"(printf "hij\nefg\nbcd\n" >testfile2)"));
-
-    data_reader_queue<char*> q (true);
-    tmpfile_reader<char*> r1 ("testfile1", 0x10000, false);
-    tmpfile_reader<char*> r2 ("testfile2", 0x10000, false);
-
-    EXPECT_EQ (true, q.empty());
-    
-    q.push (&r1);
-    q.push (&r2);
-
-    EXPECT_EQ (false, q.empty());
-    EXPECT_EQ (2, q.size());
-
-    auto proc = q.top();
-    EXPECT_EQ (0, strcmp("hij", *proc->next_key()));
-    proc->get_next_value();
-
-    q.pop();
-    q.push (proc);
-    proc = q.top();
-    EXPECT_EQ (0, strcmp("ghi", *proc->next_key()));    
-    proc->get_next_value();
-
-    q.pop();
-    q.push (proc);
-    proc = q.top();
-    EXPECT_EQ (0, strcmp("efg", *proc->next_key()));
+    // Records longer than the 64k buffers and compressed blocks
+    const std::vector<std::string> lines
+	{"short\t1", std::string(70000, 'k') + "\tv",
+	 "m\t" + std::string(140000, 'v'), "z\tlast"};
+
+    for (const bool compressed: {false, true})
+    {
+	int id = 1;
+	std::string filename;
+
+	settings::instance().set_compressed (compressed);
+	{
+	    tmpfile_collector collector ("testfile", id, nullptr,
+					 mapredo::base::STRING);
+
+	    for (auto& line: lines) collector.collect (line.data(),
+						       line.size());
+	    collector.flush();
+	    filename = collector.filename();
+	}
+
+	tmpfile_reader<char*> reader (filename, 0x20000, true);
+	std::vector<std::string> read;
+
+	while (reader.next_key())
+	{
+	    const std::string key (*reader.next_key());
+	    read.push_back (key + '\t' + reader.get_next_value());
+	}
+	EXPECT_EQ (lines, read);
+    }
+    settings::instance().set_compressed (false);
 }
@@ -0,0 +1,695 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <future>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include <snappy-c.h>
+
+#include "mapped_input.h"
+#include "split_input.h"
+#include "ring_input.h"
+#include "chunk_sizer.h"
+#include "multi_input.h"
+#include "decoded_input.h"
+#include "settings.h"
+
+static std::string read_all (input_source& input, const size_t id)
+{
+    std::string result;
+    auto* buffer = input.consumer_get (id);
+
+    while (buffer)
+    {
+	std::string chunk (buffer->get() + buffer->start(),
+			   buffer->end() - buffer->start());
+
+	if (chunk.empty() || chunk.back() != '\n')
+	{
+	    ADD_FAILURE() << "Chunk not newline aligned: '" << chunk << "'";
+	}
+	result += chunk;
+
+	// Overwrite newlines like consumers do with writable buffers
+	for (size_t i = buffer->start();
+	     buffer->writable() && i < buffer->end(); i++)
+	{
+	    if (buffer->get()[i] == '\n') buffer->get()[i] = '\0';
+	}
+	buffer = input.consumer_swap (buffer, id);
+    }
+
+    return result;
+}
+
+static std::string sort_lines (const std::string& lines)
+{
+    std::vector<std::string> vec;
+    std::string::size_type pos = 0;
+    std::string result;
+
+    while (pos < lines.size())
+    {
+	auto nl = lines.find ('\n', pos);
+	vec.push_back (lines.substr (pos, nl - pos));
+	pos = nl + 1;
+    }
+    std::sort (vec.begin(), vec.end());
+    for (auto& line: vec) result += line + "\n";
+
+    return result;
+}
+
+static std::string write_lines (const size_t num_lines)
+{
+    std::string content;
+
+    for (size_t i = 0; i < num_lines; i++)
+    {
+	content += std::string(i % 37, 'x') + std::to_string(i) + "\n";
+    }
+    std::ofstream ("testfile1") << content;
+
+    return content;
+}
+
+static std::string read_threaded (input_source& input)
+{
+    auto res1 (std::async(std::launch::async, read_all,
+			  std::ref(input), 1));
+    auto res2 (std::async(std::launch::async, read_all,
+			  std::ref(input), 2));
+
+    return read_all (input, 0) + res1.get() + res2.get();
+}
+
+TEST(mapped_input, newline_aligned)
+{
+    std::string content (write_lines (1000));
+    mapped_input input ("testfile1", 64, 3);
+
+    EXPECT_EQ (content.size(), input.size());
+    EXPECT_EQ (sort_lines(content), sort_lines(read_threaded(input)));
+
+    EXPECT_EQ (0, system ("rm -f testfile1"));
+}
+
+TEST(mapped_input, no_trailing_newline)
+{
+    EXPECT_EQ (0, system (R"(printf "\357\273\277abc\ndef" >testfile1)"));
+
+    mapped_input input ("testfile1", 0x100000, 1);
+    auto* buffer = input.consumer_get (0);
+
+    ASSERT_NE (nullptr, buffer);
+    EXPECT_EQ ("abc\ndef", std::string(buffer->get() + buffer->start(),
+				      buffer->end() - buffer->start()));
+    EXPECT_FALSE (buffer->writable());
+    EXPECT_EQ (nullptr, input.consumer_swap (buffer, 0));
+
+    EXPECT_EQ (0, system ("rm -f testfile1"));
+}
+
+TEST(mapped_input, empty_and_missing)
+{
+    EXPECT_EQ (0, system ("rm -f testfile1; touch testfile1"));
+
+    mapped_input input ("testfile1", 0x100000, 1);
+    EXPECT_EQ (nullptr, input.consumer_get (0));
+    EXPECT_THROW (mapped_input ("nonexisting", 0x100000, 1),
+		  std::runtime_error);
+
+    EXPECT_EQ (0, system ("rm -f testfile1"));
+}
+
+TEST(split_input, newline_aligned)
+{
+    for (size_t buffer_size: {48, 64, 100, 1000})
+    {
+	std::string content (write_lines (1000));
+	split_input input ("testfile1", buffer_size, 3);
+
+	EXPECT_EQ (content.size(), input.size());
+	EXPECT_LT (input.split_size(), content.size() / 3);
+	EXPECT_EQ (sort_lines(content), sort_lines(read_threaded(input)));
+    }
+
+    EXPECT_EQ (0, system ("rm -f testfile1"));
+}
+
+TEST(split_input, long_lines)
+{
+    std::string content;
+
+    for (size_t i = 0; i < 100; i++)
+    {
+	content += std::string(i % 3 ? 1 : 40, 'y') + std::to_string(i) + "\n";
+    }
+    std::ofstream ("testfile1") << content;
+
+    split_input input ("testfile1", 48, 3);
+    EXPECT_EQ (sort_lines(content), sort_lines(read_threaded(input)));
+
+    // Lines longer than the buffer make it grow
+    split_input small ("testfile1", 16, 3);
+    EXPECT_EQ (sort_lines(content), sort_lines(read_threaded(small)));
+
+    EXPECT_EQ (0, system ("rm -f testfile1"));
+}
+
+TEST(split_input, no_trailing_newline)
+{
+    EXPECT_EQ (0, system (R"(printf "\357\273\277abc\ndef" >testfile1)"));
+
+    split_input input ("testfile1", 0x100000, 1);
+    auto* buffer = input.consumer_get (0);
+
+    ASSERT_NE (nullptr, buffer);
+    EXPECT_EQ ("abc\ndef", std::string(buffer->get() + buffer->start(),
+				      buffer->end() - buffer->start()));
+    EXPECT_EQ (nullptr, input.consumer_swap (buffer, 0));
+
+    EXPECT_EQ (0, system ("rm -f testfile1"));
+}
+
+TEST(split_input, truncated)
+{
+    std::string content (write_lines (1000));
+    split_input input ("testfile1", 64, 3);
+
+    // The ranges were split from the size the file had when opened
+    ASSERT_EQ (0, truncate ("testfile1", content.size() / 2));
+    EXPECT_THROW (read_threaded (input), std::runtime_error);
+
+    EXPECT_EQ (0, system ("rm -f testfile1"));
+}
+
+static void write_pipe (const int fd, const std::string& content,
+			const size_t piece)
+{
+    for (size_t pos = 0; pos < content.size(); pos += piece)
+    {
+	const size_t bytes = std::min (piece, content.size() - pos);
+	ASSERT_EQ (bytes, write (fd, content.data() + pos, bytes));
+    }
+    close (fd);
+}
+
+TEST(ring_input, newline_aligned)
+{
+    for (size_t piece: {7, 100, 5000})
+    {
+	std::string content (write_lines (1000));
+	int fds[2];
+
+	ASSERT_EQ (0, pipe (fds));
+	ring_input input (fds[0], 64, 3);
+	EXPECT_LT (input.capacity(), content.size()); // wraps around
+
+	auto writer (std::async(std::launch::async, write_pipe, fds[1],
+				std::ref(content), piece));
+	auto reader (std::async(std::launch::async, &ring_input::read_input,
+				&input));
+
+	EXPECT_EQ (sort_lines(content), sort_lines(read_threaded(input)));
+	EXPECT_EQ (content.size(), reader.get());
+	writer.get();
+	close (fds[0]);
+    }
+
+    EXPECT_EQ (0, system ("rm -f testfile1"));
+}
+
+TEST(ring_input, no_trailing_newline)
+{
+    int fds[2];
+
+    ASSERT_EQ (0, pipe (fds));
+    write_pipe (fds[1], "\357\273\277abc\ndef", 100);
+
+    ring_input input (fds[0], 0x100000, 1);
+    EXPECT_EQ (10, input.read_input());
+    close (fds[0]);
+
+    std::string result;
+    auto* buffer = input.consumer_get (0);
+    while (buffer)
+    {
+	result.append (buffer->get() + buffer->start(),
+		       buffer->end() - buffer->start());
+	if (result.back() != '\n')
+	{
+	    buffer->get()[buffer->end()] = '\0'; // must be writable
+	}
+	buffer = input.consumer_swap (buffer, 0);
+    }
+    EXPECT_EQ ("abc\ndef", result);
+}
+
+TEST(ring_input, line_longer_than_ring)
+{
+    int fds[2];
+
+    ASSERT_EQ (0, pipe (fds));
+    ring_input input (fds[0], 64, 1);
+    const size_t capacity = input.capacity();
+    const std::string content ("abc\n" + std::string(capacity * 3, 'z')
+			       + "\ndef\n");
+    auto writer (std::async(std::launch::async, write_pipe, fds[1],
+			    std::ref(content), 1000));
+    auto reader (std::async(std::launch::async, &ring_input::read_input,
+			    &input));
+
+    EXPECT_EQ (sort_lines(content), sort_lines(read_all(input, 0)));
+    EXPECT_EQ (content.size(), reader.get());
+    EXPECT_LT (capacity * 3, input.capacity());
+    writer.get();
+    close (fds[0]);
+}
+
+TEST(input_buffer, increase_capacity)
+{
+    input_buffer buffer (4);
+
+    memcpy (buffer.get(), "abc", 3);
+    buffer.end() = 3;
+    buffer.increase_capacity (5);
+    EXPECT_LE (8, buffer.capacity());
+    EXPECT_EQ ("abc", std::string(buffer.get(), buffer.end()));
+
+    input_buffer view;
+    view.set_view (buffer.get(), 3);
+    EXPECT_THROW (view.increase_capacity (4), std::logic_error);
+}
+
+TEST(chunk_sizer, adapt)
+{
+    typedef std::chrono::milliseconds ms;
+    chunk_sizer fixed (100);
+
+    for (int i = 0; i < 10; i++) fixed.processed (100, ms(0));
+    EXPECT_EQ (100, fixed.size());
+
+    chunk_sizer sizer (100, 50, 400);
+
+    // Quickly processed chunks double the size a limited number of times
+    for (int i = 0; i < 3; i++) sizer.processed (100, ms(0));
+    EXPECT_EQ (100, sizer.size());
+    sizer.processed (100, ms(0));
+    EXPECT_EQ (200, sizer.size());
+    for (int i = 0; i < 20; i++) sizer.processed (sizer.size(), ms(0));
+    EXPECT_EQ (400, sizer.size());
+
+    // Short chunks at the end of input and ordinary times change nothing
+    for (int i = 0; i < 8; i++) sizer.processed (10, ms(1000));
+    for (int i = 0; i < 8; i++) sizer.processed (400, ms(20));
+    EXPECT_EQ (400, sizer.size());
+
+    // Slowly processed chunks halve the size
+    for (int i = 0; i < 20; i++) sizer.processed (sizer.size(), ms(1000));
+    EXPECT_EQ (50, sizer.size());
+
+    sizer.limit (20);
+    EXPECT_EQ (50, sizer.max());
+}
+
+TEST(multi_input, several_files)
+{
+    std::string content;
+
+    EXPECT_EQ (0, system ("rm -f testfile2 testfile3; touch testfile2"));
+    content += write_lines (1000);
+    EXPECT_EQ (0, system ("mv testfile1 testfile3"));
+    content += write_lines (10);
+
+    for (bool use_mmap: {true, false})
+    {
+	multi_input input ({"testfile1", "testfile2", "testfile3"}, 64, 3,
+			   use_mmap);
+
+	EXPECT_EQ (sort_lines(content), sort_lines(read_threaded(input)));
+    }
+
+    multi_input missing ({"testfile1", "nonexisting"}, 64, 1);
+    EXPECT_THROW (read_all (missing, 0), std::runtime_error);
+
+    EXPECT_EQ (0, system ("rm -f testfile1 testfile2 testfile3"));
+}
+
+TEST(multi_input, shared_chunk_sizer)
+{
+    write_lines (1000);
+    EXPECT_EQ (0, system ("sed 's/^/b/' testfile1 >testfile2"));
+
+    // Chunks of the first file are returned quickly, so the second file
+    // starts out with the chunk size learned from the first
+    multi_input input ({"testfile1", "testfile2"},
+		       chunk_sizer(64, 64, 4096), 1);
+    size_t second_file_chunk = 0;
+    auto* buffer = input.consumer_get (0);
+
+    while (buffer)
+    {
+	if (!second_file_chunk && buffer->get()[buffer->start()] == 'b')
+	{
+	    second_file_chunk = buffer->end() - buffer->start();
+	}
+	buffer = input.consumer_swap (buffer, 0);
+    }
+    EXPECT_LT (1024, second_file_chunk);
+
+    EXPECT_EQ (0, system ("rm -f testfile1 testfile2"));
+}
+
+/** Cut content into pieces that do not follow line boundaries */
+static std::vector<std::string> cut (const std::string& content,
+				     const size_t piece)
+{
+    std::vector<std::string> pieces;
+
+    for (size_t pos = 0; pos < content.size(); pos += piece)
+    {
+	pieces.push_back (content.substr (pos, piece));
+    }
+    return pieces;
+}
+
+#ifdef HAVE_ZLIB
+static std::string gzip (const std::string& data, const bool bgzf)
+{
+    z_stream zs;
+    std::string result (compressBound(data.size()) + 100, '\0');
+
+    memset (&zs, 0, sizeof(zs));
+    EXPECT_EQ (Z_OK, deflateInit2 (&zs, 6, Z_DEFLATED, 15 + 16, 8,
+				   Z_DEFAULT_STRATEGY));
+
+    // A BGZF block is a gzip member with its size in an extra field
+    unsigned char extra[] = {'B', 'C', 2, 0, 0, 0};
+    gz_header header;
+    memset (&header, 0, sizeof(header));
+    header.extra = extra;
+    header.extra_len = sizeof(extra);
+    if (bgzf)
+    {
+	EXPECT_EQ (Z_OK, deflateSetHeader (&zs, &header));
+    }
+
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    zs.avail_in = data.size();
+    zs.next_out = reinterpret_cast<Bytef*>(&result[0]);
+    zs.avail_out = result.size();
+    EXPECT_EQ (Z_STREAM_END, deflate (&zs, Z_FINISH));
+    result.resize (zs.total_out);
+    deflateEnd (&zs);
+
+    if (bgzf)
+    {
+	result[16] = (result.size() - 1) & 0xff;
+	result[17] = (result.size() - 1) >> 8;
+    }
+    return result;
+}
+
+TEST(decoded_input, gzip)
+{
+    std::string content (write_lines (1000));
+
+    for (bool bgzf: {true, false})
+    {
+	std::string packed;
+
+	for (auto& piece: cut(content, 1000)) packed += gzip (piece, bgzf);
+	if (bgzf) packed += gzip ("", true); // end of file marker
+	std::ofstream ("testfile1.gz") << packed;
+
+	decoded_input input ("testfile1.gz", 64, 3);
+	EXPECT_EQ (decoded_input::GZIP, decoded_input::detect("testfile1.gz"));
+	EXPECT_EQ (sort_lines(content), sort_lines(read_threaded(input)));
+	EXPECT_EQ (packed.size(), input.bytes_read());
+    }
+
+    EXPECT_EQ (0, system ("rm -f testfile1 testfile1.gz"));
+}
+#endif
+
+#ifdef HAVE_ZSTD
+TEST(decoded_input, zstd)
+{
+    std::string content (write_lines (1000));
+    std::string packed ("\x50\x2a\x4d\x18\x03\x00\x00\x00xyz", 11);
+
+    for (auto& piece: cut(content, 1000))
+    {
+	std::string frame (ZSTD_compressBound(piece.size()), '\0');
+	frame.resize (ZSTD_compress (&frame[0], frame.size(), piece.data(),
+				     piece.size(), 3));
+	packed += frame;
+    }
+    std::ofstream ("testfile1.zst") << packed;
+
+    decoded_input input ("testfile1.zst", 64, 3);
+    EXPECT_EQ (sort_lines(content), sort_lines(read_threaded(input)));
+
+    EXPECT_EQ (0, system ("rm -f testfile1 testfile1.zst"));
+}
+#endif
+
+static uint32_t masked_crc32c (const std::string& data)
+{
+    uint32_t crc = 0xffffffff;
+
+    for (unsigned char c: data)
+    {
+	crc ^= c;
+	for (int i = 0; i < 8; i++) crc = (crc >> 1) ^ (crc & 1 ? 0x82f63b78 : 0);
+    }
+    crc = ~crc;
+
+    return (crc >> 15 | crc << 17) + 0xa282ead8;
+}
+
+static std::string snappy_framed (const std::vector<std::string>& pieces)
+{
+    std::string result ("\xff\x06\x00\x00sNaPpY", 10);
+    bool compress = false;
+
+    for (auto& piece: pieces)
+    {
+	std::string data (piece);
+	const uint32_t crc = masked_crc32c (piece);
+
+	if ((compress = !compress))
+	{
+	    size_t size = snappy_max_compressed_length (piece.size());
+	    data.resize (size);
+	    EXPECT_EQ (SNAPPY_OK, snappy_compress (piece.data(), piece.size(),
+						   &data[0], &size));
+	    data.resize (size);
+	}
+
+	const size_t length = data.size() + 4;
+	const char header[] = {compress ? '\0' : '\1', char(length & 0xff),
+			       char(length >> 8), char(length >> 16),
+			       char(crc & 0xff), char(crc >> 8),
+			       char(crc >> 16), char(crc >> 24)};
+
+	result += std::string(header, sizeof(header)) + data;
+    }
+    return result;
+}
+
+TEST(decoded_input, snappy)
+{
+    std::string content (write_lines (1000));
+    std::string packed (snappy_framed (cut(content, 1000)));
+
+    std::ofstream ("testfile1.sz") << packed;
+
+    decoded_input input ("testfile1.sz", 64, 3);
+    EXPECT_EQ (sort_lines(content), sort_lines(read_threaded(input)));
+
+    // Corrupt data is noticed by the checksum
+    packed[packed.size() / 2] ^= 1;
+    std::ofstream ("testfile1.sz") << packed;
+    decoded_input corrupt ("testfile1.sz", 64, 1);
+    EXPECT_THROW (read_all (corrupt, 0), std::runtime_error);
+
+    EXPECT_EQ (0, system ("rm -f testfile1 testfile1.sz"));
+}
+
+TEST(decoded_input, stream_without_trailing_newline)
+{
+    const std::string packed
+	(snappy_framed ({"\357\273\277ab", "c\nd", "e", "f"}));
+    int fds[2];
+
+    ASSERT_EQ (0, pipe (fds));
+    write_pipe (fds[1], packed, 100);
+
+    // The first bytes have already been read to recognize the format
+    std::string head (decoded_input::magic_size, '\0');
+    ASSERT_EQ (head.size(), read (fds[0], &head[0], head.size()));
+    ASSERT_EQ (decoded_input::SNAPPY,
+	       decoded_input::detect (head.data(), head.size()));
+
+    decoded_input input (fds[0], head, 0x100000, 1);
+    EXPECT_EQ ("abc\ndef\n", read_all (input, 0));
+    EXPECT_EQ (packed.size(), input.bytes_read());
+    close (fds[0]);
+
+    write_lines (10);
+    EXPECT_EQ (decoded_input::PLAIN, decoded_input::detect("testfile1"));
+    EXPECT_THROW (decoded_input ("testfile1", 64, 1), std::runtime_error);
+
+    EXPECT_EQ (0, system ("rm -f testfile1"));
+}
+
+/** Records with embedded newlines, each preceded by its length */
+static std::string write_records (const record_format::type format,
+				  std::vector<std::string>& records)
+{
+    std::string content;
+
+    for (size_t i = 0; i < 1000; i++)
+    {
+	std::string record (std::string(i % 300, '\n') + std::to_string(i));
+	size_t length = record.size();
+
+	if (format == record_format::FIXED32)
+	{
+	    content += std::string(2, '\0') + char(length >> 8) + char(length);
+	}
+	else
+	{
+	    for (; length >= 0x80; length >>= 7) content += char(length | 0x80);
+	    content += char(length);
+	}
+	content += record;
+	records.push_back (record);
+    }
+    std::sort (records.begin(), records.end());
+    std::ofstream ("testfile1") << content;
+
+    return content;
+}
+
+/** Read chunks of whole records from several consumers */
+static std::vector<std::string> read_records (input_source& input)
+{
+    const record_format::type format (settings::instance().input_format());
+    auto read = [&](const size_t id) {
+	std::vector<std::string> records;
+	uint64_t length;
+
+	for (auto* buffer = input.consumer_get (id); buffer;
+	     buffer = input.consumer_swap (buffer, id))
+	{
+	    const char* pos = buffer->get() + buffer->start();
+	    const char* end = buffer->get() + buffer->end();
+
+	    EXPECT_EQ (end, record_format::records_end (format, pos, end,
+							end - pos));
+	    while (pos < end)
+	    {
+		pos += record_format::header (format, pos, end, length);
+		records.emplace_back (pos, length);
+		pos += length;
+	    }
+	}
+	return records;
+    };
+    auto res1 (std::async(std::launch::async, read, 1));
+    auto res2 (std::async(std::launch::async, read, 2));
+    std::vector<std::string> records (read(0));
+
+    for (auto* res: {&res1, &res2})
+    {
+	auto more (res->get());
+	records.insert (records.end(), more.begin(), more.end());
+    }
+    std::sort (records.begin(), records.end());
+
+    return records;
+}
+
+TEST(record_format, header)
+{
+    const char varint[] = "\xac\x02xyz";
+    const char fixed32[] = "\x00\x01\x00\x02";
+    uint64_t length;
+
+    EXPECT_EQ (2, record_format::header (record_format::VARINT, varint,
+					 varint + 5, length));
+    EXPECT_EQ (300, length);
+    EXPECT_EQ (0, record_format::header (record_format::VARINT, varint,
+					 varint + 1, length));
+    EXPECT_EQ (4, record_format::header (record_format::FIXED32, fixed32,
+					 fixed32 + 4, length));
+    EXPECT_EQ (0x10002, length);
+    const std::string overlong (11, '\xff');
+    EXPECT_THROW (record_format::header (record_format::VARINT,
+					 overlong.data(), overlong.data() + 11,
+					 length),
+		  std::runtime_error);
+    EXPECT_EQ (record_format::VARINT, record_format::parse ("varint"));
+    EXPECT_THROW (record_format::parse ("csv"), std::runtime_error);
+}
+
+TEST(mapped_input, records)
+{
+    settings& config (settings::instance());
+
+    for (auto format: {record_format::VARINT, record_format::FIXED32})
+    {
+	std::vector<std::string> records;
+	const std::string content (write_records (format, records));
+
+	config.set_input_format (format);
+	mapped_input input ("testfile1", 1000, 3);
+	EXPECT_EQ (records, read_records (input));
+
+	std::ofstream ("testfile1") << content.substr (0, content.size() - 1);
+	mapped_input truncated ("testfile1", 1000, 3);
+	EXPECT_THROW (read_records (truncated), std::runtime_error);
+    }
+    config.set_input_format (record_format::LINES);
+
+    EXPECT_EQ (0, system ("rm -f testfile1"));
+}
+
+TEST(ring_input, records)
+{
+    settings& config (settings::instance());
+
+    for (auto format: {record_format::VARINT, record_format::FIXED32})
+    {
+	std::vector<std::string> records;
+	const std::string content (write_records (format, records));
+	int fds[2];
+
+	config.set_input_format (format);
+	ASSERT_EQ (0, pipe (fds));
+	ring_input input (fds[0], 64, 3);
+
+	auto writer (std::async(std::launch::async, write_pipe, fds[1],
+				std::ref(content), 100));
+	auto reader (std::async(std::launch::async, &ring_input::read_input,
+				&input));
+
+	EXPECT_EQ (records, read_records (input));
+	EXPECT_EQ (content.size(), reader.get());
+	writer.get();
+	close (fds[0]);
+    }
+    config.set_input_format (record_format::LINES);
+
+    EXPECT_EQ (0, system ("rm -f testfile1"));
+}
@@ -0,0 +1,129 @@
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <fstream>
+#include <random>
+#include <vector>
+#ifndef _WIN32
+#include <spawn.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#endif
+
+#include "memory_budget.h"
+#include "directory.h"
+
+TEST(memory_budget, defaults)
+{
+    memory_budget budget (0, 4, 0x200000, 80);
+
+    EXPECT_EQ (0x200000, budget.sort_buffer (false));
+    EXPECT_EQ (0x200000, budget.sort_buffer (true));
+    EXPECT_EQ (size_t(memory_budget::default_input_chunk),
+	       budget.input_chunk());
+    EXPECT_EQ (size_t(memory_budget::default_reader_buffer),
+	       budget.reader_buffer());
+    EXPECT_LT (budget.input_chunk(), budget.max_input_chunk());
+}
+
+TEST(memory_budget, split)
+{
+    const size_t bytes = 0x10000000;
+    memory_budget budget (bytes, 4, 0x200000, 80);
+    const size_t input = budget.input_chunk() * 10;
+
+    // Mapping uses all of the budget but the output buffers, with
+    // half the sort buffers again for the scratch space of spilling
+    const size_t consumers = 4 * budget.sort_buffer (false) / 2 * 3;
+
+    EXPECT_GE (bytes, input + consumers);
+    EXPECT_LT (bytes / 10 * 9, input + consumers);
+    EXPECT_EQ (budget.sort_buffer (false) / 2, budget.sort_buffer (true));
+    EXPECT_EQ (budget.input_chunk(), budget.max_input_chunk());
+
+    // So does merging
+    EXPECT_GE (bytes, 80 * budget.reader_buffer());
+    EXPECT_LT (bytes / 10 * 9, 80 * budget.reader_buffer());
+}
+
+TEST(memory_budget, too_small)
+{
+    EXPECT_THROW (memory_budget (0x100000, 4, 0x200000, 80),
+		  std::invalid_argument);
+    EXPECT_NO_THROW (memory_budget (0x4000000, 4, 0x200000, 80));
+}
+
+#ifndef _WIN32
+/**
+ * Run the frontend with some arguments.
+ * @returns the peak resident memory of it in bytes
+ */
+static size_t
+peak_usage (std::vector<std::string> args)
+{
+    std::vector<char*> argv;
+    posix_spawn_file_actions_t actions;
+    pid_t pid;
+    int status = 0;
+    struct rusage usage;
+
+    args.insert (args.begin(), FRONTEND_PATH);
+    for (auto& arg: args) argv.push_back (&arg[0]);
+    argv.push_back (nullptr);
+
+    // The child shares our memory until it runs the frontend, so only
+    // the memory of the frontend is counted
+    posix_spawn_file_actions_init (&actions);
+    posix_spawn_file_actions_addopen (&actions, 1, "/dev/null", O_WRONLY, 0);
+    const int err = posix_spawn (&pid, FRONTEND_PATH, &actions, nullptr,
+				 argv.data(), nullptr);
+    posix_spawn_file_actions_destroy (&actions);
+    if (err) throw std::runtime_error ("Can not run " FRONTEND_PATH);
+
+    wait4 (pid, &status, 0, &usage);
+    EXPECT_TRUE (WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    return usage.ru_maxrss * 1024;
+}
+
+TEST(memory_budget, peak_usage)
+{
+    const size_t bytes = 0x1000000;
+    std::mt19937 generator (1);
+
+    directory::remove ("budgetdir", true, true);
+    directory::create ("budgetdir");
+    std::ofstream ("budgetfile0");
+
+    // Mostly distinct words, which spill from the sort buffers
+    {
+	std::ofstream file ("budgetfile1");
+
+	for (int i = 0; i < 1000000; i++)
+	{
+	    file << 'w' << generator() % 2000000 << (i % 8 == 7 ? '\n' : ' ');
+	}
+    }
+
+    const std::vector<std::string> args
+	{"-d", "budgetdir", "--memory", std::to_string(bytes), "-j", "2",
+	 "--no-compression", "-i"};
+    std::vector<std::string> idle (args);
+    std::vector<std::string> busy (args);
+
+    idle.insert (idle.end(), {"budgetfile0", WORDCOUNT_PATH});
+    busy.insert (busy.end(), {"budgetfile1", WORDCOUNT_PATH});
+
+    // The code and the libraries of the frontend come on top of the
+    // budget
+    const size_t idle_bytes = peak_usage (idle);
+    const size_t busy_bytes = peak_usage (busy);
+
+    EXPECT_GE (idle_bytes + bytes, busy_bytes);
+
+    directory::remove ("budgetdir", true, true);
+    unlink ("budgetfile0");
+    unlink ("budgetfile1");
+}
+#endif
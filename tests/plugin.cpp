@@ -1,5 +1,7 @@
 
 #include <string>
+#include <set>
+#include <vector>
 #include <gtest/gtest.h>
 
 #include "configuration.h"
@@ -51,3 +53,50 @@ TEST(configuration, add)
     ncollector coll;
     p.map ((char*)"", 0, coll);
 }
+
+class firstchar : public mapredo::mapreducer<char*>
+{
+public:
+    void map (char *line, int length, mapredo::mcollector&) {}
+    void reduce (char* key, vlist& values, mapredo::rcollector&) {}
+    size_t partition (const char* const key, const size_t length,
+		      const size_t partitions) const {
+	return (length ? key[0] % partitions : 0);
+    }
+};
+
+TEST(partition, hash)
+{
+    const size_t partitions = 16;
+    std::vector<size_t> counts (partitions);
+    std::set<uint64_t> hashes;
+    someplug p;
+
+    // Keys with a long common prefix, differing only at the end
+    for (size_t i = 0; i < 16000; i++)
+    {
+	const std::string key ("http://www.example.com/some/long/path/"
+			       + std::to_string (i));
+	const uint64_t hash = mapredo::base::hash (key.data(), key.size());
+
+	EXPECT_EQ (hash, mapredo::base::hash (key.data(), key.size()));
+	hashes.insert (hash);
+	counts[p.partition (key.data(), key.size(), partitions)]++;
+    }
+    EXPECT_EQ (16000, hashes.size());
+    for (auto count: counts)
+    {
+	EXPECT_LT (800, count);
+	EXPECT_GT (1200, count);
+    }
+    EXPECT_NE (mapredo::base::hash ("a", 1), mapredo::base::hash ("a\0", 2));
+}
+
+TEST(partition, override)
+{
+    firstchar p;
+    mapredo::base& base (p);
+
+    EXPECT_EQ ('a' % 7, base.partition ("abc", 3, 7));
+    EXPECT_EQ ('z' % 7, base.partition ("zyx", 3, 7));
+}
@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "radix_sort.h"
+
+/** Keys to sort, with lookup entries referring to them */
+class keys
+{
+public:
+    void add_string (const std::string& key) {
+	lookup entry;
+
+	entry.set (_buffer.size(), key.size(),
+		   lookup::string_prefix (key.data(), key.size()));
+	_entries.push_back (entry);
+	_buffer += key;
+    }
+    void add_number (const uint64_t prefix) {
+	lookup entry;
+
+	entry.set (0, 0, prefix);
+	_entries.push_back (entry);
+    }
+
+    /** @returns keys sorted by radix or by comparison */
+    std::vector<std::string> sorted (const mapredo::base::keytype type,
+				     const bool reverse, const bool radix) {
+	std::vector<lookup> entries (_entries);
+	lookup* const begin = entries.data();
+	lookup* const end = begin + entries.size();
+	std::vector<std::string> result;
+
+	if (!radix)
+	{
+	    radix_sort::comparison_sort (begin, end, _buffer.data(), type,
+					 reverse);
+	}
+	else if (type == mapredo::base::STRING)
+	{
+	    radix_sort::sort_strings (begin, end, _buffer.data(), reverse);
+	}
+	else radix_sort::sort_numbers (begin, end, reverse);
+
+	for (auto& entry: entries)
+	{
+	    if (type == mapredo::base::STRING)
+	    {
+		result.emplace_back (_buffer.data() + entry.offset(),
+				     entry.keylen());
+	    }
+	    else result.push_back (std::to_string(entry.prefix()));
+	}
+	return result;
+    }
+
+private:
+    std::string _buffer;
+    std::vector<lookup> _entries;
+};
+
+TEST(radix_sort, strings)
+{
+    std::mt19937 random (1);
+    keys sample;
+
+    for (int i = 0; i < 20000; i++)
+    {
+	// Few different bytes, to get shared prefixes and long partitions
+	std::string key (random() % 80, 'a');
+
+	for (auto& c: key) c = "ab\xe5\0"[random() % (i % 2 ? 2 : 4)];
+	sample.add_string (key);
+    }
+    sample.add_string (std::string(200, 'a'));
+
+    for (bool reverse: {false, true})
+    {
+	EXPECT_EQ (sample.sorted (mapredo::base::STRING, reverse, false),
+		   sample.sorted (mapredo::base::STRING, reverse, true));
+    }
+}
+
+TEST(radix_sort, numbers)
+{
+    std::mt19937_64 random (1);
+    keys integers, doubles;
+
+    for (int i = 0; i < 20000; i++)
+    {
+	const int64_t value = int64_t(random()) >> (random() % 64);
+
+	integers.add_number (lookup::integer_prefix (value));
+	doubles.add_number (lookup::real_prefix (value / 1000.0));
+    }
+    doubles.add_number (lookup::real_prefix (-0.0));
+
+    for (bool reverse: {false, true})
+    {
+	EXPECT_EQ (integers.sorted (mapredo::base::INT64, reverse, false),
+		   integers.sorted (mapredo::base::INT64, reverse, true));
+	EXPECT_EQ (doubles.sorted (mapredo::base::DOUBLE, reverse, false),
+		   doubles.sorted (mapredo::base::DOUBLE, reverse, true));
+    }
+}
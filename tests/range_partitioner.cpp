@@ -0,0 +1,125 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "range_partitioner.h"
+#include "mapreducer.h"
+
+/** Outputs each word of a line as a key */
+class wordmapper : public mapredo::mapreducer<char*>
+{
+public:
+    void map (char *line, const int length, mapredo::mcollector& output) {
+	int start = 0;
+
+	for (int i = 0; i <= length; i++)
+	{
+	    if (i == length || line[i] == ' ')
+	    {
+		if (i > start) output.collect (line + start, i - start);
+		start = i + 1;
+	    }
+	}
+    }
+    void reduce (char* key, vlist& values, mapredo::rcollector&) {}
+};
+
+TEST(range_partitioner, strings)
+{
+    wordmapper mapper;
+    range_partitioner ranges (mapredo::base::STRING, 4, false);
+    std::string input;
+
+    for (int i = 0; i < 1000; i++)
+    {
+	input += "w" + std::to_string(1000 + i) + " w"
+	    + std::to_string(1000 + (i * 7) % 1000) + "\n";
+    }
+    input += "not sampled without newline";
+    ranges.sample (mapper, input.data(), input.size(), record_format::LINES);
+    EXPECT_EQ (2000, ranges.samples());
+    ASSERT_TRUE (ranges.finish());
+
+    std::vector<size_t> counts (4);
+    size_t last = 0;
+
+    for (int i = 0; i < 1000; i++)
+    {
+	const std::string key ("w" + std::to_string(1000 + i) + "\tvalue");
+	const size_t partition = ranges.partition (key.data(), 5);
+
+	ASSERT_GT (4, partition);
+	EXPECT_LE (last, partition);
+	last = partition;
+	counts[partition]++;
+    }
+    for (auto count: counts) EXPECT_EQ (250, count);
+
+    // Prefixes of a split point come before it
+    EXPECT_EQ (0, ranges.partition ("w", 1));
+    EXPECT_EQ (3, ranges.partition ("x", 1));
+}
+
+TEST(range_partitioner, reverse_numbers)
+{
+    wordmapper mapper;
+    range_partitioner integers (mapredo::base::INT64, 3, true);
+    range_partitioner doubles (mapredo::base::DOUBLE, 3, true);
+
+    for (int i = -150; i < 150; i++)
+    {
+	const std::string key (std::to_string(i));
+	integers.add_key (key.data(), key.size());
+	doubles.add_key (key.data(), key.size());
+    }
+    ASSERT_TRUE (integers.finish());
+    ASSERT_TRUE (doubles.finish());
+
+    EXPECT_EQ (2, integers.partition ("-100", 4));
+    EXPECT_EQ (1, integers.partition ("0", 1));
+    EXPECT_EQ (0, integers.partition ("100\t", 4));
+    EXPECT_EQ (2, doubles.partition ("-60.5", 5));
+    EXPECT_EQ (1, doubles.partition ("-49.5", 5));
+    EXPECT_EQ (0, doubles.partition ("1e10", 4));
+}
+
+TEST(range_partitioner, repeated_keys)
+{
+    range_partitioner ranges (mapredo::base::STRING, 4, false);
+
+    EXPECT_FALSE (ranges.finish());
+
+    for (int i = 0; i < 100; i++) ranges.add_key ("same", 4);
+    ASSERT_TRUE (ranges.finish());
+
+    EXPECT_EQ (ranges.partition ("same", 4), ranges.partition ("same\t", 4));
+    EXPECT_EQ (0, ranges.partition ("a", 1));
+}
+
+TEST(range_partitioner, sorted_input)
+{
+    range_partitioner sorted (mapredo::base::STRING, 4, false);
+    range_partitioner shuffled (mapredo::base::STRING, 4, false);
+    range_partitioner few (mapredo::base::INT64, 4, false);
+
+    // Keys as sampled from the start of input sorted on key, and from
+    // input in no particular order
+    for (int i = 0; i < 1000; i++)
+    {
+	const std::string key ("w" + std::to_string(1000 + i));
+	const std::string other ("w" + std::to_string(1000 + (i * 7) % 1000));
+
+	sorted.add_key (key.data(), key.size());
+	shuffled.add_key (other.data(), other.size());
+    }
+    EXPECT_FALSE (sorted.balanced());
+    EXPECT_TRUE (shuffled.balanced());
+
+    for (int i = 0; i < 100; i++)
+    {
+	const std::string key (std::to_string(i));
+	few.add_key (key.data(), key.size());
+    }
+    EXPECT_TRUE (few.balanced());
+}
@@ -0,0 +1,62 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <random>
+
+#include "scanner.h"
+
+static void check_level (const scanner::level lvl)
+{
+    std::mt19937 random (lvl);
+    char data[200];
+
+    scanner::use (lvl);
+    EXPECT_EQ (lvl, scanner::used());
+
+    for (int round = 0; round < 2000; round++)
+    {
+	const size_t begin = random() % 70;
+	const size_t end = begin + random() % (sizeof(data) - begin);
+	const int delims = random() % 4;
+
+	memset (data, 'x', sizeof(data));
+	for (int i = 0; i < delims; i++)
+	{
+	    data[random() % sizeof(data)] = i % 2 ? '\t' : '\n';
+	}
+
+	const char* first_nl = nullptr;
+	const char* first_either = nullptr;
+	const char* last_nl = nullptr;
+
+	for (size_t i = begin; i < end; i++)
+	{
+	    if (data[i] == '\n')
+	    {
+		if (!first_nl) first_nl = data + i;
+		last_nl = data + i;
+	    }
+	    if (!first_either && (data[i] == '\n' || data[i] == '\t'))
+	    {
+		first_either = data + i;
+	    }
+	}
+
+	SCOPED_TRACE (std::to_string(begin) + "-" + std::to_string(end));
+	EXPECT_EQ (first_nl, scanner::find (data + begin, data + end, '\n'));
+	EXPECT_EQ (first_either, scanner::find_either
+		   (data + begin, data + end, '\t', '\n'));
+	EXPECT_EQ (last_nl, scanner::rfind (data + begin, data + end, '\n'));
+    }
+}
+
+TEST(scanner, all_levels)
+{
+    const scanner::level best = scanner::supported();
+
+    for (int lvl = scanner::SCALAR; lvl <= best; lvl++)
+    {
+	check_level (static_cast<scanner::level>(lvl));
+    }
+    scanner::use (best);
+}
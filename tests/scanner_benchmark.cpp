@@ -0,0 +1,91 @@
+/*
+ * Measures delimiter scanning on short records like those in typical
+ * map input and temporary files.  Usage: scanner_benchmark [megabytes]
+ */
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "scanner.h"
+
+typedef std::chrono::steady_clock clock_type;
+
+static std::string make_records (const size_t bytes)
+{
+    std::mt19937 random (1);
+    std::string data;
+
+    while (data.size() < bytes)
+    {
+	data += std::string(1 + random() % 12, 'a' + random() % 26) + '\t'
+	    + std::to_string(random() % 1000) + '\n';
+    }
+    return data;
+}
+
+template <class F> static void measure (const std::string& name,
+					const std::string& data, F scan)
+{
+    const auto start = clock_type::now();
+    const size_t lines = scan (data.data(), data.data() + data.size());
+    const double secs = std::chrono::duration<double>
+	(clock_type::now() - start).count();
+
+    std::cout << "  " << name << ": " << lines << " matches, "
+	      << int(data.size() / secs / 1e6) << " MB/s\n";
+}
+
+int main (int argc, char* argv[])
+{
+    const size_t megabytes = argc > 1 ? atoi(argv[1]) : 256;
+    const std::string data (make_records (megabytes << 20));
+    const char* const names[] = {"scalar", "sse2", "avx2"};
+
+    for (int lvl = scanner::SCALAR; lvl <= scanner::supported(); lvl++)
+    {
+	scanner::use (static_cast<scanner::level>(lvl));
+	std::cout << names[lvl] << ":\n";
+
+	measure ("find newline", data, [](const char* pos, const char* end) {
+		size_t lines = 0;
+		while ((pos = scanner::find (pos, end, '\n'))) {pos++; lines++;}
+		return lines;
+	    });
+	measure ("find tab, then newline", data,
+		 [](const char* pos, const char* end) {
+		size_t lines = 0;
+		while ((pos = scanner::find_either (pos, end, '\t', '\n')))
+		{
+		    if (*pos == '\t') pos = scanner::find (pos, end, '\n');
+		    pos++;
+		    lines++;
+		}
+		return lines;
+	    });
+	measure ("last newline in 64k blocks", data,
+		 [](const char* begin, const char* end) {
+		size_t found = 0;
+		for (; begin + 0x10000 <= end; begin += 0x10000)
+		{
+		    if (scanner::rfind (begin, begin + 0x10000, '\n')) found++;
+		}
+		return found;
+	    });
+    }
+
+    measure ("memchr newline", data, [](const char* pos, const char* end) {
+	    size_t lines = 0;
+	    while ((pos = static_cast<const char*>
+		    (memchr (pos, '\n', end - pos))))
+	    {
+		pos++;
+		lines++;
+	    }
+	    return lines;
+	});
+
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "sorted_reducer.h"
+#include "mapreducer.h"
+
+/** Sums the values of each key */
+template <class T> class summer : public mapredo::mapreducer<T>
+{
+public:
+    void map (char *line, const int length, mapredo::mcollector&) {}
+    void reduce (T key, typename mapredo::mapreducer<T>::vlist& values,
+		 mapredo::rcollector& output) {
+	int sum = 0;
+
+	for (char* value : values) sum += atoi(value);
+	output.collect_keyval (key, sum);
+    }
+};
+
+/** Reduce some records and return what is written to standard output */
+static std::string
+reduce (sorted_reducer& reducer, const std::vector<std::string>& records)
+{
+    testing::internal::CaptureStdout();
+    for (auto& record: records)
+    {
+	reducer.add (record.data(), record.find('\t'), record.size());
+    }
+    reducer.flush();
+    fflush (stdout);
+
+    return testing::internal::GetCapturedStdout();
+}
+
+TEST(sorted_reducer, groups)
+{
+    summer<char*> summer;
+    sorted_reducer whole (summer, 0x10000, false);
+    sorted_reducer batched (summer, 8, false);
+    const std::vector<std::string> records
+	{"a\t1", "a\t2", "ab\t3", "b\t4", "b\t5", "b\t6", "c\t7"};
+
+    EXPECT_EQ ("a\t3\nab\t3\nb\t15\nc\t7\n", reduce (whole, records));
+
+    // Groups are not split between batches
+    EXPECT_EQ ("a\t3\nab\t3\nb\t15\nc\t7\n", reduce (batched, records));
+}
+
+TEST(sorted_reducer, reverse_numbers)
+{
+    summer<int64_t> summer;
+    sorted_reducer reducer (summer, 4, true);
+
+    EXPECT_EQ ("10\t3\n2\t7\n-5\t1\n",
+	       reduce (reducer, {"10\t1", "10\t2", "2\t3", "02\t4", "-5\t1"}));
+}
+
+TEST(sorted_reducer, unsorted)
+{
+    summer<char*> summer;
+    sorted_reducer reducer (summer, 0x10000, false);
+
+    testing::internal::CaptureStdout();
+    reducer.add ("b\t1", 1, 3);
+    EXPECT_THROW (reducer.add ("a\t1", 1, 3), std::runtime_error);
+    testing::internal::GetCapturedStdout();
+}
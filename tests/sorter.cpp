@@ -0,0 +1,348 @@
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstring>
+#include <algorithm>
+
+#include "sorter.h"
+#include "mapreducer.h"
+#include "thread_pool.h"
+#include "run_format.h"
+#include "tmpfile_reader.h"
+#include "settings.h"
+
+/** Sums the values of each key */
+template <class T> class summer : public mapredo::mapreducer<T>
+{
+public:
+    void map (char *line, const int length, mapredo::mcollector&) {}
+    void reduce (T key, typename mapredo::mapreducer<T>::vlist& values,
+		 mapredo::rcollector& output) {
+	int sum = 0;
+
+	for (char* value : values) sum += atoi(value);
+	output.collect_keyval (key, sum);
+    }
+    bool reducer_can_combine() const {return true;}
+};
+
+/** Decode the records of a run as text lines */
+static std::string
+as_text (const std::string& run, const mapredo::base::keytype type)
+{
+    std::ostringstream text;
+    const char* pos = run.data();
+    const char* const end = pos + run.size();
+
+    while (pos < end)
+    {
+	uint64_t keysize = 0;
+	uint64_t valuesize = 0;
+	const size_t header = run_format::header (pos, end, keysize,
+						  valuesize);
+	const char* key = pos + header;
+	EXPECT_NE (0, header);
+
+	if (type == mapredo::base::INT64)
+	{
+	    int64_t number;
+	    memcpy (&number, key, sizeof(number));
+	    text << number;
+	}
+	else if (type == mapredo::base::DOUBLE)
+	{
+	    double number;
+	    memcpy (&number, key, sizeof(number));
+	    text << number;
+	}
+	else
+	{
+	    text.write (key, keysize);
+	    keysize++; // nul
+	}
+	text << '\t';
+	text.write (key + keysize, valuesize);
+	text << '\n';
+	pos = key + keysize + valuesize + 1;
+    }
+
+    return text.str();
+}
+
+/** Sort some records and return what the sorter spills, as text */
+static std::string
+spill (sorter& sort, const std::vector<std::string>& records,
+       const mapredo::base::keytype type = mapredo::base::STRING)
+{
+    for (auto& record: records)
+    {
+	sort.add (record.data(), record.find('\t'), record.size());
+    }
+    sort.flush();
+
+    auto tmpfiles (sort.grab_tmpfiles());
+    EXPECT_EQ (1, tmpfiles.size());
+    std::ifstream file (tmpfiles.front().filename());
+    std::ostringstream content;
+    content << file.rdbuf();
+    tmpfiles.front().remove();
+
+    return as_text (content.str(), type);
+}
+
+TEST(sorter, combine)
+{
+    summer<char*> reducer;
+    sorter sort (".", 1, 0, 0x10000, mapredo::base::STRING, false,
+		 &reducer);
+
+    EXPECT_EQ ("a\t5\nab\t1\nb\t12\n",
+	       spill (sort, {"b\t2", "a\t1", "b\t10", "ab\t1", "a\t4"}));
+}
+
+TEST(sorter, combine_numbers)
+{
+    summer<int64_t> reducer;
+    sorter sort (".", 1, 0, 0x10000, mapredo::base::INT64, true, &reducer);
+
+    EXPECT_EQ ("10\t3\n2\t7\n",
+	       spill (sort, {"2\t3", "10\t1", "02\t4", "10\t2"},
+		      mapredo::base::INT64));
+}
+
+TEST(sorter, no_combine)
+{
+    sorter sort (".", 1, 0, 0x10000, mapredo::base::STRING, false);
+
+    EXPECT_EQ ("a\t1\na\t1\nb\t2\n", spill (sort, {"b\t2", "a\t1", "a\t1"}));
+}
+
+TEST(sorter, numbers)
+{
+    sorter integers (".", 1, 0, 0x10000, mapredo::base::INT64, false);
+    sorter doubles (".", 1, 0, 0x10000, mapredo::base::DOUBLE, true);
+
+    EXPECT_EQ ("-20\ta\n-3\tb\n7\tc\n100\td\n",
+	       spill (integers, {"100\td", "-3\tb", "7\tc", "-20\ta"},
+		      mapredo::base::INT64));
+    EXPECT_EQ ("1000\ta\n2.5\tb\n-0.001\td\n-0.5\tc\n",
+	       spill (doubles, {"-0.5\tc", "1e3\ta", "-1e-3\td", "2.5\tb"},
+		      mapredo::base::DOUBLE));
+}
+
+TEST(sorter, long_keys)
+{
+    sorter sort (".", 1, 0, 0x1000000, mapredo::base::STRING, false);
+    sorter small (".", 1, 0, 0x10000, mapredo::base::STRING, false);
+    const std::string huge (3000000, 'x');
+
+    // Keys longer than the prefix, sharing it, and with high bytes
+    EXPECT_EQ ("abcdefgh\t1\nabcdefghi\t2\nabcdefghij\t3\nabcdefgj\t4\n"
+	       + huge + "\t5\n" + huge + "y\t6\n\xe5\t7\n",
+	       spill (sort, {huge + "y\t6", "abcdefgj\t4", "\xe5\t7",
+			     "abcdefghij\t3", huge + "\t5", "abcdefgh\t1",
+			     "abcdefghi\t2"}));
+
+    // A line larger than the buffer
+    EXPECT_EQ (huge + "\t1\n", spill (small, {huge + "\t1"}));
+}
+
+TEST(sorter, background)
+{
+    thread_pool pool (2);
+    summer<int64_t> reducer;
+    sorter sort (".", 1, 0, 0x1000, mapredo::base::INT64, false,
+		 &reducer, &pool);
+    size_t records = 0;
+
+    for (int i = 0; i < 5000; i++)
+    {
+	const std::string record (std::to_string(i % 1000) + "\t1");
+
+	sort.add (record.data(), record.find('\t'), record.size());
+    }
+    sort.flush();
+
+    auto tmpfiles (sort.grab_tmpfiles());
+    EXPECT_LT (2, tmpfiles.size());
+
+    for (auto& tmpfile: tmpfiles)
+    {
+	std::ifstream file (tmpfile.filename(), std::ifstream::binary);
+	std::ostringstream content;
+	content << file.rdbuf();
+	std::istringstream text (as_text (content.str(),
+					  mapredo::base::INT64));
+	std::string line;
+	int64_t last = -1;
+
+	while (std::getline (text, line))
+	{
+	    const int64_t key = atoll (line.c_str());
+
+	    EXPECT_LT (last, key);
+	    last = key;
+	    records += atoi (line.c_str() + line.find('\t') + 1);
+	}
+	tmpfile.remove();
+    }
+    EXPECT_EQ (5000, records);
+}
+
+TEST(sorter, partitions)
+{
+    sorter sort (".", 3, 0, 0x10000, mapredo::base::STRING, false);
+    const std::vector<std::pair<std::string, uint32_t>> records
+	{{"c\t1", 2}, {"b\t2", 0}, {"a\t3", 2}, {"d\t4", 0}, {"e\t5", 2}};
+
+    for (auto& record: records)
+    {
+	sort.add (record.first.data(), 1, record.first.size(), record.second);
+    }
+    sort.flush();
+
+    auto first (sort.grab_tmpfiles (0));
+    auto second (sort.grab_tmpfiles (1));
+    auto third (sort.grab_tmpfiles (2));
+
+    ASSERT_EQ (1, first.size());
+    EXPECT_EQ (0, second.size());
+    ASSERT_EQ (1, third.size());
+
+    const std::string filename (first.front().filename());
+    const auto sections (tmpfile_section::read_sections (filename));
+
+    ASSERT_EQ (3, sections.size());
+    EXPECT_EQ (first.front().extents()[0].offset,
+	       sections[0].extents()[0].offset);
+    EXPECT_EQ (0, sections[1].size());
+    EXPECT_EQ (third.front().size(), sections[2].size());
+
+    // Each section holds the sorted records of its partition
+    std::ifstream file (filename, std::ifstream::binary);
+    std::string content ((std::istreambuf_iterator<char>(file)),
+			 std::istreambuf_iterator<char>());
+
+    ASSERT_EQ (1, first.front().extents().size());
+    ASSERT_EQ (1, third.front().extents().size());
+    EXPECT_EQ ("b\t2\nd\t4\n",
+	       as_text (content.substr (first.front().extents()[0].offset,
+					first.front().size()),
+			mapredo::base::STRING));
+    EXPECT_EQ ("a\t3\nc\t1\ne\t5\n",
+	       as_text (content.substr (third.front().extents()[0].offset,
+					third.front().size()),
+			mapredo::base::STRING));
+
+    // The file is removed with its last section
+    first.front().remove();
+    EXPECT_TRUE (std::ifstream(filename).good());
+    third.front().remove();
+    EXPECT_FALSE (std::ifstream(filename).good());
+}
+
+/** Sort keys into runs and check them, @returns the number of runs */
+static size_t
+runs (const std::vector<std::string>& keys, const uint16_t partitions,
+      const bool replacement_selection)
+{
+    settings::instance().set_replacement_selection (replacement_selection);
+    sorter sort (".", partitions, 0, 0x10000, mapredo::base::STRING, false);
+    settings::instance().set_replacement_selection (false);
+
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+	const std::string record (keys[i] + "\t" + std::to_string(i));
+
+	sort.add (record.data(), keys[i].size(), record.size(),
+		  i % partitions);
+    }
+    sort.flush();
+
+    size_t files = 0;
+    size_t records = 0;
+
+    for (uint16_t i = 0; i < partitions; i++)
+    {
+	for (auto& tmpfile: sort.grab_tmpfiles (i))
+	{
+	    tmpfile_reader<char*> reader (tmpfile, 0x20000, true);
+	    std::string last;
+
+	    while (reader.next_key())
+	    {
+		const std::string key (*reader.next_key());
+		const size_t index = atoi (reader.get_next_value());
+
+		EXPECT_LE (last, key);
+		EXPECT_EQ (i, index % partitions);
+		last = key;
+		records++;
+	    }
+	    files++;
+	}
+    }
+    EXPECT_EQ (keys.size(), records);
+
+    return files / partitions;
+}
+
+TEST(sorter, replacement_selection)
+{
+    std::vector<std::string> keys;
+    uint32_t random = 1;
+
+    for (int i = 0; i < 20000; i++)
+    {
+	random = random * 1103515245 + 12345;
+	keys.push_back ("k" + std::to_string(random));
+    }
+
+    // Runs of random keys are longer than the buffer
+    for (uint16_t partitions = 1; partitions <= 3; partitions += 2)
+    {
+	const size_t sorted_runs = runs (keys, partitions, false);
+	const size_t long_runs = runs (keys, partitions, true);
+
+	EXPECT_LT (long_runs * 4, sorted_runs * 3);
+    }
+
+    // Sorted input with some disorder is a single run
+    std::sort (keys.begin(), keys.end());
+    for (size_t i = 0; i + 10 < keys.size(); i += 7)
+    {
+	std::swap (keys[i], keys[i + 10]);
+    }
+    EXPECT_EQ (1, runs (keys, 1, true));
+    EXPECT_EQ (1, runs (keys, 3, true));
+}
+
+TEST(sorter, presorted)
+{
+    sorter strings (".", 1, 0, 0x10000, mapredo::base::STRING, false);
+    sorter integers (".", 1, 0, 0x10000, mapredo::base::INT64, true);
+    summer<char*> reducer;
+    sorter combining (".", 1, 0, 0x10000, mapredo::base::STRING, false,
+		      &reducer);
+
+    // Input in reverse order is reversed instead of sorted
+    EXPECT_EQ ("a\t4\nb\t3\nkey_prefix1\t2\nkey_prefix2\t1\n",
+	       spill (strings, {"key_prefix2\t1", "key_prefix1\t2", "b\t3",
+				"a\t4"}));
+    EXPECT_EQ ("30\tc\n20\tb\n-10\ta\n",
+	       spill (integers, {"-10\ta", "20\tb", "30\tc"},
+		      mapredo::base::INT64));
+    EXPECT_EQ ("a\t3\nb\t3\n",
+	       spill (combining, {"a\t1", "a\t2", "b\t3"}));
+
+    // Partitions of sorted input keep their order
+    std::vector<std::string> keys;
+
+    for (int i = 0; i < 500; i++) keys.push_back ("k" + std::to_string(i));
+    std::sort (keys.begin(), keys.end());
+    EXPECT_EQ (1, runs (keys, 3, false));
+    std::reverse (keys.begin(), keys.end());
+    EXPECT_EQ (1, runs (keys, 3, false));
+}
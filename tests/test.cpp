@@ -1,6 +1,14 @@
 
 #include <thread>
 #include <future>
+#include <vector>
+#include <string>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #include <gtest/gtest.h>
 
@@ -80,6 +88,47 @@ TEST(plugin_loader, get)
     (void)mapreducer;
 }
 
+#ifndef _WIN32
+class word_collector : public mapredo::mcollector
+{
+public:
+    void collect (const char* line, const size_t length) {
+	words.emplace_back (line, length);
+    }
+    char* reserve (const char* const key, const size_t bytes) {
+	return nullptr;
+    }
+    void collect_reserved (const size_t) {}
+
+    std::vector<std::string> words;
+};
+
+TEST(plugin_loader, read_only_map)
+{
+    plugin_loader loader (WORDCOUNT_PATH);
+    mapredo::base& mapreducer (loader.get());
+    const std::string line ("The quick, BROWN fox");
+    const size_t page = sysconf (_SC_PAGESIZE);
+    void* area = mmap (nullptr, page, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    ASSERT_NE (MAP_FAILED, area);
+    ASSERT_TRUE (mapreducer.mapper_reads_only());
+
+    // The line ends the page, so reading past it or writing faults
+    char* const data = static_cast<char*>(area) + page - line.size();
+    word_collector words;
+
+    memcpy (data, line.data(), line.size());
+    mprotect (area, page, PROT_READ);
+    mapreducer.map (data, line.size(), words);
+    munmap (area, page);
+
+    EXPECT_EQ ((std::vector<std::string>{"the", "quick", "brown", "fox"}),
+	       words.words);
+}
+#endif
+
 #if 0
 class  btest : public mapredo::mapreducer<double>
 {
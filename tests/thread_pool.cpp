@@ -0,0 +1,32 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+#include "thread_pool.h"
+
+TEST(thread_pool, results)
+{
+    std::atomic<int> count (0);
+    std::vector<std::future<int>> results;
+    {
+	thread_pool pool (3);
+
+	for (int i = 0; i < 100; i++)
+	{
+	    results.push_back (pool.submit ([i, &count]() {
+			count++;
+			return i * 2;
+		    }));
+	}
+	auto failure (pool.submit ([]() -> int {
+		    throw std::runtime_error ("failed");
+		}));
+	EXPECT_THROW (failure.get(), std::runtime_error);
+    }
+
+    // All tasks are run before the pool is destroyed
+    EXPECT_EQ (100, count);
+    for (int i = 0; i < 100; i++) EXPECT_EQ (i * 2, results[i].get());
+}
@@ -0,0 +1,62 @@
+/*
+ * Measures how many buffers per second buffer_trader hands from one
+ * producer to 2 to 64 consumers doing no work, through its lock-free
+ * queues and through its queues under a mutex.  Usage:
+ * trader_benchmark [handoffs per run]
+ */
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "buffer_trader.h"
+
+typedef std::chrono::steady_clock clock_type;
+
+static double measure (const size_t threads, const size_t handoffs,
+		       const bool lock_free)
+{
+    buffer_trader trader (16, threads, lock_free);
+    std::vector<std::thread> consumers;
+
+    input_buffer* current = trader.producer_get();
+    input_buffer* next = trader.producer_get();
+    const auto start = clock_type::now();
+
+    for (size_t id = 0; id < threads; id++)
+    {
+	consumers.emplace_back ([&trader, id]() {
+		auto* buffer = trader.consumer_get (id);
+		while (buffer) buffer = trader.consumer_swap (buffer, id);
+	    });
+    }
+    for (size_t i = 0; i < handoffs; i++)
+    {
+	auto* filled = current;
+	current = next;
+	next = trader.producer_swap (filled);
+    }
+    trader.producer_finish();
+    for (auto& consumer: consumers) consumer.join();
+
+    return handoffs / std::chrono::duration<double>
+	(clock_type::now() - start).count();
+}
+
+int main (int argc, char* argv[])
+{
+    const size_t handoffs = argc > 1 ? atoi(argv[1]) : 1000000;
+
+    std::cout << "threads  lock-free handoffs/s  locking handoffs/s\n";
+    for (size_t threads = 2; threads <= 64; threads *= 2)
+    {
+	std::cout << threads << "\t " << size_t(measure (threads, handoffs,
+							  true))
+		  << "\t\t       " << size_t(measure (threads, handoffs,
+							false))
+		  << std::endl;
+    }
+
+    return 0;
+}